@@ -0,0 +1,671 @@
+// Load generator for the Manaknight HTTP server: N keep-alive
+// connections driven by one epoll loop, each with at most one request
+// in flight.
+//
+// With a target rate (-R), the requests of each connection are
+// scheduled at fixed intervals and the latency is measured from the
+// scheduled time, not from the time the request was actually written.
+// This corrects the coordinated omission: a stalled response also
+// counts for the requests which should have been sent while waiting
+// for it. Without a rate, the connections send as fast as possible and
+// the latency is the service time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_MIX          64     // request kinds of a mix
+#define MAX_SCHEDULE     1024   // weighted order of the request kinds
+#define READ_BUF_SIZE    16384
+#define MAX_RESPONSE     (64 * 1024 * 1024)
+
+// Latency histogram: 64 linear sub-buckets per power of two, i.e. a
+// relative precision better than 1.6% from 1 us up to hours
+#define HIST_SUB_BITS    6
+#define HIST_SUB         (1 << HIST_SUB_BITS)
+#define HIST_SIZE        ((64 - HIST_SUB_BITS) * HIST_SUB + HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_SIZE];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} Histogram;
+
+typedef struct {
+    char* data;                 // formatted request
+    size_t len;
+    int weight;
+} MixEntry;
+
+typedef enum {
+    CONN_IDLE,                  // waiting for the time of its next request
+    CONN_BUSY,                  // request in flight
+} ConnState;
+
+typedef struct {
+    int fd;
+    ConnState state;
+    bool output_enabled;        // EPOLLOUT while a request is partially written
+    const MixEntry* req;
+    size_t sent;
+    uint64_t scheduled_us;      // latency origin of the request in flight
+    uint64_t next_us;           // scheduled time of the next request
+    char* rbuf;
+    size_t rlen;
+    size_t rsize;
+} Conn;
+
+typedef struct {
+    struct sockaddr_in addr;
+    const char* addr_str;
+    int conn_count;
+    double duration_s;
+    double warmup_s;
+    double rate;                // requests per second, 0 = maximum
+    MixEntry mix[MAX_MIX];
+    int mix_count;
+    int schedule[MAX_SCHEDULE];
+    int schedule_len;
+    uint64_t schedule_pos;
+    uint64_t interval_us;       // between two requests of a connection
+
+    int epoll_fd;
+    int timer_fd;               // next scheduled request, in us unlike epoll_wait()
+    Conn* conns;
+    uint64_t record_from_us;    // end of the warm-up
+    Histogram hist;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t reconnects;
+    uint64_t bytes_read;
+    uint64_t status[6];         // by class: 1xx to 5xx
+} Bench;
+
+static uint64_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Histogram
+
+static int hist_index(uint64_t v) {
+    if (v < 2 * HIST_SUB)
+        return v;
+    int e = (63 - __builtin_clzll(v)) - HIST_SUB_BITS;
+    return e * HIST_SUB + (v >> e);
+}
+
+// Middle of the bucket
+static uint64_t hist_value(int idx) {
+    if (idx < 2 * HIST_SUB)
+        return idx;
+    int e = idx / HIST_SUB - 1;
+    uint64_t sub = idx - e * HIST_SUB;
+    return (sub << e) + ((1ULL << e) >> 1);
+}
+
+static void hist_record(Histogram* h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    if (h->total == 0 || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->total++;
+    h->sum += v;
+}
+
+static uint64_t hist_percentile(const Histogram* h, double q) {
+    uint64_t rank, n = 0;
+    if (h->total == 0)
+        return 0;
+    rank = (uint64_t)(q * h->total);
+    if (rank >= h->total)
+        rank = h->total - 1;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        n += h->counts[i];
+        if (n > rank) {
+            uint64_t v = hist_value(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+// Request mix
+
+// Parse "[WEIGHT:]METHOD PATH [BODY]"
+static int add_mix_entry(Bench* b, const char* spec) {
+    char method[16], path[2048];
+    const char* p = spec;
+    const char* body;
+    int weight = 1, n;
+    MixEntry* e;
+
+    if (b->mix_count >= MAX_MIX) {
+        fprintf(stderr, "Error: too many requests in the mix (max %d)\n", MAX_MIX);
+        return -1;
+    }
+    if (isdigit((unsigned char)*p)) {
+        weight = strtol(p, (char**)&p, 10);
+        if (*p != ':' || weight <= 0) {
+            fprintf(stderr, "Error: invalid weight in '%s'\n", spec);
+            return -1;
+        }
+        p++;
+    }
+    if (sscanf(p, "%15s %2047s%n", method, path, &n) != 2) {
+        fprintf(stderr, "Error: invalid request '%s'\n", spec);
+        return -1;
+    }
+    body = p + n;
+    while (*body == ' ' || *body == '\t')
+        body++;
+
+    e = &b->mix[b->mix_count];
+    size_t body_len = strlen(body);
+    size_t size = strlen(method) + strlen(path) + strlen(b->addr_str) + body_len + 160;
+    e->data = malloc(size);
+    if (!e->data)
+        return -1;
+    if (body_len > 0) {
+        e->len = snprintf(e->data, size,
+                          "%s %s HTTP/1.1\r\nHost: %s\r\n"
+                          "Content-Type: application/json\r\nContent-Length: %zu\r\n\r\n%s",
+                          method, path, b->addr_str, body_len, body);
+    } else {
+        e->len = snprintf(e->data, size, "%s %s HTTP/1.1\r\nHost: %s\r\n\r\n",
+                          method, path, b->addr_str);
+    }
+    e->weight = weight;
+    b->mix_count++;
+    return 0;
+}
+
+// One request per line, '#' starts a comment
+static int load_mix_file(Bench* b, const char* filename) {
+    char line[4096];
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open %s\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (add_mix_entry(b, p) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Interleave the request kinds according to their weights, in an order
+// which is the same for every run
+static void build_schedule(Bench* b) {
+    int total = 0;
+    uint32_t seed = 0x2545f491;
+
+    for (int i = 0; i < b->mix_count; i++)
+        total += b->mix[i].weight;
+    for (int i = 0; i < b->mix_count; i++) {
+        // at least one slot per request kind
+        int n = (int)((uint64_t)b->mix[i].weight * MAX_SCHEDULE / total);
+        if (n == 0)
+            n = 1;
+        for (int j = 0; j < n && b->schedule_len < MAX_SCHEDULE; j++)
+            b->schedule[b->schedule_len++] = i;
+    }
+    for (int i = b->schedule_len - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        int j = seed % (i + 1);
+        int tmp = b->schedule[i];
+        b->schedule[i] = b->schedule[j];
+        b->schedule[j] = tmp;
+    }
+}
+
+// Connections
+
+static int conn_open(Bench* b, Conn* c) {
+    int one = 1;
+    struct epoll_event ev;
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0)
+        return -1;
+    // loopback: the blocking connect completes immediately
+    if (connect(c->fd, (struct sockaddr*)&b->addr, sizeof(b->addr)) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->rlen = 0;
+    c->output_enabled = false;
+    return 0;
+}
+
+static void conn_close(Bench* b, Conn* c) {
+    if (c->fd >= 0) {
+        epoll_ctl(b->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+// The request in flight is lost: count it and start again on a new
+// connection
+static void conn_reset(Bench* b, Conn* c) {
+    b->errors++;
+    b->reconnects++;
+    conn_close(b, c);
+    c->state = CONN_IDLE;
+    if (conn_open(b, c) < 0)
+        c->next_us = get_time_us() + 100000; // retry later
+}
+
+static void conn_set_output(Bench* b, Conn* c, bool enable) {
+    struct epoll_event ev;
+    if (c->output_enabled == enable)
+        return;
+    c->output_enabled = enable;
+    ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void conn_write(Bench* b, Conn* c) {
+    while (c->sent < c->req->len) {
+        ssize_t ret = write(c->fd, c->req->data + c->sent, c->req->len - c->sent);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                conn_set_output(b, c, true);
+                return;
+            }
+            conn_reset(b, c);
+            return;
+        }
+        c->sent += ret;
+    }
+    conn_set_output(b, c, false);
+}
+
+static void conn_send(Bench* b, Conn* c, uint64_t now) {
+    if (c->fd < 0 && conn_open(b, c) < 0) {
+        c->next_us = now + 100000;
+        return;
+    }
+    c->req = &b->mix[b->schedule[b->schedule_pos++ % b->schedule_len]];
+    c->sent = 0;
+    // behind schedule, the request is sent at once and its latency
+    // still counts from its scheduled time
+    c->scheduled_us = b->rate > 0 ? c->next_us : now;
+    c->state = CONN_BUSY;
+    // the rest of a partial write is written on EPOLLOUT
+    conn_write(b, c);
+}
+
+// Return the length of the response if complete, 0 if incomplete and
+// -1 if it cannot be parsed. 'pclose' is set if the server closes the
+// connection after it.
+static ssize_t parse_response(const char* buf, size_t len, int* pstatus, bool* pclose) {
+    const char* end = memmem(buf, len, "\r\n\r\n", 4);
+    const char *p, *line_end;
+    long content_length = -1;
+
+    if (!end)
+        return len > MAX_RESPONSE ? -1 : 0;
+    if (len < 12 || memcmp(buf, "HTTP/1.", 7) != 0)
+        return -1;
+    *pstatus = atoi(buf + 9);
+    *pclose = buf[7] == '0';
+    for (p = (const char*)memchr(buf, '\n', end - buf) + 1; p < end; p = line_end + 1) {
+        line_end = memchr(p, '\n', end + 2 - p);
+        if (!line_end)
+            break;
+        if (strncasecmp(p, "Content-Length:", 15) == 0)
+            content_length = strtol(p + 15, NULL, 10);
+        else if (strncasecmp(p, "Connection:", 11) == 0) {
+            const char* v = p + 11;
+            while (*v == ' ')
+                v++;
+            if (strncasecmp(v, "close", 5) == 0)
+                *pclose = true;
+            else if (strncasecmp(v, "keep-alive", 10) == 0)
+                *pclose = false;
+        }
+    }
+    // the server always sends a length to the clients which do not
+    // accept a compressed encoding
+    if (content_length < 0 || content_length > MAX_RESPONSE)
+        return -1;
+    if ((size_t)(end + 4 - buf) + content_length > len)
+        return 0;
+    return end + 4 - buf + content_length;
+}
+
+static void conn_read(Bench* b, Conn* c) {
+    for (;;) {
+        if (c->rsize - c->rlen < READ_BUF_SIZE) {
+            size_t new_size = c->rsize ? c->rsize * 2 : 2 * READ_BUF_SIZE;
+            char* new_buf = realloc(c->rbuf, new_size);
+            if (!new_buf) {
+                conn_reset(b, c);
+                return;
+            }
+            c->rbuf = new_buf;
+            c->rsize = new_size;
+        }
+        ssize_t ret = read(c->fd, c->rbuf + c->rlen, c->rsize - c->rlen);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            conn_reset(b, c);
+            return;
+        }
+        if (ret == 0) {
+            // closed by the server: an error only if a response was expected
+            if (c->state != CONN_IDLE)
+                conn_reset(b, c);
+            else
+                conn_close(b, c);
+            return;
+        }
+        c->rlen += ret;
+        b->bytes_read += ret;
+    }
+
+    if (c->state != CONN_BUSY || c->sent < c->req->len)
+        return;
+    int status = 0;
+    bool close_after = false;
+    ssize_t len = parse_response(c->rbuf, c->rlen, &status, &close_after);
+    if (len == 0)
+        return;
+    if (len < 0) {
+        conn_reset(b, c);
+        return;
+    }
+
+    uint64_t now = get_time_us();
+    if (c->scheduled_us >= b->record_from_us) {
+        hist_record(&b->hist, now - c->scheduled_us);
+        b->requests++;
+        if (status >= 100 && status < 600)
+            b->status[status / 100]++;
+        else
+            b->errors++;
+    }
+    memmove(c->rbuf, c->rbuf + len, c->rlen - len);
+    c->rlen -= len;
+    c->state = CONN_IDLE;
+    c->next_us = b->rate > 0 ? c->scheduled_us + b->interval_us : now;
+    if (close_after) {
+        conn_close(b, c);
+        b->reconnects++;
+    }
+}
+
+static void run(Bench* b) {
+    struct epoll_event events[256];
+    uint64_t start = get_time_us();
+    uint64_t end = start + (uint64_t)((b->warmup_s + b->duration_s) * 1e6);
+
+    b->record_from_us = start + (uint64_t)(b->warmup_s * 1e6);
+    // spread the first requests over one interval
+    for (int i = 0; i < b->conn_count; i++)
+        b->conns[i].next_us = start + b->interval_us * i / b->conn_count;
+
+    for (;;) {
+        uint64_t now = get_time_us();
+        uint64_t next = end;
+
+        if (now >= end)
+            break;
+        for (int i = 0; i < b->conn_count; i++) {
+            Conn* c = &b->conns[i];
+            if (c->state != CONN_IDLE)
+                continue;
+            if (c->next_us <= now)
+                conn_send(b, c, now);
+            if (c->state == CONN_IDLE && c->next_us < next)
+                next = c->next_us;
+        }
+
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = next / 1000000;
+        its.it_value.tv_nsec = next % 1000000 * 1000;
+        timerfd_settime(b->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        int n = epoll_wait(b->epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        for (int i = 0; i < n; i++) {
+            Conn* c = events[i].data.ptr;
+            if (!c) {
+                uint64_t expirations;
+                if (read(b->timer_fd, &expirations, sizeof(expirations)) < 0) {
+                    // already reset by timerfd_settime()
+                }
+                continue;
+            }
+            if (c->fd < 0)
+                continue;
+            if ((events[i].events & EPOLLOUT) && c->state == CONN_BUSY)
+                conn_write(b, c);
+            if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                conn_read(b, c);
+        }
+    }
+    b->duration_s = (get_time_us() - b->record_from_us) / 1e6;
+}
+
+static void print_json(const Bench* b, FILE* f) {
+    const Histogram* h = &b->hist;
+    fprintf(f, "{\n");
+    fprintf(f, "  \"address\": \"%s\",\n", b->addr_str);
+    fprintf(f, "  \"connections\": %d,\n", b->conn_count);
+    fprintf(f, "  \"duration_s\": %.3f,\n", b->duration_s);
+    fprintf(f, "  \"target_rate\": %.1f,\n", b->rate);
+    fprintf(f, "  \"corrected\": %s,\n", b->rate > 0 ? "true" : "false");
+    fprintf(f, "  \"requests\": %llu,\n", (unsigned long long)b->requests);
+    fprintf(f, "  \"errors\": %llu,\n", (unsigned long long)b->errors);
+    fprintf(f, "  \"reconnects\": %llu,\n", (unsigned long long)b->reconnects);
+    fprintf(f, "  \"bytes_read\": %llu,\n", (unsigned long long)b->bytes_read);
+    fprintf(f, "  \"requests_per_second\": %.1f,\n",
+            b->duration_s > 0 ? b->requests / b->duration_s : 0);
+    fprintf(f, "  \"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, \"4xx\": %llu, \"5xx\": %llu},\n",
+            (unsigned long long)b->status[1], (unsigned long long)b->status[2],
+            (unsigned long long)b->status[3], (unsigned long long)b->status[4],
+            (unsigned long long)b->status[5]);
+    fprintf(f, "  \"latency_us\": {\"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p75\": %llu, "
+            "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"p9999\": %llu, \"max\": %llu}\n",
+            (unsigned long long)h->min, h->total ? h->sum / h->total : 0,
+            (unsigned long long)hist_percentile(h, 0.50),
+            (unsigned long long)hist_percentile(h, 0.75),
+            (unsigned long long)hist_percentile(h, 0.90),
+            (unsigned long long)hist_percentile(h, 0.99),
+            (unsigned long long)hist_percentile(h, 0.999),
+            (unsigned long long)hist_percentile(h, 0.9999),
+            (unsigned long long)h->max);
+    fprintf(f, "}\n");
+}
+
+static void print_usage(const char* program_name) {
+    printf("Manaknight load generator (mkload) v1.0.0\n");
+    printf("Usage: %s [options]\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -a, --address <ip:port> Server address (default: 127.0.0.1:8080)\n");
+    printf("  -c, --connections <n>   Keep-alive connections (default: 16)\n");
+    printf("  -d, --duration <s>      Measured duration in seconds (default: 10)\n");
+    printf("  -w, --warmup <s>        Warm-up not measured, in seconds (default: 1)\n");
+    printf("  -R, --rate <n>          Total requests per second, with coordinated\n");
+    printf("                          omission correction (default: maximum rate)\n");
+    printf("  -r, --request <spec>    Request of the mix: \"[WEIGHT:]METHOD PATH [BODY]\"\n");
+    printf("  -f, --mix <file>        Requests of the mix, one per line\n");
+    printf("  -o, --output <file>     JSON results file (default: stdout)\n");
+    printf("  -h, --help              Show this help message\n");
+}
+
+int main(int argc, char* argv[]) {
+    static Bench bench;
+    Bench* b = &bench;
+    const char* output_file = NULL;
+    char host[64];
+    int port;
+
+    b->addr_str = "127.0.0.1:8080";
+    b->conn_count = 16;
+    b->duration_s = 10;
+    b->warmup_s = 1;
+
+    static struct option long_options[] = {
+        {"address", required_argument, 0, 'a'},
+        {"connections", required_argument, 0, 'c'},
+        {"duration", required_argument, 0, 'd'},
+        {"warmup", required_argument, 0, 'w'},
+        {"rate", required_argument, 0, 'R'},
+        {"request", required_argument, 0, 'r'},
+        {"mix", required_argument, 0, 'f'},
+        {"output", required_argument, 0, 'o'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    // the address is needed by the Host header of the mix: parse it first
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:c:d:w:R:r:f:o:h", long_options, NULL)) != -1) {
+        if (opt == 'a')
+            b->addr_str = optarg;
+    }
+    if (sscanf(b->addr_str, "%63[^:]:%d", host, &port) != 2 ||
+        inet_pton(AF_INET, host, &b->addr.sin_addr) != 1) {
+        fprintf(stderr, "Error: invalid address '%s'\n", b->addr_str);
+        return 1;
+    }
+    b->addr.sin_family = AF_INET;
+    b->addr.sin_port = htons(port);
+
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "a:c:d:w:R:r:f:o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                break;
+            case 'c':
+                b->conn_count = atoi(optarg);
+                break;
+            case 'd':
+                b->duration_s = atof(optarg);
+                break;
+            case 'w':
+                b->warmup_s = atof(optarg);
+                break;
+            case 'R':
+                b->rate = atof(optarg);
+                break;
+            case 'r':
+                if (add_mix_entry(b, optarg) < 0)
+                    return 1;
+                break;
+            case 'f':
+                if (load_mix_file(b, optarg) < 0)
+                    return 1;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (b->conn_count <= 0 || b->duration_s <= 0) {
+        fprintf(stderr, "Error: invalid connection count or duration\n");
+        return 1;
+    }
+    if (b->mix_count == 0 && add_mix_entry(b, "GET /") < 0)
+        return 1;
+    build_schedule(b);
+    b->interval_us = b->rate > 0 ? (uint64_t)(b->conn_count * 1e6 / b->rate) : 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    b->epoll_fd = epoll_create1(0);
+    b->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    b->conns = calloc(b->conn_count, sizeof(Conn));
+    if (b->epoll_fd < 0 || b->timer_fd < 0 || !b->conns) {
+        perror("mkload");
+        return 1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, b->timer_fd, &ev);
+    for (int i = 0; i < b->conn_count; i++) {
+        if (conn_open(b, &b->conns[i]) < 0) {
+            fprintf(stderr, "Error: cannot connect to %s: %s\n", b->addr_str, strerror(errno));
+            return 1;
+        }
+    }
+
+    run(b);
+
+    FILE* f = stdout;
+    if (output_file) {
+        f = fopen(output_file, "w");
+        if (!f) {
+            perror(output_file);
+            return 1;
+        }
+    }
+    print_json(b, f);
+    if (f != stdout)
+        fclose(f);
+
+    for (int i = 0; i < b->conn_count; i++) {
+        conn_close(b, &b->conns[i]);
+        free(b->conns[i].rbuf);
+    }
+    free(b->conns);
+    for (int i = 0; i < b->mix_count; i++)
+        free(b->mix[i].data);
+    close(b->timer_fd);
+    close(b->epoll_fd);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Manaknight runtime benchmarks
+#
+# Usage: bench/run_bench.sh <service> [address] [rate]
+#
+# <service> is one of bench/services/*.mk (hello, json_echo, routing,
+# effect_heavy). It is compiled with mkc and served by mkserve on the
+# port of <address> (default: 127.0.0.1:8080) for the duration of the
+# runs; MKSERVE_FLAGS are passed to mkserve (e.g. "-u" for io_uring).
+# The request mix is bench/mixes/<service>.txt.
+#
+# A maximum throughput run is always done. With <rate>, a run at this
+# fixed rate measures the latencies corrected for coordinated omission.
+# The JSON results are written to bench/results/.
+
+set -e
+
+SERVICE=$1
+ADDRESS=${2:-127.0.0.1:8080}
+RATE=$3
+CONNECTIONS=${CONNECTIONS:-64}
+DURATION=${DURATION:-10}
+
+if [ -z "$SERVICE" ] || [ ! -f "bench/services/$SERVICE.mk" ]; then
+    echo "Usage: $0 <service> [address] [rate]"
+    echo "Services: $(cd bench/services && ls *.mk | sed 's/\.mk$//' | tr '\n' ' ')"
+    exit 1
+fi
+
+make mkc mqjs mkserve bench >/dev/null
+./mkc "bench/services/$SERVICE.mk"
+./mqjs -o "bench/services/$SERVICE.bin" "bench/services/$SERVICE.js"
+mkdir -p bench/results
+
+PORT=${ADDRESS##*:}
+./mkserve -p "$PORT" $MKSERVE_FLAGS "bench/services/$SERVICE.bin" >/dev/null &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null; wait $SERVER_PID 2>/dev/null' EXIT
+# wait until the server accepts connections
+for i in $(seq 50); do
+    (exec 3<>"/dev/tcp/${ADDRESS%:*}/$PORT") 2>/dev/null && break
+    kill -0 $SERVER_PID 2>/dev/null || { echo "mkserve failed to start"; exit 1; }
+    sleep 0.1
+done
+
+echo "Benchmarking $SERVICE at $ADDRESS ($CONNECTIONS connections, ${DURATION}s)"
+./bench/mkload -a "$ADDRESS" -c "$CONNECTIONS" -d "$DURATION" \
+    -f "bench/mixes/$SERVICE.txt" -o "bench/results/$SERVICE-max.json"
+cat "bench/results/$SERVICE-max.json"
+
+if [ -n "$RATE" ]; then
+    ./bench/mkload -a "$ADDRESS" -c "$CONNECTIONS" -d "$DURATION" -R "$RATE" \
+        -f "bench/mixes/$SERVICE.txt" -o "bench/results/$SERVICE-rate.json"
+    cat "bench/results/$SERVICE-rate.json"
+fi
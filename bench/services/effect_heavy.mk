@@ -0,0 +1,19 @@
+// Reference service: several effects per request, the independent ones
+// being batched
+
+api get "/dashboard" () -> String {
+    let user = http.get("http://127.0.0.1:8081/user")
+    let orders = http.get("http://127.0.0.1:8081/orders")
+    let config = fs.readFile("bench/services/config.json")
+    log.info("dashboard")
+    "ok"
+}
+
+api get "/time" () -> String {
+    let now = time.now()
+    now.toString()
+}
+
+fn main() -> String {
+    "effect_heavy"
+}
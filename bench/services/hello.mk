@@ -0,0 +1,9 @@
+// Reference service: the smallest dynamic response
+
+api get "/" () -> String {
+    "Hello, World!"
+}
+
+fn main() -> String {
+    "hello"
+}
@@ -0,0 +1,9 @@
+// Reference service: returns the JSON body of the request
+
+api post "/echo" () -> String {
+    request.body()
+}
+
+fn main() -> String {
+    "json_echo"
+}
@@ -0,0 +1,82 @@
+// Reference service: many routes, so that the cost of the route
+// dispatch is measured
+
+api get "/users" () -> String {
+    "users"
+}
+
+api get "/users/me" () -> String {
+    "users me"
+}
+
+api get "/users/me/orders" () -> String {
+    "users me orders"
+}
+
+api get "/users/me/settings" () -> String {
+    "users me settings"
+}
+
+api get "/products" () -> String {
+    "products"
+}
+
+api get "/products/featured" () -> String {
+    "products featured"
+}
+
+api get "/products/new" () -> String {
+    "products new"
+}
+
+api get "/products/sale" () -> String {
+    "products sale"
+}
+
+api get "/categories" () -> String {
+    "categories"
+}
+
+api get "/categories/books" () -> String {
+    "categories books"
+}
+
+api get "/categories/music" () -> String {
+    "categories music"
+}
+
+api get "/cart" () -> String {
+    "cart"
+}
+
+api get "/cart/items" () -> String {
+    "cart items"
+}
+
+api get "/checkout" () -> String {
+    "checkout"
+}
+
+api get "/orders" () -> String {
+    "orders"
+}
+
+api get "/orders/recent" () -> String {
+    "orders recent"
+}
+
+api get "/health" () -> String {
+    "health"
+}
+
+api post "/users" () -> String {
+    "created"
+}
+
+api get "/search" () -> String {
+    request.query()
+}
+
+fn main() -> String {
+    "routing"
+}
@@ -0,0 +1,208 @@
+#include "manaknight_capture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MK_CAPTURE_BUF_SIZE (256 * 1024)
+
+struct MKCaptureWriter {
+    pthread_mutex_t lock;
+    FILE* f;
+    bool error;
+    uint64_t start_us;
+};
+
+static uint64_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+MKCaptureWriter* mk_capture_writer_new(const char* filename) {
+    MKCaptureWriter* w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->f = fopen(filename, "wb");
+    if (!w->f) {
+        free(w);
+        return NULL;
+    }
+    setvbuf(w->f, NULL, _IOFBF, MK_CAPTURE_BUF_SIZE);
+    fputs(MK_CAPTURE_MAGIC, w->f);
+    pthread_mutex_init(&w->lock, NULL);
+    w->start_us = get_time_us();
+    return w;
+}
+
+int mk_capture_writer_free(MKCaptureWriter* w) {
+    bool error = w->error || ferror(w->f);
+    if (fclose(w->f) != 0)
+        error = true;
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+    return error ? -1 : 0;
+}
+
+// Called with the lock held
+static void put_varint(MKCaptureWriter* w, uint64_t v) {
+    uint8_t buf[10];
+    int n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    if (fwrite(buf, 1, n, w->f) != n)
+        w->error = true;
+}
+
+// Called with the lock held
+static void put_bytes(MKCaptureWriter* w, const void* data, size_t len) {
+    put_varint(w, len);
+    if (len > 0 && fwrite(data, 1, len, w->f) != len)
+        w->error = true;
+}
+
+void mk_capture_request(MKCaptureWriter* w, uint64_t id, const void* data, size_t len) {
+    uint64_t now = get_time_us();
+    pthread_mutex_lock(&w->lock);
+    fputc(MK_CAPTURE_REQUEST, w->f);
+    put_varint(w, id);
+    put_varint(w, now - w->start_us);
+    put_bytes(w, data, len);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void mk_capture_effect(MKCaptureWriter* w, uint64_t request_id, const char* capability,
+                       const char* key, size_t key_len, const MKEffectResult* r) {
+    int64_t error = r->error;
+    pthread_mutex_lock(&w->lock);
+    fputc(MK_CAPTURE_EFFECT, w->f);
+    put_varint(w, request_id);
+    put_bytes(w, capability, strlen(capability));
+    put_bytes(w, key, key_len);
+    put_varint(w, ((uint64_t)error << 1) ^ (uint64_t)(error >> 63));
+    put_varint(w, (uint32_t)r->status);
+    put_bytes(w, r->data, r->len);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Log reading. Return false if the log is truncated.
+
+static bool get_varint(const uint8_t** pp, const uint8_t* end, uint64_t* pv) {
+    const uint8_t* p = *pp;
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p >= end)
+            return false;
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *pp = p;
+            *pv = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_bytes(const uint8_t** pp, const uint8_t* end, const uint8_t** pdata, size_t* plen) {
+    uint64_t len;
+    if (!get_varint(pp, end, &len) || len > (uint64_t)(end - *pp))
+        return false;
+    *pdata = *pp;
+    *plen = len;
+    *pp += len;
+    return true;
+}
+
+static bool parse_record(const uint8_t** pp, const uint8_t* end, MKCaptureRecord* rec) {
+    uint64_t v;
+    const uint8_t* s;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = *(*pp)++;
+    if (!get_varint(pp, end, &rec->request_id))
+        return false;
+    switch (rec->type) {
+    case MK_CAPTURE_REQUEST:
+        return get_varint(pp, end, &rec->time_us) &&
+            get_bytes(pp, end, &rec->data, &rec->len);
+    case MK_CAPTURE_EFFECT:
+        if (!get_bytes(pp, end, &s, &rec->capability_len))
+            return false;
+        rec->capability = (const char*)s;
+        if (!get_bytes(pp, end, &s, &rec->key_len))
+            return false;
+        rec->key = (const char*)s;
+        if (!get_varint(pp, end, &v))
+            return false;
+        rec->error = (int)(int64_t)((v >> 1) ^ -(v & 1));
+        if (!get_varint(pp, end, &v))
+            return false;
+        rec->status = (int)v;
+        return get_bytes(pp, end, &rec->data, &rec->len);
+    default:
+        return false;
+    }
+}
+
+MKCaptureLog* mk_capture_log_load(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    MKCaptureLog* log;
+    const uint8_t *p, *end;
+    size_t magic_len = strlen(MK_CAPTURE_MAGIC);
+    size_t size = 0;
+    long file_size;
+
+    if (!f)
+        return NULL;
+    log = calloc(1, sizeof(*log));
+    if (!log)
+        goto fail;
+    fseek(f, 0, SEEK_END);
+    file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (file_size < (long)magic_len)
+        goto fail;
+    log->buf_len = file_size;
+    log->buf = malloc(log->buf_len);
+    if (!log->buf || fread(log->buf, 1, log->buf_len, f) != log->buf_len ||
+        memcmp(log->buf, MK_CAPTURE_MAGIC, magic_len) != 0)
+        goto fail;
+    fclose(f);
+    f = NULL;
+
+    p = log->buf + magic_len;
+    end = log->buf + log->buf_len;
+    while (p < end) {
+        if (log->record_count == size) {
+            size_t new_size = size ? size * 2 : 256;
+            MKCaptureRecord* records = realloc(log->records, new_size * sizeof(records[0]));
+            if (!records)
+                goto fail;
+            log->records = records;
+            size = new_size;
+        }
+        // a capture interrupted in the middle of a record is still usable
+        if (!parse_record(&p, end, &log->records[log->record_count]))
+            break;
+        if (log->records[log->record_count].type == MK_CAPTURE_REQUEST)
+            log->request_count++;
+        log->record_count++;
+    }
+    return log;
+ fail:
+    if (f)
+        fclose(f);
+    if (log)
+        mk_capture_log_free(log);
+    return NULL;
+}
+
+void mk_capture_log_free(MKCaptureLog* log) {
+    free(log->records);
+    free(log->buf);
+    free(log);
+}
@@ -0,0 +1,66 @@
+#ifndef MANAKNIGHT_CAPTURE_H
+#define MANAKNIGHT_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "manaknight_effect_cache.h"
+
+// Traffic capture: the requests received by the server and the results
+// of the effects they performed, in a compact binary log. The replay
+// (manaknight_replay()) runs the requests again in-process with the
+// effects answered from the log.
+//
+// The log is the "MKCAP01\n" magic followed by records: a type byte
+// then the fields. The integers are LEB128 varints and the byte strings
+// a varint length followed by the bytes.
+//   MK_CAPTURE_REQUEST: id, time (us since the start of the capture),
+//                       raw request (headers and body)
+//   MK_CAPTURE_EFFECT:  request id, capability, key, error (zigzag),
+//                       status, result data
+// The writer can be used by several threads.
+
+#define MK_CAPTURE_MAGIC "MKCAP01\n"
+
+typedef enum {
+    MK_CAPTURE_REQUEST = 1,
+    MK_CAPTURE_EFFECT = 2,
+} MKCaptureType;
+
+// The pointers reference the loaded log
+typedef struct {
+    MKCaptureType type;
+    uint64_t request_id;
+    uint64_t time_us;           // requests only
+    const char* capability;     // effects only
+    size_t capability_len;
+    const char* key;            // effects only
+    size_t key_len;
+    int error;                  // effects only
+    int status;                 // effects only
+    const uint8_t* data;        // raw request or effect result
+    size_t len;
+} MKCaptureRecord;
+
+typedef struct MKCaptureWriter MKCaptureWriter;
+
+typedef struct {
+    uint8_t* buf;
+    size_t buf_len;
+    MKCaptureRecord* records;
+    size_t record_count;
+    size_t request_count;
+} MKCaptureLog;
+
+MKCaptureWriter* mk_capture_writer_new(const char* filename);
+// Return -1 if the log could not be completely written
+int mk_capture_writer_free(MKCaptureWriter* w);
+void mk_capture_request(MKCaptureWriter* w, uint64_t id, const void* data, size_t len);
+void mk_capture_effect(MKCaptureWriter* w, uint64_t request_id, const char* capability,
+                       const char* key, size_t key_len, const MKEffectResult* r);
+
+// Return NULL if the file cannot be read or is not a valid log
+MKCaptureLog* mk_capture_log_load(const char* filename);
+void mk_capture_log_free(MKCaptureLog* log);
+
+#endif // MANAKNIGHT_CAPTURE_H
@@ -0,0 +1,821 @@
+#include "manaknight_deflate.h"
+#include "cutils.h"
+#include "list.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define WSIZE           32768
+#define WMASK           (WSIZE - 1)
+#define HASH_BITS       15
+#define HASH_SIZE       (1 << HASH_BITS)
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define MIN_LOOKAHEAD   (MAX_MATCH + MIN_MATCH + 1)
+#define MAX_DIST        (WSIZE - MIN_LOOKAHEAD)
+#define SYM_BUF_SIZE    16384
+#define MAX_STORED      65535
+
+#define L_CODES         286 // literal/length codes
+#define D_CODES         30
+#define BL_CODES        19
+#define END_BLOCK       256
+#define MAX_BITS        15
+#define MAX_BL_BITS     7
+
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t dist_extra[D_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint16_t dist_base[D_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t bl_extra[BL_CODES] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7
+};
+static const uint8_t bl_order[BL_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Tables computed once
+static uint8_t len_code[256];       // match length - 3 -> code
+static uint8_t dist_code[512];      // see get_dist_code()
+static uint8_t fixed_lit_len[288];
+static uint16_t fixed_lit_code[288];
+static uint8_t fixed_dist_len[D_CODES];
+static uint16_t fixed_dist_code[D_CODES];
+static uint32_t crc_table[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+// chain length, nice length and maximum match length for which all
+// the positions are inserted in the hash table
+typedef struct {
+    uint16_t max_chain;
+    uint16_t nice_len;
+    uint16_t max_insert;
+} MKDeflateLevel;
+
+static const MKDeflateLevel deflate_levels[3] = {
+    { 4, 8, 4 },
+    { 8, 16, 5 },
+    { 32, 32, 6 },
+};
+
+struct MKDeflate {
+    MKDeflateWriteFunc* write_func;
+    void* opaque;
+    MKDeflateLevel level;
+    bool gzip;
+    bool header_written;
+    bool finished;
+    bool error;
+    uint32_t crc;
+    uint32_t total_in;
+
+    // sliding window: the current block starts at 'block_start'
+    uint32_t strstart;
+    uint32_t lookahead;
+    uint32_t block_start;
+    uint8_t window[2 * WSIZE];
+    uint16_t head[HASH_SIZE];
+    uint16_t prev[WSIZE];
+
+    // symbols of the current block
+    uint32_t sym_count;
+    uint8_t sym_lc[SYM_BUF_SIZE];   // literal or match length - 3
+    uint16_t sym_dist[SYM_BUF_SIZE]; // 0 for a literal
+    uint32_t lit_freq[L_CODES];
+    uint32_t dist_freq[D_CODES];
+
+    // output
+    uint64_t bit_buf;
+    int bit_count;
+    uint8_t* out;
+    size_t out_len;
+    size_t out_size;
+};
+
+static inline int get_dist_code(uint32_t dist) {
+    dist--;
+    return dist < 256 ? dist_code[dist] : dist_code[256 + (dist >> 7)];
+}
+
+static uint32_t bit_reverse(uint32_t code, int len) {
+    uint32_t r = 0;
+    while (len-- > 0) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+// Canonical Huffman codes, bit reversed as deflate sends them LSB first
+static void gen_codes(const uint8_t* lens, int n, uint16_t* codes) {
+    uint16_t bl_count[MAX_BITS + 1], next_code[MAX_BITS + 1];
+    uint16_t code = 0;
+
+    memset(bl_count, 0, sizeof(bl_count));
+    for (int i = 0; i < n; i++)
+        bl_count[lens[i]]++;
+    bl_count[0] = 0;
+    for (int bits = 1; bits <= MAX_BITS; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        if (lens[i])
+            codes[i] = bit_reverse(next_code[lens[i]]++, lens[i]);
+    }
+}
+
+static void init_tables(void) {
+    for (int code = 0; code < 29; code++) {
+        for (int i = 0; i < (1 << len_extra[code]); i++)
+            len_code[len_base[code] - 3 + i] = code;
+    }
+    for (int code = 0; code < D_CODES; code++) {
+        for (int i = 0; i < (1 << dist_extra[code]); i++) {
+            uint32_t d = dist_base[code] - 1 + i;
+            if (d < 256)
+                dist_code[d] = code;
+            else
+                dist_code[256 + (d >> 7)] = code;
+        }
+    }
+    for (int i = 0; i < 288; i++)
+        fixed_lit_len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    gen_codes(fixed_lit_len, 288, fixed_lit_code);
+    for (int i = 0; i < D_CODES; i++)
+        fixed_dist_len[i] = 5;
+    gen_codes(fixed_dist_len, D_CODES, fixed_dist_code);
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+uint32_t mk_crc32(uint32_t crc, const uint8_t* buf, size_t len) {
+    pthread_once(&tables_once, init_tables);
+    crc = ~crc;
+    while (len-- > 0)
+        crc = crc_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Output
+
+static bool out_reserve(MKDeflate* d, size_t len) {
+    if (d->out_len + len > d->out_size) {
+        size_t new_size = d->out_size ? d->out_size * 3 / 2 : 4096;
+        while (new_size < d->out_len + len)
+            new_size *= 2;
+        uint8_t* new_out = realloc(d->out, new_size);
+        if (!new_out) {
+            d->error = true;
+            return false;
+        }
+        d->out = new_out;
+        d->out_size = new_size;
+    }
+    return true;
+}
+
+static inline void put_bits(MKDeflate* d, uint32_t value, int n) {
+    d->bit_buf |= (uint64_t)value << d->bit_count;
+    d->bit_count += n;
+    if (d->bit_count >= 32) {
+        if (out_reserve(d, 4)) {
+            uint8_t* p = d->out + d->out_len;
+            p[0] = d->bit_buf;
+            p[1] = d->bit_buf >> 8;
+            p[2] = d->bit_buf >> 16;
+            p[3] = d->bit_buf >> 24;
+            d->out_len += 4;
+        }
+        d->bit_buf >>= 32;
+        d->bit_count -= 32;
+    }
+}
+
+// byte align the output
+static void flush_bits(MKDeflate* d) {
+    while (d->bit_count > 0) {
+        if (out_reserve(d, 1))
+            d->out[d->out_len++] = d->bit_buf;
+        d->bit_buf >>= 8;
+        d->bit_count = max_int(d->bit_count - 8, 0);
+    }
+    d->bit_buf = 0;
+}
+
+static void put_bytes(MKDeflate* d, const uint8_t* buf, size_t len) {
+    if (out_reserve(d, len)) {
+        memcpy(d->out + d->out_len, buf, len);
+        d->out_len += len;
+    }
+}
+
+static void put_le32(MKDeflate* d, uint32_t v) {
+    uint8_t buf[4] = { v, v >> 8, v >> 16, v >> 24 };
+    put_bytes(d, buf, 4);
+}
+
+// Huffman trees
+
+typedef struct {
+    uint32_t freq;
+    uint16_t sym;
+} MKHuffLeaf;
+
+static int leaf_cmp(const void* a, const void* b) {
+    const MKHuffLeaf* l1 = a;
+    const MKHuffLeaf* l2 = b;
+    if (l1->freq != l2->freq)
+        return l1->freq < l2->freq ? -1 : 1;
+    return l1->sym - l2->sym;
+}
+
+// Compute the code lengths of a Huffman code limited to 'max_bits'
+static void build_lengths(const uint32_t* freq, int n, int max_bits, uint8_t* lens) {
+    MKHuffLeaf leaves[L_CODES];
+    uint32_t weight[2 * L_CODES];
+    uint16_t parent[2 * L_CODES];
+    uint16_t depth[2 * L_CODES];
+    uint16_t bl_count[2 * L_CODES];
+    int nleaves = 0, max_depth = 0;
+
+    memset(lens, 0, n);
+    for (int i = 0; i < n; i++) {
+        if (freq[i]) {
+            leaves[nleaves].freq = freq[i];
+            leaves[nleaves].sym = i;
+            nleaves++;
+        }
+    }
+    if (nleaves == 0)
+        return;
+    if (nleaves == 1) {
+        lens[leaves[0].sym] = 1;
+        return;
+    }
+    qsort(leaves, nleaves, sizeof(leaves[0]), leaf_cmp);
+
+    // the internal nodes are created in increasing weight order, so
+    // the two smallest nodes are at the head of the two queues
+    for (int i = 0; i < nleaves; i++)
+        weight[i] = leaves[i].freq;
+    int next_leaf = 0, next_node = nleaves;
+    int node_count = 2 * nleaves - 1;
+    for (int k = nleaves; k < node_count; k++) {
+        int a[2];
+        for (int m = 0; m < 2; m++) {
+            if (next_leaf < nleaves &&
+                (next_node >= k || weight[next_leaf] <= weight[next_node]))
+                a[m] = next_leaf++;
+            else
+                a[m] = next_node++;
+        }
+        weight[k] = weight[a[0]] + weight[a[1]];
+        parent[a[0]] = k;
+        parent[a[1]] = k;
+    }
+    depth[node_count - 1] = 0;
+    memset(bl_count, 0, sizeof(bl_count));
+    for (int k = node_count - 2; k >= 0; k--) {
+        depth[k] = depth[parent[k]] + 1;
+        if (k < nleaves) {
+            bl_count[depth[k]]++;
+            max_depth = max_int(max_depth, depth[k]);
+        }
+    }
+
+    // limit the lengths while keeping a complete code
+    for (int i = max_depth; i > max_bits; i--) {
+        while (bl_count[i] > 0) {
+            int j = i - 2;
+            while (bl_count[j] == 0)
+                j--;
+            bl_count[i] -= 2;
+            bl_count[i - 1]++;
+            bl_count[j + 1] += 2;
+            bl_count[j]--;
+        }
+    }
+
+    // the least frequent symbols get the longest codes
+    int leaf = 0;
+    for (int len = min_int(max_depth, max_bits); len >= 1; len--) {
+        for (int i = 0; i < bl_count[len]; i++)
+            lens[leaves[leaf++].sym] = len;
+    }
+}
+
+// Blocks
+
+static uint32_t symbols_cost(MKDeflate* d, const uint8_t* lit_lens, const uint8_t* dist_lens) {
+    uint32_t cost = lit_lens[END_BLOCK];
+    for (int i = 0; i < 256; i++)
+        cost += d->lit_freq[i] * lit_lens[i];
+    for (int i = 257; i < L_CODES; i++)
+        cost += d->lit_freq[i] * (lit_lens[i] + len_extra[i - 257]);
+    for (int i = 0; i < D_CODES; i++)
+        cost += d->dist_freq[i] * (dist_lens[i] + dist_extra[i]);
+    return cost;
+}
+
+static void put_symbols(MKDeflate* d, const uint16_t* lit_codes, const uint8_t* lit_lens,
+                        const uint16_t* dist_codes, const uint8_t* dist_lens) {
+    for (uint32_t i = 0; i < d->sym_count; i++) {
+        uint32_t dist = d->sym_dist[i];
+        int lc = d->sym_lc[i];
+        if (dist == 0) {
+            put_bits(d, lit_codes[lc], lit_lens[lc]);
+        } else {
+            int code = len_code[lc];
+            put_bits(d, lit_codes[257 + code], lit_lens[257 + code]);
+            if (len_extra[code])
+                put_bits(d, lc + 3 - len_base[code], len_extra[code]);
+            code = get_dist_code(dist);
+            put_bits(d, dist_codes[code], dist_lens[code]);
+            if (dist_extra[code])
+                put_bits(d, dist - dist_base[code], dist_extra[code]);
+        }
+    }
+    put_bits(d, lit_codes[END_BLOCK], lit_lens[END_BLOCK]);
+}
+
+static void put_stored(MKDeflate* d, const uint8_t* buf, uint32_t len, bool last) {
+    do {
+        uint32_t n = min_uint32(len, MAX_STORED);
+        put_bits(d, (last && n == len) ? 1 : 0, 3); // BTYPE = 00
+        flush_bits(d);
+        uint8_t hdr[4] = { n, n >> 8, ~n, ~n >> 8 };
+        put_bytes(d, hdr, 4);
+        put_bytes(d, buf, n);
+        buf += n;
+        len -= n;
+    } while (len > 0);
+}
+
+// Run length encoding of the code lengths
+static int rle_lengths(const uint8_t* lens, int n, uint8_t* rle_sym, uint8_t* rle_extra) {
+    int count = 0;
+
+    for (int i = 0; i < n;) {
+        int cur = lens[i];
+        int run = 1;
+        while (i + run < n && lens[i + run] == cur)
+            run++;
+        i += run;
+        if (cur == 0) {
+            while (run >= 11) {
+                int r = min_int(run, 138);
+                rle_sym[count] = 18;
+                rle_extra[count++] = r - 11;
+                run -= r;
+            }
+            if (run >= 3) {
+                rle_sym[count] = 17;
+                rle_extra[count++] = run - 3;
+                run = 0;
+            }
+        } else {
+            rle_sym[count] = cur;
+            rle_extra[count++] = 0;
+            run--;
+            while (run >= 3) {
+                int r = min_int(run, 6);
+                rle_sym[count] = 16;
+                rle_extra[count++] = r - 3;
+                run -= r;
+            }
+        }
+        while (run-- > 0) {
+            rle_sym[count] = cur;
+            rle_extra[count++] = 0;
+        }
+    }
+    return count;
+}
+
+// Emit the symbols of the current block with the cheapest encoding
+static void emit_block(MKDeflate* d, bool last) {
+    uint8_t lit_lens[L_CODES], dist_lens[D_CODES], bl_lens[BL_CODES];
+    uint16_t lit_codes[L_CODES], dist_codes[D_CODES], bl_codes[BL_CODES];
+    uint8_t all_lens[L_CODES + D_CODES];
+    uint8_t rle_sym[L_CODES + D_CODES], rle_extra[L_CODES + D_CODES];
+    uint32_t lit_freq[L_CODES], dist_freq[D_CODES], bl_freq[BL_CODES];
+    int hlit, hdist, hclen, rle_count, n;
+
+    d->lit_freq[END_BLOCK] = 1;
+    // at least two codes in each tree so that no code has zero bits
+    memcpy(lit_freq, d->lit_freq, sizeof(lit_freq));
+    memcpy(dist_freq, d->dist_freq, sizeof(dist_freq));
+    n = 0;
+    for (int i = 0; i < D_CODES; i++)
+        n += (dist_freq[i] != 0);
+    for (int i = 0; n < 2; i++) {
+        if (!dist_freq[i]) {
+            dist_freq[i] = 1;
+            n++;
+        }
+    }
+    if (d->sym_count == 0)
+        lit_freq[0] = 1;
+    build_lengths(lit_freq, L_CODES, MAX_BITS, lit_lens);
+    build_lengths(dist_freq, D_CODES, MAX_BITS, dist_lens);
+
+    for (hlit = L_CODES; hlit > 257 && lit_lens[hlit - 1] == 0; hlit--)
+        continue;
+    for (hdist = D_CODES; hdist > 1 && dist_lens[hdist - 1] == 0; hdist--)
+        continue;
+    memcpy(all_lens, lit_lens, hlit);
+    memcpy(all_lens + hlit, dist_lens, hdist);
+    rle_count = rle_lengths(all_lens, hlit + hdist, rle_sym, rle_extra);
+    memset(bl_freq, 0, sizeof(bl_freq));
+    for (int i = 0; i < rle_count; i++)
+        bl_freq[rle_sym[i]]++;
+    build_lengths(bl_freq, BL_CODES, MAX_BL_BITS, bl_lens);
+    for (hclen = BL_CODES; hclen > 4 && bl_lens[bl_order[hclen - 1]] == 0; hclen--)
+        continue;
+
+    // compare the sizes in bits
+    uint32_t dyn_cost = 3 + 5 + 5 + 4 + 3 * hclen + symbols_cost(d, lit_lens, dist_lens);
+    for (int i = 0; i < rle_count; i++)
+        dyn_cost += bl_lens[rle_sym[i]] + bl_extra[rle_sym[i]];
+    uint32_t fixed_cost = 3 + symbols_cost(d, fixed_lit_len, fixed_dist_len);
+    uint32_t stored_len = d->strstart - d->block_start;
+    uint32_t stored_cost = (stored_len + 5 * (stored_len / MAX_STORED + 1)) * 8 + 7;
+
+    if (stored_cost <= dyn_cost && stored_cost <= fixed_cost) {
+        put_stored(d, d->window + d->block_start, stored_len, last);
+    } else if (fixed_cost <= dyn_cost) {
+        put_bits(d, (1 << 1) | last, 3);
+        put_symbols(d, fixed_lit_code, fixed_lit_len, fixed_dist_code, fixed_dist_len);
+    } else {
+        gen_codes(lit_lens, L_CODES, lit_codes);
+        gen_codes(dist_lens, D_CODES, dist_codes);
+        gen_codes(bl_lens, BL_CODES, bl_codes);
+        put_bits(d, (2 << 1) | last, 3);
+        put_bits(d, hlit - 257, 5);
+        put_bits(d, hdist - 1, 5);
+        put_bits(d, hclen - 4, 4);
+        for (int i = 0; i < hclen; i++)
+            put_bits(d, bl_lens[bl_order[i]], 3);
+        for (int i = 0; i < rle_count; i++) {
+            int sym = rle_sym[i];
+            put_bits(d, bl_codes[sym], bl_lens[sym]);
+            if (bl_extra[sym])
+                put_bits(d, rle_extra[i], bl_extra[sym]);
+        }
+        put_symbols(d, lit_codes, lit_lens, dist_codes, dist_lens);
+    }
+
+    d->sym_count = 0;
+    d->block_start = d->strstart;
+    memset(d->lit_freq, 0, sizeof(d->lit_freq));
+    memset(d->dist_freq, 0, sizeof(d->dist_freq));
+}
+
+// Match finding
+
+static inline uint32_t hash3(const uint8_t* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Insert the string at 'pos' and return the previous head of its chain
+static inline uint32_t insert_string(MKDeflate* d, uint32_t pos) {
+    uint32_t h = hash3(d->window + pos);
+    uint32_t cur = d->head[h];
+    d->prev[pos & WMASK] = cur;
+    d->head[h] = pos;
+    return cur;
+}
+
+static inline int compare_len(const uint8_t* a, const uint8_t* b, int max_len) {
+    int len = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len + 8 <= max_len) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        if (x != y)
+            return len + (__builtin_ctzll(x ^ y) >> 3);
+        len += 8;
+    }
+#endif
+    while (len < max_len && a[len] == b[len])
+        len++;
+    return len;
+}
+
+static int longest_match(MKDeflate* d, uint32_t cur_match, uint32_t* pmatch_start) {
+    const uint8_t* scan = d->window + d->strstart;
+    int chain = d->level.max_chain;
+    int best_len = MIN_MATCH - 1;
+    int max_len = min_int(MAX_MATCH, d->lookahead);
+    uint32_t limit = d->strstart > MAX_DIST ? d->strstart - MAX_DIST : 0;
+
+    do {
+        const uint8_t* match = d->window + cur_match;
+        if (match[best_len] != scan[best_len] || match[0] != scan[0] ||
+            match[1] != scan[1])
+            continue;
+        int len = compare_len(match, scan, max_len);
+        if (len > best_len) {
+            best_len = len;
+            *pmatch_start = cur_match;
+            if (len >= d->level.nice_len || len >= max_len)
+                break;
+        }
+    } while ((cur_match = d->prev[cur_match & WMASK]) > limit && --chain != 0);
+    return best_len;
+}
+
+static inline void record_literal(MKDeflate* d, int c) {
+    d->sym_lc[d->sym_count] = c;
+    d->sym_dist[d->sym_count++] = 0;
+    d->lit_freq[c]++;
+}
+
+static inline void record_match(MKDeflate* d, uint32_t dist, int len) {
+    d->sym_lc[d->sym_count] = len - MIN_MATCH;
+    d->sym_dist[d->sym_count++] = dist;
+    d->lit_freq[257 + len_code[len - MIN_MATCH]]++;
+    d->dist_freq[get_dist_code(dist)]++;
+}
+
+// Greedy parsing of the lookahead. Without 'finish', MIN_LOOKAHEAD
+// bytes are kept so that the matches are not truncated.
+static void deflate_compress(MKDeflate* d, bool finish) {
+    while (d->lookahead >= MIN_LOOKAHEAD || (finish && d->lookahead > 0)) {
+        uint32_t match_start = 0;
+        int len = 0;
+
+        if (d->lookahead >= MIN_MATCH) {
+            uint32_t cur = insert_string(d, d->strstart);
+            if (cur != 0 && d->strstart - cur <= MAX_DIST)
+                len = longest_match(d, cur, &match_start);
+        }
+        if (len >= MIN_MATCH) {
+            record_match(d, d->strstart - match_start, len);
+            d->lookahead -= len;
+            if (len <= d->level.max_insert && d->lookahead >= MIN_MATCH) {
+                for (int i = 1; i < len; i++)
+                    insert_string(d, d->strstart + i);
+            }
+            d->strstart += len;
+        } else {
+            record_literal(d, d->window[d->strstart]);
+            d->strstart++;
+            d->lookahead--;
+        }
+        if (d->sym_count == SYM_BUF_SIZE)
+            emit_block(d, false);
+    }
+}
+
+static void slide_window(MKDeflate* d) {
+    // the data of the current block must stay in the window
+    if (d->sym_count > 0)
+        emit_block(d, false);
+    memmove(d->window, d->window + WSIZE, WSIZE);
+    d->strstart -= WSIZE;
+    d->block_start -= WSIZE;
+    for (int i = 0; i < HASH_SIZE; i++)
+        d->head[i] = d->head[i] >= WSIZE ? d->head[i] - WSIZE : 0;
+    for (int i = 0; i < WSIZE; i++)
+        d->prev[i] = d->prev[i] >= WSIZE ? d->prev[i] - WSIZE : 0;
+}
+
+MKDeflate* mk_deflate_new(int level, bool gzip,
+                          MKDeflateWriteFunc* write_func, void* opaque) {
+    pthread_once(&tables_once, init_tables);
+    MKDeflate* d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->level = deflate_levels[max_int(min_int(level, 3), 1) - 1];
+    d->gzip = gzip;
+    d->write_func = write_func;
+    d->opaque = opaque;
+    return d;
+}
+
+void mk_deflate_free(MKDeflate* d) {
+    if (d) {
+        free(d->out);
+        free(d);
+    }
+}
+
+int mk_deflate_write(MKDeflate* d, const uint8_t* buf, size_t len, bool finish) {
+    if (d->finished)
+        return -1;
+    if (d->gzip) {
+        if (!d->header_written) {
+            // no file name, no modification time, OS = Unix
+            static const uint8_t gzip_header[10] = {
+                0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+            };
+            put_bytes(d, gzip_header, sizeof(gzip_header));
+            d->header_written = true;
+        }
+        d->crc = mk_crc32(d->crc, buf, len);
+        d->total_in += len;
+    }
+
+    while (len > 0) {
+        if (d->strstart >= WSIZE + MAX_DIST)
+            slide_window(d);
+        size_t n = 2 * WSIZE - (d->strstart + d->lookahead);
+        if (n > len)
+            n = len;
+        memcpy(d->window + d->strstart + d->lookahead, buf, n);
+        d->lookahead += n;
+        buf += n;
+        len -= n;
+        deflate_compress(d, false);
+    }
+
+    if (finish) {
+        deflate_compress(d, true);
+        emit_block(d, true);
+        flush_bits(d);
+        if (d->gzip) {
+            put_le32(d, d->crc);
+            put_le32(d, d->total_in);
+        }
+        d->finished = true;
+    }
+
+    if (d->out_len > 0 && !d->error) {
+        d->write_func(d->opaque, d->out, d->out_len);
+        d->out_len = 0;
+    }
+    return d->error ? -1 : 0;
+}
+
+typedef struct {
+    uint8_t* buf;
+    size_t len;
+    size_t size;
+    bool error;
+} MKDeflateBuffer;
+
+static void buffer_write(void* opaque, const uint8_t* buf, size_t len) {
+    MKDeflateBuffer* b = opaque;
+    if (b->len + len > b->size) {
+        size_t new_size = b->size ? b->size * 2 : 4096;
+        while (new_size < b->len + len)
+            new_size *= 2;
+        uint8_t* new_buf = realloc(b->buf, new_size);
+        if (!new_buf) {
+            b->error = true;
+            return;
+        }
+        b->buf = new_buf;
+        b->size = new_size;
+    }
+    memcpy(b->buf + b->len, buf, len);
+    b->len += len;
+}
+
+uint8_t* mk_deflate_buffer(const uint8_t* buf, size_t len, int level, bool gzip,
+                           size_t* pout_len) {
+    MKDeflateBuffer b;
+    memset(&b, 0, sizeof(b));
+    MKDeflate* d = mk_deflate_new(level, gzip, buffer_write, &b);
+    if (!d)
+        return NULL;
+    int ret = mk_deflate_write(d, buf, len, true);
+    mk_deflate_free(d);
+    if (ret < 0 || b.error) {
+        free(b.buf);
+        return NULL;
+    }
+    *pout_len = b.len;
+    return b.buf;
+}
+
+// Compressed body cache
+
+#define MK_COMPRESS_CACHE_HASH_SIZE 1024 // must be a power of two
+
+typedef struct MKCacheEntry {
+    MKCompressed c;
+    struct list_head link;      // LRU list, most recent first
+    struct MKCacheEntry* hash_next;
+    uint64_t hash;
+    size_t key_len;
+    uint8_t key[];
+} MKCacheEntry;
+
+struct MKCompressCache {
+    size_t max_bytes;
+    size_t total_bytes;
+    struct list_head lru;
+    MKCacheEntry* hash_table[MK_COMPRESS_CACHE_HASH_SIZE];
+};
+
+static uint64_t hash_key(const uint8_t* key, size_t len) {
+    uint64_t h = 0xcbf29ce484222325; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+MKCompressCache* mk_compress_cache_new(size_t max_bytes) {
+    MKCompressCache* c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->max_bytes = max_bytes;
+    init_list_head(&c->lru);
+    return c;
+}
+
+void mk_compressed_unref(MKCompressed* e) {
+    if (--e->ref_count == 0) {
+        free(e->data);
+        free(container_of(e, MKCacheEntry, c));
+    }
+}
+
+static void cache_remove(MKCompressCache* c, MKCacheEntry* e) {
+    MKCacheEntry** pe = &c->hash_table[e->hash & (MK_COMPRESS_CACHE_HASH_SIZE - 1)];
+    while (*pe != e)
+        pe = &(*pe)->hash_next;
+    *pe = e->hash_next;
+    list_del(&e->link);
+    c->total_bytes -= e->c.len + e->key_len;
+    mk_compressed_unref(&e->c);
+}
+
+void mk_compress_cache_free(MKCompressCache* c) {
+    while (!list_empty(&c->lru))
+        cache_remove(c, list_entry(c->lru.next, MKCacheEntry, link));
+    free(c);
+}
+
+MKCompressed* mk_compress_cache_get(MKCompressCache* c, const void* key, size_t key_len) {
+    uint64_t h = hash_key(key, key_len);
+    MKCacheEntry* e;
+
+    for (e = c->hash_table[h & (MK_COMPRESS_CACHE_HASH_SIZE - 1)]; e; e = e->hash_next) {
+        if (e->hash == h && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+            list_del(&e->link);
+            list_add(&e->link, &c->lru);
+            e->c.ref_count++;
+            return &e->c;
+        }
+    }
+    return NULL;
+}
+
+MKCompressed* mk_compress_cache_put(MKCompressCache* c, const void* key, size_t key_len,
+                                    uint8_t* data, size_t len) {
+    MKCacheEntry* e = malloc(sizeof(*e) + key_len);
+    if (!e) {
+        free(data);
+        return NULL;
+    }
+    e->c.ref_count = 1;
+    e->c.data = data;
+    e->c.len = len;
+    e->hash = hash_key(key, key_len);
+    e->key_len = key_len;
+    memcpy(e->key, key, key_len);
+
+    // an entry larger than the cache is not inserted
+    if (len + key_len > c->max_bytes)
+        return &e->c;
+
+    MKCompressed* old = mk_compress_cache_get(c, key, key_len);
+    if (old) {
+        cache_remove(c, container_of(old, MKCacheEntry, c));
+        mk_compressed_unref(old);
+    }
+    while (c->total_bytes + len + key_len > c->max_bytes)
+        cache_remove(c, list_entry(c->lru.prev, MKCacheEntry, link));
+
+    e->hash_next = c->hash_table[e->hash & (MK_COMPRESS_CACHE_HASH_SIZE - 1)];
+    c->hash_table[e->hash & (MK_COMPRESS_CACHE_HASH_SIZE - 1)] = e;
+    list_add(&e->link, &c->lru);
+    c->total_bytes += len + key_len;
+    e->c.ref_count++; // reference of the cache
+    return &e->c;
+}
@@ -0,0 +1,50 @@
+#ifndef MANAKNIGHT_DEFLATE_H
+#define MANAKNIGHT_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Deflate (RFC 1951) encoder with an optional gzip (RFC 1952)
+// wrapper. Only the fast levels are provided: 1 to 3 select the
+// length of the hash chains which are searched for matches.
+
+typedef struct MKDeflate MKDeflate;
+
+// Called with the compressed bytes as they are produced
+typedef void MKDeflateWriteFunc(void* opaque, const uint8_t* buf, size_t len);
+
+MKDeflate* mk_deflate_new(int level, bool gzip,
+                          MKDeflateWriteFunc* write_func, void* opaque);
+// Compress 'len' bytes. If 'finish' is true, the stream is terminated
+// and no more data can be written. Return 0 if OK, -1 if memory error.
+int mk_deflate_write(MKDeflate* d, const uint8_t* buf, size_t len, bool finish);
+void mk_deflate_free(MKDeflate* d);
+
+// Compress 'buf' in one call. Return a malloc'ed buffer or NULL.
+uint8_t* mk_deflate_buffer(const uint8_t* buf, size_t len, int level, bool gzip,
+                           size_t* pout_len);
+
+uint32_t mk_crc32(uint32_t crc, const uint8_t* buf, size_t len);
+
+// LRU cache of compressed bodies. The entries are reference counted so
+// that they can be sent while being evicted.
+
+typedef struct MKCompressCache MKCompressCache;
+
+typedef struct MKCompressed {
+    int ref_count;
+    size_t len;
+    uint8_t* data;
+} MKCompressed;
+
+MKCompressCache* mk_compress_cache_new(size_t max_bytes);
+void mk_compress_cache_free(MKCompressCache* c);
+// Return a new reference or NULL if not found
+MKCompressed* mk_compress_cache_get(MKCompressCache* c, const void* key, size_t key_len);
+// Insert 'data' (malloc'ed, owned by the cache). Return a new reference.
+MKCompressed* mk_compress_cache_put(MKCompressCache* c, const void* key, size_t key_len,
+                                    uint8_t* data, size_t len);
+void mk_compressed_unref(MKCompressed* e);
+
+#endif // MANAKNIGHT_DEFLATE_H
@@ -0,0 +1,281 @@
+#include "manaknight_effect_cache.h"
+#include "cutils.h"
+#include "list.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MK_EFFECT_CACHE_HASH_SIZE 256 // must be a power of two
+
+// A call in flight or a cached result. The key is "capability\0key".
+typedef struct MKEffectEntry {
+    int ref_count;              // table, caller and waiters
+    bool in_table;
+    bool done;
+    bool cached;                // in the LRU list
+    MKEffectResult* result;     // NULL while in flight
+    int64_t expires;            // monotonic ms
+    struct list_head link;      // LRU list of the cached results
+    struct MKEffectEntry* hash_next;
+    uint64_t hash;
+    size_t key_len;
+    char key[];
+} MKEffectEntry;
+
+struct MKEffectCache {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;   // signaled when a call completes
+    size_t max_bytes;
+    size_t total_bytes;
+    struct list_head lru;       // most recent first
+    MKEffectTTL* ttls;
+    int ttl_count;
+    MKEffectEntry* hash_table[MK_EFFECT_CACHE_HASH_SIZE];
+};
+
+static int64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t hash_key(const char* key, size_t len) {
+    uint64_t h = 0xcbf29ce484222325; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+MKEffectResult* mk_effect_result_new(int error, int status, const void* data, size_t len) {
+    MKEffectResult* r = malloc(sizeof(*r));
+    if (!r)
+        return NULL;
+    r->data = malloc(len + 1);
+    if (!r->data) {
+        free(r);
+        return NULL;
+    }
+    memcpy(r->data, data, len);
+    r->data[len] = '\0';
+    r->ref_count = 1;
+    r->error = error;
+    r->status = status;
+    r->len = len;
+    return r;
+}
+
+static void result_free(MKEffectResult* r) {
+    free(r->data);
+    free(r);
+}
+
+void mk_effect_result_unref(MKEffectCache* c, MKEffectResult* r) {
+    int ref_count;
+    if (!r)
+        return;
+    if (c)
+        pthread_mutex_lock(&c->lock);
+    ref_count = --r->ref_count;
+    if (c)
+        pthread_mutex_unlock(&c->lock);
+    if (ref_count == 0)
+        result_free(r);
+}
+
+MKEffectCache* mk_effect_cache_new(size_t max_bytes, const MKEffectTTL* ttls) {
+    MKEffectCache* c = calloc(1, sizeof(*c));
+    int n = 0;
+    if (!c)
+        return NULL;
+    if (ttls) {
+        while (ttls[n].capability)
+            n++;
+    }
+    if (n > 0) {
+        c->ttls = malloc(sizeof(c->ttls[0]) * n);
+        if (!c->ttls) {
+            free(c);
+            return NULL;
+        }
+        memcpy(c->ttls, ttls, sizeof(c->ttls[0]) * n);
+        c->ttl_count = n;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->done_cond, NULL);
+    c->max_bytes = max_bytes;
+    init_list_head(&c->lru);
+    return c;
+}
+
+// Called with the lock held
+static void entry_unref(MKEffectEntry* e) {
+    if (--e->ref_count == 0) {
+        if (e->result && --e->result->ref_count == 0)
+            result_free(e->result);
+        free(e);
+    }
+}
+
+// Called with the lock held
+static void entry_remove(MKEffectCache* c, MKEffectEntry* e) {
+    MKEffectEntry** pe = &c->hash_table[e->hash & (MK_EFFECT_CACHE_HASH_SIZE - 1)];
+    while (*pe != e)
+        pe = &(*pe)->hash_next;
+    *pe = e->hash_next;
+    e->in_table = false;
+    if (e->cached) {
+        e->cached = false;
+        list_del(&e->link);
+        c->total_bytes -= e->result->len + e->key_len;
+    }
+    entry_unref(e);
+}
+
+void mk_effect_cache_free(MKEffectCache* c) {
+    // no call may be in flight
+    while (!list_empty(&c->lru))
+        entry_remove(c, list_entry(c->lru.next, MKEffectEntry, link));
+    pthread_cond_destroy(&c->done_cond);
+    pthread_mutex_destroy(&c->lock);
+    free(c->ttls);
+    free(c);
+}
+
+static uint32_t get_ttl(MKEffectCache* c, const char* capability) {
+    for (int i = 0; i < c->ttl_count; i++) {
+        if (strcmp(c->ttls[i].capability, capability) == 0)
+            return c->ttls[i].ttl_ms;
+    }
+    return 0;
+}
+
+// Return a malloc'ed "capability\0key"
+static char* make_key(const char* capability, const char* key, size_t key_len,
+                      size_t* pfull_len) {
+    size_t cap_len = strlen(capability);
+    char* full_key = malloc(cap_len + 1 + key_len);
+    if (!full_key)
+        return NULL;
+    memcpy(full_key, capability, cap_len + 1);
+    memcpy(full_key + cap_len + 1, key, key_len);
+    *pfull_len = cap_len + 1 + key_len;
+    return full_key;
+}
+
+// Called with the lock held
+static MKEffectEntry* entry_find(MKEffectCache* c, const char* key, size_t key_len,
+                                 uint64_t h) {
+    MKEffectEntry* e;
+    for (e = c->hash_table[h & (MK_EFFECT_CACHE_HASH_SIZE - 1)]; e; e = e->hash_next) {
+        if (e->hash == h && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+MKEffectResult* mk_effect_call(MKEffectCache* c, const char* capability,
+                               const char* key, size_t key_len,
+                               MKEffectFunc* func, void* opaque) {
+    MKEffectEntry* e;
+    MKEffectResult* r;
+    size_t full_len;
+    uint64_t h;
+    char* full_key = make_key(capability, key, key_len, &full_len);
+
+    if (!full_key)
+        return NULL;
+    h = hash_key(full_key, full_len);
+    pthread_mutex_lock(&c->lock);
+    e = entry_find(c, full_key, full_len, h);
+    if (e && e->cached && e->expires <= get_time_ms()) {
+        entry_remove(c, e);
+        e = NULL;
+    }
+    if (e) {
+        free(full_key);
+        if (e->cached) {
+            list_del(&e->link);
+            list_add(&e->link, &c->lru);
+            r = e->result;
+            r->ref_count++;
+        } else {
+            // in flight: wait for its result
+            e->ref_count++;
+            while (!e->done)
+                pthread_cond_wait(&c->done_cond, &c->lock);
+            r = e->result;
+            if (r)
+                r->ref_count++;
+            entry_unref(e);
+        }
+        pthread_mutex_unlock(&c->lock);
+        return r;
+    }
+
+    // first caller: perform the effect without the lock
+    e = malloc(sizeof(*e) + full_len);
+    if (!e) {
+        pthread_mutex_unlock(&c->lock);
+        free(full_key);
+        return func(opaque, key, key_len);
+    }
+    e->ref_count = 2;
+    e->in_table = true;
+    e->done = false;
+    e->cached = false;
+    e->result = NULL;
+    e->hash = h;
+    e->key_len = full_len;
+    memcpy(e->key, full_key, full_len);
+    free(full_key);
+    e->hash_next = c->hash_table[h & (MK_EFFECT_CACHE_HASH_SIZE - 1)];
+    c->hash_table[h & (MK_EFFECT_CACHE_HASH_SIZE - 1)] = e;
+    pthread_mutex_unlock(&c->lock);
+
+    r = func(opaque, key, key_len);
+
+    pthread_mutex_lock(&c->lock);
+    e->result = r;
+    e->done = true;
+    if (r)
+        r->ref_count++; // reference of the caller
+    pthread_cond_broadcast(&c->done_cond);
+    if (e->in_table) {
+        uint32_t ttl = get_ttl(c, capability);
+        size_t size = r ? r->len + full_len : 0;
+        if (r && r->error == 0 && ttl > 0 && size <= c->max_bytes) {
+            while (c->total_bytes + size > c->max_bytes)
+                entry_remove(c, list_entry(c->lru.prev, MKEffectEntry, link));
+            e->expires = get_time_ms() + ttl;
+            e->cached = true;
+            list_add(&e->link, &c->lru);
+            c->total_bytes += size;
+        } else {
+            // not cached: the next calls perform the effect again
+            entry_remove(c, e);
+        }
+    }
+    entry_unref(e);
+    pthread_mutex_unlock(&c->lock);
+    return r;
+}
+
+void mk_effect_cache_invalidate(MKEffectCache* c, const char* capability,
+                                const char* key, size_t key_len) {
+    MKEffectEntry* e;
+    size_t full_len;
+    char* full_key = make_key(capability, key, key_len, &full_len);
+
+    if (!full_key)
+        return;
+    pthread_mutex_lock(&c->lock);
+    e = entry_find(c, full_key, full_len, hash_key(full_key, full_len));
+    // a call in flight is not cached when it completes
+    if (e)
+        entry_remove(c, e);
+    pthread_mutex_unlock(&c->lock);
+    free(full_key);
+}
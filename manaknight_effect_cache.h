@@ -0,0 +1,51 @@
+#ifndef MANAKNIGHT_EFFECT_CACHE_H
+#define MANAKNIGHT_EFFECT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Coalescing of idempotent effect calls. Concurrent calls with the
+// same capability (e.g. "http.get") and key (e.g. the URL) share one
+// execution: the first caller performs the I/O and the others wait for
+// its result. The successful results of the capabilities which have a
+// TTL are then kept in an LRU until they expire.
+// The cache can be used by several threads.
+
+typedef struct MKEffectCache MKEffectCache;
+
+typedef struct MKEffectResult {
+    int ref_count;
+    int error;                  // 0 if OK. The errors are not cached.
+    int status;                 // effect specific, e.g. HTTP status
+    size_t len;
+    uint8_t* data;              // terminated by a null byte
+} MKEffectResult;
+
+// Time to live of the results of a capability, in milliseconds
+typedef struct {
+    const char* capability;
+    uint32_t ttl_ms;
+} MKEffectTTL;
+
+// Perform the effect. Return a result from mk_effect_result_new() or
+// NULL if memory error.
+typedef MKEffectResult* MKEffectFunc(void* opaque, const char* key, size_t key_len);
+
+// 'ttls' is terminated by a NULL capability and may be NULL
+MKEffectCache* mk_effect_cache_new(size_t max_bytes, const MKEffectTTL* ttls);
+void mk_effect_cache_free(MKEffectCache* c);
+// Return a new reference to the result of 'func' for this key, shared
+// with the concurrent or recent calls. Return NULL if memory error.
+MKEffectResult* mk_effect_call(MKEffectCache* c, const char* capability,
+                               const char* key, size_t key_len,
+                               MKEffectFunc* func, void* opaque);
+// Forget the cached result, e.g. when a file is written
+void mk_effect_cache_invalidate(MKEffectCache* c, const char* capability,
+                                const char* key, size_t key_len);
+
+// 'data' is copied
+MKEffectResult* mk_effect_result_new(int error, int status, const void* data, size_t len);
+void mk_effect_result_unref(MKEffectCache* c, MKEffectResult* r);
+
+#endif // MANAKNIGHT_EFFECT_CACHE_H
@@ -0,0 +1,1363 @@
+#include "manaknight_http.h"
+#include "manaknight_static.h"
+#include "manaknight_deflate.h"
+#include "manaknight_uring.h"
+#include "cutils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+
+#define MK_HTTP_READ_BUF_SIZE   4096
+#define MK_HTTP_MAX_EVENTS      64
+// compressed chunks produced per write event and connection
+#define MK_HTTP_COMPRESS_CHUNKS_PER_FLUSH 4
+
+// io_uring backend
+#define MK_HTTP_URING_ENTRIES   1024
+#define MK_HTTP_URING_BUFS      256 // receive buffers, must be a power of two
+#define MK_HTTP_URING_BUF_SIZE  4096
+#define MK_HTTP_URING_BGID      1
+#define MK_HTTP_SPLICE_SIZE     (64 * 1024) // default pipe capacity
+
+struct MKHttpUring {
+    MKHttpServer* server;
+    MKUring ring;
+    MKUringBufRing bufs;
+    MKUringOp accept_op;
+    bool accept_armed;
+    bool in_handler;            // requests are deferred while a handler runs
+    MKHttpConn* deferred;       // connections with a request to dispatch
+};
+
+struct MKHttpConn {
+    MKHttpServer* server;
+    int fd;
+    uint32_t events;            // registered epoll events
+
+    // read buffer: the current request is at the start
+    char* rbuf;
+    uint32_t rlen;
+    uint32_t rsize;
+    MKHttpRequest req;
+    bool in_request;            // the request is dispatched
+    bool response_ended;        // mk_http_end_response() was called
+    bool is_head;
+    bool close_after;
+
+    // pending output: wbuf[wpos..wlen), the external buffer, then the
+    // file range
+    char* wbuf;
+    uint32_t wpos;
+    uint32_t wlen;
+    uint32_t wsize;
+    bool write_error;
+    const uint8_t* buf_data;
+    size_t buf_left;
+    void (*buf_release)(void* opaque);
+    void* buf_release_opaque;
+    int file_fd;
+    off_t file_off;
+    size_t file_left;
+    void (*file_release)(void* opaque);
+    void* file_release_opaque;
+
+    // body compressed by the event loop (chunked transfer coding)
+    MKDeflate* deflate;
+    uint8_t* zsrc;
+    size_t zsrc_pos;
+    size_t zsrc_len;
+    uint8_t zkey[16];           // compress cache key
+    uint8_t* zout;              // copy of the output for the cache
+    size_t zout_len;
+    size_t zout_size;
+
+    // io_uring backend
+    MKUringOp recv_op;
+    MKUringOp send_op;
+    MKUringOp splice_in_op;
+    MKUringOp splice_out_op;
+    int uring_ops;              // operations in flight
+    int send_ops;               // output operations in flight
+    bool recv_armed;
+    bool send_error;
+    bool closing;               // freed when no operation is in flight
+    bool deferred;
+    MKHttpConn* deferred_next;
+    struct iovec iov[2];
+    struct msghdr msg;
+    int pipe_fds[2];            // file -> pipe -> socket
+    size_t pipe_len;            // bytes in the pipe
+};
+
+static void conn_close(MKHttpConn* c);
+static void conn_process(MKHttpConn* c);
+static void uring_conn_flush(MKHttpConn* c);
+
+// Request parsing
+
+static inline MKSlice make_slice(const char* buf, const char* p, size_t len) {
+    MKSlice s;
+    s.off = p - buf;
+    s.len = len;
+    return s;
+}
+
+bool mk_http_slice_equal(const char* buf, MKSlice s, const char* str) {
+    size_t len = strlen(str);
+    return s.len == len && strncasecmp(buf + s.off, str, len) == 0;
+}
+
+// Return the position of the end of the headers or NULL if not found
+static const char* find_header_end(const char* buf, size_t len) {
+    const char* p = buf;
+    const char* end = buf + len;
+
+    while (p < end) {
+        p = memchr(p, '\n', end - p);
+        if (!p)
+            return NULL;
+        p++;
+        if (p < end && *p == '\n')
+            return p + 1;
+        if (p + 1 < end && p[0] == '\r' && p[1] == '\n')
+            return p + 2;
+    }
+    return NULL;
+}
+
+static bool parse_uint32(const char* p, size_t len, uint32_t* pval) {
+    uint64_t v = 0;
+    if (len == 0)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9')
+            return false;
+        v = v * 10 + (p[i] - '0');
+        if (v > UINT32_MAX)
+            return false;
+    }
+    *pval = v;
+    return true;
+}
+
+int mk_http_parse_request(const char* buf, size_t len, MKHttpRequest* req) {
+    const char *p, *end, *line_end, *q;
+
+    end = find_header_end(buf, len);
+    if (!end)
+        return len > MK_HTTP_MAX_HEADER_SIZE ? -1 : 0;
+
+    memset(req, 0, sizeof(*req));
+    req->header_len = end - buf;
+
+    // request line
+    p = buf;
+    line_end = memchr(p, '\n', end - p);
+    q = memchr(p, ' ', line_end - p);
+    if (!q || q == p)
+        return -1;
+    req->method = make_slice(buf, p, q - p);
+    p = q + 1;
+    q = memchr(p, ' ', line_end - p);
+    if (!q || q == p || *p != '/')
+        return -1;
+    req->path = make_slice(buf, p, q - p);
+    const char* query = memchr(p, '?', q - p);
+    if (query) {
+        req->path.len = query - p;
+        req->query = make_slice(buf, query + 1, q - query - 1);
+    }
+    p = q + 1;
+    if (line_end - p < 8 || memcmp(p, "HTTP/1.", 7) != 0)
+        return -1;
+    req->minor_version = p[7] - '0';
+    req->keep_alive = (req->minor_version >= 1);
+
+    // headers
+    for (p = line_end + 1; p < end; p = line_end + 1) {
+        line_end = memchr(p, '\n', end - p);
+        q = line_end;
+        if (q > p && q[-1] == '\r')
+            q--;
+        if (q == p)
+            break;
+        const char* colon = memchr(p, ':', q - p);
+        if (!colon || colon == p)
+            return -1;
+        if (req->header_count >= MK_HTTP_MAX_HEADERS)
+            return -1;
+        const char* v = colon + 1;
+        while (v < q && (*v == ' ' || *v == '\t'))
+            v++;
+        const char* v_end = q;
+        while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+            v_end--;
+        MKHttpHeader* h = &req->headers[req->header_count++];
+        h->name = make_slice(buf, p, colon - p);
+        h->value = make_slice(buf, v, v_end - v);
+
+        if (mk_http_slice_equal(buf, h->name, "content-length")) {
+            if (!parse_uint32(v, v_end - v, &req->content_length))
+                return -1;
+        } else if (mk_http_slice_equal(buf, h->name, "transfer-encoding")) {
+            // chunked request bodies are not supported
+            return -1;
+        } else if (mk_http_slice_equal(buf, h->name, "connection")) {
+            if (mk_http_slice_equal(buf, h->value, "close"))
+                req->keep_alive = false;
+            else if (mk_http_slice_equal(buf, h->value, "keep-alive"))
+                req->keep_alive = true;
+        }
+    }
+    req->body.off = req->header_len;
+    req->body.len = req->content_length;
+    return req->header_len;
+}
+
+const MKSlice* mk_http_find_header(const char* buf, const MKHttpRequest* req,
+                                   const char* name) {
+    for (int i = 0; i < req->header_count; i++) {
+        if (mk_http_slice_equal(buf, req->headers[i].name, name))
+            return &req->headers[i].value;
+    }
+    return NULL;
+}
+
+static bool token_equal(const char* p, size_t len, const char* str) {
+    return len == strlen(str) && strncasecmp(p, str, len) == 0;
+}
+
+int mk_http_accepted_encodings(const char* buf, const MKHttpRequest* req) {
+    const MKSlice* ae = mk_http_find_header(buf, req, "accept-encoding");
+    int mask = 0;
+
+    if (!ae)
+        return 0;
+    const char* p = buf + ae->off;
+    const char* end = p + ae->len;
+    while (p < end) {
+        const char* item_end = memchr(p, ',', end - p);
+        if (!item_end)
+            item_end = end;
+        while (p < item_end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char* name_end = p;
+        while (name_end < item_end && *name_end != ';' &&
+               *name_end != ' ' && *name_end != '\t')
+            name_end++;
+        // "q=0" disables the encoding
+        bool refused = false;
+        const char* q = memchr(name_end, ';', item_end - name_end);
+        if (q) {
+            q++;
+            while (q < item_end && (*q == ' ' || *q == '\t'))
+                q++;
+            if (item_end - q >= 3 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+                refused = true;
+                for (q += 2; q < item_end && *q != ' '; q++) {
+                    if (*q != '0' && *q != '.')
+                        refused = false;
+                }
+            }
+        }
+        if (!refused) {
+            if (token_equal(p, name_end - p, "*"))
+                mask |= MK_HTTP_ENC_BR | MK_HTTP_ENC_GZIP;
+            else if (token_equal(p, name_end - p, "br"))
+                mask |= MK_HTTP_ENC_BR;
+            else if (token_equal(p, name_end - p, "gzip"))
+                mask |= MK_HTTP_ENC_GZIP;
+        }
+        p = item_end + 1;
+    }
+    return mask;
+}
+
+bool mk_http_is_compressible(const char* content_type) {
+    static const char* const types[] = {
+        "application/json", "application/javascript", "application/xml",
+        "image/svg+xml",
+    };
+    if (strncasecmp(content_type, "text/", 5) == 0)
+        return true;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        size_t len = strlen(types[i]);
+        if (strncasecmp(content_type, types[i], len) == 0 &&
+            (content_type[len] == '\0' || content_type[len] == ';'))
+            return true;
+    }
+    return false;
+}
+
+void mk_http_format_date(char* dst, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(dst, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+const char* mk_http_status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+// Output
+
+static bool wbuf_append(MKHttpConn* c, const void* data, size_t len) {
+    if (c->wlen + len > c->wsize) {
+        size_t new_size = c->wsize ? c->wsize : 4096;
+        while (new_size < c->wlen + len)
+            new_size *= 2;
+        char* new_buf = realloc(c->wbuf, new_size);
+        if (!new_buf)
+            return false;
+        c->wbuf = new_buf;
+        c->wsize = new_size;
+    }
+    memcpy(c->wbuf + c->wlen, data, len);
+    c->wlen += len;
+    return true;
+}
+
+// The date is formatted at most once per second
+static const char* get_date(void) {
+    static __thread time_t last_time;
+    static __thread char date[32];
+    time_t t = time(NULL);
+    if (t != last_time) {
+        mk_http_format_date(date, t);
+        last_time = t;
+    }
+    return date;
+}
+
+// Format the headers ending every response
+static int format_head_end(MKHttpConn* c, char* buf, size_t buf_size) {
+    if (!c->req.keep_alive)
+        c->close_after = true;
+    return snprintf(buf, buf_size, "Date: %s\r\nConnection: %s\r\n\r\n",
+                    get_date(), c->close_after ? "close" : "keep-alive");
+}
+
+void mk_http_send_head(MKHttpConn* c, const char* hdr, size_t hdr_len) {
+    char buf[96];
+    int len = format_head_end(c, buf, sizeof(buf));
+    if (!wbuf_append(c, hdr, hdr_len) || !wbuf_append(c, buf, len))
+        c->close_after = true;
+}
+
+void mk_http_send_data(MKHttpConn* c, const void* data, size_t len) {
+    if (c->is_head)
+        return;
+    if (!wbuf_append(c, data, len))
+        c->close_after = true;
+}
+
+// Send the head and the body with a single sendmsg() when no output is
+// pending, so that the body goes from the caller memory (e.g. a string
+// of the JS heap) to the socket. Only the part which cannot be written
+// immediately is copied.
+static void send_direct(MKHttpConn* c, const char* hdr, size_t hdr_len,
+                        const void* body, size_t body_len) {
+    char end[96];
+    int end_len = format_head_end(c, end, sizeof(end));
+    struct iovec iov[3];
+    int n = 0;
+    size_t written = 0;
+
+    iov[n].iov_base = (void*)hdr;
+    iov[n++].iov_len = hdr_len;
+    iov[n].iov_base = end;
+    iov[n++].iov_len = end_len;
+    if (!c->is_head && body_len > 0) {
+        iov[n].iov_base = (void*)body;
+        iov[n++].iov_len = body_len;
+    }
+    if (c->wlen == 0 && c->buf_left == 0 && c->file_left == 0 && !c->deflate &&
+        c->send_ops == 0 && c->pipe_len == 0) {
+        struct msghdr msg;
+        ssize_t ret;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        // the sockets of the io_uring backend are blocking
+        do {
+            ret = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (ret < 0 && errno == EINTR);
+        // on error, the next write reports it
+        if (ret > 0)
+            written = ret;
+    }
+    for (int i = 0; i < n; i++) {
+        size_t len = iov[i].iov_len;
+        if (written >= len) {
+            written -= len;
+            continue;
+        }
+        if (!wbuf_append(c, (uint8_t*)iov[i].iov_base + written, len - written))
+            c->close_after = true;
+        written = 0;
+    }
+}
+
+void mk_http_send_buffer(MKHttpConn* c, const void* data, size_t len,
+                         void (*release)(void* opaque), void* release_opaque) {
+    if (c->is_head) {
+        if (release)
+            release(release_opaque);
+        return;
+    }
+    c->buf_data = data;
+    c->buf_left = len;
+    c->buf_release = release;
+    c->buf_release_opaque = release_opaque;
+}
+
+void mk_http_send_file(MKHttpConn* c, int fd, off_t offset, size_t len,
+                       void (*release)(void* opaque), void* release_opaque) {
+    if (c->is_head) {
+        if (release)
+            release(release_opaque);
+        return;
+    }
+    c->file_fd = fd;
+    c->file_off = offset;
+    c->file_left = len;
+    c->file_release = release;
+    c->file_release_opaque = release_opaque;
+}
+
+// Compression
+
+static void compressed_release(void* opaque) {
+    mk_compressed_unref(opaque);
+}
+
+// The cache key of a body is its FNV-1a hash, its CRC32 and its length
+static void get_body_key(uint8_t* key, const uint8_t* body, size_t len) {
+    uint64_t h = 0xcbf29ce484222325;
+    uint32_t crc, len32 = len;
+    for (size_t i = 0; i < len; i++) {
+        h ^= body[i];
+        h *= 0x100000001b3;
+    }
+    crc = mk_crc32(0, body, len);
+    memcpy(key, &h, 8);
+    memcpy(key + 8, &crc, 4);
+    memcpy(key + 12, &len32, 4);
+}
+
+// Output of the incremental compression, one chunk per call
+static void compress_write(void* opaque, const uint8_t* buf, size_t len) {
+    MKHttpConn* c = opaque;
+    char line[24];
+    int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+
+    if (!wbuf_append(c, line, n) || !wbuf_append(c, buf, len) ||
+        !wbuf_append(c, "\r\n", 2)) {
+        c->write_error = true;
+        return;
+    }
+    if (c->server->compress_cache) {
+        if (c->zout_len + len > c->zout_size) {
+            size_t new_size = c->zout_size ? c->zout_size : 16384;
+            while (new_size < c->zout_len + len)
+                new_size *= 2;
+            uint8_t* new_buf = realloc(c->zout, new_size);
+            if (!new_buf) {
+                c->write_error = true;
+                return;
+            }
+            c->zout = new_buf;
+            c->zout_size = new_size;
+        }
+        memcpy(c->zout + c->zout_len, buf, len);
+        c->zout_len += len;
+    }
+}
+
+static void release_compress(MKHttpConn* c) {
+    mk_deflate_free(c->deflate);
+    c->deflate = NULL;
+    free(c->zsrc);
+    c->zsrc = NULL;
+    free(c->zout);
+    c->zout = NULL;
+    c->zout_len = c->zout_size = 0;
+}
+
+// Compress the next chunk of the body into the write buffer
+static int conn_compress_chunk(MKHttpConn* c) {
+    MKCompressCache* cache = c->server->compress_cache;
+    size_t n = c->zsrc_len - c->zsrc_pos;
+    bool finish = (n <= MK_HTTP_COMPRESS_CHUNK_SIZE);
+
+    if (!finish)
+        n = MK_HTTP_COMPRESS_CHUNK_SIZE;
+    if (mk_deflate_write(c->deflate, c->zsrc + c->zsrc_pos, n, finish) < 0 ||
+        c->write_error)
+        return -1;
+    c->zsrc_pos += n;
+    if (finish) {
+        if (!wbuf_append(c, "0\r\n\r\n", 5))
+            return -1;
+        if (cache) {
+            MKCompressed* z = mk_compress_cache_put(cache, c->zkey, sizeof(c->zkey),
+                                                    c->zout, c->zout_len);
+            c->zout = NULL; // owned by the cache
+            if (z)
+                mk_compressed_unref(z);
+        }
+        release_compress(c);
+    }
+    return 0;
+}
+
+// Return false if the body must be sent uncompressed
+static bool send_compressed(MKHttpConn* c, int status, const char* content_type,
+                            const void* body, size_t body_len) {
+    MKHttpServer* s = c->server;
+    MKCompressed* z = NULL;
+    uint8_t key[16];
+    char hdr[320];
+    int len;
+
+    if (s->compress_cache) {
+        get_body_key(key, body, body_len);
+        z = mk_compress_cache_get(s->compress_cache, key, sizeof(key));
+    }
+    if (!z && body_len >= MK_HTTP_COMPRESS_STREAM_SIZE && c->req.minor_version >= 1) {
+        // compressed by the event loop as the socket drains
+        c->zsrc = malloc(body_len);
+        c->deflate = mk_deflate_new(s->compress_level, true, compress_write, c);
+        if (!c->zsrc || !c->deflate) {
+            release_compress(c);
+            return false;
+        }
+        memcpy(c->zsrc, body, body_len);
+        c->zsrc_len = body_len;
+        c->zsrc_pos = 0;
+        if (s->compress_cache)
+            memcpy(c->zkey, key, sizeof(key));
+        len = snprintf(hdr, sizeof(hdr),
+                       "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "Content-Encoding: gzip\r\n"
+                       "Vary: Accept-Encoding\r\n"
+                       "Transfer-Encoding: chunked\r\n",
+                       status, mk_http_status_text(status), content_type);
+        mk_http_send_head(c, hdr, len);
+        return true;
+    }
+    if (!z) {
+        size_t out_len;
+        uint8_t* out = mk_deflate_buffer(body, body_len, s->compress_level, true, &out_len);
+        if (!out)
+            return false;
+        if (s->compress_cache) {
+            z = mk_compress_cache_put(s->compress_cache, key, sizeof(key), out, out_len);
+            if (!z)
+                return false;
+        } else if (out_len >= body_len) {
+            free(out);
+            return false;
+        } else {
+            len = snprintf(hdr, sizeof(hdr),
+                           "HTTP/1.1 %d %s\r\n"
+                           "Content-Type: %s\r\n"
+                           "Content-Encoding: gzip\r\n"
+                           "Vary: Accept-Encoding\r\n"
+                           "Content-Length: %zu\r\n",
+                           status, mk_http_status_text(status), content_type, out_len);
+            send_direct(c, hdr, len, out, out_len);
+            free(out);
+            return true;
+        }
+    }
+    // incompressible data
+    if (z->len >= body_len) {
+        mk_compressed_unref(z);
+        return false;
+    }
+    len = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 %d %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Encoding: gzip\r\n"
+                   "Vary: Accept-Encoding\r\n"
+                   "Content-Length: %zu\r\n",
+                   status, mk_http_status_text(status), content_type, z->len);
+    mk_http_send_head(c, hdr, len);
+    mk_http_send_buffer(c, z->data, z->len, compressed_release, z);
+    return true;
+}
+
+void mk_http_send_response(MKHttpConn* c, int status, const char* content_type,
+                           const void* body, size_t body_len) {
+    const char* vary = "";
+    char hdr[320];
+
+    if (c->server->compress_level > 0 && body_len >= MK_HTTP_COMPRESS_MIN_SIZE &&
+        mk_http_is_compressible(content_type)) {
+        if (!c->is_head &&
+            (mk_http_accepted_encodings(c->rbuf, &c->req) & MK_HTTP_ENC_GZIP) &&
+            send_compressed(c, status, content_type, body, body_len))
+            return;
+        vary = "Vary: Accept-Encoding\r\n";
+    }
+    int len = snprintf(hdr, sizeof(hdr),
+                       "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "Content-Length: %zu\r\n"
+                       "%s",
+                       status, mk_http_status_text(status),
+                       content_type, body_len, vary);
+    send_direct(c, hdr, len, body, body_len);
+}
+
+static void release_buffer(MKHttpConn* c) {
+    if (c->buf_release)
+        c->buf_release(c->buf_release_opaque);
+    c->buf_release = NULL;
+    c->buf_data = NULL;
+    c->buf_left = 0;
+}
+
+static void release_file(MKHttpConn* c) {
+    if (c->file_release)
+        c->file_release(c->file_release_opaque);
+    c->file_release = NULL;
+    c->file_fd = -1;
+    c->file_left = 0;
+}
+
+static void conn_set_events(MKHttpConn* c, uint32_t events) {
+    if (c->server->uring)
+        return;
+    if (c->events != events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(c->server->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+}
+
+// Write the write buffer and the external buffer with a single system
+// call so that the headers and a small body share a TCP segment.
+static int conn_write_buffers(MKHttpConn* c) {
+    while (c->wpos < c->wlen || c->buf_left > 0) {
+        struct iovec iov[2];
+        int n = 0;
+        if (c->wpos < c->wlen) {
+            iov[n].iov_base = c->wbuf + c->wpos;
+            iov[n].iov_len = c->wlen - c->wpos;
+            n++;
+        }
+        if (c->buf_left > 0) {
+            iov[n].iov_base = (void*)c->buf_data;
+            iov[n].iov_len = c->buf_left;
+            n++;
+        }
+        ssize_t ret = writev(c->fd, iov, n);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN) ? 0 : -1;
+        }
+        size_t w = c->wlen - c->wpos;
+        if ((size_t)ret < w)
+            w = ret;
+        c->wpos += w;
+        c->buf_data += ret - w;
+        c->buf_left -= ret - w;
+    }
+    c->wpos = c->wlen = 0;
+    release_buffer(c);
+    return 1;
+}
+
+// Return 1 if all the output is written, 0 if the socket is full and
+// -1 if error.
+static int conn_flush(MKHttpConn* c) {
+    for (int chunks = 0;; chunks++) {
+        int ret = conn_write_buffers(c);
+        if (ret <= 0)
+            return ret;
+        if (!c->deflate)
+            break;
+        // let the other connections run, EPOLLOUT brings us back
+        if (chunks == MK_HTTP_COMPRESS_CHUNKS_PER_FLUSH)
+            return 0;
+        if (conn_compress_chunk(c) < 0)
+            return -1;
+    }
+    while (c->file_left > 0) {
+        ssize_t ret = sendfile(c->fd, c->file_fd, &c->file_off, c->file_left);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN) ? 0 : -1;
+        }
+        if (ret == 0)
+            return -1; // file truncated
+        c->file_left -= ret;
+    }
+    release_file(c);
+    return 1;
+}
+
+static void conn_request_done(MKHttpConn* c) {
+    uint32_t req_len = c->req.header_len + c->req.content_length;
+
+    c->in_request = false;
+    c->response_ended = false;
+    if (c->close_after) {
+        conn_close(c);
+        return;
+    }
+    memmove(c->rbuf, c->rbuf + req_len, c->rlen - req_len);
+    c->rlen -= req_len;
+    conn_set_events(c, EPOLLIN);
+    // pipelined request
+    if (c->rlen > 0)
+        conn_process(c);
+}
+
+static void conn_write_pending(MKHttpConn* c) {
+    if (c->server->uring) {
+        uring_conn_flush(c);
+        return;
+    }
+    int ret = conn_flush(c);
+    if (ret < 0) {
+        conn_close(c);
+    } else if (ret == 0) {
+        conn_set_events(c, EPOLLOUT);
+    } else if (c->response_ended) {
+        conn_request_done(c);
+    }
+}
+
+void mk_http_end_response(MKHttpConn* c) {
+    c->response_ended = true;
+    conn_write_pending(c);
+}
+
+static void conn_send_error(MKHttpConn* c, int status) {
+    const char* text = mk_http_status_text(status);
+    c->close_after = true;
+    c->in_request = true;
+    c->req.content_length = 0;
+    mk_http_send_response(c, status, "text/plain", text, strlen(text));
+    mk_http_end_response(c);
+}
+
+// Connection handling
+
+static void conn_defer(MKHttpUring* u, MKHttpConn* c) {
+    if (!c->deferred) {
+        c->deferred = true;
+        c->deferred_next = u->deferred;
+        u->deferred = c;
+    }
+}
+
+static void conn_undefer(MKHttpUring* u, MKHttpConn* c) {
+    MKHttpConn** pc;
+    if (!c->deferred)
+        return;
+    for (pc = &u->deferred; *pc != c; pc = &(*pc)->deferred_next)
+        continue;
+    *pc = c->deferred_next;
+    c->deferred = false;
+}
+
+// Dispatch the request at the start of the read buffer if complete
+static void conn_process(MKHttpConn* c) {
+    MKHttpServer* s = c->server;
+    int ret;
+
+    if (c->in_request)
+        return;
+    // a handler waiting for its file I/O runs the ring: the handlers
+    // are not reentered
+    if (s->uring && s->uring->in_handler) {
+        conn_defer(s->uring, c);
+        return;
+    }
+    ret = mk_http_parse_request(c->rbuf, c->rlen, &c->req);
+    if (ret == 0)
+        return;
+    if (ret < 0) {
+        conn_send_error(c, c->rlen > MK_HTTP_MAX_HEADER_SIZE ? 431 : 400);
+        return;
+    }
+    if (c->req.content_length > MK_HTTP_MAX_BODY_SIZE) {
+        conn_send_error(c, 413);
+        return;
+    }
+    if (c->rlen < c->req.header_len + c->req.content_length)
+        return; // wait for the body
+
+    c->in_request = true;
+    c->is_head = mk_http_slice_equal(c->rbuf, c->req.method, "HEAD");
+    if (s->uring)
+        s->uring->in_handler = true;
+    if (!s->static_files || !mk_static_handle(s->static_files, c, c->rbuf, &c->req))
+        s->handler(s->opaque, c, c->rbuf, &c->req);
+    if (s->uring)
+        s->uring->in_handler = false;
+}
+
+// Make room for 'len' more bytes in the read buffer. Return false if
+// the connection is closed or answered with an error.
+static bool conn_grow_rbuf(MKHttpConn* c, size_t len) {
+    if (c->rlen + len <= c->rsize)
+        return true;
+    uint32_t new_size = c->rsize;
+    while (new_size < c->rlen + len)
+        new_size *= 2;
+    if (new_size > MK_HTTP_MAX_HEADER_SIZE + MK_HTTP_MAX_BODY_SIZE) {
+        // with io_uring, the input is received during the responses
+        if (c->in_request)
+            c->close_after = true;
+        else
+            conn_send_error(c, 413);
+        return false;
+    }
+    char* new_buf = realloc(c->rbuf, new_size);
+    if (!new_buf) {
+        conn_close(c);
+        return false;
+    }
+    c->rbuf = new_buf;
+    c->rsize = new_size;
+    return true;
+}
+
+static void conn_read(MKHttpConn* c) {
+    for (;;) {
+        if (c->rlen == c->rsize && !conn_grow_rbuf(c, 1))
+            return;
+        ssize_t ret = read(c->fd, c->rbuf + c->rlen, c->rsize - c->rlen);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            conn_close(c);
+            return;
+        }
+        if (ret == 0) {
+            conn_close(c);
+            return;
+        }
+        c->rlen += ret;
+        if (c->rlen < c->rsize)
+            break;
+    }
+    conn_process(c);
+}
+
+static void conn_free(MKHttpConn* c) {
+    release_compress(c);
+    release_buffer(c);
+    release_file(c);
+    close(c->fd);
+    if (c->pipe_fds[0] >= 0) {
+        close(c->pipe_fds[0]);
+        close(c->pipe_fds[1]);
+    }
+    free(c->rbuf);
+    free(c->wbuf);
+    free(c);
+}
+
+static void conn_close(MKHttpConn* c) {
+    MKHttpUring* u = c->server->uring;
+    if (u) {
+        if (c->closing)
+            return;
+        c->closing = true;
+        conn_undefer(u, c);
+        if (c->uring_ops > 0) {
+            // the operations in flight complete with an error
+            shutdown(c->fd, SHUT_RDWR);
+            return;
+        }
+    }
+    conn_free(c);
+}
+
+static MKHttpConn* conn_new(MKHttpServer* s, int fd) {
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    MKHttpConn* c = calloc(1, sizeof(*c));
+    if (c)
+        c->rbuf = malloc(MK_HTTP_READ_BUF_SIZE);
+    if (!c || !c->rbuf) {
+        if (c)
+            free(c);
+        close(fd);
+        return NULL;
+    }
+    c->server = s;
+    c->fd = fd;
+    c->file_fd = -1;
+    c->pipe_fds[0] = c->pipe_fds[1] = -1;
+    c->rsize = MK_HTTP_READ_BUF_SIZE;
+    return c;
+}
+
+static void accept_connections(MKHttpServer* s) {
+    for (;;) {
+        int fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                perror("accept");
+            return;
+        }
+        MKHttpConn* c = conn_new(s, fd);
+        if (!c)
+            continue;
+        c->events = EPOLLIN;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            conn_close(c);
+    }
+}
+
+// io_uring backend
+
+// Called when an operation of 'c' completes. Return false if 'c' must
+// no longer be used.
+static bool uring_op_done(MKHttpConn* c) {
+    c->uring_ops--;
+    if (c->closing) {
+        if (c->uring_ops == 0)
+            conn_free(c);
+        return false;
+    }
+    return true;
+}
+
+static void uring_recv_complete(MKUringOp* op, int res, uint32_t flags);
+
+// Multishot receive: one completion per received segment, in a buffer
+// of the provided ring
+static bool uring_conn_recv(MKHttpConn* c) {
+    MKHttpUring* u = c->server->uring;
+    struct io_uring_sqe* sqe;
+
+    c->recv_op.complete = uring_recv_complete;
+    sqe = mk_uring_get_sqe(&u->ring, &c->recv_op);
+    if (!sqe) {
+        conn_close(c);
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = u->bufs.bgid;
+    c->recv_armed = true;
+    c->uring_ops++;
+    return true;
+}
+
+static void uring_recv_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKHttpConn* c = container_of(op, MKHttpConn, recv_op);
+    MKHttpUring* u = c->server->uring;
+    bool ok = true;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && !c->closing) {
+            ok = conn_grow_rbuf(c, res);
+            if (ok) {
+                memcpy(c->rbuf + c->rlen, mk_uring_buf_ring_get(&u->bufs, bid), res);
+                c->rlen += res;
+            }
+        }
+        mk_uring_buf_ring_recycle(&u->bufs, bid);
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        c->recv_armed = false;
+        if (!uring_op_done(c))
+            return;
+    } else if (c->closing) {
+        return;
+    }
+    if (!ok)
+        return;
+    if (res <= 0 && res != -ENOBUFS) {
+        // end of stream or error: a response in progress is finished
+        if (c->in_request)
+            c->close_after = true;
+        else
+            conn_close(c);
+        return;
+    }
+    if (!c->recv_armed && !uring_conn_recv(c))
+        return;
+    if (res > 0)
+        conn_process(c);
+}
+
+static void uring_send_done(MKHttpConn* c) {
+    c->send_ops--;
+    if (!uring_op_done(c))
+        return;
+    if (c->send_ops == 0) {
+        if (c->send_error)
+            conn_close(c);
+        else
+            uring_conn_flush(c);
+    }
+}
+
+static void uring_send_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKHttpConn* c = container_of(op, MKHttpConn, send_op);
+
+    if (res > 0) {
+        size_t w = c->wlen - c->wpos;
+        if ((size_t)res < w)
+            w = res;
+        c->wpos += w;
+        c->buf_data += res - w;
+        c->buf_left -= res - w;
+        if (c->wpos == c->wlen)
+            c->wpos = c->wlen = 0;
+        if (c->buf_left == 0)
+            release_buffer(c);
+    } else if (res != -ECANCELED) {
+        c->send_error = true;
+    }
+    uring_send_done(c);
+}
+
+static void uring_splice_in_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKHttpConn* c = container_of(op, MKHttpConn, splice_in_op);
+
+    if (res > 0) {
+        c->file_off += res;
+        c->file_left -= res;
+        c->pipe_len += res;
+    } else if (res != -ECANCELED) {
+        // error or file truncated: the splice from the empty pipe
+        // would never complete
+        struct io_uring_sqe* sqe = mk_uring_get_sqe(&c->server->uring->ring, NULL);
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uintptr_t)&c->splice_out_op;
+        }
+        c->send_error = true;
+    }
+    uring_send_done(c);
+}
+
+static void uring_splice_out_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKHttpConn* c = container_of(op, MKHttpConn, splice_out_op);
+
+    if (res > 0)
+        c->pipe_len -= res;
+    else if (res != -ECANCELED)
+        c->send_error = true;
+    uring_send_done(c);
+}
+
+static struct io_uring_sqe* uring_conn_sqe(MKHttpConn* c, MKUringOp* op,
+                                           void (*complete)(MKUringOp* op, int res, uint32_t flags)) {
+    struct io_uring_sqe* sqe;
+    op->complete = complete;
+    sqe = mk_uring_get_sqe(&c->server->uring->ring, op);
+    if (sqe) {
+        c->uring_ops++;
+        c->send_ops++;
+    }
+    return sqe;
+}
+
+// Move the next part of the file to the socket with two linked splice
+// operations through the pipe of the connection
+static bool uring_conn_splice(MKHttpConn* c) {
+    struct io_uring_sqe* sqe;
+    size_t len = c->pipe_len;
+
+    if (len == 0) {
+        len = c->file_left < MK_HTTP_SPLICE_SIZE ? c->file_left : MK_HTTP_SPLICE_SIZE;
+        sqe = uring_conn_sqe(c, &c->splice_in_op, uring_splice_in_complete);
+        if (!sqe)
+            return false;
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = c->file_fd;
+        sqe->splice_off_in = c->file_off;
+        sqe->fd = c->pipe_fds[1];
+        sqe->off = -1;
+        sqe->len = len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe = uring_conn_sqe(c, &c->splice_out_op, uring_splice_out_complete);
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = c->pipe_fds[0];
+    sqe->splice_off_in = -1;
+    sqe->fd = c->fd;
+    sqe->off = -1;
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE | (c->file_left > len ? SPLICE_F_MORE : 0);
+    return true;
+}
+
+// Submit the pending output: the buffers with one sendmsg(), linked
+// with the start of the file if any. Continued on completion.
+static void uring_conn_flush(MKHttpConn* c) {
+    struct io_uring_sqe* sqe;
+
+    if (c->closing || c->send_ops > 0)
+        return;
+    while (c->wpos == c->wlen && c->buf_left == 0 && c->deflate) {
+        if (conn_compress_chunk(c) < 0) {
+            conn_close(c);
+            return;
+        }
+    }
+    bool has_file = (c->file_left > 0 || c->pipe_len > 0);
+    if (has_file && c->pipe_fds[0] < 0 && pipe2(c->pipe_fds, O_CLOEXEC) < 0) {
+        c->pipe_fds[0] = c->pipe_fds[1] = -1;
+        conn_close(c);
+        return;
+    }
+    if (c->wpos < c->wlen || c->buf_left > 0) {
+        int n = 0;
+        if (c->wpos < c->wlen) {
+            c->iov[n].iov_base = c->wbuf + c->wpos;
+            c->iov[n].iov_len = c->wlen - c->wpos;
+            n++;
+        }
+        if (c->buf_left > 0) {
+            c->iov[n].iov_base = (void*)c->buf_data;
+            c->iov[n].iov_len = c->buf_left;
+            n++;
+        }
+        memset(&c->msg, 0, sizeof(c->msg));
+        c->msg.msg_iov = c->iov;
+        c->msg.msg_iovlen = n;
+        sqe = uring_conn_sqe(c, &c->send_op, uring_send_complete);
+        if (!sqe) {
+            conn_close(c);
+            return;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = c->fd;
+        sqe->addr = (uintptr_t)&c->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (has_file)
+            sqe->flags = IOSQE_IO_LINK;
+    }
+    if (has_file) {
+        if (!uring_conn_splice(c))
+            conn_close(c);
+        return;
+    }
+    if (c->send_ops > 0)
+        return;
+    // everything is written
+    release_buffer(c);
+    release_file(c);
+    if (c->response_ended)
+        conn_request_done(c);
+}
+
+static void uring_accept_complete(MKUringOp* op, int res, uint32_t flags);
+
+static void uring_arm_accept(MKHttpUring* u) {
+    struct io_uring_sqe* sqe;
+    u->accept_op.complete = uring_accept_complete;
+    sqe = mk_uring_get_sqe(&u->ring, &u->accept_op);
+    if (!sqe)
+        return; // retried on the next loop iteration
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = u->server->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    u->accept_armed = true;
+}
+
+static void uring_accept_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKHttpUring* u = container_of(op, MKHttpUring, accept_op);
+
+    if (!(flags & IORING_CQE_F_MORE))
+        u->accept_armed = false;
+    if (res >= 0) {
+        MKHttpConn* c = conn_new(u->server, res);
+        if (c)
+            uring_conn_recv(c);
+    } else if (res != -EAGAIN && res != -EINTR && res != -ECONNABORTED) {
+        errno = -res;
+        perror("accept");
+    }
+}
+
+static void uring_server_run(MKHttpServer* s) {
+    MKHttpUring* u = s->uring;
+
+    while (s->running) {
+        if (!u->accept_armed)
+            uring_arm_accept(u);
+        // the timeout is used to check 'running'
+        if (mk_uring_submit(&u->ring, 100) < 0) {
+            perror("io_uring_enter");
+            break;
+        }
+        mk_uring_process(&u->ring);
+        while (u->deferred) {
+            MKHttpConn* c = u->deferred;
+            conn_undefer(u, c);
+            conn_process(c);
+        }
+    }
+}
+
+int mk_http_server_use_io_uring(MKHttpServer* s) {
+    MKHttpUring* u = calloc(1, sizeof(*u));
+    if (!u)
+        return -1;
+    if (mk_uring_init(&u->ring, MK_HTTP_URING_ENTRIES) < 0) {
+        free(u);
+        return -1;
+    }
+    if (mk_uring_buf_ring_init(&u->ring, &u->bufs, MK_HTTP_URING_BGID,
+                               MK_HTTP_URING_BUFS, MK_HTTP_URING_BUF_SIZE) < 0) {
+        mk_uring_close(&u->ring);
+        free(u);
+        return -1;
+    }
+    u->server = s;
+    // the operations wait for the sockets instead of failing with EAGAIN
+    int flags = fcntl(s->listen_fd, F_GETFL);
+    fcntl(s->listen_fd, F_SETFL, flags & ~O_NONBLOCK);
+    s->uring = u;
+    return 0;
+}
+
+MKUring* mk_http_server_ring(MKHttpServer* s) {
+    return s->uring ? &s->uring->ring : NULL;
+}
+
+// Server
+
+int mk_http_server_init(MKHttpServer* s, int port) {
+    s->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s->listen_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(s->listen_fd, SOMAXCONN) < 0) {
+        perror("bind");
+        close(s->listen_fd);
+        return -1;
+    }
+
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epoll_fd < 0) {
+        perror("epoll_create1");
+        close(s->listen_fd);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listening socket
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev);
+    s->running = true;
+    return 0;
+}
+
+void mk_http_server_run(MKHttpServer* s) {
+    struct epoll_event events[MK_HTTP_MAX_EVENTS];
+
+    if (s->uring) {
+        uring_server_run(s);
+        return;
+    }
+    while (s->running) {
+        // the timeout is used to check 'running'
+        int n = epoll_wait(s->epoll_fd, events, MK_HTTP_MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            MKHttpConn* c = events[i].data.ptr;
+            if (!c) {
+                accept_connections(s);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                conn_close(c);
+            } else if (events[i].events & EPOLLOUT) {
+                conn_write_pending(c);
+            } else if (events[i].events & EPOLLIN) {
+                conn_read(c);
+            }
+        }
+    }
+}
+
+MKHttpServer* mk_http_conn_server(MKHttpConn* c) {
+    return c->server;
+}
+
+void mk_http_server_close(MKHttpServer* s) {
+    s->running = false;
+    if (s->listen_fd >= 0) {
+        close(s->listen_fd);
+        s->listen_fd = -1;
+    }
+    if (s->epoll_fd >= 0) {
+        close(s->epoll_fd);
+        s->epoll_fd = -1;
+    }
+    if (s->uring) {
+        mk_uring_buf_ring_free(&s->uring->ring, &s->uring->bufs);
+        mk_uring_close(&s->uring->ring);
+        free(s->uring);
+        s->uring = NULL;
+    }
+}
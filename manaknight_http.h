@@ -0,0 +1,133 @@
+#ifndef MANAKNIGHT_HTTP_H
+#define MANAKNIGHT_HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MK_HTTP_MAX_HEADERS     64
+#define MK_HTTP_MAX_HEADER_SIZE (64 * 1024)
+#define MK_HTTP_MAX_BODY_SIZE   (8 * 1024 * 1024)
+
+// Response compression: the bodies of at least MK_HTTP_COMPRESS_MIN_SIZE
+// bytes are gzip'ed if the content type is textual and the client
+// accepts it. Above MK_HTTP_COMPRESS_STREAM_SIZE, the body is compressed
+// by chunks of MK_HTTP_COMPRESS_CHUNK_SIZE as the socket drains so that
+// the other connections are not delayed.
+#define MK_HTTP_COMPRESS_MIN_SIZE    1024
+#define MK_HTTP_COMPRESS_STREAM_SIZE (64 * 1024)
+#define MK_HTTP_COMPRESS_CHUNK_SIZE  (16 * 1024)
+
+// Content codings returned by mk_http_accepted_encodings()
+#define MK_HTTP_ENC_BR          (1 << 1)
+#define MK_HTTP_ENC_GZIP        (1 << 2)
+
+// Byte range of the connection read buffer. Offsets are used instead
+// of pointers so that the buffer can be reallocated.
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} MKSlice;
+
+typedef struct {
+    MKSlice name;
+    MKSlice value;
+} MKHttpHeader;
+
+// Parsed request. Nothing is copied: all the fields are slices of the
+// connection read buffer.
+typedef struct {
+    MKSlice method;
+    MKSlice path;               // without the query string
+    MKSlice query;              // after '?', empty if none
+    int minor_version;          // HTTP/1.x
+    int header_count;
+    MKHttpHeader headers[MK_HTTP_MAX_HEADERS];
+    uint32_t header_len;        // request line + headers + empty line
+    uint32_t content_length;
+    MKSlice body;               // follows the headers, only valid once received
+    bool keep_alive;
+} MKHttpRequest;
+
+typedef struct MKHttpConn MKHttpConn;
+typedef struct MKHttpServer MKHttpServer;
+typedef struct MKStaticFiles MKStaticFiles;
+typedef struct MKCompressCache MKCompressCache;
+typedef struct MKUring MKUring;
+typedef struct MKHttpUring MKHttpUring;
+
+// Called for each request which is not a static file. The handler
+// must emit exactly one response on 'conn'.
+typedef void MKHttpHandler(void* opaque, MKHttpConn* conn,
+                           const char* buf, const MKHttpRequest* req);
+
+struct MKHttpServer {
+    int listen_fd;
+    int epoll_fd;
+    volatile bool running;
+    MKStaticFiles* static_files;    // NULL if no static route
+    MKHttpHandler* handler;
+    void* opaque;
+    int compress_level;             // 1 to 3, 0 to disable the compression
+    MKCompressCache* compress_cache; // compressed bodies, NULL if none
+    MKHttpUring* uring;             // io_uring backend, NULL for epoll
+};
+
+// Request parsing. Return the header length if the request line and
+// the headers are complete, 0 if more data is needed and -1 if the
+// request is invalid.
+int mk_http_parse_request(const char* buf, size_t len, MKHttpRequest* req);
+const MKSlice* mk_http_find_header(const char* buf, const MKHttpRequest* req,
+                                   const char* name);
+bool mk_http_slice_equal(const char* buf, MKSlice s, const char* str);
+// Return the mask of the MK_HTTP_ENC_x codings in Accept-Encoding
+int mk_http_accepted_encodings(const char* buf, const MKHttpRequest* req);
+// Return true if a body of this type is worth compressing
+bool mk_http_is_compressible(const char* content_type);
+// Format 't' as an HTTP date. 'dst' must contain at least 32 bytes.
+void mk_http_format_date(char* dst, time_t t);
+
+// Server
+int mk_http_server_init(MKHttpServer* s, int port);
+void mk_http_server_run(MKHttpServer* s);
+void mk_http_server_close(MKHttpServer* s);
+// Use io_uring instead of epoll: multishot accept, receives into
+// provided buffers, linked sends and splice() for the files, all
+// submitted once per loop iteration. Must be called after
+// mk_http_server_init(). Return -1 if io_uring is not available, in
+// which case epoll remains in use.
+int mk_http_server_use_io_uring(MKHttpServer* s);
+// Ring of the server thread, usable by the handlers for their file I/O
+// (see mk_uring_read_file()). NULL with epoll.
+MKUring* mk_http_server_ring(MKHttpServer* s);
+MKHttpServer* mk_http_conn_server(MKHttpConn* conn);
+
+// Response emission. The status line and the headers are given
+// without the final empty line, the "Connection" header is added.
+// The output is sent asynchronously: 'hdr' and 'body' are copied if
+// they cannot be written immediately. mk_http_send_response() compresses
+// the body if the server and the client allow it, otherwise it writes
+// the head and the body with a single sendmsg() so that 'body' is usually
+// not copied: it only needs to remain valid during the call.
+void mk_http_send_response(MKHttpConn* conn, int status, const char* content_type,
+                           const void* body, size_t body_len);
+void mk_http_send_head(MKHttpConn* conn, const char* hdr, size_t hdr_len);
+void mk_http_send_data(MKHttpConn* conn, const void* data, size_t len);
+// Send 'len' bytes of 'data' without copying them. 'release' is called
+// with 'release_opaque' when they are no longer used.
+void mk_http_send_buffer(MKHttpConn* conn, const void* data, size_t len,
+                         void (*release)(void* opaque), void* release_opaque);
+// Send 'len' bytes of 'fd' from 'offset' with sendfile(). 'release'
+// is called with 'release_opaque' when the file is no longer used.
+void mk_http_send_file(MKHttpConn* conn, int fd, off_t offset, size_t len,
+                       void (*release)(void* opaque), void* release_opaque);
+// mk_http_send_buffer() and mk_http_send_file() must be the last output
+// of the response. mk_http_end_response() must be called after the last
+// mk_http_send_*() of a response.
+void mk_http_end_response(MKHttpConn* conn);
+
+const char* mk_http_status_text(int status);
+
+#endif // MANAKNIGHT_HTTP_H
@@ -1,4 +1,11 @@
 #include "manaknight_runtime.h"
+#include "manaknight_http.h"
+#include "manaknight_static.h"
+#include "manaknight_deflate.h"
+#include "manaknight_uring.h"
+#include "manaknight_effect_cache.h"
+#include "manaknight_vm_pool.h"
+#include "manaknight_capture.h"
 #include "cutils.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -8,69 +15,172 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <pthread.h>
 
 // Global state for HTTP server
-static int http_server_socket = -1;
+static MKHttpServer http_server;
 static bool http_server_running = false;
 static pthread_t http_server_thread;
 
+// Shared by the idempotent effects (coalescing and TTL cache)
+static MKEffectCache* effect_cache;
+
 // Forward declarations for internal functions
 static uint8_t* load_file(const char* filename, size_t* plen);
-static JSValue create_effects_object(JSContext* ctx);
+static uint64_t get_time_us(void);
 static void* http_server_worker(void* arg);
+static void http_handle_request(void* opaque, MKHttpConn* conn,
+                                const char* buf, const MKHttpRequest* req);
+
+// Request being handled. Handlers read it through __effects.request:
+// the fields stay slices of the connection buffer and a JS string is
+// only created for the fields which are actually read.
+typedef struct {
+    const char* buf;
+    const MKHttpRequest* req;
+    uint64_t id;                // identifies its effects in the capture log
+    bool side_effects;          // the request cannot be run again
+} MKRequestView;
+
+static MKRequestView current_request;
+static uint64_t request_count;
+
+// Capture of the requests and of the effect results (capture_path)
+static MKCaptureWriter* capture;
+
+// Replay of a capture: the effects of the request being replayed are
+// answered from the log instead of being performed
+typedef struct {
+    MKCaptureLog* log;
+    size_t request_index;       // record of the request being replayed
+    uint8_t* used;              // effect records already returned
+    uint64_t missing_effects;
+} MKReplay;
+
+static MKReplay* replay;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// VMs which run the requests, bucketed by memory size class
+static MKVMPool* vm_pool;
+static ManaknightConfig vm_config;
+
+// Host data of a context created by the runtime (its opaque)
+typedef struct {
+    uint8_t* mem_buf;
+    uint8_t* bytecode;          // loaded image, referenced by the context
+    uint64_t cpu_time_limit_us; // 0 = no limit
+    uint64_t deadline_us;       // of the running handler, 0 = none
+    bool log_error;             // the log goes to stderr
+    size_t live_heap_size;      // of a request VM once the routes are loaded
+} MKContextData;
+
+// Functions of the standard library which depend on the host
+
+static JSValue js_print(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    for (int i = 0; i < argc; i++) {
+        if (i != 0)
+            putchar(' ');
+        if (JS_IsString(ctx, argv[i])) {
+            JSCStringBuf buf;
+            size_t len;
+            const char* str = JS_ToCStringLen(ctx, &len, argv[i], &buf);
+            fwrite(str, 1, len, stdout);
+        } else {
+            JS_PrintValueF(ctx, argv[i], JS_DUMP_LONG);
+        }
+    }
+    putchar('\n');
+    return JS_UNDEFINED;
+}
 
-// Initialize Manaknight runtime
-JSContext* manaknight_init(const ManaknightConfig* config) {
-    // Allocate memory buffer
-    uint8_t* mem_buf = malloc(config->memory_limit);
-    if (!mem_buf) {
-        fprintf(stderr, "Failed to allocate memory buffer\n");
+static JSValue js_date_now(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return JS_NewInt64(ctx, (int64_t)tv.tv_sec * 1000 + (tv.tv_usec / 1000));
+}
+
+static JSValue js_performance_now(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    return JS_NewInt64(ctx, get_time_us() / 1000);
+}
+
+#include "manaknight_stdlib.h"
+
+static void js_log_func(void* opaque, const void* buf, size_t buf_len) {
+    MKContextData* d = opaque;
+    fwrite(buf, 1, buf_len, d->log_error ? stderr : stdout);
+}
+
+// A handler which runs past its deadline is interrupted
+static int js_interrupt_handler(JSContext* ctx, void* opaque) {
+    MKContextData* d = opaque;
+    return d->deadline_us != 0 && get_time_us() > d->deadline_us;
+}
+
+static JSContext* context_new(size_t mem_size) {
+    MKContextData* d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    d->mem_buf = malloc(mem_size);
+    if (!d->mem_buf) {
+        free(d);
+        return NULL;
+    }
+    JSContext* ctx = JS_NewContext(d->mem_buf, mem_size, &js_stdlib);
+    if (!ctx) {
+        free(d->mem_buf);
+        free(d);
         return NULL;
     }
+    JS_SetContextOpaque(ctx, d);
+    JS_SetLogFunc(ctx, js_log_func);
+    JS_SetInterruptHandler(ctx, js_interrupt_handler);
+    return ctx;
+}
 
-    // Create JS context
-    JSContext* ctx = JS_NewContext(mem_buf, config->memory_limit, NULL);
+static void context_free(JSContext* ctx) {
+    MKContextData* d = JS_GetContextOpaque(ctx);
+    JS_FreeContext(ctx);
+    free(d->bytecode);
+    free(d->mem_buf);
+    free(d);
+}
+
+// Initialize Manaknight runtime
+JSContext* manaknight_init(const ManaknightConfig* config) {
+    JSContext* ctx = context_new(config->memory_limit);
     if (!ctx) {
         fprintf(stderr, "Failed to create JS context\n");
-        free(mem_buf);
         return NULL;
     }
 
-    // Set memory limit
-    manaknight_set_memory_limit(ctx, config->memory_limit);
-
     // Set CPU time limit
     manaknight_set_cpu_limit(ctx, config->cpu_time_limit);
 
-    // Set up module loader
-    JS_SetModuleLoaderFunc(ctx, manaknight_module_loader, NULL);
-
     // Load standard library
-    if (manaknight_load_stdlib(ctx, config->stdlib_path) != 0) {
+    if (config->stdlib_path && manaknight_load_stdlib(ctx, config->stdlib_path) != 0) {
         fprintf(stderr, "Failed to load standard library\n");
-        JS_FreeContext(ctx);
-        free(mem_buf);
+        context_free(ctx);
         return NULL;
     }
 
-    // Set up effect system
-    EffectContext effect_ctx;
-    if (manaknight_setup_effects(ctx, &effect_ctx) != 0) {
-        fprintf(stderr, "Failed to set up effect system\n");
-        JS_FreeContext(ctx);
-        free(mem_buf);
-        return NULL;
+    // Shared by the effects of all the contexts
+    if (!effect_cache) {
+        effect_cache = mk_effect_cache_new(config->effect_cache_size, config->effect_ttls);
+        if (!effect_cache) {
+            fprintf(stderr, "Failed to create effect cache\n");
+            context_free(ctx);
+            return NULL;
+        }
     }
 
     // Start HTTP server if requested
     if (config->enable_http_server) {
-        if (manaknight_start_http_server(ctx, config->http_port) != 0) {
+        if (manaknight_start_http_server(ctx, config) != 0) {
             fprintf(stderr, "Failed to start HTTP server\n");
-            JS_FreeContext(ctx);
-            free(mem_buf);
+            context_free(ctx);
             return NULL;
         }
     }
@@ -80,6 +190,12 @@ JSContext* manaknight_init(const ManaknightConfig* config) {
 
 // Load and execute Manaknight bytecode
 int manaknight_execute_bytecode(JSContext* ctx, const char* bytecode_path) {
+    MKContextData* d = JS_GetContextOpaque(ctx);
+    if (d->bytecode) {
+        fprintf(stderr, "Bytecode already loaded: %s\n", bytecode_path);
+        return -1;
+    }
+
     size_t bytecode_len;
     uint8_t* bytecode = load_file(bytecode_path, &bytecode_len);
     if (!bytecode) {
@@ -101,24 +217,19 @@ int manaknight_execute_bytecode(JSContext* ctx, const char* bytecode_path) {
         return -1;
     }
 
-    // Load bytecode
+    // Load bytecode. It is freed with the context.
+    d->bytecode = bytecode;
     JSValue val = JS_LoadBytecode(ctx, bytecode);
-    free(bytecode);
-
     if (JS_IsException(val)) {
         manaknight_dump_error(ctx);
         return -1;
     }
 
     // Execute
-    JSValue result = JS_Run(ctx, val);
-    if (JS_IsException(result)) {
+    if (JS_IsException(JS_Run(ctx, val))) {
         manaknight_dump_error(ctx);
-        JS_FreeValue(ctx, result);
         return -1;
     }
-
-    JS_FreeValue(ctx, result);
     return 0;
 }
 
@@ -148,196 +259,476 @@ int manaknight_load_stdlib(JSContext* ctx, const char* stdlib_path) {
         JSValue val = JS_Parse(ctx, (char*)buf, len, filepath, 0);
         free(buf);
 
-        if (JS_IsException(val)) {
-            manaknight_dump_error(ctx);
-            return -1;
-        }
-
-        JSValue result = JS_Run(ctx, val);
-        if (JS_IsException(result)) {
+        if (JS_IsException(val) || JS_IsException(JS_Run(ctx, val))) {
             manaknight_dump_error(ctx);
-            JS_FreeValue(ctx, result);
             return -1;
         }
-
-        JS_FreeValue(ctx, result);
     }
 
     return 0;
 }
 
-// Set up effect system
-int manaknight_setup_effects(JSContext* ctx, EffectContext* effect_ctx) {
-    effect_ctx->ctx = ctx;
-    effect_ctx->effects_object = create_effects_object(ctx);
-
-    if (JS_IsException(effect_ctx->effects_object)) {
-        manaknight_dump_error(ctx);
-        return -1;
+// A request VM: a context with the standard library and the routes
+static void* request_vm_create(void* opaque, size_t mem_size) {
+    const ManaknightConfig* config = opaque;
+    JSContext* ctx = context_new(mem_size);
+    if (!ctx)
+        return NULL;
+    manaknight_set_cpu_limit(ctx, config->cpu_time_limit);
+    if ((config->stdlib_path && manaknight_load_stdlib(ctx, config->stdlib_path) != 0) ||
+        manaknight_execute_bytecode(ctx, config->app_bytecode_path) != 0) {
+        context_free(ctx);
+        return NULL;
     }
 
-    // Set __effects in global scope
-    JSValue global = JS_GetGlobalObject(ctx);
-    JS_SetPropertyStr(ctx, global, "__effects", JS_DupValue(ctx, effect_ctx->effects_object));
-    JS_FreeValue(ctx, global);
+    // the requests are measured from this size: the garbage the VM
+    // accumulates between its requests is not part of their need
+    MKContextData* d = JS_GetContextOpaque(ctx);
+    JSMemoryHighWater hw;
+    JS_GC(ctx);
+    JS_ResetMemoryHighWater(ctx);
+    JS_GetMemoryHighWater(ctx, &hw);
+    d->live_heap_size = hw.heap_size;
+    return ctx;
+}
 
-    return 0;
+static void request_vm_free(void* opaque, void* ptr) {
+    context_free(ptr);
 }
 
-// Create effects object with native function bindings
-static JSValue create_effects_object(JSContext* ctx) {
-    JSValue effects = JS_NewObject(ctx);
-
-    // Time effects
-    JSValue time_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, time_obj, "now", JS_NewCFunction(ctx, manaknight_time_now, "now", 0));
-    JS_SetPropertyStr(ctx, time_obj, "unixMillis", JS_NewCFunction(ctx, manaknight_time_unixMillis, "unixMillis", 0));
-    JS_SetPropertyStr(ctx, time_obj, "sleep", JS_NewCFunction(ctx, manaknight_time_sleep, "sleep", 1));
-    JS_SetPropertyStr(ctx, effects, "time", time_obj);
-
-    // Random effects
-    JSValue random_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, random_obj, "int", JS_NewCFunction(ctx, manaknight_random_int, "int", 0));
-    JS_SetPropertyStr(ctx, random_obj, "intRange", JS_NewCFunction(ctx, manaknight_random_intRange, "intRange", 2));
-    JS_SetPropertyStr(ctx, random_obj, "bytes", JS_NewCFunction(ctx, manaknight_random_bytes, "bytes", 1));
-    JS_SetPropertyStr(ctx, random_obj, "uuidV4", JS_NewCFunction(ctx, manaknight_random_uuidV4, "uuidV4", 0));
-    JS_SetPropertyStr(ctx, effects, "random", random_obj);
-
-    // HTTP effects
-    JSValue http_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, http_obj, "get", JS_NewCFunction(ctx, manaknight_http_get, "get", 1));
-    JS_SetPropertyStr(ctx, http_obj, "post", JS_NewCFunction(ctx, manaknight_http_post, "post", 2));
-    JS_SetPropertyStr(ctx, http_obj, "put", JS_NewCFunction(ctx, manaknight_http_put, "put", 2));
-    JS_SetPropertyStr(ctx, http_obj, "delete", JS_NewCFunction(ctx, manaknight_http_delete, "delete", 1));
-    JS_SetPropertyStr(ctx, http_obj, "head", JS_NewCFunction(ctx, manaknight_http_head, "head", 1));
-    JS_SetPropertyStr(ctx, http_obj, "request", JS_NewCFunction(ctx, manaknight_http_request, "request", 1));
-    JS_SetPropertyStr(ctx, effects, "http", http_obj);
-
-    // Logging effects
-    JSValue log_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, log_obj, "info", JS_NewCFunction(ctx, manaknight_log_info, "info", 1));
-    JS_SetPropertyStr(ctx, log_obj, "warn", JS_NewCFunction(ctx, manaknight_log_warn, "warn", 1));
-    JS_SetPropertyStr(ctx, log_obj, "error", JS_NewCFunction(ctx, manaknight_log_error, "error", 1));
-    JS_SetPropertyStr(ctx, log_obj, "debug", JS_NewCFunction(ctx, manaknight_log_debug, "debug", 1));
-    JS_SetPropertyStr(ctx, effects, "log", log_obj);
-
-    // File system effects
-    JSValue fs_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, fs_obj, "readFile", JS_NewCFunction(ctx, manaknight_fs_readFile, "readFile", 1));
-    JS_SetPropertyStr(ctx, fs_obj, "writeFile", JS_NewCFunction(ctx, manaknight_fs_writeFile, "writeFile", 2));
-    JS_SetPropertyStr(ctx, fs_obj, "exists", JS_NewCFunction(ctx, manaknight_fs_exists, "exists", 1));
-    JS_SetPropertyStr(ctx, effects, "fs", fs_obj);
-
-    // Crypto effects
-    JSValue crypto_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, crypto_obj, "hashSha256", JS_NewCFunction(ctx, manaknight_crypto_hashSha256, "hashSha256", 1));
-    JS_SetPropertyStr(ctx, crypto_obj, "hmacSha256", JS_NewCFunction(ctx, manaknight_crypto_hmacSha256, "hmacSha256", 2));
-    JS_SetPropertyStr(ctx, effects, "crypto", crypto_obj);
-
-    // Environment effects
-    JSValue env_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, env_obj, "getEnv", JS_NewCFunction(ctx, manaknight_env_getEnv, "getEnv", 1));
-    JS_SetPropertyStr(ctx, effects, "env", env_obj);
-
-    // System effects (restricted)
-    JSValue sys_obj = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, sys_obj, "exit", JS_NewCFunction(ctx, manaknight_sys_exit, "exit", 1));
-    JS_SetPropertyStr(ctx, sys_obj, "getPid", JS_NewCFunction(ctx, manaknight_sys_getPid, "getPid", 0));
-    JS_SetPropertyStr(ctx, effects, "sys", sys_obj);
-
-    return effects;
+// Close the server and free what it uses. Every failure of
+// manaknight_start_http_server() and the stop of the server end here.
+static void http_server_cleanup(void) {
+    mk_http_server_close(&http_server);
+    if (http_server.static_files) {
+        mk_static_free(http_server.static_files);
+        http_server.static_files = NULL;
+    }
+    if (http_server.compress_cache) {
+        mk_compress_cache_free(http_server.compress_cache);
+        http_server.compress_cache = NULL;
+    }
+    if (vm_pool) {
+        mk_vm_pool_free(vm_pool);
+        vm_pool = NULL;
+    }
+    if (capture) {
+        if (mk_capture_writer_free(capture) < 0)
+            fprintf(stderr, "Failed to write the capture log\n");
+        capture = NULL;
+    }
 }
 
 // HTTP server functions
-int manaknight_start_http_server(JSContext* ctx, int port) {
-    // Create socket
-    http_server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (http_server_socket < 0) {
-        perror("socket");
+int manaknight_start_http_server(JSContext* ctx, const ManaknightConfig* config) {
+    memset(&http_server, 0, sizeof(http_server));
+    if (mk_http_server_init(&http_server, config->http_port) != 0)
         return -1;
+    http_server.handler = http_handle_request;
+    http_server.opaque = ctx;
+    http_server.compress_level = config->compress_level;
+    if (config->compress_level > 0 && config->compress_cache_size > 0) {
+        http_server.compress_cache = mk_compress_cache_new(config->compress_cache_size);
+        if (!http_server.compress_cache)
+            goto fail;
     }
 
-    // Set socket options
-    int opt = 1;
-    setsockopt(http_server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    // Bind to port
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+    // Static files are served by the event loop without a JS context
+    if (config->static_dir) {
+        http_server.static_files = mk_static_new(config->static_prefix ? config->static_prefix : "/",
+                                                 config->static_dir);
+        if (!http_server.static_files)
+            goto fail;
+    }
 
-    if (bind(http_server_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(http_server_socket);
-        return -1;
+    if (config->capture_path) {
+        capture = mk_capture_writer_new(config->capture_path);
+        if (!capture) {
+            fprintf(stderr, "Failed to create capture log %s\n", config->capture_path);
+            goto fail;
+        }
     }
 
-    // Listen
-    if (listen(http_server_socket, 10) < 0) {
-        perror("listen");
-        close(http_server_socket);
-        return -1;
+    // The VMs are created by the server thread when needed
+    if (config->vm_min_memory > 0 && config->app_bytecode_path) {
+        vm_config = *config;
+        vm_pool = mk_vm_pool_new(config->vm_min_memory, config->memory_limit,
+                                 request_vm_create, request_vm_free, &vm_config);
+        if (!vm_pool)
+            goto fail;
     }
 
-    printf("Manaknight HTTP server listening on port %d\n", port);
+    if (config->use_io_uring && mk_http_server_use_io_uring(&http_server) < 0)
+        fprintf(stderr, "io_uring not available, using epoll\n");
+
+    printf("Manaknight HTTP server listening on port %d\n", config->http_port);
 
     // Start server thread
     http_server_running = true;
-    if (pthread_create(&http_server_thread, NULL, http_server_worker, ctx) != 0) {
+    if (pthread_create(&http_server_thread, NULL, http_server_worker, &http_server) != 0) {
         perror("pthread_create");
-        close(http_server_socket);
-        return -1;
+        http_server_running = false;
+        goto fail;
     }
 
     return 0;
+ fail:
+    http_server_cleanup();
+    return -1;
 }
 
 void manaknight_stop_http_server() {
-    http_server_running = false;
-    if (http_server_socket >= 0) {
-        close(http_server_socket);
-        http_server_socket = -1;
-    }
+    if (!http_server_running)
+        return;
+    http_server.running = false;
     pthread_join(http_server_thread, NULL);
+    http_server_running = false;
+    http_server_cleanup();
 }
 
 // HTTP server worker thread
 static void* http_server_worker(void* arg) {
-    JSContext* ctx = (JSContext*)arg;
+    MKHttpServer* server = (MKHttpServer*)arg;
+    mk_http_server_run(server);
+    return NULL;
+}
 
-    while (http_server_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+// Return __handleRequest or undefined if the routes are not loaded
+static JSValue get_handler(JSContext* ctx) {
+    JSValue handler = JS_GetPropertyStr(ctx, JS_GetGlobalObject(ctx), "__handleRequest");
+    if (!JS_IsFunction(ctx, handler))
+        return JS_UNDEFINED;
+    return handler;
+}
 
-        int client_socket = accept(http_server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            if (http_server_running) perror("accept");
+static JSValue call_handler(JSContext* ctx, JSValue handler,
+                            const char* buf, const MKHttpRequest* req) {
+    MKContextData* d = JS_GetContextOpaque(ctx);
+    JSGCRef handler_ref;
+    JSValue result;
+    int err;
+
+    // the stack check may run the GC
+    JS_PUSH_VALUE(ctx, handler);
+    err = JS_StackCheck(ctx, 2);
+    JS_POP_VALUE(ctx, handler);
+    if (err)
+        return JS_EXCEPTION;
+    JS_PushArg(ctx, handler);
+    JS_PushArg(ctx, JS_NULL); // this
+
+    current_request.buf = buf;
+    current_request.req = req;
+    current_request.side_effects = false;
+    if (d->cpu_time_limit_us > 0)
+        d->deadline_us = get_time_us() + d->cpu_time_limit_us;
+    result = JS_Call(ctx, 0);
+    d->deadline_us = 0;
+    current_request.buf = NULL;
+    current_request.req = NULL;
+    return result;
+}
+
+// Send the result of the handler. It is null if no route matches.
+static void send_result(JSContext* ctx, MKHttpConn* conn, JSValue result) {
+    if (JS_IsException(result)) {
+        const char* body = mk_http_status_text(500);
+        manaknight_dump_error(ctx);
+        mk_http_send_response(conn, 500, "text/plain", body, strlen(body));
+    } else if (JS_IsNull(result)) {
+        const char* body = mk_http_status_text(404);
+        mk_http_send_response(conn, 404, "text/plain", body, strlen(body));
+    } else {
+        JSGCRef str_ref;
+        JSValue* str;
+        JSCStringBuf buf;
+        const char* body = NULL;
+        size_t len;
+
+        // 'body' may point to the string in the heap: it is kept
+        // referenced and nothing is allocated until it is written
+        str = JS_PushGCRef(ctx, &str_ref);
+        *str = JS_ToString(ctx, result);
+        if (!JS_IsException(*str))
+            body = JS_ToCStringLen(ctx, &len, *str, &buf);
+        if (body) {
+            mk_http_send_response(conn, 200, "text/plain; charset=utf-8", body, len);
+        } else {
+            JS_GetException(ctx);
+            mk_http_send_response(conn, 500, "text/plain", "", 0);
+        }
+        JS_PopGCRef(ctx, &str_ref);
+    }
+    mk_http_end_response(conn);
+}
+
+static void send_placeholder(MKHttpConn* conn) {
+    // Placeholder until the routes are compiled in
+    const char* body = "Hello from Manaknight!";
+    mk_http_send_response(conn, 200, "text/plain", body, strlen(body));
+    mk_http_end_response(conn);
+}
+
+// Run the request in a VM of the size class of its route. A request
+// which runs out of memory is run again in the largest class and its
+// route is promoted.
+static void pooled_handle_request(MKHttpConn* conn, const char* buf, const MKHttpRequest* req) {
+    char route[256];
+    int route_len = snprintf(route, sizeof(route), "%.*s %.*s",
+                             (int)req->method.len, buf + req->method.off,
+                             (int)req->path.len, buf + req->path.off);
+    if (route_len >= (int)sizeof(route))
+        route_len = sizeof(route) - 1;
+    int max_cls = mk_vm_pool_class_count(vm_pool) - 1;
+    int cls = mk_vm_pool_route_class(vm_pool, route, route_len);
+
+    for (;;) {
+        JSContext* vm = mk_vm_pool_acquire(vm_pool, cls);
+        if (!vm) {
+            // the class may be too small for the routes themselves
+            if (cls < max_cls) {
+                cls++;
+                continue;
+            }
+            const char* body = mk_http_status_text(503);
+            mk_http_send_response(conn, 503, "text/plain", body, strlen(body));
+            mk_http_end_response(conn);
+            return;
+        }
+
+        JSValue handler = get_handler(vm);
+        if (JS_IsUndefined(handler)) {
+            mk_vm_pool_release(vm_pool, cls, vm);
+            send_placeholder(conn);
+            return;
+        }
+        // the need of the request is the heap it allocates on top of
+        // the routes, whatever garbage the VM holds when it starts
+        MKContextData* d = JS_GetContextOpaque(vm);
+        JSMemoryHighWater hw;
+        JS_ResetMemoryHighWater(vm);
+        JSValue result = call_handler(vm, handler, buf, req);
+        JS_GetMemoryHighWater(vm, &hw);
+        bool out_of_memory = hw.out_of_memory_count > 0;
+        mk_vm_pool_record(vm_pool, route, route_len, cls,
+                          d->live_heap_size + hw.heap_growth + hw.stack_size,
+                          out_of_memory);
+        // the effects which are visible outside must not run twice
+        if (out_of_memory && JS_IsException(result) && cls < max_cls &&
+            !current_request.side_effects) {
+            JS_GetException(vm);
+            mk_vm_pool_release(vm_pool, cls, vm);
+            cls = max_cls;
             continue;
         }
+        send_result(vm, conn, result);
+        mk_vm_pool_release(vm_pool, cls, vm);
+        return;
+    }
+}
+
+// Dynamic requests
+static void http_handle_request(void* opaque, MKHttpConn* conn,
+                                const char* buf, const MKHttpRequest* req) {
+    JSContext* ctx = opaque;
+
+    current_request.id = ++request_count;
+    if (capture)
+        mk_capture_request(capture, current_request.id, buf, req->header_len + req->body.len);
+    if (vm_pool) {
+        pooled_handle_request(conn, buf, req);
+        return;
+    }
+    JSValue handler = get_handler(ctx);
+    if (JS_IsUndefined(handler)) {
+        send_placeholder(conn);
+        return;
+    }
+    send_result(ctx, conn, call_handler(ctx, handler, buf, req));
+}
 
-        // Simple HTTP request handling (placeholder)
-        // In a real implementation, this would parse HTTP requests and route them
-        // to the appropriate Manaknight API handlers
+// Replay
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
 
-        const char* response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\nHello from Manaknight!";
-        write(client_socket, response, strlen(response));
-        close(client_socket);
+static uint64_t percentile(const uint64_t* sorted, size_t n, double q) {
+    size_t i = (size_t)(q * n);
+    return n == 0 ? 0 : sorted[i < n ? i : n - 1];
+}
+
+int manaknight_replay(JSContext* ctx, const char* log_path,
+                      const ManaknightReplayOptions* options, ManaknightReplayStats* stats) {
+    MKCaptureLog* log = mk_capture_log_load(log_path);
+    MKReplay r;
+    JSMemoryHighWater hw;
+    int iterations = options->iterations > 0 ? options->iterations : 1;
+    uint64_t* latencies;
+    uint64_t start, end;
+    size_t n = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!log) {
+        fprintf(stderr, "Failed to load capture log %s\n", log_path);
+        return -1;
+    }
+    latencies = malloc(sizeof(latencies[0]) * (log->request_count * iterations + 1));
+    memset(&r, 0, sizeof(r));
+    r.log = log;
+    r.used = malloc(log->record_count + 1);
+    if (!latencies || !r.used) {
+        free(latencies);
+        free(r.used);
+        mk_capture_log_free(log);
+        return -1;
     }
 
-    return NULL;
+    replay = &r;
+    JS_ResetMemoryHighWater(ctx);
+    start = get_time_us();
+    for (int it = 0; it < iterations; it++) {
+        memset(r.used, 0, log->record_count);
+        for (size_t i = 0; i < log->record_count; i++) {
+            const MKCaptureRecord* rec = &log->records[i];
+            const char* buf = (const char*)rec->data;
+            MKHttpRequest req;
+            uint64_t sent;
+
+            if (rec->type != MK_CAPTURE_REQUEST)
+                continue;
+            if (mk_http_parse_request(buf, rec->len, &req) <= 0 ||
+                req.header_len + req.content_length > rec->len) {
+                stats->errors++;
+                continue;
+            }
+            // at a fixed rate, the latency is measured from the time the
+            // request should have been sent so that a slow request also
+            // counts for the requests queued behind it
+            if (options->rate > 0) {
+                sent = start + (uint64_t)(n * 1e6 / options->rate);
+                uint64_t now = get_time_us();
+                if (now < sent)
+                    usleep(sent - now);
+            } else {
+                sent = get_time_us();
+            }
+
+            JSValue handler = get_handler(ctx);
+            if (JS_IsUndefined(handler)) {
+                stats->errors++;
+                continue;
+            }
+            r.request_index = i;
+            current_request.id = rec->request_id;
+            if (JS_IsException(call_handler(ctx, handler, buf, &req))) {
+                stats->errors++;
+                JS_GetException(ctx);
+            }
+            latencies[n++] = get_time_us() - sent;
+        }
+    }
+    end = get_time_us();
+    replay = NULL;
+
+    JS_GetMemoryHighWater(ctx, &hw);
+    qsort(latencies, n, sizeof(latencies[0]), compare_u64);
+    stats->requests = n;
+    stats->missing_effects = r.missing_effects;
+    stats->elapsed_us = end - start;
+    stats->requests_per_second = end > start ? n * 1e6 / (end - start) : 0;
+    stats->latency_p50_us = percentile(latencies, n, 0.50);
+    stats->latency_p90_us = percentile(latencies, n, 0.90);
+    stats->latency_p99_us = percentile(latencies, n, 0.99);
+    stats->latency_p999_us = percentile(latencies, n, 0.999);
+    stats->latency_max_us = n > 0 ? latencies[n - 1] : 0;
+    stats->gc_count = hw.gc_count;
+    stats->heap_size = hw.heap_size;
+    stats->stack_size = hw.stack_size;
+    stats->mem_size = hw.mem_size;
+
+    free(latencies);
+    free(r.used);
+    mk_capture_log_free(log);
+    return 0;
 }
 
-// Module loader
-JSModuleDef* manaknight_module_loader(JSContext* ctx, const char* module_name, void* opaque) {
-    // This would load Manaknight modules
-    // For now, return NULL (not implemented)
-    return NULL;
+// Request view effects
+
+// The handler performed an effect which is visible outside the request
+// (a write, a log line, a recorded result): it is not run again if it
+// runs out of memory
+static void request_side_effect(void) {
+    current_request.side_effects = true;
+}
+
+static JSValue request_string(JSContext* ctx, MKSlice s) {
+    return JS_NewStringLen(ctx, current_request.buf + s.off, s.len);
+}
+
+JSValue manaknight_request_method(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (!current_request.req) return JS_ThrowTypeError(ctx, "no request is being handled");
+    return request_string(ctx, current_request.req->method);
+}
+
+JSValue manaknight_request_path(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (!current_request.req) return JS_ThrowTypeError(ctx, "no request is being handled");
+    return request_string(ctx, current_request.req->path);
+}
+
+JSValue manaknight_request_query(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (!current_request.req) return JS_ThrowTypeError(ctx, "no request is being handled");
+    return request_string(ctx, current_request.req->query);
+}
+
+JSValue manaknight_request_body(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (!current_request.req) return JS_ThrowTypeError(ctx, "no request is being handled");
+    return request_string(ctx, current_request.req->body);
+}
+
+// Return the value of a header (case insensitive name) or undefined
+JSValue manaknight_request_header(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (argc < 1) return JS_ThrowTypeError(ctx, "header requires a name");
+    if (!current_request.req) return JS_ThrowTypeError(ctx, "no request is being handled");
+
+    // 'name' is valid until the next allocation in the context
+    JSCStringBuf name_buf;
+    const char* name = JS_ToCString(ctx, argv[0], &name_buf);
+    if (!name) return JS_EXCEPTION;
+    const MKSlice* value = mk_http_find_header(current_request.buf, current_request.req, name);
+    if (!value)
+        return JS_UNDEFINED;
+    return request_string(ctx, *value);
 }
 
 // Effect handler implementations
 
+// Set a property of the object referenced by 'obj' (a GC reference).
+// Return -1 if exception.
+static int set_property(JSContext* ctx, JSValue* obj, const char* name, JSValue val) {
+    if (JS_IsException(val))
+        return -1;
+    return JS_IsException(JS_SetPropertyStr(ctx, *obj, name, val)) ? -1 : 0;
+}
+
+// Return {tag} or {tag, [name]: str} if 'name' is not NULL. 'str' must
+// not be in the JS heap.
+static JSValue tagged_value(JSContext* ctx, const char* tag, const char* name,
+                            const char* str, size_t len) {
+    JSGCRef obj_ref;
+    JSValue* obj = JS_PushGCRef(ctx, &obj_ref);
+    JSValue ret = JS_EXCEPTION;
+
+    *obj = JS_NewObject(ctx);
+    if (!JS_IsException(*obj) &&
+        set_property(ctx, obj, "tag", JS_NewString(ctx, tag)) == 0 &&
+        (!name || set_property(ctx, obj, name, JS_NewStringLen(ctx, str, len)) == 0))
+        ret = *obj;
+    JS_PopGCRef(ctx, &obj_ref);
+    return ret;
+}
+
 // Time effects
 JSValue manaknight_time_now(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     struct timeval tv;
@@ -356,13 +747,12 @@ JSValue manaknight_time_unixMillis(JSContext* ctx, JSValue* this_val, int argc,
 JSValue manaknight_time_sleep(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 1) return JS_ThrowTypeError(ctx, "sleep requires duration argument");
 
-    int64_t duration_ms;
-    if (JS_ToInt64(ctx, &duration_ms, argv[0]) != 0) {
-        return JS_ThrowTypeError(ctx, "duration must be a number");
-    }
+    double duration_ms;
+    if (JS_ToNumber(ctx, &duration_ms, argv[0]))
+        return JS_EXCEPTION;
 
     if (duration_ms > 0) {
-        usleep(duration_ms * 1000); // Convert to microseconds
+        usleep((useconds_t)(duration_ms * 1000)); // Convert to microseconds
     }
 
     return JS_UNDEFINED;
@@ -388,10 +778,10 @@ JSValue manaknight_random_int(JSContext* ctx, JSValue* this_val, int argc, JSVal
 JSValue manaknight_random_intRange(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 2) return JS_ThrowTypeError(ctx, "intRange requires min and max arguments");
 
-    int64_t min, max;
-    if (JS_ToInt64(ctx, &min, argv[0]) != 0 || JS_ToInt64(ctx, &max, argv[1]) != 0) {
-        return JS_ThrowTypeError(ctx, "min and max must be numbers");
-    }
+    double dmin, dmax;
+    if (JS_ToNumber(ctx, &dmin, argv[0]) || JS_ToNumber(ctx, &dmax, argv[1]))
+        return JS_EXCEPTION;
+    int64_t min = (int64_t)dmin, max = (int64_t)dmax;
 
     if (min >= max) {
         return JS_ThrowRangeError(ctx, "min must be less than max");
@@ -418,10 +808,9 @@ JSValue manaknight_random_intRange(JSContext* ctx, JSValue* this_val, int argc,
 JSValue manaknight_random_bytes(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 1) return JS_ThrowTypeError(ctx, "bytes requires length argument");
 
-    int64_t length;
-    if (JS_ToInt64(ctx, &length, argv[0]) != 0) {
-        return JS_ThrowTypeError(ctx, "length must be a number");
-    }
+    int length;
+    if (JS_ToInt32(ctx, &length, argv[0]))
+        return JS_EXCEPTION;
 
     if (length < 0) {
         return JS_ThrowRangeError(ctx, "length cannot be negative");
@@ -432,10 +821,14 @@ JSValue manaknight_random_bytes(JSContext* ctx, JSValue* this_val, int argc, JSV
     }
 
     // Create array of random bytes
-    JSValue array = JS_NewArray(ctx);
+    JSGCRef array_ref;
+    JSValue* array = JS_PushGCRef(ctx, &array_ref);
+    *array = JS_NewArray(ctx, length);
+    if (JS_IsException(*array))
+        return JS_PopGCRef(ctx, &array_ref);
     FILE* urandom = fopen("/dev/urandom", "rb");
 
-    for (int64_t i = 0; i < length; i++) {
+    for (int i = 0; i < length; i++) {
         uint8_t byte = 0;
         if (urandom) {
             fread(&byte, 1, 1, urandom);
@@ -443,12 +836,15 @@ JSValue manaknight_random_bytes(JSContext* ctx, JSValue* this_val, int argc, JSV
             srand(time(NULL) + i);
             byte = rand() & 0xFF;
         }
-        JS_SetPropertyUint32(ctx, array, i, JS_NewInt32(ctx, byte));
+        if (JS_IsException(JS_SetPropertyUint32(ctx, *array, i, JS_NewInt32(ctx, byte)))) {
+            *array = JS_EXCEPTION;
+            break;
+        }
     }
 
     if (urandom) fclose(urandom);
 
-    return array;
+    return JS_PopGCRef(ctx, &array_ref);
 }
 
 JSValue manaknight_random_uuidV4(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
@@ -481,131 +877,233 @@ JSValue manaknight_random_uuidV4(JSContext* ctx, JSValue* this_val, int argc, JS
     return JS_NewString(ctx, uuid);
 }
 
+// Return the recorded result of an effect of the request being
+// replayed, an -ENODATA error if the request did not perform it
+static MKEffectResult* replay_effect(const char* capability, const char* key, size_t key_len) {
+    MKCaptureLog* log = replay->log;
+    const MKCaptureRecord* req = &log->records[replay->request_index];
+    size_t cap_len = strlen(capability);
+    MKEffectResult* r = NULL;
+
+    pthread_mutex_lock(&replay_lock);
+    // the effects of a request follow it in the log
+    for (size_t i = replay->request_index + 1; i < log->record_count; i++) {
+        const MKCaptureRecord* rec = &log->records[i];
+        if (rec->type == MK_CAPTURE_REQUEST)
+            break;
+        if (!replay->used[i] && rec->request_id == req->request_id &&
+            rec->capability_len == cap_len && memcmp(rec->capability, capability, cap_len) == 0 &&
+            rec->key_len == key_len && memcmp(rec->key, key, key_len) == 0) {
+            replay->used[i] = 1;
+            r = mk_effect_result_new(rec->error, rec->status, rec->data, rec->len);
+            break;
+        }
+    }
+    if (!r) {
+        replay->missing_effects++;
+        r = mk_effect_result_new(-ENODATA, 0, "", 0);
+    }
+    pthread_mutex_unlock(&replay_lock);
+    return r;
+}
+
+// Perform an idempotent effect through the effect cache. Its result is
+// recorded when capturing and comes from the log when replaying.
+static MKEffectResult* effect_call(const char* capability, const char* key, size_t key_len,
+                                   MKEffectFunc* func, void* opaque) {
+    if (replay)
+        return replay_effect(capability, key, key_len);
+    MKEffectResult* r = mk_effect_call(effect_cache, capability, key, key_len, func, opaque);
+    if (r && capture)
+        mk_capture_effect(capture, current_request.id, capability, key, key_len, r);
+    return r;
+}
+
 // HTTP effects (simplified implementations)
-JSValue manaknight_http_get(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+
+// The idempotent requests go through the effect cache: concurrent
+// requests of the same URL share one upstream request
+static MKEffectResult* http_get_effect(void* opaque, const char* key, size_t key_len) {
     // This is a placeholder - real implementation would use libcurl or similar
     // For now, return a mock response
-    JSValue response = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, response, "status_code", JS_NewInt32(ctx, 200));
-    JS_SetPropertyStr(ctx, response, "headers", JS_NewObject(ctx));
-    JS_SetPropertyStr(ctx, response, "body", JS_NewString(ctx, "{\"message\": \"HTTP GET not implemented\"}"));
+    static const char body[] = "{\"message\": \"HTTP GET not implemented\"}";
+    return mk_effect_result_new(0, 200, body, sizeof(body) - 1);
+}
+
+static MKEffectResult* http_head_effect(void* opaque, const char* key, size_t key_len) {
+    return mk_effect_result_new(0, 200, "", 0);
+}
+
+// Return {status_code, headers, body}. The body is undefined if 'body'
+// is NULL.
+static JSValue http_response_value(JSContext* ctx, int status, const char* body, size_t body_len) {
+    JSGCRef response_ref;
+    JSValue* response = JS_PushGCRef(ctx, &response_ref);
+    JSValue ret = JS_EXCEPTION;
+
+    *response = JS_NewObject(ctx);
+    if (!JS_IsException(*response) &&
+        set_property(ctx, response, "status_code", JS_NewInt32(ctx, status)) == 0 &&
+        set_property(ctx, response, "headers", JS_NewObject(ctx)) == 0 &&
+        set_property(ctx, response, "body",
+                     body ? JS_NewStringLen(ctx, body, body_len) : JS_UNDEFINED) == 0)
+        ret = *response;
+    JS_PopGCRef(ctx, &response_ref);
+    return ret;
+}
+
+static JSValue http_get_value(JSContext* ctx, MKEffectResult* r) {
+    return http_response_value(ctx, r->status, (char*)r->data, r->len);
+}
+
+static JSValue http_head_value(JSContext* ctx, MKEffectResult* r) {
+    return http_response_value(ctx, r->status, NULL, 0);
+}
+
+static JSValue http_idempotent_request(JSContext* ctx, int argc, JSValue* argv,
+                                       const char* capability, MKEffectFunc* func,
+                                       JSValue (*to_value)(JSContext* ctx, MKEffectResult* r)) {
+    if (argc < 1) return JS_ThrowTypeError(ctx, "request requires url");
+
+    // 'url' is valid until the next allocation in the context
+    JSCStringBuf url_buf;
+    const char* url = JS_ToCString(ctx, argv[0], &url_buf);
+    if (!url) return JS_EXCEPTION;
+    MKEffectResult* r = effect_call(capability, url, strlen(url), func, NULL);
+    if (!r)
+        return JS_ThrowOutOfMemory(ctx);
+    if (capture)
+        request_side_effect();
+
+    JSValue response = to_value(ctx, r);
+    mk_effect_result_unref(effect_cache, r);
     return response;
 }
 
+JSValue manaknight_http_get(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    return http_idempotent_request(ctx, argc, argv, "http.get", http_get_effect, http_get_value);
+}
+
 JSValue manaknight_http_post(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     // Placeholder implementation
-    JSValue response = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, response, "status_code", JS_NewInt32(ctx, 201));
-    JS_SetPropertyStr(ctx, response, "headers", JS_NewObject(ctx));
-    JS_SetPropertyStr(ctx, response, "body", JS_NewString(ctx, "{\"created\": true}"));
-    return response;
+    static const char body[] = "{\"created\": true}";
+    request_side_effect();
+    return http_response_value(ctx, 201, body, sizeof(body) - 1);
 }
 
 JSValue manaknight_http_put(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    JSValue response = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, response, "status_code", JS_NewInt32(ctx, 200));
-    JS_SetPropertyStr(ctx, response, "headers", JS_NewObject(ctx));
-    JS_SetPropertyStr(ctx, response, "body", JS_NewString(ctx, "{\"updated\": true}"));
-    return response;
+    static const char body[] = "{\"updated\": true}";
+    request_side_effect();
+    return http_response_value(ctx, 200, body, sizeof(body) - 1);
 }
 
 JSValue manaknight_http_delete(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    JSValue response = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, response, "status_code", JS_NewInt32(ctx, 204));
-    JS_SetPropertyStr(ctx, response, "headers", JS_NewObject(ctx));
-    JS_SetPropertyStr(ctx, response, "body", JS_UNDEFINED);
-    return response;
+    request_side_effect();
+    return http_response_value(ctx, 204, NULL, 0);
 }
 
 JSValue manaknight_http_head(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    JSValue response = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, response, "status_code", JS_NewInt32(ctx, 200));
-    JS_SetPropertyStr(ctx, response, "headers", JS_NewObject(ctx));
-    JS_SetPropertyStr(ctx, response, "body", JS_UNDEFINED);
-    return response;
+    return http_idempotent_request(ctx, argc, argv, "http.head", http_head_effect, http_head_value);
 }
 
 JSValue manaknight_http_request(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     // Generic request handler - dispatches based on method
     if (argc < 1) return JS_ThrowTypeError(ctx, "request requires request object");
 
-    JSValue request = argv[0];
-    JSValue method_val = JS_GetPropertyStr(ctx, request, "method");
-    const char* method = JS_ToCString(ctx, method_val);
-
-    JSValue result;
-    if (strcmp(method, "GET") == 0) {
-        result = manaknight_http_get(ctx, this_val, argc, argv);
+    JSValue method_val = JS_GetPropertyStr(ctx, argv[0], "method");
+    if (JS_IsException(method_val))
+        return method_val;
+    JSCStringBuf method_buf;
+    const char* str = JS_ToCString(ctx, method_val, &method_buf);
+    if (!str)
+        return JS_EXCEPTION;
+    // copied: 'str' is only valid until the next allocation
+    char method[8];
+    snprintf(method, sizeof(method), "%s", str);
+
+    if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+        // the URL is the key of the shared request
+        JSValue url_val = JS_GetPropertyStr(ctx, argv[0], "url");
+        if (JS_IsException(url_val))
+            return url_val;
+        if (method[0] == 'G')
+            return manaknight_http_get(ctx, this_val, 1, &url_val);
+        else
+            return manaknight_http_head(ctx, this_val, 1, &url_val);
     } else if (strcmp(method, "POST") == 0) {
-        result = manaknight_http_post(ctx, this_val, argc, argv);
+        return manaknight_http_post(ctx, this_val, argc, argv);
     } else if (strcmp(method, "PUT") == 0) {
-        result = manaknight_http_put(ctx, this_val, argc, argv);
+        return manaknight_http_put(ctx, this_val, argc, argv);
     } else if (strcmp(method, "DELETE") == 0) {
-        result = manaknight_http_delete(ctx, this_val, argc, argv);
-    } else if (strcmp(method, "HEAD") == 0) {
-        result = manaknight_http_head(ctx, this_val, argc, argv);
+        return manaknight_http_delete(ctx, this_val, argc, argv);
     } else {
-        result = JS_ThrowTypeError(ctx, "unsupported HTTP method");
+        return JS_ThrowTypeError(ctx, "unsupported HTTP method");
     }
-
-    JS_FreeCString(ctx, method);
-    JS_FreeValue(ctx, method_val);
-    return result;
 }
 
 // Logging effects
-JSValue manaknight_log_info(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+
+static JSValue log_message(JSContext* ctx, int argc, JSValue* argv, FILE* f, const char* level) {
     if (argc > 0) {
-        const char* message = JS_ToCString(ctx, argv[0]);
-        printf("[INFO] %s\n", message);
-        JS_FreeCString(ctx, message);
+        JSCStringBuf buf;
+        size_t len;
+        const char* message = JS_ToCStringLen(ctx, &len, argv[0], &buf);
+        if (!message)
+            return JS_EXCEPTION;
+        fprintf(f, "[%s] %.*s\n", level, (int)len, message);
+        request_side_effect();
     }
     return JS_UNDEFINED;
 }
 
+JSValue manaknight_log_info(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    return log_message(ctx, argc, argv, stdout, "INFO");
+}
+
 JSValue manaknight_log_warn(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    if (argc > 0) {
-        const char* message = JS_ToCString(ctx, argv[0]);
-        fprintf(stderr, "[WARN] %s\n", message);
-        JS_FreeCString(ctx, message);
-    }
-    return JS_UNDEFINED;
+    return log_message(ctx, argc, argv, stderr, "WARN");
 }
 
 JSValue manaknight_log_error(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    if (argc > 0) {
-        const char* message = JS_ToCString(ctx, argv[0]);
-        fprintf(stderr, "[ERROR] %s\n", message);
-        JS_FreeCString(ctx, message);
-    }
-    return JS_UNDEFINED;
+    return log_message(ctx, argc, argv, stderr, "ERROR");
 }
 
 JSValue manaknight_log_debug(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    if (argc > 0) {
-        const char* message = JS_ToCString(ctx, argv[0]);
-        printf("[DEBUG] %s\n", message);
-        JS_FreeCString(ctx, message);
-    }
-    return JS_UNDEFINED;
+    return log_message(ctx, argc, argv, stdout, "DEBUG");
 }
 
 // File system effects (basic implementations)
-JSValue manaknight_fs_readFile(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
-    if (argc < 1) return JS_ThrowTypeError(ctx, "readFile requires filename");
 
-    const char* filename = JS_ToCString(ctx, argv[0]);
-    if (!filename) return JS_ThrowTypeError(ctx, "filename must be a string");
+// Return the ring of the HTTP server if called from its thread
+static MKUring* fs_ring(void) {
+    if (!http_server_running || !pthread_equal(pthread_self(), http_server_thread))
+        return NULL;
+    return mk_http_server_ring(&http_server);
+}
 
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        JS_FreeCString(ctx, filename);
-        JSValue error = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, error, "tag", JS_NewString(ctx, "network_error"));
-        JS_SetPropertyStr(ctx, error, "message", JS_NewString(ctx, "file not found"));
-        return error;
+// Read the file named 'opaque'. The error is -errno.
+static MKEffectResult* fs_read_effect(void* opaque, const char* key, size_t key_len) {
+    const char* filename = opaque;
+    MKEffectResult* r;
+
+    // In a handler of the io_uring server, the file is read by the ring:
+    // the other connections progress during the read
+    MKUring* ring = fs_ring();
+    if (ring) {
+        uint8_t* buf;
+        size_t len;
+        int ret = mk_uring_read_file(ring, filename, 10 * 1024 * 1024, &buf, &len);
+        if (ret < 0)
+            return mk_effect_result_new(ret, 0, "", 0);
+        r = mk_effect_result_new(0, 0, buf, len);
+        free(buf);
+        return r;
     }
 
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return mk_effect_result_new(-ENOENT, 0, "", 0);
+
     // Read file content
     fseek(file, 0, SEEK_END);
     long size = ftell(file);
@@ -613,78 +1111,270 @@ JSValue manaknight_fs_readFile(JSContext* ctx, JSValue* this_val, int argc, JSVa
 
     if (size < 0 || size > 10 * 1024 * 1024) { // 10MB limit
         fclose(file);
-        JS_FreeCString(ctx, filename);
-        JSValue error = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, error, "tag", JS_NewString(ctx, "network_error"));
-        JS_SetPropertyStr(ctx, error, "message", JS_NewString(ctx, "file too large"));
-        return error;
+        return mk_effect_result_new(-EFBIG, 0, "", 0);
     }
 
     char* content = malloc(size + 1);
     if (!content) {
         fclose(file);
-        JS_FreeCString(ctx, filename);
-        return JS_ThrowOutOfMemory(ctx);
+        return NULL;
     }
 
     size_t read = fread(content, 1, size, file);
-    content[read] = '\0';
     fclose(file);
+    r = mk_effect_result_new(0, 0, content, read);
+    free(content);
+    return r;
+}
 
-    JSValue result = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, result, "tag", JS_NewString(ctx, "ok"));
-    JS_SetPropertyStr(ctx, result, "value", JS_NewString(ctx, content));
+static JSValue fs_read_value(JSContext* ctx, MKEffectResult* r) {
+    if (r->error < 0) {
+        const char* message = r->error == -EFBIG ? "file too large" : "file not found";
+        return tagged_value(ctx, "network_error", "message", message, strlen(message));
+    }
+    return tagged_value(ctx, "ok", "value", (char*)r->data, r->len);
+}
 
-    free(content);
-    JS_FreeCString(ctx, filename);
+JSValue manaknight_fs_readFile(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (argc < 1) return JS_ThrowTypeError(ctx, "readFile requires filename");
+
+    JSCStringBuf buf;
+    const char* str = JS_ToCString(ctx, argv[0], &buf);
+    if (!str) return JS_EXCEPTION;
+    // copied: the read may outlive the string in the JS heap
+    char* filename = strdup(str);
+    if (!filename)
+        return JS_ThrowOutOfMemory(ctx);
+
+    // concurrent reads of the same file share one read
+    MKEffectResult* r = effect_call("fs.readFile", filename, strlen(filename),
+                                    fs_read_effect, filename);
+    free(filename);
+    if (!r)
+        return JS_ThrowOutOfMemory(ctx);
+    if (capture)
+        request_side_effect();
+
+    JSValue result = fs_read_value(ctx, r);
+    mk_effect_result_unref(effect_cache, r);
     return result;
 }
 
 JSValue manaknight_fs_writeFile(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 2) return JS_ThrowTypeError(ctx, "writeFile requires filename and content");
 
-    const char* filename = JS_ToCString(ctx, argv[0]);
-    const char* content = JS_ToCString(ctx, argv[1]);
-
-    if (!filename || !content) {
-        JS_FreeCString(ctx, filename);
-        JS_FreeCString(ctx, content);
-        return JS_ThrowTypeError(ctx, "arguments must be strings");
-    }
-
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        JS_FreeCString(ctx, filename);
-        JS_FreeCString(ctx, content);
-        JSValue error = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, error, "tag", JS_NewString(ctx, "network_error"));
-        JS_SetPropertyStr(ctx, error, "message", JS_NewString(ctx, "cannot write file"));
-        return error;
+    // the file name is copied: converting the content may allocate
+    JSCStringBuf filename_buf, content_buf;
+    const char* str = JS_ToCString(ctx, argv[0], &filename_buf);
+    if (!str) return JS_EXCEPTION;
+    char* filename = strdup(str);
+    if (!filename)
+        return JS_ThrowOutOfMemory(ctx);
+    size_t content_len;
+    const char* content = JS_ToCStringLen(ctx, &content_len, argv[1], &content_buf);
+    if (!content) {
+        free(filename);
+        return JS_EXCEPTION;
     }
 
-    fwrite(content, 1, strlen(content), file);
-    fclose(file);
-
-    JSValue result = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, result, "tag", JS_NewString(ctx, "ok"));
-    JS_SetPropertyStr(ctx, result, "value", JS_NewString(ctx, "()"));
+    request_side_effect();
 
-    JS_FreeCString(ctx, filename);
-    JS_FreeCString(ctx, content);
-    return result;
+    int ret = 0;
+    MKUring* ring = fs_ring();
+    if (ring) {
+        ret = mk_uring_write_file(ring, filename, content, content_len);
+    } else {
+        FILE* file = fopen(filename, "wb");
+        if (!file) {
+            ret = -errno;
+        } else {
+            if (fwrite(content, 1, content_len, file) != content_len)
+                ret = -EIO;
+            if (fclose(file) != 0)
+                ret = -EIO;
+        }
+    }
+    // The cached content is out of date, even after a failed write which
+    // may have truncated the file. It is dropped once the write is done so
+    // that a read made during the write cannot cache the old content.
+    mk_effect_cache_invalidate(effect_cache, "fs.readFile", filename, strlen(filename));
+    free(filename);
+
+    if (ret < 0)
+        return tagged_value(ctx, "network_error", "message", "cannot write file", 17);
+    return tagged_value(ctx, "ok", "value", "()", 2);
 }
 
 JSValue manaknight_fs_exists(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 1) return JS_ThrowTypeError(ctx, "exists requires filename");
 
-    const char* filename = JS_ToCString(ctx, argv[0]);
-    if (!filename) return JS_NewBool(ctx, false);
+    JSCStringBuf buf;
+    const char* filename = JS_ToCString(ctx, argv[0], &buf);
+    if (!filename) return JS_EXCEPTION;
 
     struct stat st;
-    bool exists = stat(filename, &st) == 0;
+    return JS_NewBool(stat(filename, &st) == 0);
+}
+
+// Batched effects: the compiler groups the independent calls of a
+// block into __effects.batch([[name, [arg]], ...]). The calls run
+// concurrently and the handler resumes when all the results are in.
+
+#define MK_BATCH_MAX_CALLS 64
+
+typedef struct {
+    const char* name;
+    MKEffectFunc* func;
+    JSValue (*to_value)(JSContext* ctx, MKEffectResult* r);
+} BatchEffect;
+
+static const BatchEffect batch_effects[] = {
+    { "http.get", http_get_effect, http_get_value },
+    { "http.head", http_head_effect, http_head_value },
+    { "fs.readFile", fs_read_effect, fs_read_value },
+};
+
+typedef struct {
+    const BatchEffect* effect;
+    char* key;
+    MKEffectResult* result;
+    pthread_t thread;
+    bool started;
+} BatchCall;
+
+static void* batch_call_worker(void* arg) {
+    BatchCall* bc = arg;
+    // the calls still go through the effect cache
+    bc->result = effect_call(bc->effect->name, bc->key, strlen(bc->key),
+                             bc->effect->func, bc->key);
+    return NULL;
+}
 
-    JS_FreeCString(ctx, filename);
-    return JS_NewBool(ctx, exists);
+static const BatchEffect* find_batch_effect(const char* name) {
+    for (size_t i = 0; i < countof(batch_effects); i++) {
+        if (strcmp(batch_effects[i].name, name) == 0)
+            return &batch_effects[i];
+    }
+    return NULL;
+}
+
+// Set up a call from its item [name, [arg]]. The name is looked up
+// before the argument is converted: converting may allocate and move
+// both the item and the name. A call with other arguments than the key
+// is refused rather than run without them.
+static int batch_call_init(JSContext* ctx, BatchCall* bc, JSValue* item) {
+    JSCStringBuf buf;
+    const char* str;
+    JSValue val;
+    int n;
+
+    val = JS_GetPropertyUint32(ctx, *item, 0);
+    if (JS_IsException(val))
+        return -1;
+    str = JS_ToCString(ctx, val, &buf);
+    if (!str)
+        return -1;
+    bc->effect = find_batch_effect(str);
+    if (!bc->effect) {
+        JS_ThrowTypeError(ctx, "effect cannot be batched");
+        return -1;
+    }
+
+    val = JS_GetPropertyUint32(ctx, *item, 1);
+    if (JS_IsException(val))
+        return -1;
+    val = JS_GetPropertyStr(ctx, val, "length");
+    if (JS_IsException(val) || JS_ToInt32(ctx, &n, val) != 0)
+        return -1;
+    if (n != 1) {
+        JS_ThrowTypeError(ctx, "a batched call takes one argument");
+        return -1;
+    }
+    // reloaded: the length lookup may allocate
+    val = JS_GetPropertyUint32(ctx, *item, 1);
+    if (JS_IsException(val))
+        return -1;
+    val = JS_GetPropertyUint32(ctx, val, 0);
+    if (JS_IsException(val))
+        return -1;
+    str = JS_ToCString(ctx, val, &buf);
+    if (!str)
+        return -1;
+    bc->key = strdup(str);
+    if (!bc->key) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+JSValue manaknight_effects_batch(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
+    if (argc < 1) return JS_ThrowTypeError(ctx, "batch requires a list of calls");
+
+    BatchCall calls[MK_BATCH_MAX_CALLS];
+    JSValue len_val = JS_GetPropertyStr(ctx, argv[0], "length");
+    int n;
+    if (JS_IsException(len_val) || JS_ToInt32(ctx, &n, len_val) != 0 ||
+        n < 0 || n > MK_BATCH_MAX_CALLS) {
+        return JS_ThrowRangeError(ctx, "invalid batch length");
+    }
+    memset(calls, 0, sizeof(calls[0]) * n);
+
+    JSGCRef val_ref;
+    JSValue* val = JS_PushGCRef(ctx, &val_ref);
+    int ret = 0;
+    for (int i = 0; i < n && ret == 0; i++) {
+        *val = JS_GetPropertyUint32(ctx, argv[0], i);
+        if (JS_IsException(*val))
+            ret = -1;
+        else
+            ret = batch_call_init(ctx, &calls[i], val);
+    }
+
+    if (ret == 0) {
+        // No JS value is touched by the workers. The first call runs
+        // in this thread, e.g. on the io_uring ring of the server.
+        for (int i = 1; i < n; i++) {
+            calls[i].started = (pthread_create(&calls[i].thread, NULL,
+                                               batch_call_worker, &calls[i]) == 0);
+        }
+        for (int i = 0; i < n; i++) {
+            if (!calls[i].started)
+                batch_call_worker(&calls[i]);
+        }
+        for (int i = 1; i < n; i++) {
+            if (calls[i].started)
+                pthread_join(calls[i].thread, NULL);
+        }
+        if (capture)
+            request_side_effect();
+
+        // the array is kept in 'val': to_value() allocates
+        *val = JS_NewArray(ctx, n);
+        if (JS_IsException(*val))
+            ret = -1;
+        for (int i = 0; i < n && ret == 0; i++) {
+            JSValue v;
+            if (!calls[i].result) {
+                JS_ThrowOutOfMemory(ctx);
+                ret = -1;
+                break;
+            }
+            v = calls[i].effect->to_value(ctx, calls[i].result);
+            if (JS_IsException(v) ||
+                JS_IsException(JS_SetPropertyUint32(ctx, *val, i, v)))
+                ret = -1;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        mk_effect_result_unref(effect_cache, calls[i].result);
+        free(calls[i].key);
+    }
+    JSValue results = JS_PopGCRef(ctx, &val_ref);
+    if (ret < 0)
+        return JS_EXCEPTION;
+    return results;
 }
 
 // Crypto effects (basic implementations)
@@ -692,17 +1382,17 @@ JSValue manaknight_crypto_hashSha256(JSContext* ctx, JSValue* this_val, int argc
     // Placeholder - real implementation would use OpenSSL or similar
     if (argc < 1) return JS_ThrowTypeError(ctx, "hashSha256 requires data");
 
-    const char* data = JS_ToCString(ctx, argv[0]);
-    if (!data) return JS_ThrowTypeError(ctx, "data must be a string");
+    JSCStringBuf buf;
+    size_t len;
+    const char* data = JS_ToCStringLen(ctx, &len, argv[0], &buf);
+    if (!data) return JS_EXCEPTION;
 
     // Simple placeholder hash - in reality use proper SHA256
     char hash[65];
     snprintf(hash, sizeof(hash), "%08x%08x%08x%08x%08x%08x%08x%08x",
-             (unsigned int)strlen(data), 0, 0, 0, 0, 0, 0, 0);
+             (unsigned int)len, 0, 0, 0, 0, 0, 0, 0);
 
-    JSValue result = JS_NewString(ctx, hash);
-    JS_FreeCString(ctx, data);
-    return result;
+    return JS_NewString(ctx, hash);
 }
 
 JSValue manaknight_crypto_hmacSha256(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
@@ -717,30 +1407,21 @@ JSValue manaknight_crypto_hmacSha256(JSContext* ctx, JSValue* this_val, int argc
 JSValue manaknight_env_getEnv(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 1) return JS_ThrowTypeError(ctx, "getEnv requires variable name");
 
-    const char* var_name = JS_ToCString(ctx, argv[0]);
-    if (!var_name) return JS_ThrowTypeError(ctx, "variable name must be a string");
+    JSCStringBuf buf;
+    const char* var_name = JS_ToCString(ctx, argv[0], &buf);
+    if (!var_name) return JS_EXCEPTION;
 
     const char* value = getenv(var_name);
-
-    JSValue result;
-    if (value) {
-        result = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, result, "tag", JS_NewString(ctx, "some"));
-        JS_SetPropertyStr(ctx, result, "value", JS_NewString(ctx, value));
-    } else {
-        result = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, result, "tag", JS_NewString(ctx, "none"));
-    }
-
-    JS_FreeCString(ctx, var_name);
-    return result;
+    if (value)
+        return tagged_value(ctx, "some", "value", value, strlen(value));
+    return tagged_value(ctx, "none", NULL, NULL, 0);
 }
 
 // System effects (very restricted)
 JSValue manaknight_sys_exit(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv) {
     if (argc < 1) exit(0);
 
-    int32_t code;
+    int code;
     if (JS_ToInt32(ctx, &code, argv[0]) == 0) {
         exit(code);
     }
@@ -753,33 +1434,43 @@ JSValue manaknight_sys_getPid(JSContext* ctx, JSValue* this_val, int argc, JSVal
 }
 
 // Resource limits
-void manaknight_set_memory_limit(JSContext* ctx, size_t limit) {
-    JS_SetMemoryLimit(ctx, limit);
-}
-
 void manaknight_set_cpu_limit(JSContext* ctx, size_t limit_ms) {
-    // Set up interrupt handler for CPU time limit
-    // This is a simplified implementation
-    JS_SetInterruptHandler(ctx, NULL, NULL); // Placeholder
+    MKContextData* d = JS_GetContextOpaque(ctx);
+    // checked by js_interrupt_handler() while a handler runs. It is
+    // the elapsed time: the effects which wait also count.
+    d->cpu_time_limit_us = (uint64_t)limit_ms * 1000;
 }
 
 // Error handling
 void manaknight_dump_error(JSContext* ctx) {
+    MKContextData* d = JS_GetContextOpaque(ctx);
     JSValue exception = JS_GetException(ctx);
-    const char* error_str = JS_ToCString(ctx, exception);
-    fprintf(stderr, "Manaknight error: %s\n", error_str);
-    JS_FreeCString(ctx, error_str);
-    JS_FreeValue(ctx, exception);
+    fprintf(stderr, "Manaknight error: ");
+    d->log_error = true;
+    JS_PrintValueF(ctx, exception, JS_DUMP_LONG);
+    d->log_error = false;
+    fprintf(stderr, "\n");
 }
 
 // Cleanup
 void manaknight_cleanup(JSContext* ctx) {
     manaknight_stop_http_server();
+    if (effect_cache) {
+        mk_effect_cache_free(effect_cache);
+        effect_cache = NULL;
+    }
+    context_free(ctx);
+}
 
-    // The caller is responsible for JS_FreeContext and freeing memory buffer
+// Monotonic time in microseconds
+static uint64_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-// Utility function to load files
+// Utility function to load files. The content is followed by a null
+// byte (required by JS_Parse()).
 static uint8_t* load_file(const char* filename, size_t* plen) {
     FILE* f = fopen(filename, "rb");
     if (!f) {
@@ -795,7 +1486,7 @@ static uint8_t* load_file(const char* filename, size_t* plen) {
         return NULL;
     }
 
-    uint8_t* buf = malloc(size);
+    uint8_t* buf = malloc(size + 1);
     if (!buf) {
         fclose(f);
         return NULL;
@@ -809,6 +1500,7 @@ static uint8_t* load_file(const char* filename, size_t* plen) {
         return NULL;
     }
 
+    buf[size] = '\0';
     *plen = size;
     return buf;
 }
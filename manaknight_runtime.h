@@ -1,68 +1,121 @@
 #ifndef MANAKNIGHT_RUNTIME_H
 #define MANAKNIGHT_RUNTIME_H
 
-#include "mquickjs.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mquickjs.h"
+#include "manaknight_effect_cache.h"
 
 // Manaknight runtime configuration
 typedef struct {
-    const char* stdlib_path;      // Path to stdlib directory
-    size_t memory_limit;          // Memory limit in bytes
-    size_t cpu_time_limit;        // CPU time limit in milliseconds
+    const char* stdlib_path;      // Directory of the JS standard library, NULL = none
+    size_t memory_limit;          // Memory of a context in bytes (heap and stack)
+    size_t cpu_time_limit;        // Run time of a handler in milliseconds, 0 = no limit
     bool enable_http_server;     // Whether to start HTTP server
     int http_port;               // HTTP server port
+    const char* static_dir;      // Directory of static files (NULL if none)
+    const char* static_prefix;   // URL prefix of the static files, e.g. "/public"
+    int compress_level;          // gzip level of the responses (1-3), 0 = none
+    size_t compress_cache_size;  // bytes of compressed bodies kept, 0 = no cache
+    bool use_io_uring;           // io_uring event loop instead of epoll if available
+    const MKEffectTTL* effect_ttls; // result TTL per capability ("http.get", "fs.readFile"),
+                                 // terminated by a NULL capability; NULL = no caching
+    size_t effect_cache_size;    // bytes of effect results kept
+    const char* app_bytecode_path; // routes loaded in each request VM
+    size_t vm_min_memory;        // smallest request VM, up to memory_limit by powers
+                                 // of two; 0 = requests run in the main context
+    const char* capture_path;    // log of the requests and effect results, NULL = none
 } ManaknightConfig;
 
-// Module loading context
-typedef struct {
-    JSContext* ctx;
-    const char* base_path;
-} ModuleLoaderContext;
-
-// Effect injection context
-typedef struct {
-    JSContext* ctx;
-    JSValue effects_object;
-} EffectContext;
-
 // Function declarations
 
-// Initialize Manaknight runtime
+// Initialize Manaknight runtime. The effects are in the __effects
+// global object (see manaknight_stdlib.c).
 JSContext* manaknight_init(const ManaknightConfig* config);
 
-// Load and execute Manaknight bytecode
+// Load and execute Manaknight bytecode. One image per context: it is
+// kept allocated as long as the context exists.
 int manaknight_execute_bytecode(JSContext* ctx, const char* bytecode_path);
 
 // Load standard library
 int manaknight_load_stdlib(JSContext* ctx, const char* stdlib_path);
 
-// Set up effect system
-int manaknight_setup_effects(JSContext* ctx, EffectContext* effect_ctx);
-
 // HTTP server functions (if enabled)
-int manaknight_start_http_server(JSContext* ctx, int port);
+int manaknight_start_http_server(JSContext* ctx, const ManaknightConfig* config);
 void manaknight_stop_http_server();
 
-// Module loading
-JSModuleDef* manaknight_module_loader(JSContext* ctx, const char* module_name,
-                                    void* opaque);
-
 // Effect handlers
 JSValue manaknight_time_now(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
 JSValue manaknight_time_unixMillis(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_time_sleep(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
 JSValue manaknight_random_int(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_random_intRange(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_random_bytes(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_random_uuidV4(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
 JSValue manaknight_http_get(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
 JSValue manaknight_http_post(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_http_put(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_http_delete(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_http_head(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_http_request(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
 JSValue manaknight_log_info(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_log_warn(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_log_error(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_log_debug(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_fs_readFile(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_fs_writeFile(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_fs_exists(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_crypto_hashSha256(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_crypto_hmacSha256(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_env_getEnv(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_sys_exit(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_sys_getPid(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+
+// Run the independent effect calls of a block concurrently
+JSValue manaknight_effects_batch(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+
+// Request view: the fields of the request being handled, created on demand
+JSValue manaknight_request_method(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_request_path(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_request_query(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_request_header(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+JSValue manaknight_request_body(JSContext* ctx, JSValue* this_val, int argc, JSValue* argv);
+
+// Replay of a capture log (see manaknight_capture.h) in-process: the
+// requests are handled by 'ctx' and their effects answered from the log
+typedef struct {
+    double rate;                 // requests per second, 0 = as fast as possible
+    int iterations;              // passes over the log
+} ManaknightReplayOptions;
 
-// Resource limits
-void manaknight_set_memory_limit(JSContext* ctx, size_t limit);
+typedef struct {
+    uint64_t requests;
+    uint64_t errors;             // invalid requests and handler exceptions
+    uint64_t missing_effects;    // effects which are not in the log
+    uint64_t elapsed_us;
+    double requests_per_second;
+    uint64_t latency_p50_us;
+    uint64_t latency_p90_us;
+    uint64_t latency_p99_us;
+    uint64_t latency_p999_us;
+    uint64_t latency_max_us;
+    uint32_t gc_count;
+    size_t heap_size;            // heap high-water mark, including the garbage
+    size_t stack_size;           // stack high-water mark
+    size_t mem_size;
+} ManaknightReplayStats;
+
+int manaknight_replay(JSContext* ctx, const char* log_path,
+                      const ManaknightReplayOptions* options, ManaknightReplayStats* stats);
+
+// Resource limits. The memory of a context is fixed when it is created.
 void manaknight_set_cpu_limit(JSContext* ctx, size_t limit_ms);
 
 // Error handling
 void manaknight_dump_error(JSContext* ctx);
 
-// Cleanup
+// Cleanup: stop the server and free the context
 void manaknight_cleanup(JSContext* ctx);
 
 #endif // MANAKNIGHT_RUNTIME_H
@@ -0,0 +1,560 @@
+#include "manaknight_static.h"
+#include "manaknight_deflate.h"
+#include "cutils.h"
+#include "list.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define MK_STATIC_HASH_SIZE 256 // must be a power of two
+
+// Encodings, in order of preference for the precompressed siblings.
+// The bits of mk_http_accepted_encodings() use the same positions.
+enum {
+    MK_ENC_IDENTITY,
+    MK_ENC_BR,
+    MK_ENC_GZIP,
+    MK_ENC_COUNT,
+};
+
+static const char* const enc_suffix[MK_ENC_COUNT] = { "", ".br", ".gz" };
+static const char* const enc_name[MK_ENC_COUNT] = { NULL, "br", "gzip" };
+
+typedef struct {
+    int fd;                     // -1 if the file does not exist
+    off_t size;
+    ino_t ino;
+    time_t mtime;
+} MKStaticVariant;
+
+typedef struct MKStaticEntry {
+    struct list_head link;      // LRU list, most recent first
+    struct MKStaticEntry* hash_next;
+    uint32_t hash;
+    int ref_count;              // 1 for the cache + 1 per response being sent
+    bool in_cache;
+    int64_t check_time;         // last revalidation (monotonic ms)
+    MKStaticVariant variants[MK_ENC_COUNT];
+    const char* content_type;
+    char etag[40];              // without the quotes
+    char last_modified[32];
+    char path[];                // relative to the root directory
+} MKStaticEntry;
+
+struct MKStaticFiles {
+    char* prefix;               // always ends with '/'
+    size_t prefix_len;
+    int root_fd;
+    int entry_count;
+    struct list_head lru;
+    MKStaticEntry* hash_table[MK_STATIC_HASH_SIZE];
+};
+
+typedef struct {
+    const char* ext;
+    const char* type;
+} MKContentType;
+
+static const MKContentType content_types[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "htm", "text/html; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "js", "text/javascript; charset=utf-8" },
+    { "mjs", "text/javascript; charset=utf-8" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "md", "text/markdown; charset=utf-8" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "ico", "image/x-icon" },
+    { "woff2", "font/woff2" },
+    { "woff", "font/woff" },
+    { "ttf", "font/ttf" },
+    { "otf", "font/otf" },
+    { "eot", "application/vnd.ms-fontobject" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+};
+
+static const char* get_content_type(const char* path) {
+    const char* ext = strrchr(path, '.');
+    if (ext && !strchr(ext, '/')) {
+        ext++;
+        for (size_t i = 0; i < countof(content_types); i++) {
+            if (strcasecmp(ext, content_types[i].ext) == 0)
+                return content_types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static int64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t hash_path(const char* path) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*path) {
+        h ^= (uint8_t)*path++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+MKStaticFiles* mk_static_new(const char* url_prefix, const char* root_dir) {
+    MKStaticFiles* s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    size_t len = strlen(url_prefix);
+    s->prefix = malloc(len + 2);
+    if (!s->prefix) {
+        free(s);
+        return NULL;
+    }
+    memcpy(s->prefix, url_prefix, len);
+    if (len == 0 || url_prefix[len - 1] != '/')
+        s->prefix[len++] = '/';
+    s->prefix[len] = '\0';
+    s->prefix_len = len;
+    init_list_head(&s->lru);
+
+    s->root_fd = open(root_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s->root_fd < 0) {
+        perror(root_dir);
+        free(s->prefix);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void entry_unref(MKStaticEntry* e) {
+    if (--e->ref_count == 0) {
+        for (int i = 0; i < MK_ENC_COUNT; i++) {
+            if (e->variants[i].fd >= 0)
+                close(e->variants[i].fd);
+        }
+        free(e);
+    }
+}
+
+static void entry_release(void* opaque) {
+    entry_unref(opaque);
+}
+
+static void cache_remove(MKStaticFiles* s, MKStaticEntry* e) {
+    MKStaticEntry** pe = &s->hash_table[e->hash & (MK_STATIC_HASH_SIZE - 1)];
+    while (*pe != e)
+        pe = &(*pe)->hash_next;
+    *pe = e->hash_next;
+    list_del(&e->link);
+    e->in_cache = false;
+    s->entry_count--;
+    // still used by the responses being sent, if any
+    entry_unref(e);
+}
+
+void mk_static_free(MKStaticFiles* s) {
+    struct list_head *el, *el1;
+    list_for_each_safe(el, el1, &s->lru) {
+        cache_remove(s, list_entry(el, MKStaticEntry, link));
+    }
+    close(s->root_fd);
+    free(s->prefix);
+    free(s);
+}
+
+// Return 0 if the file exists, -1 otherwise. 'fd' is not opened.
+static int stat_variant(MKStaticFiles* s, const char* path, int enc,
+                        MKStaticVariant* v) {
+    char name[PATH_MAX];
+    struct stat st;
+
+    snprintf(name, sizeof(name), "%s%s", path, enc_suffix[enc]);
+    memset(v, 0, sizeof(*v));
+    v->fd = -1;
+    if (fstatat(s->root_fd, name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+        return -1;
+    v->size = st.st_size;
+    v->ino = st.st_ino;
+    v->mtime = st.st_mtime;
+    return 0;
+}
+
+static bool variant_changed(const MKStaticVariant* v, const MKStaticVariant* v1) {
+    if ((v->fd >= 0) != (v1->fd >= 0))
+        return true;
+    return v->fd >= 0 &&
+        (v->size != v1->size || v->ino != v1->ino || v->mtime != v1->mtime);
+}
+
+// Return true if the entry still matches the files on disk
+static bool entry_check(MKStaticFiles* s, MKStaticEntry* e) {
+    MKStaticVariant v;
+    time_t mtime = 0;
+    for (int i = 0; i < MK_ENC_COUNT; i++) {
+        // 'fd' is only used as a presence flag
+        if (stat_variant(s, e->path, i, &v) == 0 &&
+            (i == MK_ENC_IDENTITY || v.mtime >= mtime))
+            v.fd = 0;
+        if (i == MK_ENC_IDENTITY)
+            mtime = v.mtime;
+        if (variant_changed(&e->variants[i], &v))
+            return false;
+    }
+    return true;
+}
+
+static MKStaticEntry* entry_open(MKStaticFiles* s, const char* path, uint32_t hash) {
+    size_t path_len = strlen(path);
+    MKStaticEntry* e = calloc(1, sizeof(*e) + path_len + 1);
+    if (!e)
+        return NULL;
+    memcpy(e->path, path, path_len + 1);
+    e->hash = hash;
+    e->ref_count = 1;
+    for (int i = 0; i < MK_ENC_COUNT; i++)
+        e->variants[i].fd = -1;
+
+    for (int i = 0; i < MK_ENC_COUNT; i++) {
+        MKStaticVariant* v = &e->variants[i];
+        char name[PATH_MAX];
+        struct stat st;
+
+        snprintf(name, sizeof(name), "%s%s", path, enc_suffix[i]);
+        v->fd = openat(s->root_fd, name, O_RDONLY | O_CLOEXEC);
+        // a compressed sibling older than the file is ignored
+        if (v->fd >= 0 &&
+            (fstat(v->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+             (i != MK_ENC_IDENTITY && st.st_mtime < e->variants[0].mtime))) {
+            close(v->fd);
+            v->fd = -1;
+        }
+        if (v->fd < 0) {
+            if (i == MK_ENC_IDENTITY)
+                break;
+            continue;
+        }
+        v->size = st.st_size;
+        v->ino = st.st_ino;
+        v->mtime = st.st_mtime;
+        if (i == MK_ENC_IDENTITY) {
+            snprintf(e->etag, sizeof(e->etag), "%lx-%llx",
+                     (unsigned long)st.st_mtime, (unsigned long long)st.st_size);
+            mk_http_format_date(e->last_modified, st.st_mtime);
+        }
+    }
+    if (e->variants[MK_ENC_IDENTITY].fd < 0) {
+        entry_unref(e);
+        return NULL;
+    }
+    e->content_type = get_content_type(path);
+    e->check_time = get_time_ms();
+    return e;
+}
+
+static MKStaticEntry* cache_lookup(MKStaticFiles* s, const char* path) {
+    uint32_t hash = hash_path(path);
+    MKStaticEntry* e;
+
+    for (e = s->hash_table[hash & (MK_STATIC_HASH_SIZE - 1)]; e; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->path, path) == 0)
+            break;
+    }
+    if (e) {
+        int64_t now = get_time_ms();
+        if (now - e->check_time < MK_STATIC_CHECK_INTERVAL_MS) {
+            goto found;
+        }
+        if (entry_check(s, e)) {
+            e->check_time = now;
+            goto found;
+        }
+        cache_remove(s, e);
+    }
+
+    e = entry_open(s, path, hash);
+    if (!e)
+        return NULL;
+    if (s->entry_count >= MK_STATIC_MAX_ENTRIES) {
+        // evict the least recently used entry
+        cache_remove(s, list_entry(s->lru.prev, MKStaticEntry, link));
+    }
+    e->hash_next = s->hash_table[hash & (MK_STATIC_HASH_SIZE - 1)];
+    s->hash_table[hash & (MK_STATIC_HASH_SIZE - 1)] = e;
+    list_add(&e->link, &s->lru);
+    e->in_cache = true;
+    s->entry_count++;
+    return e;
+ found:
+    list_del(&e->link);
+    list_add(&e->link, &s->lru);
+    return e;
+}
+
+static int hex_value(int c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Decode the URL path (without the route prefix) into a relative file
+// path. Return -1 if the path is invalid or refers to a hidden file or
+// a parent directory.
+static int decode_path(char* dst, size_t dst_size, const char* src, size_t len) {
+    size_t j = 0;
+    bool seg_start = true;
+
+    for (size_t i = 0; i < len; i++) {
+        int c = (uint8_t)src[i];
+        if (c == '%') {
+            int h, l;
+            if (i + 2 >= len)
+                return -1;
+            h = hex_value(src[i + 1]);
+            l = hex_value(src[i + 2]);
+            if (h < 0 || l < 0)
+                return -1;
+            c = (h << 4) | l;
+            i += 2;
+            if (c == '\0' || c == '/')
+                return -1;
+        }
+        if (seg_start && c == '.')
+            return -1; // "..", "." and hidden files
+        if (j + 1 >= dst_size)
+            return -1;
+        dst[j++] = c;
+        seg_start = (c == '/');
+    }
+    // directory index
+    if (j == 0 || dst[j - 1] == '/') {
+        const char* index = "index.html";
+        size_t index_len = strlen(index);
+        if (j + index_len + 1 > dst_size)
+            return -1;
+        memcpy(dst + j, index, index_len);
+        j += index_len;
+    }
+    dst[j] = '\0';
+    return 0;
+}
+
+// Return true if the If-None-Match list contains 'etag'
+static bool etag_match(const char* buf, const MKSlice* inm, const char* etag) {
+    const char* p = buf + inm->off;
+    const char* end = p + inm->len;
+    size_t etag_len = strlen(etag);
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',' || *p == '\t'))
+            p++;
+        if (p < end && *p == '*')
+            return true;
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2; // weak comparison
+        const char* tag_end = memchr(p, ',', end - p);
+        if (!tag_end)
+            tag_end = end;
+        const char* e = tag_end;
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+            e--;
+        if ((size_t)(e - p) == etag_len && memcmp(p, etag, etag_len) == 0)
+            return true;
+        p = tag_end;
+    }
+    return false;
+}
+
+// Return the gzip'ed content of a file which has no precompressed
+// sibling, NULL if it is not worth compressing. The result is kept in
+// the compress cache of the server, keyed by the path and the entity
+// tag of the file.
+static MKCompressed* get_compressed(MKHttpServer* server, MKStaticEntry* e) {
+    MKStaticVariant* v = &e->variants[MK_ENC_IDENTITY];
+    char key[PATH_MAX + 48];
+    size_t out_len;
+    int key_len;
+
+    if (!server->compress_cache || server->compress_level <= 0 ||
+        v->size < MK_HTTP_COMPRESS_MIN_SIZE || v->size > MK_STATIC_COMPRESS_MAX_SIZE ||
+        !mk_http_is_compressible(e->content_type))
+        return NULL;
+    key_len = snprintf(key, sizeof(key), "%s%c%s", e->path, '\0', e->etag);
+    if (key_len >= (int)sizeof(key))
+        return NULL;
+    MKCompressed* z = mk_compress_cache_get(server->compress_cache, key, key_len);
+    if (z)
+        return z;
+
+    uint8_t* buf = malloc(v->size);
+    if (!buf)
+        return NULL;
+    for (off_t pos = 0; pos < v->size;) {
+        ssize_t ret = pread(v->fd, buf + pos, v->size - pos, pos);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            free(buf);
+            return NULL;
+        }
+        pos += ret;
+    }
+    uint8_t* out = mk_deflate_buffer(buf, v->size, server->compress_level, true, &out_len);
+    free(buf);
+    if (!out)
+        return NULL;
+    // incompressible files are cached too so that they are not read again
+    return mk_compress_cache_put(server->compress_cache, key, key_len, out, out_len);
+}
+
+static void compressed_release(void* opaque) {
+    mk_compressed_unref(opaque);
+}
+
+static void send_simple(MKHttpConn* conn, int status, const char* extra_headers) {
+    char hdr[256];
+    const char* text = mk_http_status_text(status);
+    int len = snprintf(hdr, sizeof(hdr),
+                       "HTTP/1.1 %d %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n%s",
+                       status, text, strlen(text), extra_headers);
+    mk_http_send_head(conn, hdr, len);
+    mk_http_send_data(conn, text, strlen(text));
+    mk_http_end_response(conn);
+}
+
+bool mk_static_handle(MKStaticFiles* s, MKHttpConn* conn,
+                      const char* buf, const MKHttpRequest* req) {
+    const char* path = buf + req->path.off;
+    char rel_path[PATH_MAX];
+    char etag[48];
+    char hdr[1024];
+    const MKSlice* h;
+    int len, enc;
+
+    if (req->path.len < s->prefix_len ||
+        memcmp(path, s->prefix, s->prefix_len) != 0)
+        return false;
+
+    if (!mk_http_slice_equal(buf, req->method, "GET") &&
+        !mk_http_slice_equal(buf, req->method, "HEAD")) {
+        send_simple(conn, 405, "Allow: GET, HEAD\r\n");
+        return true;
+    }
+    if (decode_path(rel_path, sizeof(rel_path), path + s->prefix_len,
+                    req->path.len - s->prefix_len) < 0) {
+        send_simple(conn, 404, "");
+        return true;
+    }
+    MKStaticEntry* e = cache_lookup(s, rel_path);
+    if (!e) {
+        send_simple(conn, 404, "");
+        return true;
+    }
+
+    // select the representation
+    enc = MK_ENC_IDENTITY;
+    int mask = mk_http_accepted_encodings(buf, req);
+    for (int i = 1; i < MK_ENC_COUNT; i++) {
+        if (e->variants[i].fd >= 0 && (mask & (1 << i))) {
+            enc = i;
+            break;
+        }
+    }
+    bool has_variants = (e->variants[MK_ENC_BR].fd >= 0 ||
+                         e->variants[MK_ENC_GZIP].fd >= 0);
+    // compressed by the server if there is no sibling
+    MKCompressed* z = NULL;
+    if (!has_variants) {
+        z = get_compressed(mk_http_conn_server(conn), e);
+        if (z && z->len >= (size_t)e->variants[MK_ENC_IDENTITY].size) {
+            mk_compressed_unref(z);
+            z = NULL;
+        }
+        if (z) {
+            has_variants = true;
+            if (mask & MK_HTTP_ENC_GZIP) {
+                enc = MK_ENC_GZIP;
+            } else {
+                mk_compressed_unref(z);
+                z = NULL;
+            }
+        }
+    }
+    // each representation has its own entity tag
+    snprintf(etag, sizeof(etag), "\"%s%s%s\"", e->etag,
+             enc != MK_ENC_IDENTITY ? "-" : "",
+             enc != MK_ENC_IDENTITY ? enc_suffix[enc] + 1 : "");
+
+    len = snprintf(hdr, sizeof(hdr),
+                   "ETag: %s\r\n"
+                   "Last-Modified: %s\r\n"
+                   "%s",
+                   etag, e->last_modified,
+                   has_variants ? "Vary: Accept-Encoding\r\n" : "");
+
+    // conditional requests
+    bool not_modified;
+    h = mk_http_find_header(buf, req, "if-none-match");
+    if (h) {
+        not_modified = etag_match(buf, h, etag);
+    } else {
+        h = mk_http_find_header(buf, req, "if-modified-since");
+        not_modified = h && mk_http_slice_equal(buf, *h, e->last_modified);
+    }
+    if (not_modified) {
+        char hdr1[1200];
+        if (z)
+            mk_compressed_unref(z);
+        int len1 = snprintf(hdr1, sizeof(hdr1), "HTTP/1.1 304 Not Modified\r\n%.*s",
+                            len, hdr);
+        mk_http_send_head(conn, hdr1, len1);
+        mk_http_end_response(conn);
+        return true;
+    }
+
+    MKStaticVariant* v = &e->variants[enc];
+    char hdr1[1200];
+    int len1 = snprintf(hdr1, sizeof(hdr1),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %lld\r\n"
+                        "%s%s%s"
+                        "%.*s",
+                        e->content_type, z ? (long long)z->len : (long long)v->size,
+                        enc != MK_ENC_IDENTITY ? "Content-Encoding: " : "",
+                        enc != MK_ENC_IDENTITY ? enc_name[enc] : "",
+                        enc != MK_ENC_IDENTITY ? "\r\n" : "",
+                        len, hdr);
+    mk_http_send_head(conn, hdr1, len1);
+    if (z) {
+        mk_http_send_buffer(conn, z->data, z->len, compressed_release, z);
+        mk_http_end_response(conn);
+        return true;
+    }
+    // the entry remains valid until the file is sent
+    e->ref_count++;
+    mk_http_send_file(conn, v->fd, 0, v->size, entry_release, e);
+    mk_http_end_response(conn);
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef MANAKNIGHT_STATIC_H
+#define MANAKNIGHT_STATIC_H
+
+#include "manaknight_http.h"
+
+// Static file route: the requests whose path starts with 'url_prefix'
+// are served from 'root_dir' by the event loop with sendfile(). No JS
+// context is involved. The open files and their metadata are cached
+// and revalidated at most every MK_STATIC_CHECK_INTERVAL_MS.
+#define MK_STATIC_CHECK_INTERVAL_MS 1000
+#define MK_STATIC_MAX_ENTRIES       1024
+// Files without a precompressed sibling are gzip'ed in memory up to this
+// size if the server has a compress cache
+#define MK_STATIC_COMPRESS_MAX_SIZE (1024 * 1024)
+
+MKStaticFiles* mk_static_new(const char* url_prefix, const char* root_dir);
+void mk_static_free(MKStaticFiles* s);
+
+// Return true if the request matches the route. The response is then
+// emitted on 'conn'.
+bool mk_static_handle(MKStaticFiles* s, MKHttpConn* conn,
+                      const char* buf, const MKHttpRequest* req);
+
+#endif // MANAKNIGHT_STATIC_H
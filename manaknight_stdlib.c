@@ -0,0 +1,108 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mquickjs_build.h"
+
+/* Manaknight runtime: the effects of the routes (manaknight_runtime.c) */
+
+static const JSPropDef js_runtime_time[] = {
+    JS_CFUNC_DEF("now", 0, manaknight_time_now ),
+    JS_CFUNC_DEF("unixMillis", 0, manaknight_time_unixMillis ),
+    JS_CFUNC_DEF("sleep", 1, manaknight_time_sleep ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_random[] = {
+    JS_CFUNC_DEF("int", 0, manaknight_random_int ),
+    JS_CFUNC_DEF("intRange", 2, manaknight_random_intRange ),
+    JS_CFUNC_DEF("bytes", 1, manaknight_random_bytes ),
+    JS_CFUNC_DEF("uuidV4", 0, manaknight_random_uuidV4 ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_http[] = {
+    JS_CFUNC_DEF("get", 1, manaknight_http_get ),
+    JS_CFUNC_DEF("post", 2, manaknight_http_post ),
+    JS_CFUNC_DEF("put", 2, manaknight_http_put ),
+    JS_CFUNC_DEF("delete", 1, manaknight_http_delete ),
+    JS_CFUNC_DEF("head", 1, manaknight_http_head ),
+    JS_CFUNC_DEF("request", 1, manaknight_http_request ),
+    JS_PROP_END,
+};
+
+/* incoming request (valid while a handler runs) */
+static const JSPropDef js_runtime_request[] = {
+    JS_CFUNC_DEF("method", 0, manaknight_request_method ),
+    JS_CFUNC_DEF("path", 0, manaknight_request_path ),
+    JS_CFUNC_DEF("query", 0, manaknight_request_query ),
+    JS_CFUNC_DEF("header", 1, manaknight_request_header ),
+    JS_CFUNC_DEF("body", 0, manaknight_request_body ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_log[] = {
+    JS_CFUNC_DEF("info", 1, manaknight_log_info ),
+    JS_CFUNC_DEF("warn", 1, manaknight_log_warn ),
+    JS_CFUNC_DEF("error", 1, manaknight_log_error ),
+    JS_CFUNC_DEF("debug", 1, manaknight_log_debug ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_fs[] = {
+    JS_CFUNC_DEF("readFile", 1, manaknight_fs_readFile ),
+    JS_CFUNC_DEF("writeFile", 2, manaknight_fs_writeFile ),
+    JS_CFUNC_DEF("exists", 1, manaknight_fs_exists ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_crypto[] = {
+    JS_CFUNC_DEF("hashSha256", 1, manaknight_crypto_hashSha256 ),
+    JS_CFUNC_DEF("hmacSha256", 2, manaknight_crypto_hmacSha256 ),
+    JS_PROP_END,
+};
+
+static const JSPropDef js_runtime_env[] = {
+    JS_CFUNC_DEF("getEnv", 1, manaknight_env_getEnv ),
+    JS_PROP_END,
+};
+
+/* restricted */
+static const JSPropDef js_runtime_sys[] = {
+    JS_CFUNC_DEF("exit", 1, manaknight_sys_exit ),
+    JS_CFUNC_DEF("getPid", 0, manaknight_sys_getPid ),
+    JS_PROP_END,
+};
+
+static const JSClassDef js_runtime_time_obj = JS_OBJECT_DEF("Time", js_runtime_time);
+static const JSClassDef js_runtime_random_obj = JS_OBJECT_DEF("Random", js_runtime_random);
+static const JSClassDef js_runtime_http_obj = JS_OBJECT_DEF("Http", js_runtime_http);
+static const JSClassDef js_runtime_request_obj = JS_OBJECT_DEF("Request", js_runtime_request);
+static const JSClassDef js_runtime_log_obj = JS_OBJECT_DEF("Log", js_runtime_log);
+static const JSClassDef js_runtime_fs_obj = JS_OBJECT_DEF("Fs", js_runtime_fs);
+static const JSClassDef js_runtime_crypto_obj = JS_OBJECT_DEF("Crypto", js_runtime_crypto);
+static const JSClassDef js_runtime_env_obj = JS_OBJECT_DEF("Env", js_runtime_env);
+static const JSClassDef js_runtime_sys_obj = JS_OBJECT_DEF("Sys", js_runtime_sys);
+
+static const JSPropDef js_runtime_effects[] = {
+    JS_PROP_CLASS_DEF("time", &js_runtime_time_obj),
+    JS_PROP_CLASS_DEF("random", &js_runtime_random_obj),
+    JS_PROP_CLASS_DEF("http", &js_runtime_http_obj),
+    /* independent calls run concurrently (emitted by the compiler) */
+    JS_CFUNC_DEF("batch", 1, manaknight_effects_batch ),
+    JS_PROP_CLASS_DEF("request", &js_runtime_request_obj),
+    JS_PROP_CLASS_DEF("log", &js_runtime_log_obj),
+    JS_PROP_CLASS_DEF("fs", &js_runtime_fs_obj),
+    JS_PROP_CLASS_DEF("crypto", &js_runtime_crypto_obj),
+    JS_PROP_CLASS_DEF("env", &js_runtime_env_obj),
+    JS_PROP_CLASS_DEF("sys", &js_runtime_sys_obj),
+    JS_PROP_END,
+};
+
+static const JSClassDef js_runtime_effects_obj =
+    JS_OBJECT_DEF("ManaknightEffects", js_runtime_effects);
+
+/* include the full standard library too */
+
+#define CONFIG_MANAKNIGHT_RUNTIME
+#include "mqjs_stdlib.c"
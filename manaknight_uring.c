@@ -0,0 +1,360 @@
+#include "manaknight_uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void* arg, size_t arg_size) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int mk_uring_init(MKUring* r, unsigned entries) {
+    struct io_uring_params p;
+    int fd;
+
+    memset(r, 0, sizeof(*r));
+    r->ring_fd = -1;
+    memset(&p, 0, sizeof(p));
+    // the completions are only needed when the thread enters the kernel
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        fd = sys_io_uring_setup(entries, &p);
+    }
+    if (fd < 0)
+        return -1;
+    // the timeout of mk_uring_submit() needs IORING_FEAT_EXT_ARG
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return -1;
+    }
+    r->ring_fd = fd;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    r->ring_ptr = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->ring_ptr == MAP_FAILED)
+        goto fail;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring_ptr, r->ring_size);
+        goto fail;
+    }
+
+    uint8_t* ptr = r->ring_ptr;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned*)(ptr + p.sq_off.head);
+    r->sq_tail = (unsigned*)(ptr + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)(ptr + p.sq_off.ring_mask);
+    r->sqe_tail = *r->sq_tail;
+    // the submission array is the identity
+    unsigned* array = (unsigned*)(ptr + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    r->cq_head = (unsigned*)(ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)(ptr + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+    return 0;
+ fail:
+    close(fd);
+    r->ring_fd = -1;
+    return -1;
+}
+
+void mk_uring_close(MKUring* r) {
+    if (r->ring_fd < 0)
+        return;
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->ring_ptr, r->ring_size);
+    close(r->ring_fd);
+    r->ring_fd = -1;
+}
+
+struct io_uring_sqe* mk_uring_get_sqe(MKUring* r, MKUringOp* op) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) {
+        mk_uring_submit(r, 0);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sqe_tail - head >= r->sq_entries)
+            return NULL;
+    }
+    struct io_uring_sqe* sqe = &r->sqes[r->sqe_tail & r->sq_mask];
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uintptr_t)op;
+    return sqe;
+}
+
+int mk_uring_submit(MKUring* r, int timeout_ms) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    unsigned to_submit, min_complete = 0;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms != 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+        if (timeout_ms > 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            arg.ts = (uintptr_t)&ts;
+        }
+    } else if (to_submit == 0) {
+        return 0;
+    }
+    ret = sys_io_uring_enter(r->ring_fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+        return -1;
+    return 0;
+}
+
+int mk_uring_process(MKUring* r) {
+    int count = 0;
+    for (;;) {
+        unsigned head = *r->cq_head;
+        if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+            break;
+        struct io_uring_cqe* cqe = &r->cqes[head & r->cq_mask];
+        MKUringOp* op = (MKUringOp*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+        // released first: the callback may run the ring recursively
+        __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+        if (op)
+            op->complete(op, res, flags);
+        count++;
+    }
+    return count;
+}
+
+// Provided buffer ring
+
+int mk_uring_buf_ring_init(MKUring* r, MKUringBufRing* br, uint16_t bgid,
+                           unsigned entries, size_t buf_size) {
+    struct io_uring_buf_reg reg;
+
+    memset(br, 0, sizeof(*br));
+    br->ring_size = entries * sizeof(struct io_uring_buf);
+    br->ring = mmap(NULL, br->ring_size, PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br->ring == MAP_FAILED) {
+        br->ring = NULL;
+        return -1;
+    }
+    br->bufs = malloc(entries * buf_size);
+    if (!br->bufs) {
+        munmap(br->ring, br->ring_size);
+        br->ring = NULL;
+        return -1;
+    }
+    br->buf_size = buf_size;
+    br->entries = entries;
+    br->bgid = bgid;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)br->ring;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_io_uring_register(r->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(br->bufs);
+        munmap(br->ring, br->ring_size);
+        br->ring = NULL;
+        return -1;
+    }
+    for (unsigned i = 0; i < entries; i++)
+        mk_uring_buf_ring_recycle(br, i);
+    return 0;
+}
+
+void mk_uring_buf_ring_free(MKUring* r, MKUringBufRing* br) {
+    struct io_uring_buf_reg reg;
+    if (!br->ring)
+        return;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    sys_io_uring_register(r->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(br->bufs);
+    munmap(br->ring, br->ring_size);
+    br->ring = NULL;
+}
+
+void mk_uring_buf_ring_recycle(MKUringBufRing* br, unsigned bid) {
+    struct io_uring_buf* b = &br->ring->bufs[br->tail & (br->entries - 1)];
+    b->addr = (uintptr_t)mk_uring_buf_ring_get(br, bid);
+    b->len = br->buf_size;
+    b->bid = bid;
+    br->tail++;
+    __atomic_store_n(&br->ring->tail, br->tail, __ATOMIC_RELEASE);
+}
+
+// Files
+
+typedef struct {
+    MKUringOp op;
+    bool done;
+    int res;
+} MKUringWait;
+
+static void wait_complete(MKUringOp* op, int res, uint32_t flags) {
+    MKUringWait* w = (MKUringWait*)op;
+    w->done = true;
+    w->res = res;
+}
+
+static struct io_uring_sqe* wait_start(MKUring* r, MKUringWait* w) {
+    w->op.complete = wait_complete;
+    w->done = false;
+    w->res = 0;
+    return mk_uring_get_sqe(r, &w->op);
+}
+
+// Run the ring until 'w' completes
+static int wait_end(MKUring* r, MKUringWait* w) {
+    while (!w->done) {
+        if (mk_uring_submit(r, -1) < 0)
+            return -errno;
+        mk_uring_process(r);
+    }
+    return w->res;
+}
+
+static int uring_open(MKUring* r, const char* path, int flags) {
+    MKUringWait w;
+    struct io_uring_sqe* sqe = wait_start(r, &w);
+    if (!sqe)
+        return -EBUSY;
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->open_flags = flags | O_CLOEXEC;
+    sqe->len = 0644;
+    return wait_end(r, &w);
+}
+
+// Closing is not waited for
+static void uring_close(MKUring* r, int fd) {
+    struct io_uring_sqe* sqe = mk_uring_get_sqe(r, NULL);
+    if (!sqe) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+}
+
+int mk_uring_read_file(MKUring* r, const char* path, size_t max_size,
+                       uint8_t** pbuf, size_t* plen) {
+    struct statx stx;
+    MKUringWait w;
+    struct io_uring_sqe* sqe;
+    uint8_t* buf = NULL;
+    size_t pos = 0;
+    int fd, ret;
+
+    fd = uring_open(r, path, O_RDONLY);
+    if (fd < 0)
+        return fd;
+    sqe = wait_start(r, &w);
+    if (!sqe) {
+        ret = -EBUSY;
+        goto done;
+    }
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)"";
+    sqe->statx_flags = AT_EMPTY_PATH;
+    sqe->len = STATX_SIZE;
+    sqe->off = (uintptr_t)&stx;
+    ret = wait_end(r, &w);
+    if (ret < 0)
+        goto done;
+    if (stx.stx_size > max_size) {
+        ret = -EFBIG;
+        goto done;
+    }
+    buf = malloc(stx.stx_size + 1);
+    if (!buf) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    while (pos < stx.stx_size) {
+        sqe = wait_start(r, &w);
+        if (!sqe) {
+            ret = -EBUSY;
+            goto done;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)(buf + pos);
+        sqe->len = stx.stx_size - pos;
+        sqe->off = pos;
+        ret = wait_end(r, &w);
+        if (ret < 0)
+            goto done;
+        if (ret == 0)
+            break; // truncated meanwhile
+        pos += ret;
+    }
+    buf[pos] = '\0';
+    *pbuf = buf;
+    *plen = pos;
+    buf = NULL;
+    ret = 0;
+ done:
+    free(buf);
+    uring_close(r, fd);
+    return ret;
+}
+
+int mk_uring_write_file(MKUring* r, const char* path, const void* buf, size_t len) {
+    MKUringWait w;
+    struct io_uring_sqe* sqe;
+    size_t pos = 0;
+    int fd, ret = 0;
+
+    fd = uring_open(r, path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0)
+        return fd;
+    while (pos < len) {
+        sqe = wait_start(r, &w);
+        if (!sqe) {
+            ret = -EBUSY;
+            break;
+        }
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)((const uint8_t*)buf + pos);
+        sqe->len = len - pos;
+        sqe->off = pos;
+        ret = wait_end(r, &w);
+        if (ret < 0)
+            break;
+        pos += ret;
+        ret = 0;
+    }
+    uring_close(r, fd);
+    return ret;
+}
@@ -0,0 +1,77 @@
+#ifndef MANAKNIGHT_URING_H
+#define MANAKNIGHT_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper using the raw system calls (no liburing).
+// Each submission carries a pointer to an MKUringOp as user_data: its
+// 'complete' callback is called with the result of the operation.
+// A ring must only be used by one thread.
+
+typedef struct MKUringOp MKUringOp;
+
+struct MKUringOp {
+    void (*complete)(MKUringOp* op, int res, uint32_t flags);
+};
+
+typedef struct MKUring {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sqe_tail;          // prepared entries, published on submit
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    void* ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+} MKUring;
+
+// Return 0 if OK, -1 if io_uring is not available or too old
+int mk_uring_init(MKUring* r, unsigned entries);
+void mk_uring_close(MKUring* r);
+// Return a cleared submission entry. The ring is submitted if full.
+struct io_uring_sqe* mk_uring_get_sqe(MKUring* r, MKUringOp* op);
+// Submit the prepared entries and wait for at least one completion or
+// 'timeout_ms' (-1 = no timeout, 0 = no wait)
+int mk_uring_submit(MKUring* r, int timeout_ms);
+// Call the callbacks of the available completions. Return their count.
+int mk_uring_process(MKUring* r);
+
+// Provided buffer ring: the kernel picks a buffer for each receive and
+// returns its ID in the completion flags.
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    size_t ring_size;
+    uint8_t* bufs;
+    size_t buf_size;
+    unsigned entries;
+    uint16_t bgid;
+    uint16_t tail;
+} MKUringBufRing;
+
+int mk_uring_buf_ring_init(MKUring* r, MKUringBufRing* br, uint16_t bgid,
+                           unsigned entries, size_t buf_size);
+void mk_uring_buf_ring_free(MKUring* r, MKUringBufRing* br);
+static inline uint8_t* mk_uring_buf_ring_get(MKUringBufRing* br, unsigned bid) {
+    return br->bufs + bid * br->buf_size;
+}
+// Give the buffer back to the kernel
+void mk_uring_buf_ring_recycle(MKUringBufRing* br, unsigned bid);
+
+// File I/O which does not block the thread: the ring is run until the
+// operations complete, so the other completions are processed meanwhile.
+// Return 0 or -errno. mk_uring_read_file() returns a malloc'ed buffer
+// terminated by a null byte.
+int mk_uring_read_file(MKUring* r, const char* path, size_t max_size,
+                       uint8_t** pbuf, size_t* plen);
+int mk_uring_write_file(MKUring* r, const char* path, const void* buf, size_t len);
+
+#endif // MANAKNIGHT_URING_H
@@ -0,0 +1,158 @@
+#include "manaknight_vm_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MK_VM_POOL_HASH_SIZE 256 // must be a power of two
+
+typedef struct {
+    size_t mem_size;
+    void* idle[MK_VM_POOL_MAX_IDLE];
+    int idle_count;
+} MKVMClass;
+
+// Memory needed by the requests of a route: the max of the current and
+// of the previous window, so that the estimate follows the route when
+// its needs decrease
+typedef struct MKVMRoute {
+    struct MKVMRoute* hash_next;
+    uint64_t hash;
+    size_t need[2];
+    uint32_t sample_count;
+    size_t key_len;
+    char key[];
+} MKVMRoute;
+
+struct MKVMPool {
+    MKVMCreateFunc* create_func;
+    MKVMFreeFunc* free_func;
+    void* opaque;
+    int class_count;
+    MKVMClass classes[MK_VM_POOL_MAX_CLASSES];
+    int route_count;
+    MKVMRoute* hash_table[MK_VM_POOL_HASH_SIZE];
+};
+
+static uint64_t hash_key(const char* key, size_t len) {
+    uint64_t h = 0xcbf29ce484222325; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+MKVMPool* mk_vm_pool_new(size_t min_size, size_t max_size,
+                         MKVMCreateFunc* create_func, MKVMFreeFunc* free_func,
+                         void* opaque) {
+    MKVMPool* p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->create_func = create_func;
+    p->free_func = free_func;
+    p->opaque = opaque;
+    if (min_size > max_size)
+        min_size = max_size;
+    // the largest class is 'max_size' even if not a power of two of 'min_size'
+    for (size_t size = min_size; size < max_size && p->class_count < MK_VM_POOL_MAX_CLASSES - 1;
+         size *= 2) {
+        p->classes[p->class_count++].mem_size = size;
+    }
+    p->classes[p->class_count++].mem_size = max_size;
+    return p;
+}
+
+void mk_vm_pool_free(MKVMPool* p) {
+    for (int i = 0; i < p->class_count; i++) {
+        MKVMClass* c = &p->classes[i];
+        while (c->idle_count > 0)
+            p->free_func(p->opaque, c->idle[--c->idle_count]);
+    }
+    for (int i = 0; i < MK_VM_POOL_HASH_SIZE; i++) {
+        MKVMRoute* r = p->hash_table[i];
+        while (r) {
+            MKVMRoute* next = r->hash_next;
+            free(r);
+            r = next;
+        }
+    }
+    free(p);
+}
+
+int mk_vm_pool_class_count(MKVMPool* p) {
+    return p->class_count;
+}
+
+size_t mk_vm_pool_class_size(MKVMPool* p, int cls) {
+    return p->classes[cls].mem_size;
+}
+
+static MKVMRoute* find_route(MKVMPool* p, const char* key, size_t key_len, bool create) {
+    uint64_t h = hash_key(key, key_len);
+    MKVMRoute** pr = &p->hash_table[h & (MK_VM_POOL_HASH_SIZE - 1)];
+    MKVMRoute* r;
+
+    for (r = *pr; r; r = r->hash_next) {
+        if (r->hash == h && r->key_len == key_len && memcmp(r->key, key, key_len) == 0)
+            return r;
+    }
+    // the routes beyond the limit (e.g. paths with IDs) use the largest class
+    if (!create || p->route_count >= MK_VM_POOL_MAX_ROUTES)
+        return NULL;
+    r = calloc(1, sizeof(*r) + key_len);
+    if (!r)
+        return NULL;
+    r->hash = h;
+    r->key_len = key_len;
+    memcpy(r->key, key, key_len);
+    r->hash_next = *pr;
+    *pr = r;
+    p->route_count++;
+    return r;
+}
+
+int mk_vm_pool_route_class(MKVMPool* p, const char* route, size_t route_len) {
+    MKVMRoute* r = find_route(p, route, route_len, false);
+    size_t need;
+
+    if (!r)
+        return p->class_count - 1;
+    need = r->need[0] > r->need[1] ? r->need[0] : r->need[1];
+    // headroom so that the GC does not run at each allocation
+    need += need / 4;
+    for (int i = 0; i < p->class_count; i++) {
+        if (p->classes[i].mem_size >= need)
+            return i;
+    }
+    return p->class_count - 1;
+}
+
+void mk_vm_pool_record(MKVMPool* p, const char* route, size_t route_len,
+                       int cls, size_t used, bool out_of_memory) {
+    MKVMRoute* r = find_route(p, route, route_len, true);
+    if (!r)
+        return;
+    // at least the next class
+    if (out_of_memory && used <= p->classes[cls].mem_size)
+        used = p->classes[cls].mem_size + 1;
+    if (used > r->need[0])
+        r->need[0] = used;
+    if (++r->sample_count % MK_VM_POOL_WINDOW == 0) {
+        r->need[1] = r->need[0];
+        r->need[0] = 0;
+    }
+}
+
+void* mk_vm_pool_acquire(MKVMPool* p, int cls) {
+    MKVMClass* c = &p->classes[cls];
+    if (c->idle_count > 0)
+        return c->idle[--c->idle_count];
+    return p->create_func(p->opaque, c->mem_size);
+}
+
+void mk_vm_pool_release(MKVMPool* p, int cls, void* vm) {
+    MKVMClass* c = &p->classes[cls];
+    if (c->idle_count < MK_VM_POOL_MAX_IDLE)
+        c->idle[c->idle_count++] = vm;
+    else
+        p->free_func(p->opaque, vm);
+}
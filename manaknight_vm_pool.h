@@ -0,0 +1,44 @@
+#ifndef MANAKNIGHT_VM_POOL_H
+#define MANAKNIGHT_VM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Pools of VMs bucketed by memory size class (powers of two). Each
+// route runs in the smallest class which fits the high-water marks of
+// its recent requests. A route without history runs in the largest
+// class so that its first request measures it.
+// A pool must only be used by one thread.
+
+#define MK_VM_POOL_MAX_CLASSES 16
+#define MK_VM_POOL_MAX_IDLE    2    // idle VMs kept per class
+#define MK_VM_POOL_MAX_ROUTES  1024 // routes with statistics
+#define MK_VM_POOL_WINDOW      64   // requests per statistics window
+
+typedef struct MKVMPool MKVMPool;
+
+// Return a new VM with 'mem_size' bytes of memory or NULL
+typedef void* MKVMCreateFunc(void* opaque, size_t mem_size);
+typedef void MKVMFreeFunc(void* opaque, void* vm);
+
+MKVMPool* mk_vm_pool_new(size_t min_size, size_t max_size,
+                         MKVMCreateFunc* create_func, MKVMFreeFunc* free_func,
+                         void* opaque);
+void mk_vm_pool_free(MKVMPool* p);
+int mk_vm_pool_class_count(MKVMPool* p);
+size_t mk_vm_pool_class_size(MKVMPool* p, int cls);
+
+// Return the size class to run a request of 'route' with
+int mk_vm_pool_route_class(MKVMPool* p, const char* route, size_t route_len);
+// Record the memory used by a request of 'route' run in class 'cls'
+// (heap and stack high-water marks). If 'out_of_memory' is true, the
+// class was too small and the route is promoted.
+void mk_vm_pool_record(MKVMPool* p, const char* route, size_t route_len,
+                       int cls, size_t used, bool out_of_memory);
+
+// Return an idle VM of the class or a new one, NULL if memory error
+void* mk_vm_pool_acquire(MKVMPool* p, int cls);
+void mk_vm_pool_release(MKVMPool* p, int cls, void* vm);
+
+#endif // MANAKNIGHT_VM_POOL_H
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "manaknight_runtime.h"
+
+// Replay of a capture log against the compiled routes, in-process and
+// without network: deterministic performance regression tests
+
+static void print_usage(const char* program_name) {
+    printf("Manaknight Replay (mkreplay) v1.0.0\n");
+    printf("Usage: %s [options] <bytecode_file> <capture_log>\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -r, --rate <n>          Requests per second (default: as fast as possible)\n");
+    printf("  -n, --iterations <n>    Passes over the log (default: 1)\n");
+    printf("  -m, --memory <bytes>    Memory of the context (default: 16777216)\n");
+    printf("  -s, --stdlib <dir>      Standard library directory (default: none)\n");
+    printf("  -j, --json              Print the results as JSON\n");
+    printf("  -h, --help              Show this help message\n");
+}
+
+static void print_stats(const ManaknightReplayStats* s, int json) {
+    if (json) {
+        printf("{\"requests\": %llu, \"errors\": %llu, \"missing_effects\": %llu, "
+               "\"elapsed_us\": %llu, \"requests_per_second\": %.1f, "
+               "\"latency_us\": {\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+               "\"p999\": %llu, \"max\": %llu}, \"gc_count\": %u, "
+               "\"heap_size\": %zu, \"stack_size\": %zu, \"mem_size\": %zu}\n",
+               (unsigned long long)s->requests, (unsigned long long)s->errors,
+               (unsigned long long)s->missing_effects, (unsigned long long)s->elapsed_us,
+               s->requests_per_second,
+               (unsigned long long)s->latency_p50_us, (unsigned long long)s->latency_p90_us,
+               (unsigned long long)s->latency_p99_us, (unsigned long long)s->latency_p999_us,
+               (unsigned long long)s->latency_max_us, s->gc_count,
+               s->heap_size, s->stack_size, s->mem_size);
+        return;
+    }
+    printf("requests:        %llu (%llu errors, %llu missing effects)\n",
+           (unsigned long long)s->requests, (unsigned long long)s->errors,
+           (unsigned long long)s->missing_effects);
+    printf("elapsed:         %.3f s\n", s->elapsed_us / 1e6);
+    printf("throughput:      %.1f req/s\n", s->requests_per_second);
+    printf("latency (us):    p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+           (unsigned long long)s->latency_p50_us, (unsigned long long)s->latency_p90_us,
+           (unsigned long long)s->latency_p99_us, (unsigned long long)s->latency_p999_us,
+           (unsigned long long)s->latency_max_us);
+    printf("gc:              %u collections\n", s->gc_count);
+    printf("heap high-water: %zu / %zu bytes (stack %zu)\n",
+           s->heap_size, s->mem_size, s->stack_size);
+}
+
+int main(int argc, char* argv[]) {
+    ManaknightConfig config;
+    ManaknightReplayOptions options;
+    ManaknightReplayStats stats;
+    int json = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.memory_limit = 16 * 1024 * 1024;
+    memset(&options, 0, sizeof(options));
+    options.iterations = 1;
+
+    static struct option long_options[] = {
+        {"rate", required_argument, 0, 'r'},
+        {"iterations", required_argument, 0, 'n'},
+        {"memory", required_argument, 0, 'm'},
+        {"stdlib", required_argument, 0, 's'},
+        {"json", no_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:n:m:s:jh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                options.rate = atof(optarg);
+                break;
+            case 'n':
+                options.iterations = atoi(optarg);
+                break;
+            case 'm':
+                config.memory_limit = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                config.stdlib_path = optarg;
+                break;
+            case 'j':
+                json = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 2 > argc) {
+        fprintf(stderr, "Error: Bytecode file and capture log required\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    JSContext* ctx = manaknight_init(&config);
+    if (!ctx)
+        return 1;
+    if (manaknight_execute_bytecode(ctx, argv[optind]) != 0) {
+        manaknight_cleanup(ctx);
+        return 1;
+    }
+    if (manaknight_replay(ctx, argv[optind + 1], &options, &stats) != 0) {
+        manaknight_cleanup(ctx);
+        return 1;
+    }
+    print_stats(&stats, json);
+    manaknight_cleanup(ctx);
+    return stats.errors > 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#include "manaknight_runtime.h"
+
+// HTTP server of the compiled routes: the requests are dispatched by the
+// __handleRequest() the compiler generates. Runs until SIGINT or SIGTERM.
+
+static void print_usage(const char* program_name) {
+    printf("Manaknight Server (mkserve) v1.0.0\n");
+    printf("Usage: %s [options] <bytecode_file>\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -p, --port <n>          HTTP port (default: 8080)\n");
+    printf("  -m, --memory <bytes>    Memory of the context (default: 16777216)\n");
+    printf("  -t, --cpu-limit <ms>    Run time of a handler (default: no limit)\n");
+    printf("  -s, --stdlib <dir>      Standard library directory (default: none)\n");
+    printf("  -d, --static <dir>      Directory of static files (default: none)\n");
+    printf("  -P, --static-prefix <p> URL prefix of the static files (default: /)\n");
+    printf("  -z, --compress <level>  gzip level of the responses, 1-3 (default: none)\n");
+    printf("  -v, --vm-min <bytes>    Smallest request VM, enables the VM pools (default: none)\n");
+    printf("  -c, --capture <file>    Capture log of the requests (default: none)\n");
+    printf("  -u, --io-uring          Use io_uring instead of epoll if available\n");
+    printf("  -h, --help              Show this help message\n");
+}
+
+int main(int argc, char* argv[]) {
+    ManaknightConfig config;
+    sigset_t signals;
+    int sig;
+
+    memset(&config, 0, sizeof(config));
+    config.http_port = 8080;
+    config.memory_limit = 16 * 1024 * 1024;
+
+    static struct option long_options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"memory", required_argument, 0, 'm'},
+        {"cpu-limit", required_argument, 0, 't'},
+        {"stdlib", required_argument, 0, 's'},
+        {"static", required_argument, 0, 'd'},
+        {"static-prefix", required_argument, 0, 'P'},
+        {"compress", required_argument, 0, 'z'},
+        {"vm-min", required_argument, 0, 'v'},
+        {"capture", required_argument, 0, 'c'},
+        {"io-uring", no_argument, 0, 'u'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:m:t:s:d:P:z:v:c:uh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                config.http_port = atoi(optarg);
+                break;
+            case 'm':
+                config.memory_limit = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                config.cpu_time_limit = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                config.stdlib_path = optarg;
+                break;
+            case 'd':
+                config.static_dir = optarg;
+                break;
+            case 'P':
+                config.static_prefix = optarg;
+                break;
+            case 'z':
+                config.compress_level = atoi(optarg);
+                config.compress_cache_size = 16 * 1024 * 1024;
+                break;
+            case 'v':
+                config.vm_min_memory = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                config.capture_path = optarg;
+                break;
+            case 'u':
+                config.use_io_uring = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Error: Bytecode file required\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    config.app_bytecode_path = argv[optind];
+
+    // The signals are blocked in all the threads and waited for here
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // The routes are loaded before the server accepts requests
+    JSContext* ctx = manaknight_init(&config);
+    if (!ctx)
+        return 1;
+    if (manaknight_execute_bytecode(ctx, config.app_bytecode_path) != 0 ||
+        manaknight_start_http_server(ctx, &config) != 0) {
+        manaknight_cleanup(ctx);
+        return 1;
+    }
+    fflush(stdout);
+
+    sigwait(&signals, &sig);
+    manaknight_cleanup(ctx);
+    return 0;
+}
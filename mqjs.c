@@ -34,6 +34,9 @@
 #include <sys/time.h>
 #include <math.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cutils.h"
 #include "readline_tty.h"
@@ -432,6 +435,78 @@ static uint8_t *load_file(const char *filename, int *plen)
     return buf;
 }
 
+/* Map a bytecode file. The mapping is private so that the pages
+   which are not modified by JS_RelocateBytecode() (strings and byte
+   code) remain shared with the other processes. Return NULL if the
+   file is not a bytecode file. */
+static uint8_t *map_bytecode_file(const char *filename, int *plen)
+{
+    JSBytecodeHeader hdr;
+    struct stat st;
+    void *buf;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (fstat(fd, &st) < 0 ||
+        read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        !JS_IsBytecode((uint8_t *)&hdr, sizeof(hdr))) {
+        close(fd);
+        return NULL;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        perror(filename);
+        exit(1);
+    }
+    *plen = st.st_size;
+    return buf;
+}
+
+/* Map a source file so that it is parsed in place. The parser needs
+   a '\0' after the source: it is provided by the zero filled end of
+   the last page. Return NULL if the file size is a multiple of the
+   page size (or zero) so that the caller falls back to load_file(). */
+static uint8_t *map_source_file(const char *filename, int *plen)
+{
+    struct stat st;
+    void *buf;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (fstat(fd, &st) < 0 ||
+        (st.st_size % sysconf(_SC_PAGESIZE)) == 0) {
+        close(fd);
+        return NULL;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return NULL;
+    *plen = st.st_size;
+    return buf;
+}
+
+/* relocate the mapped bytecode and make it read-only */
+static int relocate_bytecode_file(JSContext *ctx, uint8_t *buf, int buf_len)
+{
+    if (JS_RelocateBytecode(ctx, buf, buf_len))
+        return -1;
+    if (mprotect(buf, buf_len, PROT_READ) < 0) {
+        perror("mprotect");
+        return -1;
+    }
+    return 0;
+}
+
 static int js_log_err_flag;
 
 static void js_log_func(void *opaque, const void *buf, size_t buf_len)
@@ -450,11 +525,68 @@ static void dump_error(JSContext *ctx)
     fprintf(stderr, "%s\n", term_colors[COLOR_NONE]);
 }
 
+/* data images: read-only JSON values shared by all the contexts */
+
+typedef struct {
+    const char *name;
+    uint8_t *buf;
+    JSValue val;
+} DataImage;
+
+static DataImage data_images[8];
+static int data_image_count;
+static BOOL data_images_defined;
+
+static void load_data_images(JSContext *ctx)
+{
+    DataImage *d;
+    int i, buf_len;
+
+    for(i = 0; i < data_image_count; i++) {
+        d = &data_images[i];
+        d->buf = map_bytecode_file(strchr(d->name, '=') + 1, &buf_len);
+        if (!d->buf ||
+            relocate_bytecode_file(ctx, d->buf, buf_len)) {
+            fprintf(stderr, "%s: invalid data image\n",
+                    strchr(d->name, '=') + 1);
+            exit(1);
+        }
+        d->val = JS_LoadBytecode(ctx, d->buf);
+        if (JS_IsException(d->val)) {
+            dump_error(ctx);
+            exit(1);
+        }
+    }
+}
+
+/* must be defined after JS_LoadBytecode() */
+static void define_data_images(JSContext *ctx)
+{
+    DataImage *d;
+    JSValue obj;
+    char name[64];
+    int i, len;
+
+    if (data_images_defined)
+        return;
+    data_images_defined = TRUE;
+    obj = JS_GetGlobalObject(ctx);
+    for(i = 0; i < data_image_count; i++) {
+        d = &data_images[i];
+        len = min_int(strchr(d->name, '=') - d->name, sizeof(name) - 1);
+        memcpy(name, d->name, len);
+        name[len] = '\0';
+        JS_SetPropertyStr(ctx, obj, name, d->val);
+    }
+}
+
 static int eval_buf(JSContext *ctx, const char *eval_str, const char *filename, BOOL is_repl, int parse_flags)
 {
     JSValue val;
     int flags;
 
+    define_data_images(ctx);
+
     flags = parse_flags;
     if (is_repl)
         flags |= JS_EVAL_RETVAL | JS_EVAL_REPL;
@@ -485,15 +617,35 @@ static int eval_file(JSContext *ctx, const char *filename,
     int ret, buf_len;
     JSValue val;
 
-    buf = load_file(filename, &buf_len);
-    if (allow_bytecode && JS_IsBytecode(buf, buf_len)) {
-        if (JS_RelocateBytecode(ctx, buf, buf_len)) {
+    buf = NULL;
+    if (allow_bytecode)
+        buf = map_bytecode_file(filename, &buf_len);
+    if (buf) {
+        /* the image must remain mapped as long as the context exists */
+        if (relocate_bytecode_file(ctx, buf, buf_len)) {
             fprintf(stderr, "Could not relocate bytecode\n");
             exit(1);
         }
         val = JS_LoadBytecode(ctx, buf);
+        if (!JS_IsException(val)) {
+            JSGCRef val_ref;
+            JS_PUSH_VALUE(ctx, val);
+            define_data_images(ctx);
+            JS_POP_VALUE(ctx, val);
+        }
     } else {
+        BOOL is_mapped;
+        buf = map_source_file(filename, &buf_len);
+        is_mapped = (buf != NULL);
+        if (!is_mapped)
+            buf = load_file(filename, &buf_len);
+        define_data_images(ctx);
+        /* the source is not referenced after parsing */
         val = JS_Parse(ctx, (char *)buf, buf_len, filename, parse_flags);
+        if (is_mapped)
+            munmap(buf, buf_len);
+        else
+            free(buf);
     }
     if (JS_IsException(val))
         goto exception;
@@ -526,7 +678,6 @@ static int eval_file(JSContext *ctx, const char *filename,
     } else {
         ret = 0;
     }
-    free(buf);
     return ret;
 }
 
@@ -559,6 +710,11 @@ static void compile_file(const char *filename, const char *outfilename,
 
     eval_str = (char *)load_file(filename, NULL);
 
+    if ((parse_flags & JS_EVAL_JSON) && force_32bit) {
+        fprintf(stderr, "-m32 is not supported with --json\n");
+        exit(1);
+    }
+
     val = JS_Parse(ctx, eval_str, strlen(eval_str), filename, parse_flags);
     free(eval_str);
     if (JS_IsException(val)) {
@@ -584,7 +740,10 @@ static void compile_file(const char *filename, const char *outfilename,
         /* Relocate to zero to have a deterministic
            output. JS_DumpMemory() cannot work once the heap is relocated,
            so we relocate after it. */
-        JS_RelocateBytecode2(ctx, &hdr_buf.hdr, (uint8_t *)data_buf, data_len, 0, FALSE);
+        if (JS_RelocateBytecode2(ctx, &hdr_buf.hdr, (uint8_t *)data_buf, data_len, 0, FALSE)) {
+            fprintf(stderr, "Could not relocate the bytecode\n");
+            exit(1);
+        }
         hdr_len = sizeof(JSBytecodeHeader);
     }
     f = fopen(outfilename, "wb");
@@ -751,7 +910,9 @@ static void help(void)
            "--no-column           no column number in debug information\n"
            "-o FILE               save the bytecode to FILE\n"
            "-m32                  force 32 bit bytecode output (use with -o)\n"
-           "-b  --allow-bytecode  allow bytecode in input file\n");
+           "-b  --allow-bytecode  allow bytecode in input file\n"
+           "    --json            compile a JSON file to a data image (use with -o)\n"
+           "    --data name=file  define the global 'name' from a data image\n");
     exit(1);
 }
 
@@ -883,6 +1044,22 @@ int main(int argc, const char **argv)
                 allow_bytecode = TRUE;
                 continue;
             }
+            if (!strcmp(longopt, "json")) {
+                parse_flags |= JS_EVAL_JSON;
+                continue;
+            }
+            if (!strcmp(longopt, "data")) {
+                if (optind >= argc || !strchr(argv[optind], '=')) {
+                    fprintf(stderr, "expecting name=file\n");
+                    exit(1);
+                }
+                if (data_image_count >= countof(data_images)) {
+                    fprintf(stderr, "too many data images\n");
+                    exit(1);
+                }
+                data_images[data_image_count++].name = argv[optind++];
+                continue;
+            }
             if (opt) {
                 fprintf(stderr, "qjs: unknown option '-%c'\n", opt);
             } else {
@@ -908,6 +1085,7 @@ int main(int argc, const char **argv)
             gettimeofday(&tv, NULL);
             JS_SetRandomSeed(ctx, ((uint64_t)tv.tv_sec << 32) ^ tv.tv_usec);
         }
+        load_data_images(ctx);
 
         for(i = 0; i < include_count; i++) {
             if (eval_file(ctx, include_list[i], 0, NULL,
@@ -929,6 +1107,7 @@ int main(int argc, const char **argv)
         }
 
         if (interactive) {
+            define_data_images(ctx);
             repl_run(ctx);
         } else {
             run_timers(ctx);
@@ -34,8 +34,11 @@
 
 /* defined in mqjs_example.c */
 //#define CONFIG_CLASS_EXAMPLE
+/* defined in manaknight_stdlib.c */
+//#define CONFIG_MANAKNIGHT_RUNTIME
 
-/* Forward declarations for Manaknight Effects - implemented in mqjs.c */
+#if !defined(CONFIG_CLASS_EXAMPLE) && !defined(CONFIG_MANAKNIGHT_RUNTIME)
+/* Manaknight Effects of mqjs - implemented in mqjs.c */
 
 static const JSPropDef js_time_obj[] = {
     JS_CFUNC_DEF("now", 0, js_time_now),
@@ -80,6 +83,7 @@ static const JSPropDef js_manaknight_effects[] = {
 
 static const JSClassDef js_manaknight_effects_obj =
     JS_OBJECT_DEF("ManaknightEffects", js_manaknight_effects);
+#endif
 
 static const JSPropDef js_object_proto[] = {
     JS_CFUNC_DEF("hasOwnProperty", 1, js_object_hasOwnProperty),
@@ -290,6 +294,15 @@ static const JSPropDef js_json[] = {
 static const JSClassDef js_json_obj =
     JS_OBJECT_DEF("JSON", js_json);
 
+static const JSPropDef js_string_builder_proto[] = {
+    JS_CFUNC_DEF("append", 1, js_string_builder_append ),
+    JS_CFUNC_DEF("toString", 0, js_string_builder_toString ),
+    JS_PROP_END,
+};
+
+static const JSClassDef js_string_builder_class =
+    JS_CLASS_DEF("StringBuilder", 1, js_string_builder_constructor, JS_CLASS_STRING_BUILDER, NULL, js_string_builder_proto, NULL, NULL);
+
 /* typed arrays */
 static const JSPropDef js_array_buffer_proto[] = {
     JS_CGETSET_DEF("byteLength", js_array_buffer_get_byteLength, NULL ),
@@ -326,6 +339,28 @@ static const JSPropDef js_ ## name ## _proto[] = {\
 static const JSClassDef js_ ## name ## _class =\
     JS_CLASS_MAGIC_DEF(#name, 3, js_typed_array_constructor, class_name, js_ ## name, js_ ## name ## _proto, &js_typed_array_base_class, NULL);
 
+/* non standard vector methods of Float32Array and Float64Array */
+#define FLOAT_TA_DEF(name, class_name, bpe)\
+static const JSPropDef js_ ## name [] = {\
+    JS_PROP_DOUBLE_DEF("BYTES_PER_ELEMENT", bpe, 0),\
+    JS_PROP_END,\
+};\
+static const JSPropDef js_ ## name ## _proto[] = {\
+    JS_PROP_DOUBLE_DEF("BYTES_PER_ELEMENT", bpe, 0),\
+    JS_CFUNC_MAGIC_DEF("exp", 0, js_float_array_map, js_float_array_exp ),\
+    JS_CFUNC_MAGIC_DEF("log", 0, js_float_array_map, js_float_array_log ),\
+    JS_CFUNC_MAGIC_DEF("sqrt", 0, js_float_array_map, js_float_array_sqrt ),\
+    JS_CFUNC_MAGIC_DEF("pow", 1, js_float_array_map, js_float_array_pow ),\
+    JS_CFUNC_MAGIC_DEF("scale", 2, js_float_array_map, js_float_array_scale ),\
+    JS_CFUNC_MAGIC_DEF("sum", 0, js_float_array_reduce, js_float_array_sum ),\
+    JS_CFUNC_MAGIC_DEF("min", 0, js_float_array_reduce, js_float_array_min ),\
+    JS_CFUNC_MAGIC_DEF("max", 0, js_float_array_reduce, js_float_array_max ),\
+    JS_CFUNC_MAGIC_DEF("dot", 1, js_float_array_reduce, js_float_array_dot ),\
+    JS_PROP_END,\
+};\
+static const JSClassDef js_ ## name ## _class =\
+    JS_CLASS_MAGIC_DEF(#name, 3, js_typed_array_constructor, class_name, js_ ## name, js_ ## name ## _proto, &js_typed_array_base_class, NULL);
+
 TA_DEF(Uint8ClampedArray, JS_CLASS_UINT8C_ARRAY, 1)
 TA_DEF(Int8Array, JS_CLASS_INT8_ARRAY, 1)
 TA_DEF(Uint8Array, JS_CLASS_UINT8_ARRAY, 1)
@@ -333,8 +368,8 @@ TA_DEF(Int16Array, JS_CLASS_INT16_ARRAY, 2)
 TA_DEF(Uint16Array, JS_CLASS_UINT16_ARRAY, 2)
 TA_DEF(Int32Array, JS_CLASS_INT32_ARRAY, 4)
 TA_DEF(Uint32Array, JS_CLASS_UINT32_ARRAY, 4)
-TA_DEF(Float32Array, JS_CLASS_FLOAT32_ARRAY, 4)
-TA_DEF(Float64Array, JS_CLASS_FLOAT64_ARRAY, 8)
+FLOAT_TA_DEF(Float32Array, JS_CLASS_FLOAT32_ARRAY, 4)
+FLOAT_TA_DEF(Float64Array, JS_CLASS_FLOAT64_ARRAY, 8)
 
 /* regexp */
 
@@ -386,6 +421,7 @@ static const JSPropDef js_global_object[] = {
     JS_PROP_CLASS_DEF("Date", &js_date_class),
     JS_PROP_CLASS_DEF("JSON", &js_json_obj),
     JS_PROP_CLASS_DEF("RegExp", &js_regexp_class),
+    JS_PROP_CLASS_DEF("StringBuilder", &js_string_builder_class),
 
     JS_PROP_CLASS_DEF("Error", &js_error_class),
     JS_PROP_CLASS_DEF("EvalError", &js_eval_error_class),
@@ -423,18 +459,21 @@ static const JSPropDef js_global_object[] = {
     JS_PROP_CLASS_DEF("performance", &js_performance_obj),
 
     JS_CFUNC_DEF("print", 1, js_print),
-#ifdef CONFIG_CLASS_EXAMPLE
+#if defined(CONFIG_CLASS_EXAMPLE)
     JS_PROP_CLASS_DEF("Rectangle", &js_rectangle_class),
     JS_PROP_CLASS_DEF("FilledRectangle", &js_filled_rectangle_class),
+#elif defined(CONFIG_MANAKNIGHT_RUNTIME)
+    /* Manaknight Effects of the runtime */
+    JS_PROP_CLASS_DEF("__effects", &js_runtime_effects_obj),
 #else
     JS_CFUNC_DEF("gc", 0, js_gc),
     JS_CFUNC_DEF("load", 1, js_load),
     JS_CFUNC_DEF("setTimeout", 2, js_setTimeout),
     JS_CFUNC_DEF("clearTimeout", 1, js_clearTimeout),
-#endif
 
     /* Manaknight Effects */
     JS_PROP_CLASS_DEF("__effects", &js_manaknight_effects_obj),
+#endif
 
     JS_PROP_END,
 };
@@ -68,8 +68,13 @@
 #define JS_MAX_CALL_RECURSE 8
 
 
+#ifdef JS_NAN_BOXING
+#define JS_VALUE_IS_BOTH_INT(a, b) (((((a) + JS_NAN_BOXING_OFFSET) | ((b) + JS_NAN_BOXING_OFFSET)) & (JS_NAN_BOXING_MASK | 1)) == 0)
+#define JS_VALUE_IS_BOTH_SHORT_FLOAT(a, b) (JS_IsShortFloat(a) && JS_IsShortFloat(b))
+#else
 #define JS_VALUE_IS_BOTH_INT(a, b) ((((a) | (b)) & 1) == 0)
 #define JS_VALUE_IS_BOTH_SHORT_FLOAT(a, b) (((((a) - JS_TAG_SHORT_FLOAT) | ((b) - JS_TAG_SHORT_FLOAT)) & 7) == 0)
+#endif
 
 static __maybe_unused const char *js_mtag_name[JS_MTAG_COUNT] = {
     "free",
@@ -179,8 +184,6 @@ typedef struct JSROMClass {
     JSValue parent_class; /* JSROMClass or JS_NULL */
 } JSROMClass;
 
-#define N_ROM_ATOM_TABLES_MAX 2
-
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
 #define JS_INTERRUPT_COUNTER_INIT 10000
@@ -216,7 +219,11 @@ struct JSContext {
     uint32_t min_free_size; /* min free size between heap_free and the
                                bottom of the stack */
     BOOL in_out_of_memory : 8; /* != 0 if generating the out of memory object */
-    uint8_t n_rom_atom_tables;
+    BOOL has_forwarded_atoms : 8; /* != 0 if free blocks forward RAM
+                                     atoms to image atoms (see
+                                     JS_LoadBytecode()) */
+    BOOL is_heap_32bit : 8; /* != 0 if the heap was converted to 32 bit
+                               values (see JS_PrepareBytecode64to32()) */
     uint8_t string_pos_cache_counter; /* used for string_pos_cache[] update */
     uint16_t class_count; /* number of classes including user classes */
     int16_t interrupt_counter;
@@ -227,8 +234,7 @@ struct JSContext {
     JSGCRef *top_gc_ref; /* used to reference temporary GC roots (stack top) */
     JSGCRef *last_gc_ref; /* used to reference temporary GC roots (list) */
     const JSWord *atom_table; /* constant atom table */
-    /* 'n_rom_atom_tables' atom tables from code loaded from rom */
-    const JSValueArray *rom_atom_tables[N_ROM_ATOM_TABLES_MAX];
+    const JSValueArray *rom_atom_table; /* sorted stdlib atoms or NULL */
     const JSCFunctionDef *c_function_table;
     const JSCFinalizer *c_finalizer_table;
     uint64_t random_state;
@@ -237,12 +243,23 @@ struct JSContext {
     void *opaque;
     JSValue *class_obj; /* same as class_proto + class_count */
     JSStringPosCacheEntry string_pos_cache[JS_STRING_POS_CACHE_SIZE];
+    /* statistics of the last bytecode deduplication (see bc_dedup()) */
+    uint32_t bc_dedup_count; /* number of merged memory blocks */
+    uint32_t bc_dedup_size; /* saved size in bytes */
+    /* high-water marks (see JS_GetMemoryHighWater()) */
+    uint8_t *heap_free_max; /* updated at each GC */
+    uint8_t *heap_free_start; /* heap_free at the last reset */
+    JSValue *stack_bottom_min;
+    uint32_t out_of_memory_count;
+    uint32_t gc_count;
                                            
     /* must only contain JSValue from this point (see JS_GC()) */
     JSValue unique_strings; /* JSValueArray of sorted strings or JS_NULL */
     
     JSValue current_exception; /* currently pending exception, must
                                   come after unique_strings */
+    JSValue image_atoms; /* JSValueArray of the sorted atoms of all the
+                            loaded bytecode images or JS_NULL */
 #ifdef DEBUG_GC
     JSValue dummy_block; /* dummy memory block near the start of the memory */
 #endif
@@ -259,8 +276,16 @@ typedef enum {
     JS_VARREF_KIND_VAR, /* var_idx is a local variable of the parent function */
     JS_VARREF_KIND_VAR_REF, /* var_idx is a var ref of the parent function */
     JS_VARREF_KIND_GLOBAL, /* to debug */
+    JS_VARREF_KIND_ARG_VALUE, /* copy of the argument var_idx of the
+                                 parent function */
+    JS_VARREF_KIND_VAR_REF_VALUE, /* copy of the value var_idx of the
+                                     parent function */
 } JSVarRefKindEnum;
 
+/* set in the ext_vars declarations during the compilation if the
+   variable is modified by the function or one of its children */
+#define JS_VARREF_WRITTEN (1 << 20)
+
 typedef struct JSObject JSObject;
 
 typedef struct {
@@ -293,13 +318,22 @@ typedef struct {
 
 typedef struct {
     JSValue message; /* string or JS_NULL */
-    JSValue stack; /* string or JS_NULL */
+    JSValue stack; /* string, JSValueArray of (function, pc) pairs
+                      if not formatted yet (see build_backtrace()) or
+                      JS_NULL */
 } JSErrorData;
     
 typedef struct {
     JSValue byte_buffer; /* JSByteBuffer */
 } JSArrayBuffer;
 
+/* same fields as StringBuffer */
+typedef struct {
+    JSValue buffer; /* string or JSByteBuffer */
+    int len; /* current string length (in bytes) */
+    BOOL is_ascii;
+} JSStringBuilder;
+
 typedef struct {
     JSValue buffer; /* corresponding array buffer */
     uint32_t len; /* in elements */
@@ -338,6 +372,7 @@ struct JSObject {
         JSArrayBuffer array_buffer;
         JSTypedArray typed_array;
         JSRegExp regexp;
+        JSStringBuilder string_builder;
         JSObjectUserData user;
     } u;
 };
@@ -377,6 +412,7 @@ static int JS_ToUint8Clamp(JSContext *ctx, int *pres, JSValue val);
 static JSValue js_set_prototype_internal(JSContext *ctx, JSValue obj, JSValue proto);
 static JSValue js_resize_byte_array(JSContext *ctx, JSValue val, int new_size);
 static JSValueArray *js_alloc_props(JSContext *ctx, int n);
+static BOOL js_is_enumerated(JSContext *ctx, JSValue obj);
 
 typedef enum OPCodeFormat {
 #define FMT(f) OP_FMT_ ## f,
@@ -525,6 +561,8 @@ int JS_StackCheck(JSContext *ctx, uint32_t len)
     if (check_free_mem(ctx, new_stack_bottom, len * sizeof(JSValue)))
         return -1;
     ctx->stack_bottom = new_stack_bottom;
+    if (new_stack_bottom < ctx->stack_bottom_min)
+        ctx->stack_bottom_min = new_stack_bottom;
     return 0;
 }
 
@@ -943,6 +981,7 @@ JSValue JS_ThrowOutOfMemory(JSContext *ctx)
     if (ctx->in_out_of_memory)
         return JS_Throw(ctx, JS_NULL);
     ctx->in_out_of_memory = TRUE;
+    ctx->out_of_memory_count++;
     ctx->min_free_size = JS_MIN_CRITICAL_FREE_SIZE;
     val = JS_ThrowInternalError(ctx, "out of memory");
     ctx->in_out_of_memory = FALSE;
@@ -953,7 +992,27 @@ JSValue JS_ThrowOutOfMemory(JSContext *ctx)
 #define JS_SHORTINT_MIN (-(1 << 30))
 #define JS_SHORTINT_MAX ((1 << 30) - 1)
 
-#ifdef JS_USE_SHORT_FLOAT
+#ifdef JS_NAN_BOXING
+
+/* zero is excluded so that it remains a short integer */
+#define js_is_short_float_range(d) ((d) != 0)
+
+static double js_get_short_float(JSValue v)
+{
+    return uint64_as_float64(v - JS_NAN_BOXING_OFFSET);
+}
+
+static JSValue js_to_short_float(double d)
+{
+    if (unlikely(isnan(d)))
+        return 0x7ff8000000000000 + JS_NAN_BOXING_OFFSET;
+    return float64_as_uint64(d) + JS_NAN_BOXING_OFFSET;
+}
+
+#elif defined(JS_USE_SHORT_FLOAT)
+
+/* Note: this test is false for NaN */
+#define js_is_short_float_range(d) (fabs(d) >= 0x1p-127 && fabs(d) <= 0x1p+128)
 
 #define JS_FLOAT64_VALUE_EXP_MIN (1023 - 127)
 #define JS_FLOAT64_VALUE_ADDEND ((uint64_t)(JS_FLOAT64_VALUE_EXP_MIN - (JS_TAG_SHORT_FLOAT << 8)) << 52)
@@ -995,8 +1054,7 @@ static JSValue __JS_NewFloat64(JSContext *ctx, double d)
         return ctx->minus_zero;
     } else
 #ifdef JS_USE_SHORT_FLOAT
-    /* Note: this test is false for NaN */
-    if (fabs(d) >= 0x1p-127 && fabs(d) <= 0x1p+128) {
+    if (js_is_short_float_range(d)) {
         return js_to_short_float(d);
     } else
 #endif
@@ -1010,6 +1068,22 @@ static inline JSValue JS_NewShortInt(int32_t val)
     return JS_TAG_INT + (val << 1);
 }
 
+/* The objects saved in a data image cannot reference the prototypes
+   of a context, so they store the class id of their prototype. */
+#define JS_PROTO_CLASS(class_id) JS_NewShortInt(class_id)
+
+static inline JSValue js_get_proto(JSContext *ctx, const JSObject *p)
+{
+    if (unlikely(JS_IsInt(p->proto)))
+        return ctx->class_proto[JS_VALUE_GET_INT(p->proto)];
+    return p->proto;
+}
+
+static JSValue JS_ThrowTypeErrorReadOnly(JSContext *ctx)
+{
+    return JS_ThrowTypeError(ctx, "object is read-only");
+}
+
 #if defined(USE_SOFTFLOAT)
 JSValue JS_NewFloat64(JSContext *ctx, double d)
 {
@@ -1394,7 +1468,7 @@ static JSValue js_byte_array_to_string(JSContext *ctx, JSValue val, int len, BOO
 }
 
 /* in bytes */
-static __maybe_unused int js_string_byte_len(JSContext *ctx, JSValue val)
+static int js_string_byte_len(JSContext *ctx, JSValue val)
 {
     if (JS_VALUE_GET_SPECIAL_TAG(val) == JS_TAG_STRING_CHAR) {
         int c = JS_VALUE_GET_SPECIAL_VALUE(val);
@@ -1996,14 +2070,34 @@ static JSValue find_atom(JSContext *ctx, int *pidx, const JSValueArray *arr, int
     return JS_NULL;
 }
 
+/* find the string 'val' in the stdlib atoms and in the atoms of the
+   loaded bytecode images. Return JS_NULL if not found. */
+static JSValue find_rom_atom(JSContext *ctx, JSValue val)
+{
+    const JSValueArray *arr;
+    JSValue val1;
+    int a;
+
+    arr = ctx->rom_atom_table;
+    if (arr) {
+        val1 = find_atom(ctx, &a, arr, arr->size, val);
+        if (!JS_IsNull(val1))
+            return val1;
+    }
+    if (!JS_IsNull(ctx->image_atoms)) {
+        arr = JS_VALUE_TO_PTR(ctx->image_atoms);
+        return find_atom(ctx, &a, arr, arr->size, val);
+    }
+    return JS_NULL;
+}
+
 /* if 'val' is not a string, it is returned */
 /* XXX: use hash table */
 static JSValue JS_MakeUniqueString(JSContext *ctx, JSValue val)
 {
     JSString *p;
-    int a, is_numeric, i;
+    int a, is_numeric;
     JSValueArray *arr;
-    const JSValueArray *arr1;
     JSValue val1, new_tab;
     JSGCRef val_ref;
     
@@ -2014,19 +2108,25 @@ static JSValue JS_MakeUniqueString(JSContext *ctx, JSValue val)
         return val;
 
     /* not unique: find it in the ROM or RAM sorted unique string table */
-    for(i = 0; i < ctx->n_rom_atom_tables; i++) {
-        arr1 = ctx->rom_atom_tables[i];
-        if (arr1) {
-            val1 = find_atom(ctx, &a, arr1, arr1->size, val); 
-            if (!JS_IsNull(val1))
-                return val1;
-        }
-    }
+    val1 = find_rom_atom(ctx, val);
+    if (!JS_IsNull(val1))
+        return val1;
     
     arr = JS_VALUE_TO_PTR( ctx->unique_strings);
     val1 = find_atom(ctx, &a, arr, ctx->unique_strings_len, val); 
     if (!JS_IsNull(val1))
         return val1;
+
+    /* the strings in ROM (e.g. in a bytecode image) cannot be modified */
+    if (JS_IS_ROM_PTR(ctx, p)) {
+        JSString *p1;
+        p1 = js_alloc_string(ctx, p->len);
+        if (!p1)
+            return JS_EXCEPTION;
+        p1->is_ascii = p->is_ascii;
+        memcpy(p1->buf, p->buf, p->len);
+        val = JS_VALUE_FROM_PTR(p1);
+    }
     
     JS_PUSH_VALUE(ctx, val);
     is_numeric = js_is_numeric_string(ctx, val);
@@ -2422,6 +2522,43 @@ JSValue JS_NewObjectPrealloc(JSContext *ctx, int n)
     return obj;
 }
 
+/* create an object with the same properties as the object 'tmpl'
+   (used for object literals). The property values are taken from
+   'tab' in reverse order. */
+static JSValue js_new_object_from_template(JSContext *ctx, JSValue tmpl,
+                                           const JSValue *tab)
+{
+    JSValue obj;
+    JSValueArray *arr, *arr1;
+    JSObject *p;
+    JSGCRef tmpl_ref, obj_ref;
+    int i, prop_count, first;
+    
+    arr1 = NULL;
+    JS_PUSH_VALUE(ctx, tmpl);
+    obj = JS_NewObject(ctx);
+    if (!JS_IsException(obj)) {
+        JS_PUSH_VALUE(ctx, obj);
+        p = JS_VALUE_TO_PTR(tmpl_ref.val);
+        arr = JS_VALUE_TO_PTR(p->props);
+        arr1 = js_alloc_value_array(ctx, 0, arr->size);
+        JS_POP_VALUE(ctx, obj);
+    }
+    JS_POP_VALUE(ctx, tmpl);
+    if (JS_IsException(obj) || !arr1)
+        return JS_EXCEPTION;
+    p = JS_VALUE_TO_PTR(tmpl);
+    arr = JS_VALUE_TO_PTR(p->props);
+    memcpy(arr1->arr, arr->arr, arr->size * sizeof(arr->arr[0]));
+    prop_count = JS_VALUE_GET_INT(arr->arr[0]);
+    first = 2 + JS_VALUE_GET_INT(arr->arr[1]) + 1;
+    for(i = 0; i < prop_count; i++)
+        arr1->arr[first + 3 * i + 1] = tab[prop_count - 1 - i];
+    p = JS_VALUE_TO_PTR(obj);
+    p->props = JS_VALUE_FROM_PTR(arr1);
+    return obj;
+}
+
 JSValue JS_NewArray(JSContext *ctx, int initial_len)
 {
     JSObject *p;
@@ -2480,6 +2617,18 @@ static inline JSProperty *find_own_property(JSContext *ctx,
     return find_own_property_inlined(ctx, p, prop);
 }
 
+/* A global variable which is only referenced or which was deleted
+   keeps its variable reference with an uninitialized value. It is not
+   visible as a property. */
+static inline BOOL js_is_undefined_var(JSProperty *pr)
+{
+    JSVarRef *pv;
+    if (pr->prop_type != JS_PROP_VARREF)
+        return FALSE;
+    pv = JS_VALUE_TO_PTR(pr->value);
+    return pv->u.value == JS_UNINITIALIZED;
+}
+
 static JSValue get_special_prop(JSContext *ctx, JSValue val)
 {
     int idx;
@@ -2604,7 +2753,8 @@ static JSValue JS_GetPropertyInternal(JSContext *ctx, JSValue obj, JSValue prop,
             } else if (pr->prop_type == JS_PROP_VARREF) {
                 JSVarRef *pv = JS_VALUE_TO_PTR(pr->value);
                 /* always detached */
-                return pv->u.value;
+                if (pv->u.value != JS_UNINITIALIZED)
+                    return pv->u.value;
             } else if (pr->prop_type == JS_PROP_SPECIAL) {
                 return get_special_prop(ctx, pr->value);
             } else {
@@ -2636,7 +2786,7 @@ static JSValue JS_GetPropertyInternal(JSContext *ctx, JSValue obj, JSValue prop,
             }
         }
         /* look in the prototype */
-        proto = p->proto;
+        proto = js_get_proto(ctx, p);
         if (proto == JS_NULL)
             break;
         p = JS_VALUE_TO_PTR(proto);
@@ -2684,9 +2834,9 @@ static BOOL JS_HasProperty(JSContext *ctx, JSValue obj, JSValue prop)
         return FALSE;
     for(;;) {
         pr = find_own_property(ctx, p, prop);
-        if (pr)
+        if (pr && !js_is_undefined_var(pr))
             return TRUE;
-        obj = p->proto;
+        obj = js_get_proto(ctx, p);
         if (obj == JS_NULL)
             break;
         p = JS_VALUE_TO_PTR(obj);
@@ -2731,15 +2881,11 @@ static JSValueArray *js_alloc_props(JSContext *ctx, int n)
     return arr;
 }
                           
-static void js_rehash_props(JSContext *ctx, JSObject *p, BOOL gc_rehash)
+static void js_rehash_props_array(JSValueArray *arr, BOOL gc_rehash)
 {
-    JSValueArray *arr;
     int prop_count, hash_mask, h, idx, i, j;
     JSProperty *pr;
 
-    arr = JS_VALUE_TO_PTR(p->props);
-    if (JS_IS_ROM_PTR(ctx, arr))
-        return;
     hash_mask = JS_VALUE_GET_INT(arr->arr[1]);
     if (hash_mask == 0 && gc_rehash)
         return; /* no need to rehash if single hash entry */
@@ -2759,6 +2905,16 @@ static void js_rehash_props(JSContext *ctx, JSObject *p, BOOL gc_rehash)
     }
 }
 
+static void js_rehash_props(JSContext *ctx, JSObject *p, BOOL gc_rehash)
+{
+    JSValueArray *arr;
+
+    arr = JS_VALUE_TO_PTR(p->props);
+    if (JS_IS_ROM_PTR(ctx, arr))
+        return;
+    js_rehash_props_array(arr, gc_rehash);
+}
+
 /* Compact the properties. No memory allocation is done */
 static void js_compact_props(JSContext *ctx, JSObject *p)
 {
@@ -2817,6 +2973,11 @@ static int js_update_props(JSContext *ctx, JSValue obj)
     arr = JS_VALUE_TO_PTR(p->props);
     if (!JS_IS_ROM_PTR(ctx, arr))
         return 0;
+    /* objects from a data image are read-only */
+    if (JS_IS_ROM_PTR(ctx, p)) {
+        JS_ThrowTypeErrorReadOnly(ctx);
+        return -1;
+    }
     JS_PUSH_VALUE(ctx, obj);
     arr1 = js_alloc_value_array(ctx, 0, arr->size);
     JS_POP_VALUE(ctx, obj);
@@ -3143,6 +3304,8 @@ static JSValue JS_SetPropertyInternal(JSContext *ctx, JSValue this_obj,
         if (JS_IsInt(prop)) {
             JSValueArray *arr;
             uint32_t idx = JS_VALUE_GET_INT(prop);
+            if (unlikely(JS_IS_ROM_PTR(ctx, p)))
+                return JS_ThrowTypeErrorReadOnly(ctx);
             /* not standard: we refuse to add properties to object
                except at the last position */
             if (idx < p->u.array.len) {
@@ -3271,7 +3434,7 @@ static JSValue JS_SetPropertyInternal(JSContext *ctx, JSValue this_obj,
 
     /* search in the prototype chain (getter/setters) */
     for(;;) {
-        proto = p->proto;
+        proto = js_get_proto(ctx, p);
         if (proto == JS_NULL)
             break;
         p = JS_VALUE_TO_PTR(proto);
@@ -3383,13 +3546,23 @@ static JSValue JS_DeleteProperty(JSContext *ctx, JSValue this_obj,
     while (idx != 0) {
         pr = (JSProperty *)(arr->arr + idx);
         if (pr->key == prop) {
+            if (pr->prop_type == JS_PROP_VARREF) {
+                /* global variable: the functions are linked to its
+                   variable reference, so it must be kept. The
+                   variable becomes undefined as if it was only
+                   referenced. */
+                JSVarRef *pv = JS_VALUE_TO_PTR(pr->value);
+                pv->u.value = JS_UNINITIALIZED;
+                return JS_TRUE;
+            }
             if (JS_IS_ROM_PTR(ctx, arr)) {
-                JSGCRef this_obj_ref;
+                int err;
                 
                 JS_PUSH_VALUE(ctx, this_obj);
-                if (js_update_props(ctx, this_obj))
-                    return JS_EXCEPTION;
+                err = js_update_props(ctx, this_obj);
                 JS_POP_VALUE(ctx, this_obj);
+                if (err)
+                    return JS_EXCEPTION;
                 p = JS_VALUE_TO_PTR(this_obj);
                 arr = JS_VALUE_TO_PTR(p->props);
                 pr = (JSProperty *)(arr->arr + idx);
@@ -3424,7 +3597,8 @@ static JSValue JS_DeleteProperty(JSContext *ctx, JSValue this_obj,
             }
 
             /* compact the properties if needed */
-            if ((2 + hash_mask + 1 + 3 * prop_count) < arr->size / 2)
+            if ((2 + hash_mask + 1 + 3 * prop_count) < arr->size / 2 &&
+                !js_is_enumerated(ctx, this_obj))
                 js_compact_props(ctx, p);
             return JS_TRUE;
         }
@@ -3435,10 +3609,50 @@ static JSValue JS_DeleteProperty(JSContext *ctx, JSValue this_obj,
     return JS_TRUE;
 }
 
+static JSValue stdlib_init_class(JSContext *ctx, const JSROMClass *class_def);
+
+/* create the objects defined in the ROM properties of 'obj' (nested
+   JS_OBJECT_DEF()). The properties are then copied to RAM. */
+static void stdlib_init_props(JSContext *ctx, JSValue obj)
+{
+    JSObject *p;
+    JSValueArray *arr;
+    JSProperty *pr;
+    JSGCRef obj_ref, val_ref;
+    JSValue *pobj, *pval;
+    int i, idx, prop_count, hash_mask;
+
+    pobj = JS_PushGCRef(ctx, &obj_ref);
+    *pobj = obj;
+    pval = JS_PushGCRef(ctx, &val_ref);
+    p = JS_VALUE_TO_PTR(obj);
+    arr = JS_VALUE_TO_PTR(p->props);
+    prop_count = JS_VALUE_GET_INT(arr->arr[0]);
+    hash_mask = JS_VALUE_GET_INT(arr->arr[1]);
+    for(i = 0; i < prop_count; i++) {
+        idx = 2 + (hash_mask + 1) + 3 * i;
+        p = JS_VALUE_TO_PTR(*pobj);
+        arr = JS_VALUE_TO_PTR(p->props);
+        pr = (JSProperty *)&arr->arr[idx];
+        if (pr->prop_type != JS_PROP_NORMAL || !JS_IsObject(ctx, pr->value) ||
+            !JS_IS_ROM_PTR(ctx, JS_VALUE_TO_PTR(pr->value)))
+            continue;
+        *pval = stdlib_init_class(ctx, JS_VALUE_TO_PTR(pr->value));
+        if (js_update_props(ctx, *pobj))
+            break;
+        p = JS_VALUE_TO_PTR(*pobj);
+        arr = JS_VALUE_TO_PTR(p->props);
+        pr = (JSProperty *)&arr->arr[idx];
+        pr->value = *pval;
+    }
+    JS_PopGCRef(ctx, &val_ref);
+    JS_PopGCRef(ctx, &obj_ref);
+}
+
 static JSValue stdlib_init_class(JSContext *ctx, const JSROMClass *class_def)
 {
     JSValue obj, proto, parent_class, parent_proto;
-    JSGCRef parent_class_ref;
+    JSGCRef parent_class_ref, obj_ref;
     JSObject *p;
     int ctor_idx = class_def->ctor_idx;
 
@@ -3485,6 +3699,9 @@ static JSValue stdlib_init_class(JSContext *ctx, const JSROMClass *class_def)
         /* set the properties from the ROM. They are copied to RAM
            when modified */
         p->props = class_def->props;
+        JS_PUSH_VALUE(ctx, obj);
+        stdlib_init_props(ctx, obj);
+        JS_POP_VALUE(ctx, obj);
     } 
     return obj;
 }
@@ -3537,9 +3754,11 @@ JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDe
     ctx->class_obj = ctx->class_proto + ctx->class_count;
     ctx->heap_base = (void *)(ctx->class_proto + 2 * ctx->class_count);
     ctx->heap_free = ctx->heap_base;
+    ctx->heap_free_start = ctx->heap_free;
     ctx->stack_top = mem_start + mem_size;
     ctx->sp = (JSValue *)ctx->stack_top;
     ctx->stack_bottom = ctx->sp;
+    ctx->stack_bottom_min = ctx->stack_bottom;
     ctx->fp = ctx->sp;
     ctx->min_free_size = JS_MIN_FREE_SIZE;
 #ifdef DEBUG_GC
@@ -3580,9 +3799,8 @@ JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDe
         ctx->unique_strings_len = arr1->size;
     } else {
         ctx->atom_table = stdlib_def->stdlib_table;
-        ctx->rom_atom_tables[0] = (JSValueArray *)(stdlib_def->stdlib_table +
-                                                   stdlib_def->sorted_atoms_offset);
-        ctx->n_rom_atom_tables = 1;
+        ctx->rom_atom_table = (JSValueArray *)(stdlib_def->stdlib_table +
+                                               stdlib_def->sorted_atoms_offset);
         ctx->c_function_table = stdlib_def->c_function_table;
         ctx->c_finalizer_table = stdlib_def->c_finalizer_table;
         ctx->unique_strings = JS_NULL;
@@ -3591,6 +3809,7 @@ JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDe
     
     
     ctx->current_exception = JS_UNDEFINED;
+    ctx->image_atoms = JS_NULL;
 #ifdef DEBUG_GC
     /* set the dummy block at the start of the memory */
     {
@@ -3637,6 +3856,10 @@ void JS_FreeContext(JSContext *ctx)
     int size;
     JSObject *p;
     
+    /* the memory blocks of a heap converted to 32 bits cannot be
+       walked. It only contains the compiled code. */
+    if (ctx->is_heap_32bit)
+        return;
     ptr = ctx->heap_base;
     while (ptr < ctx->heap_free) {
         size = get_mblock_size(ptr);
@@ -3654,6 +3877,11 @@ void JS_SetContextOpaque(JSContext *ctx, void *opaque)
     ctx->opaque = opaque;
 }
 
+void *JS_GetContextOpaque(JSContext *ctx)
+{
+    return ctx->opaque;
+}
+
 void JS_SetInterruptHandler(JSContext *ctx, JSInterruptHandler *interrupt_handler)
 {
     ctx->interrupt_handler = interrupt_handler;
@@ -3949,69 +4177,146 @@ static const char *get_func_name(JSContext *ctx, JSValue func_obj,
     return JS_ToCString(ctx, val, str_buf);
 }
 
-static void build_backtrace(JSContext *ctx, JSValue error_obj,
-                            const char *filename, int line_num, int col_num, int skip_level)
+/* maximum number of stack frames captured in the error objects */
+#define JS_BACKTRACE_LEVEL_MAX 10
+
+/* Format the frames captured by build_backtrace() into 'buf'. No
+   memory is allocated. */
+static void format_backtrace(JSContext *ctx, char *buf, int buf_size,
+                             JSValueArray *frames, const char *filename,
+                             int line_num, int col_num)
 {
-    JSObject *p1;
-    char buf[128], *p, *buf_end, *line_start;
+    char *p, *buf_end, *line_start;
     const char *str;
-    JSValue *fp, stack_str;
     JSCStringBuf str_buf;
     JSFunctionBytecode *b;
-    int level;
-    JSGCRef error_obj_ref;
-    
-    if (!JS_IsError(ctx, error_obj))
-        return;
+    int i;
+
     p = buf;
-    buf_end = buf + sizeof(buf);
+    buf_end = buf + buf_size;
     p[0] = '\0';
     if (filename) {
         cprintf(&p, buf_end, "    at %s:%d:%d\n", filename, line_num, col_num);
     }
-    fp = ctx->fp;
-    level = 0;
-    while (fp != (JSValue *)ctx->stack_top && level < 10) {
-        if (skip_level != 0) {
-            skip_level--;
-        } else {
-            line_start = p;
-            str = get_func_name(ctx, fp[FRAME_OFFSET_FUNC_OBJ], &str_buf, &b);
-            if (!str)
-                str = "<anonymous>";
-            cprintf(&p, buf_end, "    at %s", str);
-            if (b) {
-                int pc, line_num, col_num;
-                const char *filename;
-                filename = JS_ToCString(ctx, b->filename, &str_buf);
-                pc = JS_VALUE_GET_INT(fp[FRAME_OFFSET_CUR_PC]) - 1;
-                line_num = find_line_col(&col_num, b, pc);
-                cprintf(&p, buf_end, " (%s", filename);
-                if (line_num != 0) {
-                    cprintf(&p, buf_end, ":%d", line_num);
-                    if (col_num != 0)
-                        cprintf(&p, buf_end, ":%d", col_num);
-                }
-                cprintf(&p, buf_end, ")");
-            } else {
-                cprintf(&p, buf_end, " (native)");
-            }
-            cprintf(&p, buf_end, "\n");
-            /* if truncated line, remove it and stop */
-            if ((p + 1) >= buf_end) {
-                *line_start = '\0';
-                break;
+    for(i = 0; i + 1 < frames->size; i += 2) {
+        line_start = p;
+        str = get_func_name(ctx, frames->arr[i], &str_buf, &b);
+        if (!str)
+            str = "<anonymous>";
+        cprintf(&p, buf_end, "    at %s", str);
+        if (b) {
+            int pc, line_num, col_num;
+            const char *filename;
+            filename = JS_ToCString(ctx, b->filename, &str_buf);
+            pc = JS_VALUE_GET_INT(frames->arr[i + 1]) - 1;
+            line_num = find_line_col(&col_num, b, pc);
+            cprintf(&p, buf_end, " (%s", filename);
+            if (line_num != 0) {
+                cprintf(&p, buf_end, ":%d", line_num);
+                if (col_num != 0)
+                    cprintf(&p, buf_end, ":%d", col_num);
             }
-            level++;
+            cprintf(&p, buf_end, ")");
+        } else {
+            cprintf(&p, buf_end, " (native)");
+        }
+        cprintf(&p, buf_end, "\n");
+        /* if truncated line, remove it and stop */
+        if ((p + 1) >= buf_end) {
+            *line_start = '\0';
+            break;
         }
+    }
+}
+
+/* Only the (function, pc) pairs of the stack frames are captured. The
+   'stack' string is built on first access (see js_error_get_stack())
+   so that throwing errors which are caught without looking at their
+   stack is cheap. */
+static void build_backtrace(JSContext *ctx, JSValue error_obj,
+                            const char *filename, int line_num, int col_num, int skip_level)
+{
+    JSObject *p1;
+    JSValueArray *frames;
+    JSValue *fp, stack_val;
+    int level, n;
+    JSGCRef error_obj_ref;
+    char buf[128];
+    
+    if (!JS_IsError(ctx, error_obj))
+        return;
+    /* count the captured frames */
+    fp = ctx->fp;
+    level = skip_level;
+    n = 0;
+    while (fp != (JSValue *)ctx->stack_top && n < JS_BACKTRACE_LEVEL_MAX) {
+        if (level != 0)
+            level--;
+        else
+            n++;
         fp = VALUE_TO_SP(ctx, fp[FRAME_OFFSET_SAVED_FP]);
     }
 
     JS_PUSH_VALUE(ctx, error_obj);
-    stack_str = JS_NewString(ctx, buf);
+    frames = js_alloc_value_array(ctx, 0, n * 2);
     JS_POP_VALUE(ctx, error_obj);
+    if (!frames)
+        return;
+    fp = ctx->fp;
+    level = skip_level;
+    n = 0;
+    while (n < frames->size) {
+        if (level != 0) {
+            level--;
+        } else {
+            frames->arr[n] = fp[FRAME_OFFSET_FUNC_OBJ];
+            frames->arr[n + 1] = fp[FRAME_OFFSET_CUR_PC];
+            n += 2;
+        }
+        fp = VALUE_TO_SP(ctx, fp[FRAME_OFFSET_SAVED_FP]);
+    }
+
+    if (filename) {
+        /* the source position is only known here */
+        format_backtrace(ctx, buf, sizeof(buf), frames, filename, line_num, col_num);
+        JS_PUSH_VALUE(ctx, error_obj);
+        stack_val = JS_NewString(ctx, buf);
+        JS_POP_VALUE(ctx, error_obj);
+    } else {
+        stack_val = JS_VALUE_FROM_PTR(frames);
+    }
     p1 = JS_VALUE_TO_PTR(error_obj);
-    p1->u.error.stack = stack_str;
+    p1->u.error.stack = stack_val;
+}
+
+/* return TRUE if the error stack is not formatted yet */
+static BOOL js_is_raw_backtrace(JSValue val)
+{
+    return JS_IsPtr(val) &&
+        js_get_mtag(JS_VALUE_TO_PTR(val)) == JS_MTAG_VALUE_ARRAY;
+}
+
+/* return the 'stack' property of the error object 'obj' */
+static JSValue js_error_get_stack(JSContext *ctx, JSValue obj)
+{
+    JSObject *p;
+    JSValue stack_str;
+    JSGCRef obj_ref;
+    char buf[128];
+    
+    p = JS_VALUE_TO_PTR(obj);
+    if (!js_is_raw_backtrace(p->u.error.stack))
+        return p->u.error.stack;
+    format_backtrace(ctx, buf, sizeof(buf), JS_VALUE_TO_PTR(p->u.error.stack),
+                     NULL, 0, 0);
+    JS_PUSH_VALUE(ctx, obj);
+    stack_str = JS_NewString(ctx, buf);
+    JS_POP_VALUE(ctx, obj);
+    if (JS_IsException(stack_str))
+        return stack_str;
+    p = JS_VALUE_TO_PTR(obj);
+    p->u.error.stack = stack_str;
+    return stack_str;
 }
 
 #define HINT_STRING  0
@@ -4805,11 +5110,12 @@ static JSValue js_operator_instanceof(JSContext *ctx)
         return JS_NewBool(FALSE);
     p = JS_VALUE_TO_PTR(op1);
     for(;;) {
-        if (p->proto == JS_NULL)
+        op1 = js_get_proto(ctx, p);
+        if (op1 == JS_NULL)
             return JS_NewBool(FALSE);
-        if (p->proto == proto)
+        if (op1 == proto)
             return JS_NewBool(TRUE);
-        p = JS_VALUE_TO_PTR(p->proto);
+        p = JS_VALUE_TO_PTR(op1);
     }
     return JS_NewBool(FALSE);
 }
@@ -4907,11 +5213,15 @@ static JSValue js_closure(JSContext *ctx, JSValue bfunc, JSValue *fp)
                 val = get_var_ref(ctx, pfirst_var_ref, 
                                   &fp[FRAME_OFFSET_ARG0 + var_idx]);
                 break;
+            case JS_VARREF_KIND_ARG_VALUE:
+                val = fp[FRAME_OFFSET_ARG0 + var_idx];
+                break;
             case JS_VARREF_KIND_VAR:
                 val = get_var_ref(ctx, pfirst_var_ref,
                                   &fp[FRAME_OFFSET_VAR0 - var_idx]);
                 break;
             case JS_VARREF_KIND_VAR_REF:
+            case JS_VARREF_KIND_VAR_REF_VALUE:
                 {
                     JSObject *p;
                     p = JS_VALUE_TO_PTR(fp[FRAME_OFFSET_FUNC_OBJ]);
@@ -4936,50 +5246,125 @@ static JSValue js_closure(JSContext *ctx, JSValue bfunc, JSValue *fp)
     return closure;
 }
 
+/* The for...in and for...of iterators use two stack slots: the
+   iterated object and the current position, so no memory is
+   allocated. The for...in position is a special value so that the
+   active enumerations can be found on the stack (see
+   js_is_enumerated()). Its bit 0 is set when the own properties are
+   enumerated, otherwise it is twice the index of the next array
+   element. */
+#define JS_FOR_IN_POS(pos) JS_VALUE_MAKE_SPECIAL(JS_TAG_UNINITIALIZED, (pos) + 1)
+#define JS_FOR_IN_GET_POS(v) (JS_VALUE_GET_SPECIAL_VALUE(v) - 1)
+
+static int js_get_array_len(JSObject *p)
+{
+    if (p->class_id == JS_CLASS_ARRAY)
+        return p->u.array.len;
+    else if (p->class_id >= JS_CLASS_UINT8C_ARRAY && p->class_id <= JS_CLASS_FLOAT64_ARRAY)
+        return p->u.typed_array.len;
+    else
+        return 0;
+}
+
+/* return the initial position */
 static JSValue js_for_of_start(JSContext *ctx, BOOL is_for_in)
 {
-    JSValueArray *arr;
+    JSObject *p;
 
     if (is_for_in) {
-        /* XXX: not spec compliant and slow. We return only the own
-           object keys. */
-        ctx->sp[0] = js_object_keys(ctx, NULL, 1, &ctx->sp[0]);
-        if (JS_IsException(ctx->sp[0]))
-            return JS_EXCEPTION;
+        /* XXX: not spec compliant. We return only the own object
+           keys. */
+        if (!JS_IsObject(ctx, ctx->sp[0]))
+            return JS_ThrowTypeErrorNotAnObject(ctx);
+        p = JS_VALUE_TO_PTR(ctx->sp[0]);
+        if (js_get_array_len(p) > 0)
+            return JS_FOR_IN_POS(0);
+        else
+            return JS_FOR_IN_POS(1);
     }
-    
+
     if (!js_get_object_class(ctx, ctx->sp[0], JS_CLASS_ARRAY))
         return JS_ThrowTypeError(ctx, "unsupported type in for...of");
-    
-    arr = js_alloc_value_array(ctx, 0, 2);
-    if (!arr)
-        return JS_EXCEPTION;
-    arr->arr[0] = ctx->sp[0];
-    arr->arr[1] = JS_NewShortInt(0);
-    return JS_VALUE_FROM_PTR(arr);
+    return JS_NewShortInt(0);
 }
 
 static JSValue js_for_of_next(JSContext *ctx)
 {
-    JSValueArray *arr, *arr1;
+    JSValueArray *arr;
+    JSProperty *pr;
     JSObject *p;
-    int pos;
-    
-    arr = JS_VALUE_TO_PTR(ctx->sp[0]);
-    pos = JS_VALUE_GET_INT(arr->arr[1]);
-    p = JS_VALUE_TO_PTR(arr->arr[0]);
-    if (pos >= p->u.array.len) {
-        ctx->sp[-2] = JS_TRUE;
-        ctx->sp[-1] = JS_UNDEFINED;
+    JSValue val;
+    int pos, idx, hash_mask, first_free;
+
+    p = JS_VALUE_TO_PTR(ctx->sp[1]);
+    if (JS_IsInt(ctx->sp[0])) {
+        /* for...of */
+        pos = JS_VALUE_GET_INT(ctx->sp[0]);
+        if (pos >= p->u.array.len)
+            goto done;
+        arr = JS_VALUE_TO_PTR(p->u.array.tab);
+        ctx->sp[-1] = arr->arr[pos];
+        ctx->sp[0] = JS_NewShortInt(pos + 1);
     } else {
-        ctx->sp[-2] = JS_FALSE;
-        arr1 = JS_VALUE_TO_PTR(p->u.array.tab);
-        ctx->sp[-1] = arr1->arr[pos];
-        arr->arr[1] = JS_NewShortInt(pos + 1);
+        /* for...in */
+        pos = JS_FOR_IN_GET_POS(ctx->sp[0]);
+        if (!(pos & 1)) {
+            idx = pos >> 1;
+            if (idx < js_get_array_len(p)) {
+                ctx->sp[0] = JS_FOR_IN_POS(pos + 2);
+                val = JS_NewShortInt(idx);
+                goto to_string;
+            }
+            pos = 1;
+        }
+        /* the properties are enumerated in creation order directly
+           from the property table. It is not compacted while it is
+           enumerated, so the position remains valid. */
+        arr = JS_VALUE_TO_PTR(p->props);
+        hash_mask = JS_VALUE_GET_INT(arr->arr[1]);
+        first_free = get_first_free(arr);
+        for(;;) {
+            idx = 2 + hash_mask + 1 + 3 * (pos >> 1);
+            if (idx >= first_free)
+                goto done;
+            pos += 2;
+            pr = (JSProperty *)&arr->arr[idx];
+            /* exclude deleted properties */
+            if (pr->key != JS_UNINITIALIZED && !js_is_undefined_var(pr))
+                break;
+        }
+        ctx->sp[0] = JS_FOR_IN_POS(pos);
+        val = pr->key;
+    to_string:
+        if (JS_IsInt(val)) {
+            val = JS_ToString(ctx, val);
+            if (JS_IsException(val))
+                return val;
+        }
+        ctx->sp[-1] = val;
     }
+    ctx->sp[-2] = JS_FALSE;
+    return JS_UNDEFINED;
+ done:
+    ctx->sp[-2] = JS_TRUE;
+    ctx->sp[-1] = JS_UNDEFINED;
     return JS_UNDEFINED;
 }
 
+/* return TRUE if a for...in enumeration of 'obj' is in progress */
+static BOOL js_is_enumerated(JSContext *ctx, JSValue obj)
+{
+    JSValue *sp;
+
+    for(sp = ctx->sp; sp < (JSValue *)ctx->stack_top - 1; sp++) {
+        if (sp[1] == obj &&
+            JS_VALUE_GET_SPECIAL_TAG(sp[0]) == JS_TAG_UNINITIALIZED &&
+            sp[0] != JS_UNINITIALIZED)
+            return TRUE;
+    }
+    return FALSE;
+}
+
 static JSValue js_new_c_function_proto(JSContext *ctx, int func_idx, JSValue proto, BOOL has_params,
                                        JSValue params)
 {
@@ -5199,6 +5584,21 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                 *--sp = val;
             }
             BREAK;
+        CASE(OP_object_template):
+            {
+                int argc;
+
+                argc = get_u16(pc);
+                SAVE();
+                val = js_new_object_from_template(ctx, sp[0], sp + 1);
+                RESTORE();
+                if (JS_IsException(val))
+                    goto exception;
+                pc += 2;
+                sp += argc + 1;
+                *--sp = val;
+            }
+            BREAK;
         CASE(OP_this_func):
             *--sp = fp[FRAME_OFFSET_FUNC_OBJ];
             BREAK;
@@ -5754,6 +6154,16 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                 *--sp = val;
             }
             BREAK;
+        CASE(OP_get_var_value):
+            {
+                int idx;
+                JSObject *p;
+                idx = get_u16(pc);
+                p = JS_VALUE_TO_PTR(fp[FRAME_OFFSET_FUNC_OBJ]);
+                pc += 2;
+                *--sp = p->u.closure.var_refs[idx];
+            }
+            BREAK;
         CASE(OP_put_var_ref):
         CASE(OP_put_var_ref_nocheck):
             {
@@ -5843,9 +6253,12 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                             }
                         }
                         obj = p->proto;
-                        if (obj == JS_NULL) {
-                            val = JS_UNDEFINED;
-                            break;
+                        if (!JS_IsPtr(obj)) {
+                            obj = js_get_proto(ctx, p);
+                            if (obj == JS_NULL) {
+                                val = JS_UNDEFINED;
+                                break;
+                            }
                         }
                         p = JS_VALUE_TO_PTR(obj);
                     }
@@ -6018,6 +6431,8 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                         goto put_array_el_slow;
                     if (unlikely(p->class_id != JS_CLASS_ARRAY))
                         goto put_array_el_slow;
+                    if (unlikely(JS_IS_ROM_PTR(ctx, p)))
+                        goto put_array_el_slow;
                     idx = JS_VALUE_GET_INT(prop);
                     arr = JS_VALUE_TO_PTR(p->u.array.tab);
                     if (unlikely(idx >= p->u.array.len)) {
@@ -6284,7 +6699,7 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
                     dr = -js_get_short_float(op1);
                 float_result:
                     /* for efficiency, we don't try to store it as a short integer */
-                    if (likely(fabs(dr) >= 0x1p-127 && fabs(dr) <= 0x1p+128)) {
+                    if (likely(js_is_short_float_range(dr))) {
                         val = js_to_short_float(dr);
                     } else if (dr == 0.0) {
                         if (float64_as_uint64(dr) != 0) {
@@ -6571,7 +6986,7 @@ JSValue JS_Call(JSContext *ctx, int call_flags)
             RESTORE();
             if (unlikely(JS_IsException(val)))
                 goto exception;
-            sp[0] = val;
+            *--sp = val;
             BREAK;
         CASE(OP_for_of_next):
             SAVE();
@@ -6665,8 +7080,8 @@ static void js_dump_error(JSContext *ctx, JSObject *p)
     
     /* find the error name without side effect */
     p1 = p;
-    if (p->proto != JS_NULL) 
-        p1 = JS_VALUE_TO_PTR(p->proto);
+    if (js_get_proto(ctx, p) != JS_NULL) 
+        p1 = JS_VALUE_TO_PTR(js_get_proto(ctx, p));
     pr = find_own_property(ctx, p1, js_get_atom(ctx, JS_ATOM_name));
     if (!pr || !JS_IsString(ctx, pr->value))
         name = js_get_atom(ctx, JS_ATOM_Error);
@@ -6676,7 +7091,17 @@ static void js_dump_error(JSContext *ctx, JSObject *p)
     if (p->u.error.message != JS_NULL) {
         js_printf(ctx, ": %" JSValue_PRI, p->u.error.message);
     }
-    if (p->u.error.stack != JS_NULL) {
+    if (js_is_raw_backtrace(p->u.error.stack)) {
+        char buf[128];
+        int len;
+        /* format without allocating memory */
+        format_backtrace(ctx, buf, sizeof(buf), JS_VALUE_TO_PTR(p->u.error.stack),
+                         NULL, 0, 0);
+        len = strlen(buf);
+        if (len > 0 && buf[len - 1] == '\n')
+            buf[len - 1] = '\0';
+        js_printf(ctx, "\n%s", buf);
+    } else if (p->u.error.stack != JS_NULL) {
         /* remove the trailing '\n' if any */
         js_printf(ctx, "\n%#" JSValue_PRI, p->u.error.stack);
     }
@@ -7071,6 +7496,11 @@ void JS_DumpMemory(JSContext *ctx, BOOL is_long)
            (unsigned int)(ctx->heap_free - ctx->heap_base),
            (unsigned int)(ctx->stack_top - ctx->heap_base),
            (unsigned int)(ctx->stack_top - (uint8_t *)ctx->sp));
+    if (ctx->bc_dedup_count != 0) {
+        js_printf(ctx, "bytecode dedup: %u blocks merged, %u bytes saved\n",
+                  (unsigned int)ctx->bc_dedup_count,
+                  (unsigned int)ctx->bc_dedup_size);
+    }
 }
 
 static __maybe_unused void JS_DumpUniqueStrings(JSContext *ctx)
@@ -7260,11 +7690,20 @@ typedef struct JSParseState {
     int last_opcode_pos; /* -1 if no last opcode */
     int last_pc2line_pos; /* pc2line pos for the last opcode */
     JSSourcePos last_pc2line_source_pos;
+    /* same for the opcode before the last one (used for constant
+       folding) */
+    int prev_opcode_pos; /* -1 if none */
+    int prev_pc2line_pos;
+    JSSourcePos prev_pc2line_source_pos;
     
     uint32_t pc2line_bit_len;
     JSSourcePos pc2line_source_pos; /* last generated source pos */
     
     uint16_t cpool_len;
+    /* byte code position of the push_const opcode which added the
+       last two constants or -1 if unknown. All the references to
+       these constants are after this position. */
+    int cpool_add_pos[2];
     /* size of the byte code necessary to define the hoisted functions  */
     uint32_t hoisted_code_len;
     
@@ -7350,10 +7789,10 @@ static __maybe_unused void dump_byte_code(JSContext *ctx, JSFunctionBytecode *b)
         js_printf(ctx, "  refs:");
         for(i = 0; i < b->ext_vars_len; i++) {
             int var_kind, var_idx, decl;
-            static const char *var_kind_str[] = { "arg", "var", "ref", "global" };
+            static const char *var_kind_str[] = { "arg", "var", "ref", "global", "arg_value", "ref_value" };
             js_printf(ctx, " ");
             JS_PrintValue(ctx, ext_vars->arr[2 * i]);
-            decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]);
+            decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]) & ~JS_VARREF_WRITTEN;
             var_kind = decl >> 16;
             var_idx = decl & 0xffff;
             js_printf(ctx, " (%s:%d)", var_kind_str[var_kind], var_idx);
@@ -8477,6 +8916,10 @@ void dump_pc2line(void)
 /* warning: pc2line info must be associated to each generated opcode */
 static void emit_op_pos(JSParseState *s, uint8_t op, JSSourcePos source_pos)
 {
+    s->prev_opcode_pos = s->last_opcode_pos;
+    s->prev_pc2line_pos = s->last_pc2line_pos;
+    s->prev_pc2line_source_pos = s->last_pc2line_source_pos;
+
     s->last_opcode_pos = s->byte_code_len;
     s->last_pc2line_pos = s->pc2line_bit_len;
     s->last_pc2line_source_pos = s->pc2line_source_pos;
@@ -8541,9 +8984,16 @@ static BOOL js_is_live_code(JSParseState *s) {
     }
 }
 
-static void remove_last_op(JSParseState *s)
+static void set_byte_code_len(JSParseState *s, int len)
 {
-    s->byte_code_len = s->last_opcode_pos;
+    s->byte_code_len = len;
+    s->cpool_add_pos[0] = min_int(s->cpool_add_pos[0], len);
+    s->cpool_add_pos[1] = min_int(s->cpool_add_pos[1], len);
+}
+
+static void remove_last_op(JSParseState *s)
+{
+    set_byte_code_len(s, s->last_opcode_pos);
     s->pc2line_bit_len = s->last_pc2line_pos;
     s->pc2line_source_pos = s->last_pc2line_source_pos;
     s->last_opcode_pos = -1;
@@ -8700,12 +9150,14 @@ static int cpool_add(JSParseState *s, JSValue val)
     b->cpool = new_cpool;
     arr = JS_VALUE_TO_PTR(b->cpool);
     arr->arr[s->cpool_len++] = val;
+    s->cpool_add_pos[1] = s->cpool_add_pos[0];
+    s->cpool_add_pos[0] = -1;
     return s->cpool_len - 1;
 }
 
 static void js_emit_push_const(JSParseState *s, JSValue val)
 {
-    int idx;
+    int idx, cpool_len;
 
     if (JS_IsPtr(val)
 #ifdef JS_USE_SHORT_FLOAT
@@ -8714,7 +9166,10 @@ static void js_emit_push_const(JSParseState *s, JSValue val)
         ) {
         /* We use a constant pool to avoid scanning the bytecode
            during the GC. XXX: is it a good choice ? */
+        cpool_len = s->cpool_len;
         idx = cpool_add(s, val);
+        if (s->cpool_len != cpool_len)
+            s->cpool_add_pos[0] = s->byte_code_len;
         emit_op(s, OP_push_const);
         emit_u16(s, idx);
     } else {
@@ -8993,6 +9448,62 @@ enum {
     PARSE_PROP_METHOD,
 };
 
+/* Add the field 'name' to the template object of an object literal
+   stored at '*ptmpl_idx' in the constant pool. The template is
+   created if '*ptmpl_idx' < 0. Return FALSE if the field is already
+   present. */
+static BOOL js_template_add_field(JSParseState *s, int *ptmpl_idx, JSValue name)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b;
+    JSValueArray *cpool;
+    JSValue tmpl;
+    JSGCRef name_ref;
+    
+    JS_PUSH_VALUE(ctx, name);
+    if (*ptmpl_idx < 0) {
+        tmpl = JS_NewObject(ctx);
+        if (JS_IsException(tmpl))
+            js_parse_error_mem(s);
+        *ptmpl_idx = cpool_add(s, tmpl);
+    }
+    b = JS_VALUE_TO_PTR(s->cur_func);
+    cpool = JS_VALUE_TO_PTR(b->cpool);
+    tmpl = cpool->arr[*ptmpl_idx];
+    if (find_own_property(ctx, JS_VALUE_TO_PTR(tmpl), name_ref.val)) {
+        JS_POP_VALUE(ctx, name);
+        return FALSE;
+    }
+    tmpl = JS_DefinePropertyValue(ctx, tmpl, name_ref.val, JS_UNDEFINED);
+    JS_POP_VALUE(ctx, name);
+    if (JS_IsException(tmpl))
+        js_parse_error_mem(s);
+    return TRUE;
+}
+
+/* Emit the creation of the object of an object literal. Return the
+   position of the property count of OP_object or 0 if there is
+   none. */
+static int js_emit_object(JSParseState *s, int tmpl_idx, int tmpl_count)
+{
+    JSFunctionBytecode *b;
+    JSValueArray *cpool;
+    
+    if (tmpl_count > 0) {
+        b = JS_VALUE_TO_PTR(s->cur_func);
+        cpool = JS_VALUE_TO_PTR(b->cpool);
+        js_compact_props(s->ctx, JS_VALUE_TO_PTR(cpool->arr[tmpl_idx]));
+        emit_op(s, OP_push_const);
+        emit_u16(s, tmpl_idx);
+        emit_op_param(s, OP_object_template, tmpl_count, s->pc2line_source_pos);
+        return 0;
+    } else {
+        emit_op(s, OP_object);
+        emit_u16(s, 0);
+        return s->byte_code_len - 2;
+    }
+}
+
 static int js_parse_property_name(JSParseState *s, JSValue *pname)
 {
     JSContext *ctx = s->ctx;
@@ -9287,6 +9798,232 @@ static void js_emit_push_number(JSParseState *s, double d)
     }
 }
 
+/* Constant folding: the operands of an operator are constant if they
+   are pushed by the last opcodes. As labels reset last_opcode_pos,
+   these opcodes are always executed in sequence. */
+
+/* return TRUE if the opcode at 'pos' pushes a constant */
+static BOOL js_get_const_op(JSParseState *s, int pos, JSValue *pval)
+{
+    const uint8_t *tab;
+    JSFunctionBytecode *b;
+    JSValueArray *cpool;
+    int op;
+
+    if (pos < 0)
+        return FALSE;
+    tab = get_byte_code(s) + pos;
+    op = tab[0];
+    switch(op) {
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+        *pval = JS_NewShortInt(op - OP_push_0);
+        break;
+    case OP_push_i8:
+        *pval = JS_NewShortInt(get_i8(tab + 1));
+        break;
+    case OP_push_i16:
+        *pval = JS_NewShortInt(get_i16(tab + 1));
+        break;
+    case OP_push_value:
+        *pval = get_u32(tab + 1);
+        break;
+    case OP_push_const:
+        b = JS_VALUE_TO_PTR(s->cur_func);
+        cpool = JS_VALUE_TO_PTR(b->cpool);
+        *pval = cpool->arr[get_u16(tab + 1)];
+        break;
+    case OP_undefined:
+        *pval = JS_UNDEFINED;
+        break;
+    case OP_null:
+        *pval = JS_NULL;
+        break;
+    case OP_push_false:
+        *pval = JS_FALSE;
+        break;
+    case OP_push_true:
+        *pval = JS_TRUE;
+        break;
+    default:
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* remove the constant pushed at 'pos' (last or previous opcode) and
+   all the following opcodes */
+static void js_remove_const_op(JSParseState *s, int pos)
+{
+    const uint8_t *tab;
+    
+    tab = get_byte_code(s) + pos;
+    /* remove the last constant if it is only referenced by the
+       removed code (e.g. intermediate results of a folded string
+       concatenation) */
+    if (tab[0] == OP_push_const &&
+        get_u16(tab + 1) == s->cpool_len - 1 &&
+        s->cpool_add_pos[0] >= pos) {
+        JSFunctionBytecode *b = JS_VALUE_TO_PTR(s->cur_func);
+        JSValueArray *cpool = JS_VALUE_TO_PTR(b->cpool);
+        cpool->arr[--s->cpool_len] = JS_UNDEFINED;
+        s->cpool_add_pos[0] = s->cpool_add_pos[1];
+        s->cpool_add_pos[1] = -1;
+    }
+    set_byte_code_len(s, pos);
+    if (pos == s->prev_opcode_pos) {
+        s->pc2line_bit_len = s->prev_pc2line_pos;
+        s->pc2line_source_pos = s->prev_pc2line_source_pos;
+    } else {
+        s->pc2line_bit_len = s->last_pc2line_pos;
+        s->pc2line_source_pos = s->last_pc2line_source_pos;
+    }
+    s->last_opcode_pos = -1;
+}
+
+/* 'val' must be a constant which cannot be modified */
+static void js_emit_push_folded(JSParseState *s, JSValue val)
+{
+    if (JS_IsInt(val)) {
+        emit_push_short_int(s, JS_VALUE_GET_INT(val));
+    } else if (val == JS_TRUE || val == JS_FALSE) {
+        emit_op(s, OP_push_false + (val == JS_TRUE));
+    } else if (val == JS_NULL) {
+        emit_op(s, OP_null);
+    } else if (val == JS_UNDEFINED) {
+        emit_op(s, OP_undefined);
+    } else {
+        js_emit_push_const(s, val);
+    }
+}
+
+/* return TRUE if the binary operator 'op' was evaluated at compile time */
+static BOOL js_fold_binary_op(JSParseState *s, int op)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val;
+    
+    switch(op) {
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_mod:
+    case OP_pow:
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+    case OP_strict_eq:
+    case OP_strict_neq:
+        break;
+    default:
+        return FALSE;
+    }
+    if (!js_get_const_op(s, s->prev_opcode_pos, &val) ||
+        !js_get_const_op(s, s->last_opcode_pos, &val))
+        return FALSE;
+    if (JS_StackCheck(ctx, 2))
+        js_parse_error_stack_overflow(s);
+    /* the operands are evaluated on the stack as in the interpreter */
+    ctx->sp -= 2;
+    js_get_const_op(s, s->prev_opcode_pos, &ctx->sp[1]);
+    js_get_const_op(s, s->last_opcode_pos, &ctx->sp[0]);
+    switch(op) {
+    case OP_add:
+        val = js_add_slow(ctx);
+        break;
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_mod:
+    case OP_pow:
+        val = js_binary_arith_slow(ctx, op);
+        break;
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+        val = js_binary_logic_slow(ctx, op);
+        break;
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+        val = js_relational_slow(ctx, op);
+        break;
+    case OP_eq:
+    case OP_neq:
+        val = js_eq_slow(ctx, op == OP_neq);
+        break;
+    default:
+        val = js_strict_eq_slow(ctx, op == OP_strict_neq);
+        break;
+    }
+    /* 'val' is kept on the stack while the opcodes are removed */
+    ctx->sp[1] = val;
+    ctx->sp++;
+    if (JS_IsException(val))
+        js_parse_error_mem(s);
+    js_remove_const_op(s, s->last_opcode_pos);
+    js_remove_const_op(s, s->prev_opcode_pos);
+    js_emit_push_folded(s, ctx->sp[0]);
+    ctx->sp++;
+    return TRUE;
+}
+
+/* return TRUE if the unary operator 'op' was evaluated at compile time */
+static BOOL js_fold_unary_op(JSParseState *s, int op)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val;
+
+    if (!js_get_const_op(s, s->last_opcode_pos, &val))
+        return FALSE;
+    if (JS_StackCheck(ctx, 1))
+        js_parse_error_stack_overflow(s);
+    ctx->sp--;
+    js_get_const_op(s, s->last_opcode_pos, &ctx->sp[0]);
+    switch(op) {
+    case OP_neg:
+    case OP_plus:
+        val = js_unary_arith_slow(ctx, op);
+        break;
+    case OP_not:
+        val = js_not_slow(ctx);
+        break;
+    case OP_lnot:
+        val = JS_NewBool(!JS_ToBool(ctx, ctx->sp[0]));
+        break;
+    default:
+        abort();
+    }
+    ctx->sp[0] = val;
+    if (JS_IsException(val))
+        js_parse_error_mem(s);
+    js_remove_const_op(s, s->last_opcode_pos);
+    js_emit_push_folded(s, ctx->sp[0]);
+    ctx->sp++;
+    return TRUE;
+}
+
 static int js_parse_postfix_expr(JSParseState *s, int state, int parse_flags)
 {
     BOOL is_new = FALSE;
@@ -9392,36 +10129,54 @@ static int js_parse_postfix_expr(JSParseState *s, int state, int parse_flags)
     case '{':
         {
             JSValue name;
-            int prop_idx, prop_type, count_pos;
+            int prop_idx, prop_type, count_pos, tmpl_idx, tmpl_count;
             BOOL has_proto;
             
             next_token(s);
-            emit_op(s, OP_object);
-            count_pos = s->byte_code_len;
-            emit_u16(s, 0);
-
+            /* The values of the first fields are evaluated on the
+               stack. Then the object is created with a copy of the
+               property table of a template object holding their
+               names. count_pos < 0 means that the object is not
+               created yet. */
+            count_pos = -1;
+            tmpl_idx = -1;
+            tmpl_count = 0;
             has_proto = FALSE;
             while (s->token.val != '}') {
                 prop_type = js_parse_property_name(s, &name);
-                if (prop_type == PARSE_PROP_FIELD &&
-                    name == js_get_atom(s->ctx, JS_ATOM___proto__)) {
-                    if (has_proto)
-                        js_parse_error(s, "duplicate __proto__ property name");
-                    has_proto = TRUE;
+                if (count_pos < 0 && prop_type == PARSE_PROP_FIELD &&
+                    name != js_get_atom(s->ctx, JS_ATOM___proto__) &&
+                    tmpl_count < 32 &&
+                    js_template_add_field(s, &tmpl_idx, name)) {
+                    tmpl_count++;
                     prop_idx = -1;
                 } else {
-                    uint8_t *byte_code;
-                    int count;
-                    prop_idx = cpool_add(s, name);
-                    /* increment the count */
-                    byte_code = get_byte_code(s);
-                    count = get_u16(byte_code + count_pos);
-                    put_u16(byte_code + count_pos, min_int(count + 1, 0xffff));
+                    if (count_pos < 0)
+                        count_pos = js_emit_object(s, tmpl_idx, tmpl_count);
+                    if (prop_type == PARSE_PROP_FIELD &&
+                        name == js_get_atom(s->ctx, JS_ATOM___proto__)) {
+                        if (has_proto)
+                            js_parse_error(s, "duplicate __proto__ property name");
+                        has_proto = TRUE;
+                        prop_idx = -1;
+                    } else {
+                        prop_idx = cpool_add(s, name);
+                        if (count_pos > 0) {
+                            uint8_t *byte_code;
+                            int count;
+                            /* increment the count */
+                            byte_code = get_byte_code(s);
+                            count = get_u16(byte_code + count_pos);
+                            put_u16(byte_code + count_pos, min_int(count + 1, 0xffff));
+                        }
+                    }
                 }
                 if (prop_type == PARSE_PROP_FIELD) {
                     js_parse_expect(s, ':');
-                    PARSE_CALL_SAVE4(s, 1, js_parse_assign_expr, 0, prop_idx, parse_flags, has_proto, count_pos);
-                    if (prop_idx >= 0) {
+                    PARSE_CALL_SAVE6(s, 1, js_parse_assign_expr, 0, prop_idx, parse_flags, has_proto, count_pos, tmpl_idx, tmpl_count);
+                    if (count_pos < 0) {
+                        /* template field: the value stays on the stack */
+                    } else if (prop_idx >= 0) {
                         emit_op(s, OP_define_field);
                         emit_u16(s, prop_idx);
                     } else {
@@ -9442,6 +10197,8 @@ static int js_parse_postfix_expr(JSParseState *s, int state, int parse_flags)
                     break;
                 next_token(s);
             }
+            if (count_pos < 0)
+                js_emit_object(s, tmpl_idx, tmpl_count);
             js_parse_expect(s, '}');
         }
         break;
@@ -9683,23 +10440,26 @@ static int js_parse_unary(JSParseState *s, int state, int parse_flags)
                 js_emit_push_number(s, d);
                 next_token(s);
             } else {
+                int opcode;
                 PARSE_CALL_SAVE2(s, 0, js_parse_unary, 0, op, op_source_pos);
                 switch(op) {
                 case '-':
-                    emit_op_pos(s, OP_neg, op_source_pos);
+                    opcode = OP_neg;
                     break;
                 case '+':
-                    emit_op_pos(s, OP_plus, op_source_pos);
+                    opcode = OP_plus;
                     break;
                 case '!':
-                    emit_op_pos(s, OP_lnot, op_source_pos);
+                    opcode = OP_lnot;
                     break;
                 case '~':
-                    emit_op_pos(s, OP_not, op_source_pos);
+                    opcode = OP_not;
                     break;
                 default:
                     abort();
                 }
+                if (!js_fold_unary_op(s, opcode))
+                    emit_op_pos(s, opcode, op_source_pos);
             }
         }
         break;
@@ -9759,7 +10519,8 @@ static int js_parse_unary(JSParseState *s, int state, int parse_flags)
             op_source_pos = s->token.source_pos;
             next_token(s);
             PARSE_CALL_SAVE1(s, 6, js_parse_unary, 0, op_source_pos);
-            emit_op_pos(s, OP_pow, op_source_pos);
+            if (!js_fold_binary_op(s, OP_pow))
+                emit_op_pos(s, OP_pow, op_source_pos);
         }
         break;
     }
@@ -9904,14 +10665,15 @@ static int js_parse_expr_binary(JSParseState *s, int state, int parse_flags)
         }
         next_token(s);
         PARSE_CALL_SAVE3(s, 2, js_parse_expr_binary, parse_flags - (1 << PF_LEVEL_SHIFT), parse_flags, opcode, op_source_pos);
-        emit_op_pos(s, opcode, op_source_pos);
+        if (!js_fold_binary_op(s, opcode))
+            emit_op_pos(s, opcode, op_source_pos);
     }
     return PARSE_STATE_RET;
 }
 
 static int js_parse_logical_and_or(JSParseState *s, int state, int parse_flags)
 {
-    JSValue label1;
+    JSValue label1, val;
     int level, op;
 
     PARSE_START3();
@@ -9934,9 +10696,17 @@ static int js_parse_logical_and_or(JSParseState *s, int state, int parse_flags)
 
         for(;;) {
             next_token(s);
-            emit_op(s, OP_dup);
-            emit_goto(s, op == TOK_LAND ? OP_if_false : OP_if_true, &label1);
-            emit_op(s, OP_drop);
+            if (js_get_const_op(s, s->last_opcode_pos, &val)) {
+                /* constant left operand */
+                if (JS_ToBool(s->ctx, val) == (op == TOK_LAND))
+                    js_remove_const_op(s, s->last_opcode_pos);
+                else
+                    emit_goto(s, OP_goto, &label1);
+            } else {
+                emit_op(s, OP_dup);
+                emit_goto(s, op == TOK_LAND ? OP_if_false : OP_if_true, &label1);
+                emit_op(s, OP_drop);
+            }
             
             PARSE_PUSH_VAL(s, label1);
             PARSE_CALL_SAVE1(s, 2, js_parse_logical_and_or, parse_flags - (1 << PF_LEVEL_SHIFT), parse_flags);
@@ -10485,7 +11255,7 @@ static int js_parse_statement(JSParseState *s, int state, int dummy_param)
                 JSValue label_expr, label_body, label_next;
                 int opcode, var_idx;
                 
-                be->drop_count = JS_NewShortInt(1);
+                be->drop_count = JS_NewShortInt(2);
                 
                 label_expr = new_label(s);
                 label_body = new_label(s);
@@ -10544,13 +11314,14 @@ static int js_parse_statement(JSParseState *s, int state, int dummy_param)
                 emit_label(s, &be->label_cont);
                 emit_op(s, OP_for_of_next);
                 
-                /* on stack: enum_rec / enum_obj value bool */
+                /* on stack: enum_obj enum_pos value bool */
                 emit_goto(s, OP_if_false, &label_next);
                 /* drop the undefined value from for_xx_next */
                 emit_op(s, OP_drop);
 
                 emit_label(s, &be->label_break);
                 emit_op(s, OP_drop);
+                emit_op(s, OP_drop);
             } else {
                 JSValue label_test;
                 JSParsePos expr3_pos;
@@ -11348,10 +12119,54 @@ static void compute_stack_size(JSParseState *s, JSValue *pfunc)
     js_free(s->ctx, explore_arr);
 }
 
+/* set JS_VARREF_WRITTEN in the ext_vars of 'func' which are modified
+   by its byte code or by one of its children. No allocation. */
+static void mark_written_var_refs(JSFunctionBytecode *b)
+{
+    JSValueArray *ext_vars, *cpool, *ext_vars1;
+    JSByteArray *bc_arr;
+    JSFunctionBytecode *b1;
+    int pos, op, i, i1, j, decl;
+    
+    ext_vars = JS_VALUE_TO_PTR(b->ext_vars);
+    bc_arr = JS_VALUE_TO_PTR(b->byte_code);
+    pos = 0;
+    while (pos < bc_arr->size) {
+        op = bc_arr->buf[pos];
+        if (op == OP_put_var_ref || op == OP_put_var_ref_nocheck) {
+            i = get_u16(bc_arr->buf + pos + 1);
+            decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]);
+            ext_vars->arr[2 * i + 1] = JS_NewShortInt(decl | JS_VARREF_WRITTEN);
+        }
+        pos += opcode_info[op].size;
+    }
+
+    if (b->cpool == JS_NULL)
+        return;
+    cpool = JS_VALUE_TO_PTR(b->cpool);
+    for(j = 0; j < cpool->size; j++) {
+        if (!JS_IsPtr(cpool->arr[j]))
+            continue;
+        b1 = JS_VALUE_TO_PTR(cpool->arr[j]);
+        if (b1->mtag != JS_MTAG_FUNCTION_BYTECODE || b1->ext_vars_len == 0)
+            continue;
+        ext_vars1 = JS_VALUE_TO_PTR(b1->ext_vars);
+        for(i = 0; i < b1->ext_vars_len; i++) {
+            decl = JS_VALUE_GET_INT(ext_vars1->arr[2 * i + 1]);
+            if ((decl & JS_VARREF_WRITTEN) &&
+                ((decl & ~JS_VARREF_WRITTEN) >> 16) == JS_VARREF_KIND_VAR_REF) {
+                i1 = decl & 0xffff;
+                decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i1 + 1]);
+                ext_vars->arr[2 * i1 + 1] = JS_NewShortInt(decl | JS_VARREF_WRITTEN);
+            }
+        }
+    }
+}
+
 static void resolve_var_refs(JSParseState *s, JSValue *pfunc, JSValue *pparent_func)
 {
     JSContext *ctx = s->ctx;
-    int i, decl, var_idx, arg_count, ext_vars_len;
+    int i, decl, var_idx, arg_count, ext_vars_len, written;
     JSValueArray *ext_vars;
     JSValue var_name;
     JSFunctionBytecode *b1, *b;
@@ -11359,6 +12174,7 @@ static void resolve_var_refs(JSParseState *s, JSValue *pfunc, JSValue *pparent_f
     b = JS_VALUE_TO_PTR(*pfunc);
     if (b->ext_vars_len == 0)
         return;
+    mark_written_var_refs(b);
     b1 = JS_VALUE_TO_PTR(*pparent_func);
     arg_count = b1->arg_count;
     
@@ -11369,6 +12185,7 @@ static void resolve_var_refs(JSParseState *s, JSValue *pfunc, JSValue *pparent_f
         b = JS_VALUE_TO_PTR(*pfunc);
         ext_vars = JS_VALUE_TO_PTR(b->ext_vars);
         var_name = ext_vars->arr[2 * i];
+        written = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]) & JS_VARREF_WRITTEN;
         var_idx = find_func_var(ctx, *pparent_func, var_name);
         if (var_idx >= 0) {
             if (var_idx < arg_count) {
@@ -11387,7 +12204,150 @@ static void resolve_var_refs(JSParseState *s, JSValue *pfunc, JSValue *pparent_f
         }
         b = JS_VALUE_TO_PTR(*pfunc);
         ext_vars = JS_VALUE_TO_PTR(b->ext_vars);
-        ext_vars->arr[2 * i + 1] = JS_NewShortInt(decl);
+        ext_vars->arr[2 * i + 1] = JS_NewShortInt(decl | written);
+    }
+}
+
+/* replace the accesses to the ext_var 'var_idx' of '*pfunc' and of
+   the children which reference it by a copy of the value */
+static void flatten_var_ref(JSParseState *s, JSValue *pfunc, int var_idx)
+{
+    JSContext *ctx = s->ctx;
+    JSValue *stack_top;
+    JSValueArray *cpool, *ext_vars;
+    JSByteArray *bc_arr;
+    JSFunctionBytecode *b, *b1;
+    JSGCRef func_ref;
+    JSValue func;
+    int pos, op, i, j, decl, cpool_size;
+    
+    stack_top = ctx->sp;
+    if (JS_StackCheck(ctx, 2))
+        js_parse_error_stack_overflow(s);
+    *--ctx->sp = *pfunc;
+    *--ctx->sp = JS_NewShortInt(var_idx);
+    while (ctx->sp < stack_top) {
+        var_idx = JS_VALUE_GET_INT(ctx->sp[0]);
+        func = ctx->sp[1];
+        ctx->sp += 2;
+        
+        b = JS_VALUE_TO_PTR(func);
+        bc_arr = JS_VALUE_TO_PTR(b->byte_code);
+        pos = 0;
+        while (pos < bc_arr->size) {
+            op = bc_arr->buf[pos];
+            if ((op == OP_get_var_ref || op == OP_get_var_ref_nocheck) &&
+                get_u16(bc_arr->buf + pos + 1) == var_idx) {
+                bc_arr->buf[pos] = OP_get_var_value;
+            }
+            pos += opcode_info[op].size;
+        }
+        
+        if (b->cpool == JS_NULL)
+            continue;
+        cpool = JS_VALUE_TO_PTR(b->cpool);
+        cpool_size = cpool->size;
+        JS_PUSH_VALUE(ctx, func);
+        for(j = 0; j < cpool_size; j++) {
+            b = JS_VALUE_TO_PTR(func_ref.val);
+            cpool = JS_VALUE_TO_PTR(b->cpool);
+            if (!JS_IsPtr(cpool->arr[j]))
+                continue;
+            b1 = JS_VALUE_TO_PTR(cpool->arr[j]);
+            if (b1->mtag != JS_MTAG_FUNCTION_BYTECODE)
+                continue;
+            for(i = 0; i < b1->ext_vars_len; i++) {
+                b = JS_VALUE_TO_PTR(func_ref.val);
+                cpool = JS_VALUE_TO_PTR(b->cpool);
+                b1 = JS_VALUE_TO_PTR(cpool->arr[j]);
+                ext_vars = JS_VALUE_TO_PTR(b1->ext_vars);
+                decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]);
+                if (decl == ((JS_VARREF_KIND_VAR_REF << 16) | var_idx)) {
+                    ext_vars->arr[2 * i + 1] =
+                        JS_NewShortInt((JS_VARREF_KIND_VAR_REF_VALUE << 16) | var_idx);
+                    if (JS_StackCheck(ctx, 2))
+                        js_parse_error_stack_overflow(s);
+                    b = JS_VALUE_TO_PTR(func_ref.val);
+                    cpool = JS_VALUE_TO_PTR(b->cpool);
+                    *--ctx->sp = cpool->arr[j];
+                    *--ctx->sp = JS_NewShortInt(i);
+                }
+            }
+        }
+        JS_POP_VALUE(ctx, func);
+    }
+    ctx->stack_bottom = ctx->sp;
+}
+
+/* Called once all the children of 'func' are resolved. The arguments
+   of 'func' which are never modified are copied to the closures of its
+   children instead of being referenced thru a JSVarRef. */
+static void flatten_var_refs(JSParseState *s, JSValue *pfunc)
+{
+    JSContext *ctx = s->ctx;
+    JSValueArray *cpool, *ext_vars;
+    JSByteArray *bc_arr;
+    JSFunctionBytecode *b, *b1;
+    JSGCRef func_ref;
+    JSValue func;
+    int pos, op, i, j, decl, var_idx, pass;
+    uint64_t arg_written;
+    
+    b = JS_VALUE_TO_PTR(*pfunc);
+    if (b->cpool == JS_NULL)
+        return;
+    /* only the first 64 arguments are considered */
+    arg_written = 0;
+    bc_arr = JS_VALUE_TO_PTR(b->byte_code);
+    pos = 0;
+    while (pos < bc_arr->size) {
+        op = bc_arr->buf[pos];
+        if (op == OP_put_arg) {
+            var_idx = get_u16(bc_arr->buf + pos + 1);
+            if (var_idx < 64)
+                arg_written |= (uint64_t)1 << var_idx;
+        } else if (op >= OP_put_arg0 && op <= OP_put_arg3) {
+            arg_written |= (uint64_t)1 << (op - OP_put_arg0);
+        }
+        pos += opcode_info[op].size;
+    }
+
+    /* first pass: collect the writes done by the children. Second
+       pass: flatten the references to the unmodified arguments. */
+    for(pass = 0; pass < 2; pass++) {
+        for(j = 0;; j++) {
+            b = JS_VALUE_TO_PTR(*pfunc);
+            cpool = JS_VALUE_TO_PTR(b->cpool);
+            if (j >= cpool->size)
+                break;
+            func = cpool->arr[j];
+            if (!JS_IsPtr(func))
+                continue;
+            b1 = JS_VALUE_TO_PTR(func);
+            if (b1->mtag != JS_MTAG_FUNCTION_BYTECODE)
+                continue;
+            JS_PUSH_VALUE(ctx, func);
+            for(i = 0; i < b1->ext_vars_len; i++) {
+                b1 = JS_VALUE_TO_PTR(func_ref.val);
+                ext_vars = JS_VALUE_TO_PTR(b1->ext_vars);
+                decl = JS_VALUE_GET_INT(ext_vars->arr[2 * i + 1]);
+                var_idx = decl & 0xffff;
+                if (pass == 0) {
+                    if (decl & JS_VARREF_WRITTEN) {
+                        decl &= ~JS_VARREF_WRITTEN;
+                        if ((decl >> 16) == JS_VARREF_KIND_ARG && var_idx < 64)
+                            arg_written |= (uint64_t)1 << var_idx;
+                        ext_vars->arr[2 * i + 1] = JS_NewShortInt(decl);
+                    }
+                } else if ((decl >> 16) == JS_VARREF_KIND_ARG && var_idx < 64 &&
+                           !(arg_written & ((uint64_t)1 << var_idx))) {
+                    ext_vars->arr[2 * i + 1] =
+                        JS_NewShortInt((JS_VARREF_KIND_ARG_VALUE << 16) | var_idx);
+                    flatten_var_ref(s, &func_ref.val, i);
+                }
+            }
+            JS_POP_VALUE(ctx, func);
+        }
     }
 }
 
@@ -11401,11 +12361,14 @@ static void reset_parse_state(JSParseState *s, uint32_t input_pos,
     s->byte_code = JS_NULL;
     s->byte_code_len = 0;
     s->last_opcode_pos = -1;
+    s->prev_opcode_pos = -1;
 
     s->pc2line_bit_len = 0;
     s->pc2line_source_pos = 0;
     
     s->cpool_len = 0;
+    s->cpool_add_pos[0] = -1;
+    s->cpool_add_pos[1] = -1;
     s->hoisted_code_len = 0;
     
     s->local_vars_len = 0;
@@ -11497,6 +12460,7 @@ static void js_parse_local_functions(JSParseState *s, JSValue *pfunc)
         if (*pparent_func != JS_NULL) {
             resolve_var_refs(s, pfunc, pparent_func);
         }
+        flatten_var_refs(s, pfunc);
         /* now we can shrink the external vars */
         b = JS_VALUE_TO_PTR(*pfunc);
         js_shrink_value_array(ctx, &b->ext_vars, 2 * b->ext_vars_len);
@@ -11651,7 +12615,9 @@ static JSValue js_parse_json(JSParseState *s)
 }
 
 /* source_str must be a string or JS_NULL. (input, input_len) is
-   meaningful only if source_str is JS_NULL. */
+   meaningful only if source_str is JS_NULL. The source is parsed in
+   place: it is never copied and only a string in the JS heap needs
+   to be tracked by the GC. */
 static JSValue JS_Parse2(JSContext *ctx, JSValue source_str,
                          const char *input, size_t input_len,
                          const char *filename, int eval_flags)
@@ -11675,7 +12641,10 @@ static JSValue JS_Parse2(JSContext *ctx, JSValue source_str,
 
     if (JS_IsPtr(source_str)) {
         JSString *p = JS_VALUE_TO_PTR(source_str);
-        s->source_str = source_str;
+        /* a string in ROM never moves: it is parsed as an external
+           buffer */
+        if (!JS_IS_ROM_PTR(ctx, p))
+            s->source_str = source_str;
         s->buf_len = p->len;
         s->source_buf = p->buf;
     } else if (JS_VALUE_GET_SPECIAL_TAG(source_str) == JS_TAG_STRING_CHAR) {
@@ -11938,6 +12907,9 @@ static void gc_mark_flush(GCMarkState *s)
                 case JS_CLASS_ARRAY_BUFFER:
                     gc_mark(s, p->u.array_buffer.byte_buffer);
                     break;
+                case JS_CLASS_STRING_BUILDER:
+                    gc_mark(s, p->u.string_builder.buffer);
+                    break;
                 case JS_CLASS_UINT8C_ARRAY:
                 case JS_CLASS_INT8_ARRAY:
                 case JS_CLASS_UINT8_ARRAY:
@@ -12192,19 +13164,35 @@ static void gc_thread_pointer(JSContext *ctx, JSValue *pval)
     *ptr = js_value_from_pval(ctx, pval);
 }
 
+/* return the header of the block 'ptr'. It is stored in the last
+   threaded pointer if the block is referenced. */
+static JSMemBlockHeader *gc_get_threaded_header(JSContext *ctx, void *ptr)
+{
+    JSValue *pv = ptr;
+    while (JS_IsPtr(*pv))
+        pv = js_value_to_pval(ctx, *pv);
+    return (JSMemBlockHeader *)pv;
+}
+
 static void gc_update_threaded_pointers(JSContext *ctx,
                                         void *ptr, void *new_ptr)
 {
-    JSValue val, *pv;
+    JSValue val, new_val, *pv;
 
     val = *(JSValue *)ptr;
     if (JS_IsPtr(val)) {
+        new_val = JS_VALUE_FROM_PTR(new_ptr);
+        /* a referenced free block contains the atom replacing a RAM
+           atom (see JS_LoadBytecode()) */
+        if (ctx->has_forwarded_atoms &&
+            gc_get_threaded_header(ctx, ptr)->mtag == JS_MTAG_FREE)
+            new_val = ((JSValue *)ptr)[1];
         /* update the threaded pointers to the node 'ptr' and
            unthread it. */
         for(;;) {
             pv = js_value_to_pval(ctx, val);
             val = *pv;
-            *pv = JS_VALUE_FROM_PTR(new_ptr);
+            *pv = new_val;
             if (!JS_IsPtr(val))
                 break;
         }
@@ -12246,6 +13234,9 @@ static void gc_thread_block(JSContext *ctx, void *ptr)
             case JS_CLASS_ARRAY_BUFFER:
                 gc_thread_pointer(ctx, &p->u.array_buffer.byte_buffer);
                 break;
+            case JS_CLASS_STRING_BUILDER:
+                gc_thread_pointer(ctx, &p->u.string_builder.buffer);
+                break;
             case JS_CLASS_UINT8C_ARRAY:
             case JS_CLASS_INT8_ARRAY:
             case JS_CLASS_UINT8_ARRAY:
@@ -12296,14 +13287,11 @@ static void gc_thread_block(JSContext *ctx, void *ptr)
     }
 }
 
-/* Heap compaction using Jonkers algorithm */
-static void gc_compact_heap(JSContext *ctx)
+/* thread all the external pointers */
+static void gc_thread_roots(JSContext *ctx)
 {
-    uint8_t *ptr, *new_ptr;
-    int size;
     JSValue *sp, *sp_end;
     
-    /* thread all the external pointers */
     sp_end = ctx->class_proto + 2 * ctx->class_count;
     for(sp = &ctx->unique_strings; sp < sp_end; sp++) {
         gc_thread_pointer(ctx, sp);
@@ -12340,17 +13328,43 @@ static void gc_compact_heap(JSContext *ctx)
         gc_thread_pointer(ctx, &ps->cur_func);
         gc_thread_pointer(ctx, &ps->byte_code);
     }
+}
 
-    /* pass 1: thread the pointers and update the previous ones */
-    new_ptr = ctx->heap_base;
+/* rehash the object properties after their keys were moved */
+static void gc_rehash_objects(JSContext *ctx)
+{
+    uint8_t *ptr;
+    int size;
+
+    /* XXX: try to do it in the previous pass (add a specific tag ?) */
     ptr = ctx->heap_base;
     while (ptr < ctx->heap_free) {
-        gc_update_threaded_pointers(ctx, ptr, new_ptr);
         size = get_mblock_size(ptr);
-        if (js_get_mtag(ptr) != JS_MTAG_FREE) {
-            gc_thread_block(ctx, ptr);
-            new_ptr += size;
-        }
+        if (js_get_mtag(ptr) == JS_MTAG_OBJECT) {
+            js_rehash_props(ctx, (JSObject *)ptr, TRUE);
+        }
+        ptr += size;
+    }
+}
+
+/* Heap compaction using Jonkers algorithm */
+static void gc_compact_heap(JSContext *ctx)
+{
+    uint8_t *ptr, *new_ptr;
+    int size;
+    
+    gc_thread_roots(ctx);
+
+    /* pass 1: thread the pointers and update the previous ones */
+    new_ptr = ctx->heap_base;
+    ptr = ctx->heap_base;
+    while (ptr < ctx->heap_free) {
+        gc_update_threaded_pointers(ctx, ptr, new_ptr);
+        size = get_mblock_size(ptr);
+        if (js_get_mtag(ptr) != JS_MTAG_FREE) {
+            gc_thread_block(ctx, ptr);
+            new_ptr += size;
+        }
         ptr += size;
     }
     
@@ -12370,6 +13384,7 @@ static void gc_compact_heap(JSContext *ctx)
         ptr += size;
     }
     ctx->heap_free = new_ptr;
+    ctx->has_forwarded_atoms = FALSE;
 
     /* update the source pointer in the parser */
     if (ctx->parse_state) {
@@ -12380,20 +13395,15 @@ static void gc_compact_heap(JSContext *ctx)
         }
     }
     
-    /* rehash the object properties */
-    /* XXX: try to do it in the previous pass (add a specific tag ?) */
-    ptr = ctx->heap_base;
-    while (ptr < ctx->heap_free) {
-        size = get_mblock_size(ptr);
-        if (js_get_mtag(ptr) == JS_MTAG_OBJECT) {
-            js_rehash_props(ctx, (JSObject *)ptr, TRUE);
-        }
-        ptr += size;
-    }
+    gc_rehash_objects(ctx);
 }
 
 static void JS_GC2(JSContext *ctx, BOOL keep_atoms)
 {
+    /* the heap only grows between two GCs */
+    if (ctx->heap_free > ctx->heap_free_max)
+        ctx->heap_free_max = ctx->heap_free;
+    ctx->gc_count++;
 #ifdef DUMP_GC
     js_printf(ctx, "GC   : heap size=%u/%u stack_size=%u\n",
            (uint32_t)(ctx->heap_free - ctx->heap_base),
@@ -12432,11 +13442,290 @@ void JS_GC(JSContext *ctx)
     JS_GC2(ctx, TRUE);
 }
 
+void JS_GetMemoryHighWater(JSContext *ctx, JSMemoryHighWater *hw)
+{
+    uint8_t *heap_free_max = ctx->heap_free_max;
+    if (ctx->heap_free > heap_free_max)
+        heap_free_max = ctx->heap_free;
+    hw->heap_size = heap_free_max - ctx->heap_base;
+    hw->heap_growth = heap_free_max - ctx->heap_free_start;
+    hw->stack_size = ctx->stack_top - (uint8_t *)ctx->stack_bottom_min;
+    hw->mem_size = ctx->stack_top - (uint8_t *)ctx;
+    hw->out_of_memory_count = ctx->out_of_memory_count;
+    hw->gc_count = ctx->gc_count;
+}
+
+void JS_ResetMemoryHighWater(JSContext *ctx)
+{
+    ctx->heap_free_max = ctx->heap_free;
+    ctx->heap_free_start = ctx->heap_free;
+    ctx->stack_bottom_min = ctx->stack_bottom;
+    ctx->out_of_memory_count = 0;
+    ctx->gc_count = 0;
+}
+
 /* bytecode saving and loading */
 
-#define JS_BYTECODE_VERSION_32 0x0001
+#define JS_BYTECODE_VERSION_32 0x0004
 /* bit 15 of bytecode version is a 64-bit indicator */
+#ifdef JS_NAN_BOXING
+#define JS_BYTECODE_VERSION (JS_BYTECODE_VERSION_32 | ((JSW & 8) << 12) | 0x4000)
+#else
 #define JS_BYTECODE_VERSION (JS_BYTECODE_VERSION_32 | ((JSW & 8) << 12))
+#endif
+
+/* The saved objects (data images, object literal templates)
+   reference the prototype of their class by class id. The prototypes
+   are JS_NULL in a compilation context. */
+static void bc_set_proto_class(JSContext *ctx)
+{
+    uint8_t *ptr;
+    
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += get_mblock_size(ptr)) {
+        if (js_get_mtag(ptr) == JS_MTAG_OBJECT) {
+            JSObject *p = (JSObject *)ptr;
+            if (p->proto == ctx->class_proto[p->class_id])
+                p->proto = JS_PROTO_CLASS(p->class_id);
+        }
+    }
+}
+
+/* Bytecode image deduplication: the identical strings, numbers, byte
+   arrays (byte code, pc2line), value arrays (constant pools, variable
+   names) and function bytecodes are merged so that they are stored
+   once in the image. The pass is repeated because merging blocks can
+   make their parents identical. The hash table is stored in the free
+   memory as the GC mark stack. */
+
+typedef struct {
+    JSContext *ctx;
+    uint32_t *hash_table; /* heap offset + 1 of the block or 0 */
+    uint32_t hash_mask;
+} BCDedupState;
+
+/* return the number of compared bytes or 0 if the block cannot be merged */
+static int bc_dedup_get_size(JSContext *ctx, const uint8_t *ptr)
+{
+    switch(js_get_mtag((void *)ptr)) {
+    case JS_MTAG_STRING:
+        {
+            const JSString *p = (const JSString *)ptr;
+            /* unique strings are already unique */
+            if (p->is_unique)
+                return 0;
+            return offsetof(JSString, buf) + p->len;
+        }
+    case JS_MTAG_BYTE_ARRAY:
+        return offsetof(JSByteArray, buf) + ((const JSByteArray *)ptr)->size;
+    case JS_MTAG_FLOAT64:
+        return sizeof(JSFloat64);
+    case JS_MTAG_VALUE_ARRAY:
+        /* modified in place by the GC */
+        if (JS_VALUE_FROM_PTR(ptr) == ctx->unique_strings)
+            return 0;
+        return offsetof(JSValueArray, arr) +
+            ((const JSValueArray *)ptr)->size * sizeof(JSValue);
+    case JS_MTAG_FUNCTION_BYTECODE:
+        /* 'source_pos' is only used during parsing */
+        return offsetof(JSFunctionBytecode, source_pos);
+    default:
+        return 0;
+    }
+}
+
+static uint32_t bc_dedup_hash(const uint8_t *ptr, int size)
+{
+    uint32_t h;
+    int i;
+    h = 1;
+    for(i = 0; i < size; i++)
+        h = h * 263 + ptr[i];
+    return h;
+}
+
+/* return the first block identical to 'ptr'. If 'add' is TRUE, 'ptr'
+   is added if not found. */
+static uint8_t *bc_dedup_find(BCDedupState *s, uint8_t *ptr, BOOL add)
+{
+    JSContext *ctx = s->ctx;
+    uint8_t *ptr1;
+    uint32_t h;
+    int size;
+    
+    size = bc_dedup_get_size(ctx, ptr);
+    if (size == 0)
+        return ptr;
+    h = bc_dedup_hash(ptr, size) & s->hash_mask;
+    while (s->hash_table[h] != 0) {
+        ptr1 = ctx->heap_base + s->hash_table[h] - 1;
+        if (ptr1 == ptr ||
+            (bc_dedup_get_size(ctx, ptr1) == size && !memcmp(ptr1, ptr, size)))
+            return ptr1;
+        h = (h + 1) & s->hash_mask;
+    }
+    if (add)
+        s->hash_table[h] = ptr - ctx->heap_base + 1;
+    return ptr;
+}
+
+static void bc_dedup_value(BCDedupState *s, JSValue *pval)
+{
+    JSContext *ctx = s->ctx;
+    uint8_t *ptr;
+    
+    if (JS_IsPtr(*pval)) {
+        ptr = JS_VALUE_TO_PTR(*pval);
+        /* the ROM atoms are not in the heap */
+        if (ptr >= ctx->heap_base && ptr < ctx->heap_free)
+            *pval = JS_VALUE_FROM_PTR(bc_dedup_find(s, ptr, FALSE));
+    }
+}
+
+/* must be called after a GC so that the heap only contains the
+   compiled code. Return the number of merged blocks. */
+static int bc_dedup(JSContext *ctx, JSValue *proot)
+{
+    BCDedupState ss, *s = &ss;
+    uint8_t *ptr;
+    int n, hash_size, count;
+
+    s->ctx = ctx;
+    n = 0;
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += get_mblock_size(ptr)) {
+        if (bc_dedup_get_size(ctx, ptr) != 0)
+            n++;
+    }
+    hash_size = 16;
+    while (hash_size < 2 * n)
+        hash_size *= 2;
+    if (hash_size * sizeof(uint32_t) > (uint8_t *)ctx->sp - ctx->heap_free)
+        return 0; /* not enough memory: no deduplication */
+    s->hash_table = (uint32_t *)ctx->heap_free;
+    s->hash_mask = hash_size - 1;
+    memset(s->hash_table, 0, hash_size * sizeof(uint32_t));
+
+    count = 0;
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += get_mblock_size(ptr)) {
+        if (bc_dedup_find(s, ptr, TRUE) != ptr) {
+            ctx->bc_dedup_size += get_mblock_size(ptr);
+            count++;
+        }
+    }
+    if (count == 0)
+        return 0;
+
+    /* redirect the references to the first identical block. The
+       duplicated blocks are freed by the next GC. */
+    bc_dedup_value(s, proot);
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += get_mblock_size(ptr)) {
+        switch(js_get_mtag(ptr)) {
+        case JS_MTAG_FUNCTION_BYTECODE:
+            {
+                JSFunctionBytecode *b = (JSFunctionBytecode *)ptr;
+                bc_dedup_value(s, &b->func_name);
+                bc_dedup_value(s, &b->byte_code);
+                bc_dedup_value(s, &b->cpool);
+                bc_dedup_value(s, &b->vars);
+                bc_dedup_value(s, &b->ext_vars);
+                bc_dedup_value(s, &b->filename);
+                bc_dedup_value(s, &b->pc2line);
+            }
+            break;
+        case JS_MTAG_VALUE_ARRAY:
+            {
+                JSValueArray *p = (JSValueArray *)ptr;
+                int i;
+                for(i = 0; i < p->size; i++) {
+                    bc_dedup_value(s, &p->arr[i]);
+                }
+            }
+            break;
+        case JS_MTAG_OBJECT:
+            {
+                /* the saved objects are read-only */
+                JSObject *p = (JSObject *)ptr;
+                bc_dedup_value(s, &p->props);
+                if (p->class_id == JS_CLASS_ARRAY)
+                    bc_dedup_value(s, &p->u.array.tab);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    ctx->bc_dedup_count += count;
+    return count;
+}
+
+/* Move the memory blocks without references (strings, numbers and
+   byte arrays) after the other ones. They are not modified by the
+   relocation, so their pages remain shared when the image is mapped
+   (see JS_RelocateBytecode()). The heap must be compacted. The blocks
+   are copied to the free memory, so the order is kept if it is too
+   small. */
+static void bc_sort_blocks(JSContext *ctx)
+{
+    uint8_t *ptr, *new_ptr[2], *buf;
+    int size, heap_size, ref_size, is_leaf;
+
+    heap_size = ctx->heap_free - ctx->heap_base;
+    buf = ctx->heap_free;
+    if ((uint8_t *)ctx->sp - buf < heap_size)
+        return;
+    ref_size = 0;
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += size) {
+        size = get_mblock_size(ptr);
+        if (mtag_has_references(js_get_mtag(ptr)))
+            ref_size += size;
+    }
+
+    gc_thread_roots(ctx);
+
+    /* pass 1: thread the pointers and update the previous ones */
+    new_ptr[0] = ctx->heap_base;
+    new_ptr[1] = ctx->heap_base + ref_size;
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += size) {
+        is_leaf = !mtag_has_references(gc_get_threaded_header(ctx, ptr)->mtag);
+        gc_update_threaded_pointers(ctx, ptr, new_ptr[is_leaf]);
+        size = get_mblock_size(ptr);
+        gc_thread_block(ctx, ptr);
+        new_ptr[is_leaf] += size;
+    }
+
+    /* pass 2: update the threaded pointers and copy the block to
+       its final position */
+    new_ptr[0] = ctx->heap_base;
+    new_ptr[1] = ctx->heap_base + ref_size;
+    for(ptr = ctx->heap_base; ptr < ctx->heap_free; ptr += size) {
+        is_leaf = !mtag_has_references(gc_get_threaded_header(ctx, ptr)->mtag);
+        gc_update_threaded_pointers(ctx, ptr, new_ptr[is_leaf]);
+        size = get_mblock_size(ptr);
+        memcpy(buf + (new_ptr[is_leaf] - ctx->heap_base), ptr, size);
+        new_ptr[is_leaf] += size;
+    }
+    memcpy(ctx->heap_base, buf, heap_size);
+
+    gc_rehash_objects(ctx);
+}
+
+/* remove the unreferenced and duplicated memory blocks */
+static void bc_gc(JSContext *ctx, JSValue *peval_code)
+{
+    JSGCRef eval_code_ref;
+    JSValue eval_code;
+
+    ctx->bc_dedup_count = 0;
+    ctx->bc_dedup_size = 0;
+    eval_code = *peval_code;
+    JS_PUSH_VALUE(ctx, eval_code);
+    for(;;) {
+        JS_GC2(ctx, FALSE);
+        if (bc_dedup(ctx, &eval_code_ref.val) == 0)
+            break;
+    }
+    JS_POP_VALUE(ctx, eval_code);
+    *peval_code = eval_code;
+}
 
 void JS_PrepareBytecode(JSContext *ctx,
                         JSBytecodeHeader *hdr,
@@ -12446,6 +13735,8 @@ void JS_PrepareBytecode(JSContext *ctx,
     JSGCRef eval_code_ref;
     int i;
     
+    bc_set_proto_class(ctx);
+
     /* remove all the objects except the compiled code */
     ctx->empty_props = JS_NULL;
     for(i = 0; i < ctx->class_count; i++) {
@@ -12457,8 +13748,9 @@ void JS_PrepareBytecode(JSContext *ctx,
     ctx->dummy_block = JS_NULL;
 #endif
     
+    bc_gc(ctx, &eval_code);
     JS_PUSH_VALUE(ctx, eval_code);
-    JS_GC2(ctx, FALSE);
+    bc_sort_blocks(ctx);
     JS_POP_VALUE(ctx, eval_code);
 
     hdr->magic = JS_BYTECODE_MAGIC;
@@ -12493,6 +13785,15 @@ typedef struct {
     JSValue_32 arr[];
 } JSValueArray_32;
 
+/* only objects without additional fields are supported */
+typedef struct {
+    JS_MB_HEADER_32;
+    JSWord_32 class_id: 8;
+    JSWord_32 extra_size: JS_MB_PAD_32(JS_MTAG_BITS + 8);
+    JSValue_32 proto;
+    JSValue_32 props;
+} JSObject_32;
+
 typedef struct {
     JS_MB_HEADER_32;
     JSWord_32 size: JS_MB_PAD_32(JS_MTAG_BITS);
@@ -12548,6 +13849,24 @@ static int convert_mblock_64to32(void *ptr1, const void *ptr)
 
     mtag = ((JSMemBlockHeader*)ptr)->mtag;
     switch(mtag) {
+    case JS_MTAG_OBJECT:
+        {
+            const JSObject *b = ptr;
+            JSObject_32 *b1 = ptr1;
+            JSValue proto, props;
+
+            if (b->extra_size != 0)
+                return -1;
+            proto = b->proto;
+            props = b->props;
+            b1->gc_mark = b->gc_mark;
+            b1->mtag = b->mtag;
+            b1->class_id = b->class_id;
+            b1->extra_size = 0;
+            b1->proto = proto;
+            b1->props = props;
+        }
+        break;
     case JS_MTAG_FUNCTION_BYTECODE:
         {
             const JSFunctionBytecode *b = ptr;
@@ -12633,6 +13952,9 @@ static int get_mblock_size_32(const void *ptr)
     int mtag = ((JSMemBlockHeader_32 *)ptr)->mtag;
     int size;
     switch(mtag) {
+    case JS_MTAG_OBJECT:
+        size = sizeof(JSObject_32);
+        break;
     case JS_MTAG_FLOAT64:
         size = sizeof(JSFloat64_32);
         break;
@@ -12746,6 +14068,7 @@ static int expand_short_floats(JSContext *ctx)
         mtag = ((JSMemBlockHeader *)ptr)->mtag;
         switch(mtag) {
         case JS_MTAG_FUNCTION_BYTECODE:
+        case JS_MTAG_OBJECT:
             /* we assume no short floats here */
             break;
         case JS_MTAG_VALUE_ARRAY:
@@ -12780,6 +14103,8 @@ int JS_PrepareBytecode64to32(JSContext *ctx,
     JSGCRef eval_code_ref;
     int i;
     
+    bc_set_proto_class(ctx);
+
     /* remove all the objects except the compiled code */
     ctx->empty_props = JS_NULL;
     for(i = 0; i < ctx->class_count; i++) {
@@ -12791,6 +14116,7 @@ int JS_PrepareBytecode64to32(JSContext *ctx,
     ctx->dummy_block = JS_NULL;
 #endif
     
+    bc_gc(ctx, &eval_code);
     JS_PUSH_VALUE(ctx, eval_code);
 #ifdef JS_USE_SHORT_FLOAT
     JS_GC2(ctx, FALSE);
@@ -12801,6 +14127,7 @@ int JS_PrepareBytecode64to32(JSContext *ctx,
 #endif    
     if (gc_compact_heap_64to32(ctx))
         return -1;
+    ctx->is_heap_32bit = TRUE;
     JS_POP_VALUE(ctx, eval_code);
 
     hdr->magic = JS_BYTECODE_MAGIC;
@@ -12825,6 +14152,7 @@ typedef struct {
     JSContext *ctx;
     uintptr_t offset;
     BOOL update_atoms;
+    BOOL modified; /* TRUE if a value was modified */
 } BCRelocState;
 
 static void bc_reloc_value(BCRelocState *s, JSValue *pval)
@@ -12842,19 +14170,17 @@ static void bc_reloc_value(BCRelocState *s, JSValue *pval)
         if (s->update_atoms) {
             p = JS_VALUE_TO_PTR(val);
             if (p->mtag == JS_MTAG_STRING && p->is_unique) {
-                const JSValueArray *arr1;
-                int a, i;
-                for(i = 0; i < ctx->n_rom_atom_tables; i++) {
-                    arr1 = ctx->rom_atom_tables[i];
-                    str = find_atom(ctx, &a, arr1, arr1->size, val); 
-                    if (!JS_IsNull(str)) {
-                        val = str;
-                        break;
-                    }
-                }
+                str = find_rom_atom(ctx, val);
+                if (!JS_IsNull(str))
+                    val = str;
             }
         }
-        *pval = val;
+        /* the unmodified pages of a copy-on-write mapping of the
+           image remain shared */
+        if (val != *pval) {
+            *pval = val;
+            s->modified = TRUE;
+        }
     }
 }
 
@@ -12876,6 +14202,7 @@ int JS_RelocateBytecode2(JSContext *ctx, JSBytecodeHeader *hdr,
     s->ctx = ctx;
     s->offset = new_base_addr - hdr->base_addr;
     s->update_atoms = update_atoms;
+    s->modified = FALSE;
 
     bc_reloc_value(s, &hdr->unique_strings);
     bc_reloc_value(s, &hdr->main_func);
@@ -12907,6 +14234,20 @@ int JS_RelocateBytecode2(JSContext *ctx, JSBytecodeHeader *hdr,
                 }
             }
             break;
+        case JS_MTAG_OBJECT:
+            {
+                /* only the objects created by JSON.parse() can be
+                   saved in a data image */
+                JSObject *p = (JSObject *)ptr;
+                if (!JS_IsInt(p->proto))
+                    return -1;
+                bc_reloc_value(s, &p->props);
+                if (p->class_id == JS_CLASS_ARRAY)
+                    bc_reloc_value(s, &p->u.array.tab);
+                else if (p->class_id != JS_CLASS_OBJECT)
+                    return -1;
+            }
+            break;
         case JS_MTAG_STRING:
         case JS_MTAG_FLOAT64:
         case JS_MTAG_BYTE_ARRAY:
@@ -12916,12 +14257,24 @@ int JS_RelocateBytecode2(JSContext *ctx, JSBytecodeHeader *hdr,
         }
         ptr += size;
     }
-    hdr->base_addr = new_base_addr;
+
+    /* the property hash tables depend on the key values */
+    if (s->modified) {
+        for(ptr = buf; ptr < p_end; ptr += get_mblock_size(ptr)) {
+            if (((JSMemBlockHeader *)ptr)->mtag == JS_MTAG_OBJECT) {
+                JSObject *p = (JSObject *)ptr;
+                js_rehash_props_array((JSValueArray *)(buf + ((uintptr_t)JS_VALUE_TO_PTR(p->props) - new_base_addr)), FALSE);
+            }
+        }
+    }
+    if (hdr->base_addr != new_base_addr)
+        hdr->base_addr = new_base_addr;
     return 0;
 }
 
 /* Relocate the bytecode in 'buf' so that it can be executed
-   later. Return 0 if OK, != 0 if error */
+   later. Only the modified values are written. Return 0 if OK, != 0
+   if error */
 int JS_RelocateBytecode(JSContext *ctx,
                         uint8_t *buf, uint32_t buf_len)
 {
@@ -12936,19 +14289,100 @@ int JS_RelocateBytecode(JSContext *ctx,
                                 (uintptr_t)data_ptr, TRUE);
 }
 
+/* Add the atoms of a loaded image to the sorted image atom table. The
+   atoms which are already defined were replaced by the relocation. */
+static int js_add_image_atoms(JSContext *ctx, const JSValueArray *arr1)
+{
+    JSValueArray *arr, *new_arr;
+    JSValue val;
+    int i, j, k, len, n;
+
+    len = 0;
+    if (!JS_IsNull(ctx->image_atoms)) {
+        arr = JS_VALUE_TO_PTR(ctx->image_atoms);
+        len = arr->size;
+    }
+    n = 0;
+    for(i = 0; i < arr1->size; i++) {
+        if (JS_IsNull(find_rom_atom(ctx, arr1->arr[i])))
+            n++;
+    }
+    if (n == 0)
+        return 0;
+    new_arr = js_alloc_value_array(ctx, 0, len + n);
+    if (!new_arr)
+        return -1;
+    /* merge the two sorted tables */
+    j = 0;
+    k = 0;
+    for(i = 0; i < arr1->size; i++) {
+        val = arr1->arr[i];
+        if (!JS_IsNull(find_rom_atom(ctx, val)))
+            continue;
+        if (len != 0) {
+            arr = JS_VALUE_TO_PTR(ctx->image_atoms);
+            while (j < len && js_string_compare(ctx, arr->arr[j], val) < 0)
+                new_arr->arr[k++] = arr->arr[j++];
+        }
+        new_arr->arr[k++] = val;
+    }
+    if (len != 0) {
+        arr = JS_VALUE_TO_PTR(ctx->image_atoms);
+        while (j < len)
+            new_arr->arr[k++] = arr->arr[j++];
+    }
+    ctx->image_atoms = JS_VALUE_FROM_PTR(new_arr);
+    return 0;
+}
+
+/* The RAM atoms which are also defined in the image 'arr1' are
+   removed from the unique string table and their memory blocks are
+   converted to free blocks containing the image atom. The references
+   to them are redirected to the image atom by the heap compaction. */
+static void js_forward_ram_atoms(JSContext *ctx, const JSValueArray *arr1)
+{
+    JSValueArray *arr;
+    JSValue val, val1;
+    int i, j, a;
+    void *ptr;
+
+    if (JS_IsNull(ctx->unique_strings))
+        return;
+    arr = JS_VALUE_TO_PTR(ctx->unique_strings);
+    j = 0;
+    for(i = 0; i < ctx->unique_strings_len; i++) {
+        val = arr->arr[i];
+        val1 = find_atom(ctx, &a, arr1, arr1->size, val);
+        if (JS_IsNull(val1)) {
+            arr->arr[j++] = val;
+        } else {
+            ptr = JS_VALUE_TO_PTR(val);
+            set_free_block(ptr, get_mblock_size(ptr));
+            ((JSValue *)ptr)[1] = val1;
+            ctx->has_forwarded_atoms = TRUE;
+        }
+    }
+    for(i = j; i < ctx->unique_strings_len; i++)
+        arr->arr[i] = JS_UNDEFINED;
+    ctx->unique_strings_len = j;
+    if (ctx->has_forwarded_atoms)
+        JS_GC(ctx);
+}
+
 /* Load the precompiled bytecode from 'buf'. 'buf' must be allocated
    as long as the JSContext exists. Use JS_Run() to execute
-   it. warning: the bytecode is not checked so it should come from a
-   trusted source. */
+   it. Several images may be loaded, also after code has been
+   run. The GC is run when RAM atoms are forwarded to the image
+   atoms. warning: the bytecode is not checked so it should come from
+   a trusted source. */
 JSValue JS_LoadBytecode(JSContext *ctx, const uint8_t *buf)
 {
     const JSBytecodeHeader *hdr = (const JSBytecodeHeader *)buf;
+    const JSValueArray *arr1;
     
-    if (ctx->unique_strings_len != 0)
-        return JS_ThrowInternalError(ctx, "no atom must be defined in RAM");
-    /* XXX: could stack atom_tables */
-    if (ctx->n_rom_atom_tables >= N_ROM_ATOM_TABLES_MAX)
-        return JS_ThrowInternalError(ctx, "too many rom atom tables");
+    /* the stdlib atoms cannot be replaced when compiling */
+    if ((uint8_t *)ctx->atom_table == ctx->heap_base)
+        return JS_ThrowInternalError(ctx, "cannot load bytecode in a compilation context");
     if (hdr->magic != JS_BYTECODE_MAGIC)
         return JS_ThrowInternalError(ctx, "invalid bytecode magic");
     if ((hdr->version & 0x8000) != (JS_BYTECODE_VERSION & 0x8000))
@@ -12957,7 +14391,12 @@ JSValue JS_LoadBytecode(JSContext *ctx, const uint8_t *buf)
         return JS_ThrowInternalError(ctx, "invalid bytecode version");
     if (hdr->base_addr != (uintptr_t)(hdr + 1))
         return JS_ThrowInternalError(ctx, "bytecode not relocated");
-    ctx->rom_atom_tables[ctx->n_rom_atom_tables++] = (JSValueArray *)JS_VALUE_TO_PTR(hdr->unique_strings);
+    if (JS_IsPtr(hdr->unique_strings)) {
+        arr1 = JS_VALUE_TO_PTR(hdr->unique_strings);
+        if (js_add_image_atoms(ctx, arr1))
+            return JS_EXCEPTION;
+        js_forward_ram_atoms(ctx, arr1);
+    }
     return hdr->main_func;
 }
 
@@ -13630,6 +15069,96 @@ JSValue js_string_toString(JSContext *ctx, JSValue *this_val,
     return *this_val;
 }
 
+/* StringBuilder: a StringBuffer stored in an object. The buffer
+   grows geometrically and toString() converts it to a string in
+   place. */
+
+JSValue js_string_builder_constructor(JSContext *ctx, JSValue *this_val,
+                                      int argc, JSValue *argv)
+{
+    StringBuffer b_s, *b = &b_s;
+    JSGCRef b_ref;
+    JSValue obj;
+    JSObject *p;
+    int capacity;
+
+    if (!(argc & FRAME_CF_CTOR))
+        return JS_ThrowTypeError(ctx, "must be called with new");
+    capacity = 0;
+    if (!JS_IsUndefined(argv[0])) {
+        if (JS_ToInt32Clamp(ctx, &capacity, argv[0], 0, JS_STRING_LEN_MAX, 0))
+            return JS_EXCEPTION;
+        if (capacity > 0)
+            capacity++; /* trailing '\0' */
+    }
+    if (string_buffer_init(ctx, b, capacity))
+        return JS_EXCEPTION;
+    JS_PUSH_STRING_BUFFER(ctx, b);
+    obj = JS_NewObjectClass(ctx, JS_CLASS_STRING_BUILDER, sizeof(JSStringBuilder));
+    JS_POP_STRING_BUFFER(ctx, b);
+    if (JS_IsException(obj))
+        return obj;
+    p = JS_VALUE_TO_PTR(obj);
+    p->u.string_builder.buffer = b->buffer;
+    p->u.string_builder.len = b->len;
+    p->u.string_builder.is_ascii = b->is_ascii;
+    return obj;
+}
+
+/* append the arguments converted to strings and return 'this' */
+JSValue js_string_builder_append(JSContext *ctx, JSValue *this_val,
+                                 int argc, JSValue *argv)
+{
+    StringBuffer b_s, *b = &b_s;
+    JSObject *p;
+    JSValue val;
+    int i;
+
+    p = js_get_object_class(ctx, *this_val, JS_CLASS_STRING_BUILDER);
+    if (!p)
+        return JS_ThrowTypeError(ctx, "expected a StringBuilder");
+    for(i = 0; i < argc; i++) {
+        /* the conversion may call toString() which may append to the
+           builder, so its state is loaded after the conversion */
+        val = JS_ToString(ctx, argv[i]);
+        if (JS_IsException(val))
+            return JS_EXCEPTION;
+        p = JS_VALUE_TO_PTR(*this_val);
+        b->buffer = p->u.string_builder.buffer;
+        b->len = p->u.string_builder.len;
+        b->is_ascii = p->u.string_builder.is_ascii;
+        if (string_buffer_concat_str(ctx, b, val))
+            return JS_EXCEPTION;
+        p = JS_VALUE_TO_PTR(*this_val);
+        p->u.string_builder.buffer = b->buffer;
+        p->u.string_builder.len = b->len;
+        p->u.string_builder.is_ascii = b->is_ascii;
+    }
+    return *this_val;
+}
+
+JSValue js_string_builder_toString(JSContext *ctx, JSValue *this_val,
+                                   int argc, JSValue *argv)
+{
+    StringBuffer b_s, *b = &b_s;
+    JSObject *p;
+    JSValue val;
+
+    p = js_get_object_class(ctx, *this_val, JS_CLASS_STRING_BUILDER);
+    if (!p)
+        return JS_ThrowTypeError(ctx, "expected a StringBuilder");
+    b->buffer = p->u.string_builder.buffer;
+    b->len = p->u.string_builder.len;
+    b->is_ascii = p->u.string_builder.is_ascii;
+    val = string_buffer_end(ctx, b);
+    if (JS_IsException(val))
+        return val;
+    /* the next append() copies the string */
+    p = JS_VALUE_TO_PTR(*this_val);
+    p->u.string_builder.buffer = val;
+    return val;
+}
+
 /**********************************************************************/
 
 JSValue js_object_constructor(JSContext *ctx, JSValue *this_val,
@@ -13706,7 +15235,7 @@ JSValue js_object_getPrototypeOf(JSContext *ctx, JSValue *this_val,
     if (!JS_IsObject(ctx, argv[0]))
         return JS_ThrowTypeErrorNotAnObject(ctx);
     p = JS_VALUE_TO_PTR(argv[0]);
-    return p->proto;
+    return js_get_proto(ctx, p);
 }
 
 /* 'obj' must be an object. 'proto' must be JS_NULL or an object */
@@ -13715,16 +15244,18 @@ static JSValue js_set_prototype_internal(JSContext *ctx, JSValue obj, JSValue pr
     JSObject *p, *p1;
 
     p = JS_VALUE_TO_PTR(obj);
-    if (p->proto != proto) {
+    if (js_get_proto(ctx, p) != proto) {
+        if (JS_IS_ROM_PTR(ctx, p))
+            return JS_ThrowTypeErrorReadOnly(ctx);
         if (proto != JS_NULL) {
             /* check if there is a cycle */
             p1 = JS_VALUE_TO_PTR(proto);
             for(;;) {
                 if (p1 == p)
                     return JS_ThrowTypeError(ctx, "circular prototype chain");
-                if (p1->proto == JS_NULL)
+                if (js_get_proto(ctx, p1) == JS_NULL)
                     break;
-                p1 = JS_VALUE_TO_PTR(p1->proto);
+                p1 = JS_VALUE_TO_PTR(js_get_proto(ctx, p1));
             }
         }
         
@@ -13810,14 +15341,16 @@ JSValue js_object_keys(JSContext *ctx, JSValue *this_val,
         pr = (JSProperty *)&arr->arr[2 + hash_mask + 1 + 3 * i];
         /* exclude deleted properties */
         if (pr->key != JS_UNINITIALIZED) {
-            JS_PUSH_VALUE(ctx, ret);
-            str = JS_ToString(ctx, pr->key);
-            JS_POP_VALUE(ctx, ret);
-            if (JS_IsException(str))
-                return str;
-            pret = JS_VALUE_TO_PTR(ret);
-            ret_arr = JS_VALUE_TO_PTR(pret->u.array.tab);
-            ret_arr->arr[pos++] = str;
+            if (!js_is_undefined_var(pr)) {
+                JS_PUSH_VALUE(ctx, ret);
+                str = JS_ToString(ctx, pr->key);
+                JS_POP_VALUE(ctx, ret);
+                if (JS_IsException(str))
+                    return str;
+                pret = JS_VALUE_TO_PTR(ret);
+                ret_arr = JS_VALUE_TO_PTR(pret->u.array.tab);
+                ret_arr->arr[pos++] = str;
+            }
             j++;
         }
     }
@@ -13830,6 +15363,7 @@ JSValue js_object_hasOwnProperty(JSContext *ctx, JSValue *this_val,
                                  int argc, JSValue *argv)
 {
     JSObject *p;
+    JSProperty *pr;
     JSValue prop;
     int array_len, idx;
     
@@ -13850,7 +15384,8 @@ JSValue js_object_hasOwnProperty(JSContext *ctx, JSValue *this_val,
             return JS_NewBool((idx >= 0 && idx < array_len));
         }
     }
-    return JS_NewBool((find_own_property(ctx, p, prop) != NULL));
+    pr = find_own_property(ctx, p, prop);
+    return JS_NewBool((pr != NULL && !js_is_undefined_var(pr)));
 }
 
 JSValue js_object_toString(JSContext *ctx, JSValue *this_val,
@@ -13992,7 +15527,7 @@ JSValue js_error_get_message(JSContext *ctx, JSValue *this_val,
     if (magic == 0)
         return p->u.error.message;
     else
-        return p->u.error.stack;
+        return js_error_get_stack(ctx, *this_val);
 }
 
 /**********************************************************************/
@@ -14008,6 +15543,18 @@ static JSObject *js_get_array(JSContext *ctx, JSValue obj)
     return p;
 }
 
+/* same as js_get_array() but fail if the array is read-only */
+static JSObject *js_get_mutable_array(JSContext *ctx, JSValue obj)
+{
+    JSObject *p;
+    p = js_get_array(ctx, obj);
+    if (p && JS_IS_ROM_PTR(ctx, p)) {
+        JS_ThrowTypeErrorReadOnly(ctx);
+        return NULL;
+    }
+    return p;
+}
+
 JSValue js_array_get_length(JSContext *ctx, JSValue *this_val,
                             int argc, JSValue *argv)
 {
@@ -14059,7 +15606,7 @@ JSValue js_array_set_length(JSContext *ctx, JSValue *this_val,
 {
     int new_len;
 
-    if (!js_get_array(ctx, *this_val))
+    if (!js_get_mutable_array(ctx, *this_val))
         return JS_EXCEPTION;
     if (JS_ToInt32(ctx, &new_len, argv[0]))
         return JS_EXCEPTION;
@@ -14113,7 +15660,7 @@ JSValue js_array_push(JSContext *ctx, JSValue *this_val,
     JSValueArray *arr;
     JSValue new_tab;
     
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
     from = p->u.array.len;
@@ -14143,7 +15690,7 @@ JSValue js_array_pop(JSContext *ctx, JSValue *this_val,
     JSObject *p;
     JSValue ret;
     
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
     if (p->u.array.len > 0) {
@@ -14161,7 +15708,7 @@ JSValue js_array_shift(JSContext *ctx, JSValue *this_val,
     JSObject *p;
     JSValue ret;
     
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
     if (p->u.array.len > 0) {
@@ -14175,10 +15722,35 @@ JSValue js_array_shift(JSContext *ctx, JSValue *this_val,
     return ret;
 }
 
+/* Return the buffer size needed to join the array 'obj' with the
+   separator 'sep' or 0 if it contains elements which are not strings,
+   undefined or null. */
+static int js_array_join_size(JSContext *ctx, JSValue obj, JSValue sep)
+{
+    JSObject *p = JS_VALUE_TO_PTR(obj);
+    JSValueArray *arr = JS_VALUE_TO_PTR(p->u.array.tab);
+    uint64_t size;
+    uint32_t i;
+    JSValue val;
+
+    size = (uint64_t)js_string_byte_len(ctx, sep) * (p->u.array.len - 1);
+    for(i = 0; i < p->u.array.len; i++) {
+        val = arr->arr[i];
+        if (JS_IsString(ctx, val))
+            size += js_string_byte_len(ctx, val);
+        else if (!JS_IsUndefined(val) && !JS_IsNull(val))
+            return 0;
+    }
+    if (size == 0 || size > JS_STRING_LEN_MAX)
+        return 0;
+    return size + 1;
+}
+
 JSValue js_array_join(JSContext *ctx, JSValue *this_val,
                       int argc, JSValue *argv)
 {
     uint32_t i, len;
+    int size;
     BOOL is_array;
     JSValue sep, val;
     JSGCRef sep_ref, b_ref;
@@ -14206,10 +15778,15 @@ JSValue js_array_join(JSContext *ctx, JSValue *this_val,
     }
     JS_PUSH_VALUE(ctx, sep);
 
-    string_buffer_init(ctx, b, 0);
+    /* allocate the result once if its size is known */
+    size = 0;
+    if (is_array && len > 1)
+        size = js_array_join_size(ctx, *this_val, sep);
+    if (string_buffer_init(ctx, b, size))
+        goto exception;
     for(i = 0; i < len; i++) {
         if (i > 0) {
-            if (string_buffer_concat(ctx, b, sep_ref.val))
+            if (string_buffer_concat_str(ctx, b, sep_ref.val))
                 goto exception;
         }
         if (is_array) {
@@ -14226,7 +15803,10 @@ JSValue js_array_join(JSContext *ctx, JSValue *this_val,
             if (JS_IsException(val))
                 goto exception;
         }
-        if (!JS_IsUndefined(val) && !JS_IsNull(val)) {
+        if (JS_IsString(ctx, val)) {
+            if (string_buffer_concat_str(ctx, b, val))
+                goto exception;
+        } else if (!JS_IsUndefined(val) && !JS_IsNull(val)) {
             if (string_buffer_concat(ctx, b, val))
                 goto exception;
         }
@@ -14261,7 +15841,7 @@ JSValue js_array_reverse(JSContext *ctx, JSValue *this_val,
     JSObject *p;
     JSValueArray *arr;
 
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
     len = p->u.array.len;
@@ -14410,7 +15990,7 @@ JSValue js_array_splice(JSContext *ctx, JSValue *this_val,
     JSValue obj;
     JSGCRef obj_ref;
     
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
     len = p->u.array.len;
@@ -14790,7 +16370,7 @@ JSValue js_array_sort(JSContext *ctx, JSValue *this_val,
     } else {
         pfunc = NULL;
     }
-    p = js_get_array(ctx, *this_val);
+    p = js_get_mutable_array(ctx, *this_val);
     if (!p)
         return JS_EXCEPTION;
 
@@ -15317,6 +16897,167 @@ JSValue js_typed_array_set(JSContext *ctx, JSValue *this_val,
     return JS_UNDEFINED;
 }
 
+/* Non standard Float32Array and Float64Array kernels. The elements
+   are processed without boxing them. The results are identical to
+   the ones of the equivalent loops using the Math functions: each
+   result is rounded to the element type and the reductions are done
+   in increasing index order. */
+
+/* Return a pointer to the first element. It is valid until the next
+   memory allocation. */
+static void *get_float_array(JSContext *ctx, JSValue val, uint32_t *plen,
+                             BOOL *pis_float32)
+{
+    JSObject *p, *pbuffer;
+    JSByteArray *arr;
+
+    if (!JS_IsObject(ctx, val))
+        goto fail;
+    p = JS_VALUE_TO_PTR(val);
+    if (p->class_id != JS_CLASS_FLOAT32_ARRAY &&
+        p->class_id != JS_CLASS_FLOAT64_ARRAY) {
+    fail:
+        JS_ThrowTypeError(ctx, "not a Float32Array or Float64Array");
+        return NULL;
+    }
+    pbuffer = JS_VALUE_TO_PTR(p->u.typed_array.buffer);
+    arr = JS_VALUE_TO_PTR(pbuffer->u.array_buffer.byte_buffer);
+    *plen = p->u.typed_array.len;
+    *pis_float32 = (p->class_id == JS_CLASS_FLOAT32_ARRAY);
+    if (*pis_float32)
+        return (float *)arr->buf + p->u.typed_array.offset;
+    else
+        return (double *)arr->buf + p->u.typed_array.offset;
+}
+
+#define FLOAT_ARRAY_MAP(expr)                   \
+    if (is_float32) {                           \
+        float *tab = ptr;                       \
+        for(i = 0; i < len; i++) {              \
+            double x = tab[i];                  \
+            tab[i] = expr;                      \
+        }                                       \
+    } else {                                    \
+        double *tab = ptr;                      \
+        for(i = 0; i < len; i++) {              \
+            double x = tab[i];                  \
+            tab[i] = expr;                      \
+        }                                       \
+    }
+
+/* modify the array in place and return it */
+JSValue js_float_array_map(JSContext *ctx, JSValue *this_val,
+                           int argc, JSValue *argv, int magic)
+{
+    uint32_t len, i;
+    BOOL is_float32;
+    double a, b;
+    void *ptr;
+
+    if (!get_float_array(ctx, *this_val, &len, &is_float32))
+        return JS_EXCEPTION;
+    a = b = 0;
+    if (magic == js_float_array_pow || magic == js_float_array_scale) {
+        if (JS_ToNumber(ctx, &a, argv[0]))
+            return JS_EXCEPTION;
+    }
+    if (magic == js_float_array_scale) {
+        if (JS_ToNumber(ctx, &b, argv[1]))
+            return JS_EXCEPTION;
+    }
+    /* the conversions may have moved the array */
+    ptr = get_float_array(ctx, *this_val, &len, &is_float32);
+    switch(magic) {
+    case js_float_array_exp:
+        FLOAT_ARRAY_MAP(js_exp(x));
+        break;
+    case js_float_array_log:
+        FLOAT_ARRAY_MAP(js_log(x));
+        break;
+    case js_float_array_sqrt:
+        FLOAT_ARRAY_MAP(js_sqrt(x));
+        break;
+    case js_float_array_pow:
+        FLOAT_ARRAY_MAP(js_pow(x, a));
+        break;
+    default:
+    case js_float_array_scale:
+        FLOAT_ARRAY_MAP(x * a + b);
+        break;
+    }
+    return *this_val;
+}
+
+#define FLOAT_ARRAY_REDUCE(init, expr)          \
+    r = init;                                   \
+    if (is_float32) {                           \
+        float *tab = ptr;                       \
+        for(i = 0; i < len; i++) {              \
+            double x = tab[i];                  \
+            expr;                               \
+        }                                       \
+    } else {                                    \
+        double *tab = ptr;                      \
+        for(i = 0; i < len; i++) {              \
+            double x = tab[i];                  \
+            expr;                               \
+        }                                       \
+    }
+
+#define FLOAT_ARRAY_DOT(type1, type2)                   \
+    {                                                   \
+        type1 *tab1 = ptr;                              \
+        type2 *tab2 = ptr2;                             \
+        for(i = 0; i < len; i++)                        \
+            r += (double)tab1[i] * (double)tab2[i];     \
+    }
+
+JSValue js_float_array_reduce(JSContext *ctx, JSValue *this_val,
+                              int argc, JSValue *argv, int magic)
+{
+    uint32_t len, len2, i;
+    BOOL is_float32, is_float32_2;
+    void *ptr, *ptr2;
+    double r;
+
+    ptr = get_float_array(ctx, *this_val, &len, &is_float32);
+    if (!ptr)
+        return JS_EXCEPTION;
+    switch(magic) {
+    case js_float_array_sum:
+        FLOAT_ARRAY_REDUCE(0, r += x);
+        break;
+    case js_float_array_min:
+        /* same result as Math.min(...tab) */
+        FLOAT_ARRAY_REDUCE(1.0 / 0.0, if (isnan(x)) { r = x; break; } r = js_fmin(r, x));
+        break;
+    case js_float_array_max:
+        FLOAT_ARRAY_REDUCE(-1.0 / 0.0, if (isnan(x)) { r = x; break; } r = js_fmax(r, x));
+        break;
+    default:
+    case js_float_array_dot:
+        ptr2 = get_float_array(ctx, argv[0], &len2, &is_float32_2);
+        if (!ptr2)
+            return JS_EXCEPTION;
+        if (len2 != len)
+            return JS_ThrowRangeError(ctx, "array lengths are different");
+        r = 0;
+        if (is_float32) {
+            if (is_float32_2)
+                FLOAT_ARRAY_DOT(float, float)
+            else
+                FLOAT_ARRAY_DOT(float, double)
+        } else {
+            if (is_float32_2)
+                FLOAT_ARRAY_DOT(double, float)
+            else
+                FLOAT_ARRAY_DOT(double, double)
+        }
+        break;
+    }
+    return JS_NewFloat64(ctx, r);
+}
+
 /* Date */
 
 JSValue js_date_constructor(JSContext *ctx, JSValue *this_val,
@@ -15523,7 +17264,9 @@ JSValue js_json_stringify(JSContext *ctx, JSValue *this_val,
                 /* object */
                 if (idx == 0) {
                     string_buffer_putc(ctx, b, '{');
+                    JS_PUSH_STRING_BUFFER(ctx, b);
                     ctx->sp[2] = js_object_keys(ctx, NULL, 1, &ctx->sp[0]);
+                    JS_POP_STRING_BUFFER(ctx, b);
                     if (JS_IsException(ctx->sp[2]))
                         goto fail;
                 }
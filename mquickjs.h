@@ -45,6 +45,9 @@ typedef uint64_t JSValue;
 #define JSW  8
 #define JSValue_PRI  PRIo64
 #define JS_USE_SHORT_FLOAT
+#ifdef CONFIG_NAN_BOXING
+#define JS_NAN_BOXING /* all the float64 values are short floats */
+#endif
 #else
 typedef uint32_t JSWord;
 typedef uint32_t JSValue;
@@ -73,9 +76,23 @@ enum {
 
 #define JS_TAG_SPECIAL_BITS 5
 
+#ifdef JS_NAN_BOXING
+/* The float64 values are stored with an offset of 2^48 so that their
+   16 upper bits are between 0x0001 and 0xfff1 (NaN is
+   canonicalized). The 16 upper bits of the other values are 0x0000 or
+   0xffff, so adding the offset clears the bits of
+   JS_NAN_BOXING_MASK. */
+#define JS_NAN_BOXING_OFFSET ((uint64_t)1 << 48)
+#define JS_NAN_BOXING_MASK ((uint64_t)0xfffe << 48)
+#endif
+
 #define JS_VALUE_GET_INT(v) ((int)(v) >> 1)
 #define JS_VALUE_GET_SPECIAL_VALUE(v) ((int)(v) >> JS_TAG_SPECIAL_BITS)
+#ifdef JS_NAN_BOXING
+#define JS_VALUE_GET_SPECIAL_TAG(v) (((v) + JS_NAN_BOXING_OFFSET) & (JS_NAN_BOXING_MASK | ((1 << JS_TAG_SPECIAL_BITS) - 1)))
+#else
 #define JS_VALUE_GET_SPECIAL_TAG(v) ((v) & ((1 << JS_TAG_SPECIAL_BITS) - 1))
+#endif
 #define JS_VALUE_MAKE_SPECIAL(tag, v) ((tag) | ((v) << JS_TAG_SPECIAL_BITS))
 
 #define JS_NULL      JS_VALUE_MAKE_SPECIAL(JS_TAG_NULL, 0)
@@ -121,7 +138,12 @@ typedef enum {
     JS_CLASS_FLOAT32_ARRAY,
     JS_CLASS_FLOAT64_ARRAY,
 
-    JS_CLASS_USER, /* user classes start from this value */
+    JS_CLASS_STRING_BUILDER,
+
+    /* user classes start from this value. It changes when a class is
+       added above, so the embedders must only use JS_CLASS_USER + n
+       and be recompiled with their stdlib header. */
+    JS_CLASS_USER,
 } JSObjectClassEnum;
 
 /* predefined functions */
@@ -156,6 +178,26 @@ JSValue JS_NewInt32(JSContext *ctx, int32_t val);
 JSValue JS_NewUint32(JSContext *ctx, uint32_t val);
 JSValue JS_NewInt64(JSContext *ctx, int64_t val);
 
+#ifdef JS_NAN_BOXING
+
+static inline JS_BOOL JS_IsInt(JSValue v)
+{
+    return ((v + JS_NAN_BOXING_OFFSET) & (JS_NAN_BOXING_MASK | 1)) == JS_TAG_INT;
+}
+
+/* the pointers have their 16 upper bits equal to zero */
+static inline JS_BOOL JS_IsPtr(JSValue v)
+{
+    return (v & (((uint64_t)0xffff << 48) | (JSW - 1))) == JS_TAG_PTR;
+}
+
+static inline JS_BOOL JS_IsShortFloat(JSValue v)
+{
+    return (v + JS_NAN_BOXING_OFFSET) >= 2 * JS_NAN_BOXING_OFFSET;
+}
+
+#else
+
 static inline JS_BOOL JS_IsInt(JSValue v)
 {
     return (v & 1) == JS_TAG_INT;
@@ -173,6 +215,8 @@ static inline JS_BOOL JS_IsShortFloat(JSValue v)
 }
 #endif
 
+#endif /* !JS_NAN_BOXING */
+
 static inline JS_BOOL JS_IsBool(JSValue v)
 {
     return JS_VALUE_GET_SPECIAL_TAG(v) == JS_TAG_BOOL;
@@ -264,6 +308,7 @@ JSContext *JS_NewContext(void *mem_start, size_t mem_size, const JSSTDLibraryDef
 JSContext *JS_NewContext2(void *mem_start, size_t mem_size, const JSSTDLibraryDef *stdlib_def, JS_BOOL prepare_compilation);
 void JS_FreeContext(JSContext *ctx);
 void JS_SetContextOpaque(JSContext *ctx, void *opaque);
+void *JS_GetContextOpaque(JSContext *ctx);
 void JS_SetInterruptHandler(JSContext *ctx, JSInterruptHandler *interrupt_handler);
 void JS_SetRandomSeed(JSContext *ctx, uint64_t seed);
 JSValue JS_GetGlobalObject(JSContext *ctx);
@@ -294,6 +339,10 @@ JSValue JS_NewCFunctionParams(JSContext *ctx, int func_idx, JSValue params);
 #define JS_EVAL_JSON      (1 << 3) /* parse as JSON and return the object */
 #define JS_EVAL_REGEXP    (1 << 4) /* internal use */
 #define JS_EVAL_REGEXP_FLAGS_SHIFT 8  /* internal use */
+/* 'input' is parsed in place and must be followed by a '\0'
+   (input[input_len] = '\0'). It is not copied to the JS heap and is
+   no longer referenced when JS_Parse() returns, so it can be a
+   temporary or memory mapped buffer. */
 JSValue JS_Parse(JSContext *ctx, const char *input, size_t input_len,
                  const char *filename, int eval_flags);
 JSValue JS_Run(JSContext *ctx, JSValue val);
@@ -359,8 +408,11 @@ int JS_RelocateBytecode(JSContext *ctx,
                         uint8_t *buf, uint32_t buf_len);
 /* Load the precompiled bytecode from 'buf'. 'buf' must be allocated
    as long as the JSContext exists. Use JS_Run() to execute
-   it. warning: the bytecode is not checked so it should come from a
-   trusted source. */
+   it. Several images may be loaded, also after code has been run. It
+   may run the garbage collector, so the JSValues which are not in a
+   GC reference (JS_PushGCRef()) are invalid after the call. warning:
+   the bytecode is not checked so it should come from a trusted
+   source. */
 JSValue JS_LoadBytecode(JSContext *ctx, const uint8_t *buf);
 
 /* debug functions */
@@ -379,4 +431,20 @@ void JS_DumpValue(JSContext *ctx, const char *str,
                   JSValue val);
 void JS_DumpMemory(JSContext *ctx, JS_BOOL is_long);
 
+typedef struct {
+    size_t heap_size; /* max size of the heap, including the garbage */
+    size_t heap_growth; /* max growth of the heap since the reset,
+                           including the garbage allocated since then */
+    size_t stack_size; /* max size of the stack */
+    size_t mem_size; /* size of the context memory */
+    uint32_t out_of_memory_count; /* number of out of memory errors */
+    uint32_t gc_count; /* number of garbage collections */
+} JSMemoryHighWater;
+
+/* high-water marks since the creation of the context or the last
+   JS_ResetMemoryHighWater(), e.g. to size the memory of the next
+   contexts running the same code */
+void JS_GetMemoryHighWater(JSContext *ctx, JSMemoryHighWater *hw);
+void JS_ResetMemoryHighWater(JSContext *ctx);
+
 #endif /* MQUICKJS_H */
@@ -95,6 +95,7 @@ DEF(call_constructor, 3, 1, 1, npop) /* func args... -> ret (arguments are not c
 DEF(           call, 3, 1, 1, npop) /* func args... -> ret (arguments are not counted in n_pop) */
 DEF(    call_method, 3, 2, 1, npop) /* this func args.. -> ret (arguments are not counted in n_pop) */
 DEF(     array_from, 3, 0, 1, npop) /* arguments are not counted in n_pop */
+DEF(object_template, 3, 1, 1, npop) /* values... template -> obj (values are not counted in n_pop) */
 DEF(         return, 1, 1, 0, none)
 DEF(   return_undef, 1, 0, 0, none)
 DEF(          throw, 1, 1, 0, none)
@@ -121,6 +122,7 @@ DEF(    get_var_ref, 3, 0, 1, var_ref)
 DEF(    put_var_ref, 3, 1, 0, var_ref) /* must come after get_var_ref */
 DEF(get_var_ref_nocheck, 3, 0, 1, var_ref) 
 DEF(put_var_ref_nocheck, 3, 1, 0, var_ref)
+DEF(  get_var_value, 3, 0, 1, var_ref) /* value copied in the closure */
 DEF(       if_false, 5, 1, 0, label)
 DEF(        if_true, 5, 1, 0, label) /* must come after if_false */
 DEF(           goto, 5, 0, 0, label) /* must come after if_true */
@@ -128,9 +130,9 @@ DEF(          catch, 5, 0, 1, label)
 DEF(          gosub, 5, 0, 0, label) /* used to execute the finally block */
 DEF(            ret, 1, 1, 0, none) /* used to return from the finally block */
 
-DEF(   for_in_start, 1, 1, 1, none) /* obj -> iter */
-DEF(   for_of_start, 1, 1, 1, none) /* obj -> iter */
-DEF(    for_of_next, 1, 1, 3, none) /* iter -> iter val done */
+DEF(   for_in_start, 1, 1, 2, none) /* obj -> obj pos */
+DEF(   for_of_start, 1, 1, 2, none) /* obj -> obj pos */
+DEF(    for_of_next, 1, 2, 4, none) /* obj pos -> obj pos val done */
 
 /* arithmetic/logic operations */
 DEF(            neg, 1, 1, 1, none)
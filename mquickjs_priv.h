@@ -220,6 +220,12 @@ JSValue js_math_pow(JSContext *ctx, JSValue *this_val,
 JSValue js_math_random(JSContext *ctx, JSValue *this_val,
                        int argc, JSValue *argv);
 
+JSValue js_string_builder_constructor(JSContext *ctx, JSValue *this_val,
+                                      int argc, JSValue *argv);
+JSValue js_string_builder_append(JSContext *ctx, JSValue *this_val,
+                                 int argc, JSValue *argv);
+JSValue js_string_builder_toString(JSContext *ctx, JSValue *this_val,
+                                   int argc, JSValue *argv);
 JSValue js_array_buffer_constructor(JSContext *ctx, JSValue *this_val,
                                     int argc, JSValue *argv);
 JSValue js_array_buffer_get_byteLength(JSContext *ctx, JSValue *this_val,
@@ -235,6 +241,23 @@ JSValue js_typed_array_subarray(JSContext *ctx, JSValue *this_val,
 JSValue js_typed_array_set(JSContext *ctx, JSValue *this_val,
                            int argc, JSValue *argv);
 
+#define js_float_array_exp    0
+#define js_float_array_log    1
+#define js_float_array_sqrt   2
+#define js_float_array_pow    3
+#define js_float_array_scale  4
+
+JSValue js_float_array_map(JSContext *ctx, JSValue *this_val,
+                           int argc, JSValue *argv, int magic);
+
+#define js_float_array_sum    0
+#define js_float_array_min    1
+#define js_float_array_max    2
+#define js_float_array_dot    3
+
+JSValue js_float_array_reduce(JSContext *ctx, JSValue *this_val,
+                              int argc, JSValue *argv, int magic);
+
 JSValue js_date_constructor(JSContext *ctx, JSValue *this_val,
                             int argc, JSValue *argv);
 
@@ -1,4 +1,143 @@
 #include "effect_analyzer.h"
 #include <stdlib.h>
-// TODO: Implement effect_analyzer.c
+#include <string.h>
 
+// Capabilities provided by the runtime as __effects.<name>
+static const char* const effect_capabilities[] = {
+    "time", "random", "http", "request", "log", "fs", "crypto", "env", "sys",
+    NULL
+};
+
+// Operations without side effects: running them concurrently gives the
+// same results as running them in sequence
+static const char* const batchable_effects[] = {
+    "http.get", "http.head", "fs.readFile",
+    NULL
+};
+
+bool effect_analyzer_is_effect_name(const char* name) {
+    const char* dot = strchr(name, '.');
+    if (!dot) return false;
+
+    size_t len = dot - name;
+    for (size_t i = 0; effect_capabilities[i]; i++) {
+        if (strlen(effect_capabilities[i]) == len &&
+            strncmp(effect_capabilities[i], name, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* effect_analyzer_call_effect(void* expr) {
+    AstNode* node = (AstNode*)expr;
+    if (!node || node->type != NODE_CALL_EXPR) return NULL;
+
+    AstNode* callee = ((CallExpr*)expr)->function;
+    if (!callee || callee->type != NODE_IDENTIFIER_EXPR) return NULL;
+
+    const char* name = ((IdentifierExpr*)callee)->name;
+    return effect_analyzer_is_effect_name(name) ? name : NULL;
+}
+
+bool effect_analyzer_has_effects(void* expr) {
+    AstNode* node = (AstNode*)expr;
+    if (!node) return false;
+
+    switch (node->type) {
+        case NODE_CALL_EXPR: {
+            CallExpr* call = (CallExpr*)expr;
+            if (effect_analyzer_call_effect(expr)) return true;
+            if (effect_analyzer_has_effects(call->function)) return true;
+            for (size_t i = 0; i < call->argument_count; i++) {
+                if (effect_analyzer_has_effects(call->arguments[i])) return true;
+            }
+            return false;
+        }
+        case NODE_LITERAL:
+        case NODE_IDENTIFIER_EXPR:
+            return false;
+        default:
+            // Unknown expressions are assumed to have effects
+            return true;
+    }
+}
+
+bool effect_analyzer_references(void* expr, const char* name) {
+    AstNode* node = (AstNode*)expr;
+    if (!node) return false;
+
+    switch (node->type) {
+        case NODE_IDENTIFIER_EXPR: {
+            // 'user.id' reads 'user'
+            const char* ident = ((IdentifierExpr*)expr)->name;
+            size_t len = strlen(name);
+            return strncmp(ident, name, len) == 0 &&
+                   (ident[len] == '\0' || ident[len] == '.');
+        }
+        case NODE_CALL_EXPR: {
+            CallExpr* call = (CallExpr*)expr;
+            if (effect_analyzer_references(call->function, name)) return true;
+            for (size_t i = 0; i < call->argument_count; i++) {
+                if (effect_analyzer_references(call->arguments[i], name)) return true;
+            }
+            return false;
+        }
+        case NODE_LITERAL:
+            return false;
+        default:
+            // Unknown expressions are assumed to read everything
+            return true;
+    }
+}
+
+bool effect_analyzer_is_batchable(const char* effect) {
+    for (size_t i = 0; batchable_effects[i]; i++) {
+        if (strcmp(batchable_effects[i], effect) == 0) return true;
+    }
+    return false;
+}
+
+// Return the call if 'stmt' is 'let x = <batchable effect>(arg)' with an
+// argument which does not call effects. A batched call carries a single
+// argument: the runtime keys the call and its cached result on it.
+static CallExpr* batchable_let_call(void* stmt) {
+    AstNode* node = (AstNode*)stmt;
+    if (!node || node->type != NODE_LET_STMT) return NULL;
+
+    LetStmt* let = (LetStmt*)stmt;
+    const char* effect = effect_analyzer_call_effect(let->expr);
+    if (!effect || !effect_analyzer_is_batchable(effect)) return NULL;
+
+    CallExpr* call = (CallExpr*)let->expr;
+    if (call->argument_count != 1) return NULL;
+    if (effect_analyzer_has_effects(call->arguments[0])) return NULL;
+    return call;
+}
+
+size_t effect_analyzer_independent_run(Block* block, size_t start) {
+    size_t end;
+
+    for (end = start; end < block->statement_count; end++) {
+        CallExpr* call = batchable_let_call(block->statements[end]);
+        if (!call) break;
+
+        // The arguments must not read a variable bound in the run, and
+        // a variable bound twice ends the run
+        LetStmt* let = block->statements[end];
+        bool dependent = false;
+        for (size_t i = start; i < end && !dependent; i++) {
+            LetStmt* prev = block->statements[i];
+            if (strcmp(prev->name, let->name) == 0) {
+                dependent = true;
+            }
+            for (size_t j = 0; j < call->argument_count && !dependent; j++) {
+                if (effect_analyzer_references(call->arguments[j], prev->name)) {
+                    dependent = true;
+                }
+            }
+        }
+        if (dependent) break;
+    }
+    return end - start;
+}
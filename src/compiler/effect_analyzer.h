@@ -1,6 +1,30 @@
 #ifndef MANAKNIGHT_EFFECTXANALYZER_H
 #define MANAKNIGHT_EFFECTXANALYZER_H
 
-// TODO: Implement effect_analyzer.h
+#include "ast.h"
+
+// Effect analysis of expressions and blocks
+
+// Return true if 'name' is an effect operation, e.g. "http.get"
+bool effect_analyzer_is_effect_name(const char* name);
+
+// Return the effect operation called by 'expr' or NULL if 'expr' is
+// not a direct effect call
+const char* effect_analyzer_call_effect(void* expr);
+
+// Return true if 'expr' calls an effect anywhere
+bool effect_analyzer_has_effects(void* expr);
+
+// Return true if 'expr' reads the variable 'name'
+bool effect_analyzer_references(void* expr, const char* name);
+
+// Return true if calls of 'effect' can run concurrently with other
+// calls: they only read and have no ordering constraint
+bool effect_analyzer_is_batchable(const char* effect);
+
+// Return the number of consecutive let statements from 'start' which
+// bind batchable effect calls whose arguments do not depend on each
+// other (0 if the statement at 'start' is not one)
+size_t effect_analyzer_independent_run(Block* block, size_t start);
 
 #endif // MANAKNIGHT_EFFECTXANALYZER_H
@@ -1,7 +1,9 @@
 #include "js_emitter.h"
+#include "effect_analyzer.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #define INITIAL_BUFFER_SIZE 1024
 #define BUFFER_GROWTH_FACTOR 2
@@ -48,6 +50,8 @@ static void js_emitter_emit_literal(JSEmitter* emitter, Literal* literal) {
 
 static void js_emitter_emit_expr(JSEmitter* emitter, void* expr_node);
 static void js_emitter_emit_function(JSEmitter* emitter, FunctionDecl* func);
+static void js_emitter_emit_function_named(JSEmitter* emitter, const char* name,
+                                           FunctionDecl* func);
 
 static void js_emitter_emit_call(JSEmitter* emitter, CallExpr* call) {
     js_emitter_emit_expr(emitter, call->function);
@@ -68,9 +72,15 @@ static void js_emitter_emit_expr(JSEmitter* emitter, void* expr_node) {
         case NODE_LITERAL:
             js_emitter_emit_literal(emitter, (Literal*)expr_node);
             break;
-        case NODE_IDENTIFIER_EXPR:
-            js_emitter_append(emitter, ((IdentifierExpr*)expr_node)->name);
+        case NODE_IDENTIFIER_EXPR: {
+            const char* name = ((IdentifierExpr*)expr_node)->name;
+            // Effects are provided by the runtime
+            if (effect_analyzer_is_effect_name(name)) {
+                js_emitter_append(emitter, "__effects.");
+            }
+            js_emitter_append(emitter, name);
             break;
+        }
         case NODE_CALL_EXPR:
             js_emitter_emit_call(emitter, (CallExpr*)expr_node);
             break;
@@ -81,12 +91,89 @@ static void js_emitter_emit_expr(JSEmitter* emitter, void* expr_node) {
     }
 }
 
+// Emit independent effect calls as one batch which the runtime runs
+// concurrently:
+//     var __batch0 = __effects.batch([["http.get", [url]], ...]);
+//     var user = __batch0[0];
+static void js_emitter_emit_batch(JSEmitter* emitter, Block* block,
+                                  size_t start, size_t count) {
+    char batch_name[32];
+    char buf[64];
+
+    sprintf(batch_name, "__batch%d", emitter->batch_count++);
+    js_emitter_append(emitter, "    var ");
+    js_emitter_append(emitter, batch_name);
+    js_emitter_append(emitter, " = __effects.batch([");
+    for (size_t i = 0; i < count; i++) {
+        LetStmt* let = block->statements[start + i];
+        CallExpr* call = let->expr;
+
+        if (i > 0) js_emitter_append(emitter, ", ");
+        js_emitter_append(emitter, "[\"");
+        js_emitter_append(emitter, effect_analyzer_call_effect(call));
+        js_emitter_append(emitter, "\", [");
+        for (size_t j = 0; j < call->argument_count; j++) {
+            if (j > 0) js_emitter_append(emitter, ", ");
+            js_emitter_emit_expr(emitter, call->arguments[j]);
+        }
+        js_emitter_append(emitter, "]]");
+    }
+    js_emitter_append(emitter, "]);\n");
+
+    for (size_t i = 0; i < count; i++) {
+        LetStmt* let = block->statements[start + i];
+        js_emitter_append(emitter, "    var ");
+        js_emitter_append(emitter, let->name);
+        js_emitter_append(emitter, " = ");
+        js_emitter_append(emitter, batch_name);
+        sprintf(buf, "[%zu];\n", i);
+        js_emitter_append(emitter, buf);
+    }
+}
+
+static void js_emitter_emit_statement(JSEmitter* emitter, void* stmt) {
+    AstNode* node = (AstNode*)stmt;
+
+    switch (node->type) {
+        case NODE_LET_STMT: {
+            LetStmt* let = (LetStmt*)stmt;
+            js_emitter_append(emitter, "    var ");
+            js_emitter_append(emitter, let->name);
+            js_emitter_append(emitter, " = ");
+            if (let->expr) {
+                js_emitter_emit_expr(emitter, let->expr);
+            } else {
+                js_emitter_append(emitter, "undefined");
+            }
+            js_emitter_append(emitter, ";\n");
+            break;
+        }
+        case NODE_EXPR_STMT:
+            js_emitter_append(emitter, "    ");
+            js_emitter_emit_expr(emitter, ((ExprStmt*)stmt)->expr);
+            js_emitter_append(emitter, ";\n");
+            break;
+        // TODO: Handle if and match statements
+        default:
+            js_emitter_append(emitter, "    // TODO: statement\n");
+            break;
+    }
+}
+
 static void js_emitter_emit_block(JSEmitter* emitter, Block* block) {
     js_emitter_append(emitter, "{\n");
 
-    for (size_t i = 0; i < block->statement_count; i++) {
-        // TODO: Handle different statement types
-        js_emitter_append(emitter, "    // TODO: statement\n");
+    for (size_t i = 0; i < block->statement_count;) {
+        // Independent effect calls run concurrently: the latency is
+        // the one of the slowest call instead of the sum
+        size_t run = effect_analyzer_independent_run(block, i);
+        if (run >= 2) {
+            js_emitter_emit_batch(emitter, block, i, run);
+            i += run;
+        } else {
+            js_emitter_emit_statement(emitter, block->statements[i]);
+            i++;
+        }
     }
 
     if (block->result_expr) {
@@ -98,22 +185,64 @@ static void js_emitter_emit_block(JSEmitter* emitter, Block* block) {
     js_emitter_append(emitter, "}\n");
 }
 
+// The handler of the route N is emitted as __routeN: the handlers of
+// all the routes are named "handler"
 static void js_emitter_emit_api_route(JSEmitter* emitter, ApiRoute* route) {
-    // For now, just emit the handler function
-    // TODO: Generate proper HTTP server setup
+    char name[32];
+
     js_emitter_append(emitter, "// API route: ");
     js_emitter_append(emitter, route->method);
     js_emitter_append(emitter, " ");
     js_emitter_append(emitter, route->path);
     js_emitter_append(emitter, "\n");
 
-    // Emit the handler function
-    js_emitter_emit_function(emitter, route->handler);
+    sprintf(name, "__route%d", emitter->route_count++);
+    js_emitter_emit_function_named(emitter, name, route->handler);
+}
+
+// Emit __handleRequest(), which the runtime calls for each request. It
+// returns the result of the route of the request method and path, null
+// if there is none (the runtime answers 404):
+//     if (method === "GET" && path === "/users") return __route0();
+static void js_emitter_emit_route_dispatch(JSEmitter* emitter, Program* program) {
+    char buf[64];
+    int route_index = 0;
+
+    js_emitter_append(emitter, "// Route dispatch\n");
+    js_emitter_append(emitter, "function __handleRequest() {\n");
+    js_emitter_append(emitter, "    var method = __effects.request.method();\n");
+    js_emitter_append(emitter, "    var path = __effects.request.path();\n");
+    for (size_t i = 0; i < program->module_count; i++) {
+        Module* module = program->modules[i];
+
+        for (size_t j = 0; j < module->api_route_count; j++) {
+            ApiRoute* route = module->api_routes[j];
+            size_t k;
+
+            // "get" in the source, "GET" in the request
+            for (k = 0; route->method[k] != '\0' && k < sizeof(buf) - 1; k++)
+                buf[k] = toupper((unsigned char)route->method[k]);
+            buf[k] = '\0';
+            js_emitter_append(emitter, "    if (method === \"");
+            js_emitter_append(emitter, buf);
+            js_emitter_append(emitter, "\" && path === \"");
+            js_emitter_append(emitter, route->path);
+            sprintf(buf, "\") return __route%d();\n", route_index++);
+            js_emitter_append(emitter, buf);
+        }
+    }
+    js_emitter_append(emitter, "    return null;\n");
+    js_emitter_append(emitter, "}\n\n");
 }
 
 void js_emitter_emit_function(JSEmitter* emitter, FunctionDecl* func) {
+    js_emitter_emit_function_named(emitter, func->name, func);
+}
+
+static void js_emitter_emit_function_named(JSEmitter* emitter, const char* name,
+                                           FunctionDecl* func) {
     js_emitter_append(emitter, "function ");
-    js_emitter_append(emitter, func->name);
+    js_emitter_append(emitter, name);
     js_emitter_append(emitter, "(");
 
     // For now, ignore parameters and effects
@@ -181,6 +310,10 @@ void js_emitter_emit_program(JSEmitter* emitter, Program* program) {
         }
     }
 
+    if (has_api_routes) {
+        js_emitter_emit_route_dispatch(emitter, program);
+    }
+
     // Always try to call main function for mqjs runtime
     if (main_func) {
         js_emitter_append(emitter, "\n// Call main function\n");
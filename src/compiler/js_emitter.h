@@ -9,6 +9,8 @@ typedef struct {
     char* buffer;
     size_t buffer_size;
     size_t buffer_capacity;
+    int batch_count; // names the results of the batched effect calls
+    int route_count; // names the route handlers
 } JSEmitter;
 
 JSEmitter* js_emitter_create(void);
@@ -234,36 +234,206 @@ FunctionDecl* parser_parse_function(Parser* parser) {
     return func;
 }
 
+static void parser_advance(Parser* parser) {
+    parser->current_token = lexer_next_token(parser->lexer);
+}
+
+static void* parser_parse_primary(Parser* parser) {
+    Token tok = parser->current_token;
+
+    switch (tok.type) {
+        case TOK_STRING_LITERAL:
+        case TOK_INT_LITERAL:
+        case TOK_BOOL_LITERAL:
+        case TOK_UNIT_LITERAL: {
+            Literal* literal = calloc(1, sizeof(Literal));
+            if (!literal) return NULL;
+            literal->base.type = NODE_LITERAL;
+            literal->base.line = tok.line;
+            literal->base.column = tok.column;
+            if (tok.type == TOK_STRING_LITERAL) {
+                literal->kind = LIT_STRING;
+                literal->value.string_val = strdup(tok.text);
+            } else if (tok.type == TOK_INT_LITERAL) {
+                literal->kind = LIT_INT64;
+                literal->value.int64_val = tok.value.int_val;
+            } else if (tok.type == TOK_BOOL_LITERAL) {
+                literal->kind = LIT_BOOL;
+                literal->value.bool_val = tok.value.bool_val;
+            } else {
+                literal->kind = LIT_UNIT;
+            }
+            parser_advance(parser);
+            return literal;
+        }
+        case TOK_IDENTIFIER: {
+            // Qualified names such as 'http.get' are kept as one identifier
+            size_t len = strlen(tok.text);
+            char* name = strdup(tok.text);
+            parser_advance(parser);
+            while (name && parser->current_token.type == TOK_DOT) {
+                parser_advance(parser);
+                // Effect operations may be keywords, e.g. 'get'
+                if (parser->current_token.type != TOK_IDENTIFIER &&
+                    (parser->current_token.type < TOK_FN ||
+                     parser->current_token.type > TOK_HEAD)) {
+                    break;
+                }
+                size_t part_len = strlen(parser->current_token.text);
+                char* new_name = realloc(name, len + part_len + 2);
+                if (!new_name) {
+                    free(name);
+                    return NULL;
+                }
+                name = new_name;
+                name[len] = '.';
+                memcpy(name + len + 1, parser->current_token.text, part_len + 1);
+                len += part_len + 1;
+                parser_advance(parser);
+            }
+            if (!name) return NULL;
+
+            IdentifierExpr* ident = calloc(1, sizeof(IdentifierExpr));
+            if (!ident) {
+                free(name);
+                return NULL;
+            }
+            ident->base.type = NODE_IDENTIFIER_EXPR;
+            ident->base.line = tok.line;
+            ident->base.column = tok.column;
+            ident->name = name;
+            return ident;
+        }
+        case TOK_LPAREN: {
+            parser_advance(parser);
+            void* expr = parser_parse_expr(parser);
+            if (parser->current_token.type == TOK_RPAREN) {
+                parser_advance(parser);
+            }
+            return expr;
+        }
+        default:
+            return NULL;
+    }
+}
+
+void* parser_parse_expr(Parser* parser) {
+    void* expr = parser_parse_primary(parser);
+
+    // Calls, possibly chained: f(a)(b)
+    while (expr && parser->current_token.type == TOK_LPAREN) {
+        CallExpr* call = calloc(1, sizeof(CallExpr));
+        if (!call) return expr;
+        call->base.type = NODE_CALL_EXPR;
+        call->base.line = ((AstNode*)expr)->line;
+        call->base.column = ((AstNode*)expr)->column;
+        call->function = expr;
+
+        // Consume '('
+        parser_advance(parser);
+        while (parser->current_token.type != TOK_RPAREN &&
+               parser->current_token.type != TOK_EOF) {
+            void* arg = parser_parse_expr(parser);
+            if (!arg) break;
+            call->arguments = realloc(call->arguments,
+                sizeof(void*) * (call->argument_count + 1));
+            call->arguments[call->argument_count] = arg;
+            call->argument_count++;
+            if (parser->current_token.type != TOK_COMMA) break;
+            parser_advance(parser);
+        }
+
+        // Expect ')'
+        if (parser->current_token.type == TOK_RPAREN) {
+            parser_advance(parser);
+        }
+        expr = call;
+    }
+
+    return expr;
+}
+
+static void parser_add_statement(Block* block, void* stmt) {
+    block->statements = realloc(block->statements,
+        sizeof(void*) * (block->statement_count + 1));
+    block->statements[block->statement_count] = stmt;
+    block->statement_count++;
+}
+
 Block* parser_parse_block(Parser* parser) {
     Block* block = calloc(1, sizeof(Block));
     if (!block) return NULL;
 
     block->base.type = NODE_BLOCK;
+    block->base.line = parser->current_token.line;
+    block->base.column = parser->current_token.column;
 
     // Consume '{'
-    parser->current_token = lexer_next_token(parser->lexer);
+    parser_advance(parser);
 
-    // For now, just look for a string literal followed by '}'
-    if (parser->current_token.type == TOK_STRING_LITERAL) {
-        // Create a literal expression
-        Literal* literal = calloc(1, sizeof(Literal));
-        if (literal) {
-            literal->base.type = NODE_LITERAL;
-            literal->kind = LIT_STRING;
-            literal->value.string_val = strdup(parser->current_token.text);
+    // Statements, then the optional result expression before '}'
+    while (parser->current_token.type != TOK_RBRACE &&
+           parser->current_token.type != TOK_EOF) {
+        if (parser->current_token.type == TOK_LET) {
+            Token let_tok = parser->current_token;
 
-            block->result_expr = literal;
-        }
+            // Consume 'let'
+            parser_advance(parser);
+            if (parser->current_token.type != TOK_IDENTIFIER) {
+                continue;
+            }
+            char* name = strdup(parser->current_token.text);
+            parser_advance(parser);
 
-        // Consume the string
-        parser->current_token = lexer_next_token(parser->lexer);
+            // Expect '='
+            if (parser->current_token.type != TOK_EQUALS) {
+                free(name);
+                continue;
+            }
+            parser_advance(parser);
 
-        // Expect '}'
-        if (parser->current_token.type == TOK_RBRACE) {
-            parser->current_token = lexer_next_token(parser->lexer);
+            LetStmt* let = calloc(1, sizeof(LetStmt));
+            if (!let) {
+                free(name);
+                return block;
+            }
+            let->base.type = NODE_LET_STMT;
+            let->base.line = let_tok.line;
+            let->base.column = let_tok.column;
+            let->name = name;
+            let->expr = parser_parse_expr(parser);
+            parser_add_statement(block, let);
+        } else {
+            void* expr = parser_parse_expr(parser);
+            if (!expr) {
+                // Skip unsupported tokens
+                parser_advance(parser);
+                continue;
+            }
+            if (parser->current_token.type == TOK_RBRACE) {
+                block->result_expr = expr;
+                break;
+            }
+            ExprStmt* stmt = calloc(1, sizeof(ExprStmt));
+            if (!stmt) return block;
+            stmt->base.type = NODE_EXPR_STMT;
+            stmt->base.line = ((AstNode*)expr)->line;
+            stmt->base.column = ((AstNode*)expr)->column;
+            stmt->expr = expr;
+            parser_add_statement(block, stmt);
+        }
+
+        // Optional ';'
+        if (parser->current_token.type == TOK_SEMICOLON) {
+            parser_advance(parser);
         }
     }
 
+    // Consume '}'
+    if (parser->current_token.type == TOK_RBRACE) {
+        parser_advance(parser);
+    }
+
     return block;
 }
 
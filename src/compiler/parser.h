@@ -19,6 +19,7 @@ Program* parser_parse_program(Parser* parser);
 // Internal parsing functions
 FunctionDecl* parser_parse_function(Parser* parser);
 Block* parser_parse_block(Parser* parser);
+void* parser_parse_expr(Parser* parser);
 void parser_skip_to_next_declaration(Parser* parser);
 
 #endif // MANAKNIGHT_PARSER_H
\ No newline at end of file
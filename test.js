@@ -3,7 +3,7 @@
 // Manaknight compiled code
 
 // API route: get /hello
-function handler() {
+function __route0() {
     return "Hello from Manaknight!";
 }
 
@@ -11,6 +11,14 @@ function main() {
     return "Hello, World!";
 }
 
+// Route dispatch
+function __handleRequest() {
+    var method = __effects.request.method();
+    var path = __effects.request.path();
+    if (method === "GET" && path === "/hello") return __route0();
+    return null;
+}
+
 
 // Call main function
 console.log(main());
@@ -87,8 +87,29 @@ run_test "Type Checker - Basic Types" \
     "./mkc tests/function_test.mk && ./mqjs tests/function_test.js" \
     "Main function works"
 
-# Task 2.3: Effect Analyzer (not implemented)
-echo -e "${YELLOW}⚠️  Task 2.3: Effect Analyzer - Not implemented yet${NC}"
+# Task 2.3: Effect Analyzer (independent effect calls)
+run_test "Effect Analyzer - Independent Calls Batched" \
+    "./mkc tests/effect_batch_test.mk && grep -q '__effects.batch' tests/effect_batch_test.js && grep -q 'var search = __effects.http.get(' tests/effect_batch_test.js && ./mqjs tests/effect_batch_test.js" \
+    "Effect batch test passed"
+
+# Run the batched handler with mkreplay: the request goes through the
+# generated __handleRequest, the results of the batch come from a capture
+# log and the search call with two arguments and the audit call with a
+# computed URL are not in it
+batch_replay_test() {
+    str() { printf "\\x$(printf %02x ${#1})"; printf '%s' "$1"; }
+    { printf 'MKCAP01\n'
+      printf '\x01\x01\x00'; str $'GET /dashboard HTTP/1.1\r\nHost: localhost\r\n\r\n'
+      printf '\x02\x01'; str http.get; str 'https://api.example.com/users/1'; printf '\x00\xc8\x01'; str '{"id": 1}'
+      printf '\x02\x01'; str http.get; str 'https://api.example.com/orders?user=1'; printf '\x00\xc8\x01'; str '[]'
+      printf '\x02\x01'; str fs.readFile; str config.json; printf '\x00\x00'; str '{}'
+    } > /tmp/effect_batch_test.cap
+    ./mqjs -o /tmp/effect_batch_test.bin tests/effect_batch_test.js &&
+        ./mkreplay /tmp/effect_batch_test.bin /tmp/effect_batch_test.cap
+}
+run_test "Effect Analyzer - Batched Handler Replay" \
+    "./mkc tests/effect_batch_test.mk && batch_replay_test" \
+    "requests: *1 (0 errors, 2 missing effects)"
 
 # Task 2.4: Exhaustiveness Checker (not implemented)
 echo -e "${YELLOW}⚠️  Task 2.4: Exhaustiveness Checker - Not implemented yet${NC}"
@@ -135,6 +156,86 @@ run_test "Host Runtime - mqjs Execution" \
     "./mqjs --help 2>/dev/null | head -1" \
     ""
 
+# Serve the program $1 and /tmp/mk_static/www under /static/ with
+# mkserve; the other arguments are passed to mkserve
+start_static_server() {
+    ./mqjs -o /tmp/mk_static/app.bin "$1" > /dev/null || return 1
+    shift
+    ./mkserve -p 18431 -d /tmp/mk_static/www -P /static/ "$@" /tmp/mk_static/app.bin > /dev/null &
+    static_server=$!
+    for i in $(seq 50); do
+        curl -s -o /dev/null http://127.0.0.1:18431/ && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+stop_static_server() {
+    kill $static_server 2>/dev/null
+    wait $static_server 2>/dev/null
+    true
+}
+
+# The static files cannot be read outside of their directory, whatever
+# the encoding of the path
+static_path_test() {
+    rm -rf /tmp/mk_static && mkdir -p /tmp/mk_static/www/sub &&
+        echo public > /tmp/mk_static/www/sub/a.txt &&
+        echo private > /tmp/mk_static/secret.txt &&
+        echo private > /tmp/mk_static/www/.hidden &&
+        start_static_server tests/hello_world.js || return 1
+    curl -s http://127.0.0.1:18431/static/sub/a.txt
+    for p in ../secret.txt sub/../../secret.txt %2e%2e/secret.txt \
+             sub/%2e%2e/%2e%2e/secret.txt ..%2fsecret.txt .hidden sub/.%2e/a.txt; do
+        echo "$p: $(curl -s --path-as-is -w ' %{http_code}' \
+                    "http://127.0.0.1:18431/static/$p")"
+    done
+    stop_static_server
+}
+run_test "Static Files - Paths Outside the Directory" \
+    "static_path_test > /tmp/mk_static.out && cat /tmp/mk_static.out && ! grep -q private /tmp/mk_static.out && [ \$(grep -c ' 404\$' /tmp/mk_static.out) -eq 7 ]" \
+    "public"
+
+# The gzip responses decompress to the original bodies, for the static
+# files compressed once and cached and for the handler responses,
+# buffered below 64KB and streamed above
+deflate_round_trip_test() {
+    rm -rf /tmp/mk_static && mkdir -p /tmp/mk_static/www &&
+        seq 1 100000 > /tmp/mk_static/www/seq.txt &&
+        head -c 60000 /dev/urandom | base64 > /tmp/mk_static/www/random.txt &&
+        seq 1 1000 > /tmp/mk_static/small &&
+        seq 1 30000 > /tmp/mk_static/large || return 1
+    cat > /tmp/mk_static/app.js <<'JS'
+function __handleRequest() {
+    var n = __effects.request.path() == "/small" ? 1000 : 30000, a = [], i;
+    for (i = 1; i <= n; i++)
+        a.push(i);
+    return a.join("\n") + "\n";
+}
+JS
+    for level in 1 2 3; do
+        start_static_server /tmp/mk_static/app.js -z $level || return 1
+        for url in static/seq.txt static/random.txt static/seq.txt small large; do
+            curl -s -H 'Accept-Encoding: gzip' -D /tmp/mk_static/hdr -o /tmp/mk_static/body \
+                 "http://127.0.0.1:18431/$url"
+            case $url in
+                static/*) file=/tmp/mk_static/www/${url#static/} ;;
+                *) file=/tmp/mk_static/$url ;;
+            esac
+            if grep -qi '^content-encoding: gzip' /tmp/mk_static/hdr &&
+                gzip -dc < /tmp/mk_static/body | cmp -s - $file; then
+                echo "level $level $url: ok"
+            else
+                echo "level $level $url: mismatch"
+            fi
+        done
+        stop_static_server
+    done
+}
+run_test "Compression - gzip Round Trip" \
+    "deflate_round_trip_test > /tmp/mk_deflate.out; cat /tmp/mk_deflate.out; [ \$(grep -c ': ok\$' /tmp/mk_deflate.out) -eq 15 ]" \
+    "level 3 large: ok"
+
 # Task 4.3: Effect Handlers (not implemented)
 echo -e "${YELLOW}⚠️  Task 4.3: Effect Handlers - Not implemented yet${NC}"
 
@@ -0,0 +1,31 @@
+"use strict";
+
+// Manaknight compiled code
+
+// API route: get /dashboard
+function __route0() {
+    var __batch0 = __effects.batch([["http.get", ["https://api.example.com/users/1"]], ["http.get", ["https://api.example.com/orders?user=1"]], ["fs.readFile", ["config.json"]]]);
+    var user = __batch0[0];
+    var orders = __batch0[1];
+    var config = __batch0[2];
+    var search = __effects.http.get("https://api.example.com/search", "q=1");
+    var audit = __effects.http.get(user);
+    __effects.log.info("dashboard");
+    return "ok";
+}
+
+function main() {
+    return "Effect batch test passed";
+}
+
+// Route dispatch
+function __handleRequest() {
+    var method = __effects.request.method();
+    var path = __effects.request.path();
+    if (method === "GET" && path === "/dashboard") return __route0();
+    return null;
+}
+
+
+// Call main function
+console.log(main());
@@ -0,0 +1,15 @@
+// Independent effect calls are batched and run concurrently
+
+api get "/dashboard" () -> String {
+    let user = http.get("https://api.example.com/users/1")
+    let orders = http.get("https://api.example.com/orders?user=1")
+    let config = fs.readFile("config.json")
+    let search = http.get("https://api.example.com/search", "q=1")
+    let audit = http.get(user)
+    log.info("dashboard")
+    "ok"
+}
+
+fn main() -> String {
+    "Effect batch test passed"
+}
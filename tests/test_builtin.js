@@ -211,6 +211,10 @@ function test_array()
 
     a = [1,2,3];
     assert(a.join("-"), "1-2-3");
+    assert(["ab", "c", null, "\u00e9", undefined].join(), "ab,c,,\u00e9,");
+    assert(["ab", "c"].join(""), "abc");
+    assert(["\ud83d", "\ude00"].join(""), "\ud83d\ude00");
+    assert(["a", 1, true].join("::"), "a::1::true");
     
     a = [1,2];
     assert(a.push(3, 4), 4);
@@ -559,6 +563,56 @@ function test_typed_array()
     assert(a.toString(), "2,3");
 }
 
+function test_float_array_kernels()
+{
+    var src, a, b, i, k, r, f;
+
+    src = [0.5, -1.25, 3, 1e-3, 7.75, -0, 2.5e10, 0.1];
+    function check_map(ctor, name, func, x, y)
+    {
+        var a = new ctor(src), b = new ctor(src), i;
+        assert(a[name](x, y), a);
+        for(i = 0; i < b.length; i++)
+            b[i] = func(b[i]);
+        assert(a.toString(), b.toString());
+    }
+    for(k = 0; k < 2; k++) {
+        f = (k == 0) ? Float64Array : Float32Array;
+        check_map(f, "exp", Math.exp);
+        check_map(f, "log", Math.log);
+        check_map(f, "sqrt", Math.sqrt);
+        check_map(f, "pow", function(x) { return Math.pow(x, 1.5); }, 1.5);
+        check_map(f, "scale", function(x) { return x * 0.3 + 0.7; }, 0.3, 0.7);
+
+        a = new f(src);
+        r = 0;
+        for(i = 0; i < a.length; i++)
+            r += a[i];
+        assert(a.sum(), r);
+        r = 0;
+        for(i = 0; i < a.length; i++)
+            r += a[i] * a[i];
+        assert(a.dot(a), r);
+        assert(a.min(), -1.25);
+        assert(a.max(), a[6]);
+    }
+    a = new Float64Array([1, NaN, 2]);
+    assert(a.min(), NaN);
+    assert(a.max(), NaN);
+    a = new Float64Array(0);
+    assert(a.sum(), 0);
+    assert(a.min(), Infinity);
+    assert(a.max(), -Infinity);
+    a = new Float64Array([1, 2, 3]);
+    b = new Float32Array([4, 5, 6]);
+    assert(a.dot(b), 32);
+    assert(a.subarray(1).sum(), 5);
+    assert_throws(RangeError, function() { a.dot(b.subarray(1)); });
+    assert_throws(TypeError, function() { new Int32Array(2).sum(); });
+    assert(typeof Uint8Array.prototype.sum, "undefined");
+    assert_throws(TypeError, function() { Float64Array.prototype.sum.call(new Int32Array(2)); });
+}
+
 function repeat(a, n)
 {
     var i, r;
@@ -855,6 +909,57 @@ function test_line_column_numbers()
     eval_error('var a;\n 1 + (a @+= poisoned_number);', Error, 1);
 }
 
+function test_error_stack()
+{
+    var e, s, i;
+    function f1(n) { if (n == 0) return new Error("x"); return f1(n - 1); }
+    function f2() { throw TypeError("y"); }
+
+    /* the stack is formatted after the frames are gone */
+    e = f1(0);
+    s = e.stack;
+    assert(s.indexOf("at f1") >= 0, true);
+    assert(e.stack === s, true);
+
+    try {
+        f2();
+    } catch(e1) {
+        e = e1;
+    }
+    assert(e.stack.split("\n")[0].indexOf("at f2") >= 0, true);
+
+    /* the captured depth is limited */
+    e = f1(100);
+    assert(e.stack.split("\n").length <= 11, true);
+}
+
+function test_string_builder()
+{
+    var b, i, s;
+
+    b = new StringBuilder();
+    assert(b.toString(), "");
+    assert(b.append("ab", 1) === b, true);
+    b.append(null).append("\u00e9");
+    assert(b.toString(), "ab1null\u00e9");
+    b.append("x");
+    assert(b.toString(), "ab1null\u00e9x");
+
+    b = new StringBuilder(16);
+    s = "";
+    for(i = 0; i < 100; i++) {
+        b.append(i, ",");
+        s += i + ",";
+    }
+    assert(b.toString(), s);
+
+    /* append() from the toString() of an argument */
+    b = new StringBuilder();
+    b.append("a", { toString() { b.append("x"); return "y"; } }, "b");
+    assert(b.toString(), "axyb");
+    assert_throws(TypeError, function () { StringBuilder(); });
+}
+
 test();
 test_string();
 test_string2();
@@ -865,8 +970,11 @@ test_function();
 test_number();
 test_math();
 test_typed_array();
+test_float_array_kernels();
 test_global_eval();
 test_json();
 test_regexp();
 test_line_column_numbers();
+test_error_stack();
+test_string_builder();
 test_large_eval_parse_stack();
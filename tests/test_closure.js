@@ -101,6 +101,41 @@ function test_closure3()
     assert(fib_func(6) === 8, "fib");
 }
 
+function test_closure4()
+{
+    /* unmodified arguments are copied to the closures */
+    function f1(a, b)
+    {
+        return function (c) {
+            return function () {
+                return a + b + c;
+            };
+        };
+    }
+    assert(f1(1, 2)(3)() === 6, "copy");
+
+    /* modified arguments are shared */
+    function f2(a)
+    {
+        var get = function () { return a; };
+        a = 2;
+        return get;
+    }
+    assert(f2(1)() === 2, "parent write");
+    
+    function f3(a)
+    {
+        function get() { return a; }
+        function set(v) {
+            return function () { a = v; };
+        }
+        set(3)();
+        return get;
+    }
+    assert(f3(1)() === 3, "child write");
+}
+
 test_closure1();
 test_closure2();
 test_closure3();
+test_closure4();
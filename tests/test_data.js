@@ -0,0 +1,72 @@
+"use strict";
+
+/* run with: mqjs --data data=test_data.bin test_data.js */
+
+function throw_error(msg) {
+    throw Error(msg);
+}
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+    throw_error("assertion failed: got |" + actual + "|, expected |" +
+                expected + "|" + (message ? " (" + message + ")" : ""));
+}
+
+function assert_throws(expected_error, func)
+{
+    var err = false;
+    try {
+        func();
+    } catch(e) {
+        err = true;
+        if (!(e instanceof expected_error)) {
+            throw_error("unexpected exception type");
+            return;
+        }
+    }
+    if (!err) {
+        throw_error("expected exception");
+    }
+}
+
+function test_read()
+{
+    assert(data.name, "config");
+    assert(data.version, 3);
+    assert(data.ratio, 0.5);
+    assert(data.length, 12);
+    assert(data.tags.length, 3);
+    assert(data.tags[1], "b");
+    assert(data.tags.join(), "a,b,c");
+    assert(data.nested.y[2].z, true);
+    assert(Object.keys(data).join(), "name,version,ratio,length,tags,nested,empty");
+    assert(Object.keys(data.empty).length, 0);
+    assert(Object.getPrototypeOf(data), Object.prototype);
+    assert(Array.isArray(data.tags));
+    assert(data.tags instanceof Array);
+    assert(data.hasOwnProperty("version"));
+    assert(JSON.stringify(data.nested), '{"x":1,"y":[1,2,{"z":true}]}');
+    assert(data.tags.map(function (s) { return s + s; }).join(), "aa,bb,cc");
+}
+
+function test_read_only()
+{
+    assert_throws(TypeError, function () { data.version = 4; });
+    assert_throws(TypeError, function () { data.added = 1; });
+    assert_throws(TypeError, function () { delete data.name; });
+    assert_throws(TypeError, function () { data.empty.x = 1; });
+    assert_throws(TypeError, function () { data.tags[0] = "z"; });
+    assert_throws(TypeError, function () { data.tags.push("d"); });
+    assert_throws(TypeError, function () { data.tags.length = 0; });
+    assert_throws(TypeError, function () { data.tags.sort(); });
+    assert_throws(TypeError, function () { Object.setPrototypeOf(data, null); });
+    assert(data.version, 3);
+    assert(data.tags.join(), "a,b,c");
+}
+
+test_read();
+test_read_only();
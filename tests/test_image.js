@@ -0,0 +1,55 @@
+"use strict";
+
+/* run with:
+   mqjs -o test_image.bin test_image.js
+   mqjs -b -I test_module.js -I test_image.bin test_image.bin
+*/
+
+function throw_error(msg) {
+    throw Error(msg);
+}
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+    throw_error("assertion failed: got |" + actual + "|, expected |" +
+                expected + "|" + (message ? " (" + message + ")" : ""));
+}
+
+/* the atoms defined in RAM by test_module.js are replaced by the
+   atoms of the image when it is loaded */
+function test_ram_atoms()
+{
+    var o, k;
+
+    assert(module_obj.module_prop, "module");
+    assert(module_get(module_obj, "module_prop"), "module");
+    o = {};
+    o.module_prop = 1;
+    assert(module_get(o, "module_prop"), 1);
+    assert(Object.keys(o)[0], "module_prop");
+
+    o = module_make();
+    assert(o.module_key, 2);
+    k = "module_";
+    k += "key";
+    assert(o[k], 2);
+    assert(o.hasOwnProperty(k), true);
+}
+
+/* the image is loaded twice: its atoms are shared with the first
+   instance */
+function test_image_atoms()
+{
+    var o = { image_prop: 3 };
+
+    globalThis.image_obj = globalThis.image_obj || o;
+    assert(image_obj.image_prop, 3);
+    assert(module_get(image_obj, "image_prop"), 3);
+}
+
+test_ram_atoms();
+test_image_atoms();
@@ -289,6 +289,96 @@ function test_op2()
     assert(a.get(), 2);
 }
 
+/* the constant expressions are evaluated by the parser */
+function test_constant_folding()
+{
+    var one = 1, c = 0;
+    function f() { c++; return 3; }
+
+    assert(-0 * 1, -(0 * one));
+    assert(2 ** 0.5, (2 * one) ** 0.5);
+    assert(2147483647 + 1, 2147483647 * one + 1);
+    assert(-1 >>> 0, -one >>> 0);
+    assert("a" + 1 + 2, "a" + one + 2);
+    assert(1 + 2 + "a", one + 2 + "a");
+    assert("ab" + "cd" + "ef", "abcdef");
+    assert("1" == 1, true);
+    assert(null === undefined, false);
+    assert(!"", true);
+    assert(~5, -6);
+    assert(true && "x", "x");
+    assert(0 || null, null);
+
+    /* side effects are kept */
+    assert((f(), 1) + 2, 3);
+    assert(1 + f(), 4);
+    assert(true && f(), 3);
+    assert(false && f(), false);
+    assert(c, 3);
+    assert((one ? 1 : 2) + 3, 4);
+}
+
+function test_object_literal()
+{
+    var a, i, s, log = [];
+
+    a = { x: 1, x: 2, y: 3 };
+    assert(Object.keys(a).join(), "x,y");
+    assert(a.x, 2);
+
+    a = { x: 1, __proto__: { y: 2 }, z: 3 };
+    assert(a.y, 2);
+    assert(Object.keys(a).join(), "x,z");
+
+    a = { x: 1, get y() { return this.x + 1; }, z: 3 };
+    assert(a.y, 2);
+    assert(Object.keys(a).join(), "x,y,z");
+
+    a = { x: log.push(1), y: log.push(2), z: log.push(3) };
+    assert(log.join(), "1,2,3");
+
+    s = "({";
+    for(i = 0; i < 40; i++)
+        s += "k" + i + ":" + i + ",";
+    s += "})";
+    a = (1, eval)(s);
+    assert(Object.keys(a).length, 40);
+    assert(a.k31 + a.k32 + a.k39, 102);
+
+    /* the objects do not share their properties */
+    log = [];
+    for(i = 0; i < 3; i++)
+        log.push({ tag: i, value: i * 2 });
+    log[0].tag = 10;
+    log[1].extra = 1;
+    delete log[2].value;
+    assert(JSON.stringify(log), '[{"tag":10,"value":0},{"tag":1,"value":2,"extra":1},{"tag":2}]');
+}
+
+function test_global_var()
+{
+    function f() { return test_global_var0; }
+
+    /* the global variable is linked to 'f' before it is defined */
+    globalThis.test_global_var0 = 1;
+    assert(f(), 1);
+    assert(delete globalThis.test_global_var0);
+    assert(typeof globalThis.test_global_var0, "undefined");
+    assert_throws(ReferenceError, f);
+
+    /* the deleted variable is no longer a property */
+    assert("test_global_var0" in globalThis, false);
+    assert(globalThis.hasOwnProperty("test_global_var0"), false);
+    assert(Object.keys(globalThis).indexOf("test_global_var0"), -1);
+    for (var k in globalThis)
+        assert(k !== "test_global_var0");
+
+    globalThis.test_global_var0 = 2;
+    assert(f(), 2);
+    assert("test_global_var0" in globalThis, true);
+    assert(Object.keys(globalThis).indexOf("test_global_var0") >= 0);
+}
+
 function test_prototype()
 {
     function f() { }
@@ -348,6 +438,9 @@ test_cvt();
 test_eq();
 test_inc_dec();
 test_op2();
+test_constant_folding();
+test_object_literal();
+test_global_var();
 test_prototype();
 test_arguments();
 test_to_primitive();
@@ -168,6 +168,50 @@ function test_for_in2()
     assert(tab.toString(), "x,y");
 }
 
+function test_for_in_modify()
+{
+    var i, a, tab;
+
+    /* deleted properties are not enumerated */
+    a = {x:1, y: 2, z:3};
+    tab = [];
+    for(i in a) {
+        delete a.y;
+        tab.push(i);
+    }
+    assert(tab.toString(), "x,z");
+
+    /* delete all the properties while enumerating them */
+    a = {};
+    for(i = 0; i < 32; i++)
+        a["k" + i] = i;
+    tab = [];
+    for(i in a) {
+        delete a[i];
+        tab.push(i);
+    }
+    assert(tab.length, 32);
+    assert(Object.keys(a).length, 0);
+
+    /* array elements then properties */
+    a = [1, 2];
+    a.x = 3;
+    tab = [];
+    for(i in a) {
+        tab.push(typeof i + i);
+    }
+    assert(tab.toString(), "string0,string1,stringx");
+
+    /* nested enumeration of the same object */
+    a = {x:1, y: 2};
+    tab = [];
+    for(i in a) {
+        for(var j in a)
+            tab.push(i + j);
+    }
+    assert(tab.toString(), "xx,xy,yx,yy");
+}
+
 /*
 function test_for_in_proxy() {
     let removed_key = "";
@@ -383,6 +427,7 @@ test_switch1();
 test_switch2();
 test_for_in();
 test_for_in2();
+test_for_in_modify();
 //test_for_in_proxy();
 
 test_try_catch1();
@@ -0,0 +1,14 @@
+/* loaded as source before the bytecode image generated from
+   test_image.js, so that its atoms are first defined in RAM */
+
+var module_obj = { module_prop: "module" };
+
+function module_get(o, name)
+{
+    return o[name];
+}
+
+function module_make()
+{
+    return { module_key: 2 };
+}